@@ -7,6 +7,10 @@
 static const int PNGIF_ERR_FILEIO = 49;
 // Memory allocation error.
 static const int PNGIF_ERR_UNKNOWN_FORMAT = 50;
+// Invalid decoding options.
+static const int PNGIF_ERR_BAD_OPTIONS = 51;
+// Output surface is invalid or too small for the image.
+static const int PNGIF_ERR_BAD_SURFACE = 52;
 
 /** GIF errors **/
 
@@ -59,6 +63,8 @@ static const int PNG_ERR_INVALID_FORMAT = 11;
 static const int PNG_ERR_BAD_FRAME_COUNT = 12;
 // Bad frame data, i. e. wrong size or offset.
 static const int PNG_ERR_BAD_FRAME_DATA = 13;
+// Decompressed image data size doesn't match image dimensions.
+static const int PNG_ERR_DATA_SIZE = 14;
 
 
 #endif
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 
 #include <pngif/gif_parsed.h>
+#include <pngif/options.h>
+#include <pngif/surface.h>
 
 /** Data types **/
 
@@ -20,10 +22,16 @@ typedef struct {
 
   // Image data.
   unsigned char *rgba;
+
+  // Flag set by the decoder when every pixel is known to be opaque: no color
+  // index the data can hold is transparent, and the data isn't cut short.
+  // Such images are composited with a single copy per row. 0 means pixels may
+  // be transparent, and transparent runs are skipped while compositing.
+  unsigned char opaque;
 } gif_decoded_image_t;
 
 typedef struct {
-  // Dimensions.
+  // Dimensions, reduced when decoding at reduced resolution.
   u_int32_t width;
   u_int32_t height;
 
@@ -35,11 +43,64 @@ typedef struct {
   unsigned char animated;
   u_int32_t repeat_count;
 
-  // Sub-images.
+  // Sub-images, and the pixel format of their data, PNGIF_FORMAT_* value.
   size_t image_count;
   gif_decoded_image_t *images;
+  int format;
+
+  // Flag indicating that decoding was stopped by the progress callback, so
+  // the last image may be incomplete and some images may be missing.
+  unsigned char partial;
+
+  // Buffer pool image data was allocated from, or NULL.
+  pngif_pool_t *pool;
 } gif_decoded_t;
 
+/**
+ * Image of color indices, one byte per pixel, with the colors to look them up
+ * in, e.g. for palette lookup on the GPU or re-encoding.
+ */
+typedef struct {
+  // Dimensions.
+  u_int32_t top;
+  u_int32_t left;
+  u_int32_t width;
+  u_int32_t height;
+
+  // Frame settings
+  u_int8_t dispose_method;
+  u_int32_t delay_cs;
+
+  // Effective color table: the local one of the image, or the global one.
+  // Indices past its end have no color, and are displayed as transparent.
+  size_t color_table_size;
+  gif_color_t *color_table;
+  // Transparent color index, or -1 if the image has none.
+  int transparent_index;
+
+  // Color indices, rows of width bytes, in display order even for interlaced
+  // images.
+  unsigned char *indices;
+} gif_indexed_image_t;
+
+typedef struct {
+  // Dimensions.
+  u_int32_t width;
+  u_int32_t height;
+
+  // Optional data.
+  gif_color_t *background_color;
+  u_int32_t pixel_ratio;
+
+  // Animation settings.
+  unsigned char animated;
+  u_int32_t repeat_count;
+
+  // Sub-images.
+  size_t image_count;
+  gif_indexed_image_t *images;
+} gif_indexed_t;
+
 /** Interface **/
 
 /**
@@ -52,6 +113,21 @@ typedef struct {
  */
 gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error);
 
+/**
+ * Same as gif_decoded_from_parsed(), with decoding options.
+ *
+ * @param parsed Parsed GIF data.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_decoded_t *gif_decoded_from_parsed_with_options(
+  gif_parsed_t *parsed,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Decodes given data into a gif_decoded_t struct.
  *
@@ -63,6 +139,23 @@ gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error);
  */
 gif_decoded_t *gif_decoded_from_data(unsigned char *data, size_t size, int *error);
 
+/**
+ * Same as gif_decoded_from_data(), with decoding options.
+ *
+ * @param data GIF data to decode.
+ * @param size Data size.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_decoded_t *gif_decoded_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Reads and decodes given file into a gif_decoded_t struct.
  *
@@ -73,6 +166,21 @@ gif_decoded_t *gif_decoded_from_data(unsigned char *data, size_t size, int *erro
  */
 gif_decoded_t *gif_decoded_from_file(FILE *file, int *error);
 
+/**
+ * Same as gif_decoded_from_file(), with decoding options.
+ *
+ * @param file File handle to GIF file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_decoded_t *gif_decoded_from_file_with_options(
+  FILE *file,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Reads and decodes a file at given path into a gif_decoded_t struct.
  *
@@ -83,6 +191,41 @@ gif_decoded_t *gif_decoded_from_file(FILE *file, int *error);
  */
 gif_decoded_t *gif_decoded_from_path(char *path, int *error);
 
+/**
+ * Same as gif_decoded_from_path(), with decoding options.
+ *
+ * @param path Path to the GIF file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_decoded_t *gif_decoded_from_path_with_options(
+  char *path,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Decodes a single image block into a caller-provided surface, without
+ * compositing. Transparent pixels are stored as transparent black. To place
+ * the image, point the surface at the image position in a larger surface.
+ *
+ * @param parsed Parsed GIF data.
+ * @param index Index of the image, counting image blocks only.
+ * @param surface Output surface. It has to fit the image, or its reduced size
+ *   when decoding at reduced resolution.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ */
+void gif_decode_image_into(
+  gif_parsed_t *parsed,
+  size_t index,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Frees memory occupied by a decoded GIF data struct.
  *
@@ -90,4 +233,55 @@ gif_decoded_t *gif_decoded_from_path(char *path, int *error);
  */
 void gif_decoded_free(gif_decoded_t *gif);
 
+/**
+ * Decodes parsed GIF data into color indices, without mapping them to pixels.
+ * Takes a quarter of the memory of RGBA images, and skips the mapping work.
+ * Pixels missing from image data that ends early are set to the transparent
+ * index, or to 0 in images without one.
+ *
+ * @param parsed Parsed GIF data.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_indexed_t *gif_indexed_from_parsed(gif_parsed_t *parsed, int *error);
+
+/**
+ * Decodes given data into a gif_indexed_t struct.
+ *
+ * @param data GIF data to decode.
+ * @param size Data size.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_indexed_t *gif_indexed_from_data(unsigned char *data, size_t size, int *error);
+
+/**
+ * Reads and decodes given file into a gif_indexed_t struct.
+ *
+ * @param file File handle to GIF file.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_indexed_t *gif_indexed_from_file(FILE *file, int *error);
+
+/**
+ * Reads and decodes a file at given path into a gif_indexed_t struct.
+ *
+ * @param path Path to the GIF file.
+ * @param error Error output.
+ *
+ * @return Decoded GIF data, or NULL in case of errors.
+ */
+gif_indexed_t *gif_indexed_from_path(char *path, int *error);
+
+/**
+ * Frees memory occupied by an indexed GIF data struct.
+ *
+ * @param gif Indexed gif data.
+ */
+void gif_indexed_free(gif_indexed_t *gif);
+
 #endif
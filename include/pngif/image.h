@@ -4,12 +4,27 @@
 #include <stdio.h>
 #include <pngif/gif_decoded.h>
 #include <pngif/png_decoded.h>
+#include <pngif/options.h>
+#include <pngif/surface.h>
 
 /** Data types **/
 
 typedef struct {
+  // Frame pixels: the whole image, or with delta frames only the rectangle
+  // that changed since the previous frame, tightly packed. NULL when the
+  // rectangle is empty.
   unsigned char *rgba;
   u_int32_t duration_ms;
+
+  // Rectangle of the image covered by the pixels.
+  u_int32_t x;
+  u_int32_t y;
+  u_int32_t width;
+  u_int32_t height;
+
+  // Consecutive frames that are identical share their pixels. This is the
+  // number of frames sharing them, or NULL if the pixels aren't shared.
+  u_int32_t *refcount;
 } image_frame_t;
 
 typedef struct {
@@ -20,11 +35,91 @@ typedef struct {
   // Animation data.
   u_int32_t repeat_count;
 
-  // Frames.
+  // Frames, and the pixel format of their data, PNGIF_FORMAT_* value.
   size_t frame_count;
   image_frame_t *frames;
+  int format;
+
+  // Flag indicating whether frames are delta frames, see the delta_frames
+  // option. The first frame always covers the whole image.
+  int delta_frames;
+
+  // Buffer pool frame pixels were allocated from, or NULL.
+  pngif_pool_t *pool;
 } animated_image_t;
 
+/**
+ * Canvas snapshot of a frame renderer, taken before drawing a frame, to seek
+ * back to that frame without replaying the animation from the start.
+ */
+typedef struct {
+  // Index of the frame drawn next from the snapshot, and its first GIF block.
+  size_t frame;
+  size_t block;
+  // Canvas state, RGBA.
+  unsigned char *canvas;
+} image_keyframe_t;
+
+/**
+ * Draws frames of an image one at a time into caller-provided surfaces. Image
+ * data is decoded as frames are drawn, and composed on a single canvas, so
+ * no memory is allocated per frame. Still PNG images are decoded straight into
+ * the surface.
+ *
+ * Frames can also be drawn in any order. The renderer snapshots the canvas
+ * every keyframe_interval frames as it goes, so seeking replays at most that
+ * many frames from the nearest snapshot. When there are more snapshots than
+ * keyframe_limit, every other one is dropped and the interval doubles, so
+ * memory stays bounded however long the animation is.
+ */
+typedef struct {
+  // Image size, reduced when decoding at reduced resolution.
+  u_int32_t width;
+  u_int32_t height;
+
+  // Animation data.
+  u_int32_t repeat_count;
+  size_t frame_count;
+
+  // Index of the next frame to draw.
+  size_t frame;
+
+  /* Internal state */
+
+  // Decoding settings.
+  int ignore_background;
+  pngif_options_t options;
+  int shift;
+
+  // Image data, owned when the renderer reads it from a file.
+  unsigned char *data;
+  png_raw_t *png_raw;
+  png_parsed_t *png;
+  gif_parsed_t *gif;
+
+  // GIF state: animation flag, background color, and the index of the next
+  // block to draw.
+  int animated;
+  gif_color_t *background_color;
+  size_t block;
+
+  // Canvas with the state before the next frame, a buffer for decoded frame
+  // images, and a buffer for the canvas region under a frame that's disposed
+  // to the previous state. All of them are RGBA, the canvas is converted to
+  // the surface pixel format as it's copied out.
+  unsigned char *canvas;
+  unsigned char *image;
+  size_t image_size;
+  unsigned char *saved;
+
+  // Canvas snapshots, in frame order: keyframes[idx] is taken before frame
+  // (idx + 1) * keyframe_interval, the first frame needs none.
+  size_t keyframe_interval;
+  size_t keyframe_limit;
+  size_t keyframe_count;
+  image_keyframe_t *keyframes;
+} image_renderer_t;
+
 /** Interface **/
 
 /**
@@ -82,6 +177,28 @@ animated_image_t *image_from_data(
   int *error
 );
 
+/**
+ * Same as image_from_data(), with decoding options. E.g. with a reduced
+ * decoding scale, the image and all its frames are composed at reduced size,
+ * and full size frames are never allocated.
+ *
+ * @param data GIF/PNG data array.
+ * @param size Data size.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Creates animated image from data read from given file handle.
  *
@@ -94,6 +211,24 @@ animated_image_t *image_from_data(
  */
 animated_image_t *image_from_file(FILE *file, int ignore_background, int *error);
 
+/**
+ * Same as image_from_file(), with decoding options.
+ *
+ * @param file File handle to GIF or PNG file.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_from_file_with_options(
+  FILE *file,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Creates animated image from file at given path.
  *
@@ -106,6 +241,153 @@ animated_image_t *image_from_file(FILE *file, int ignore_background, int *error)
  */
 animated_image_t *image_from_path(char *path, int ignore_background, int *error);
 
+/**
+ * Same as image_from_path(), with decoding options.
+ *
+ * @param path Path to GIF or PNG file.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_from_path_with_options(
+  char *path,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Draws a frame onto a canvas that holds the previous frame. With delta frames
+ * only the changed rectangle is copied, so frames have to be applied in order,
+ * starting from the first one. Full frames replace the whole canvas.
+ *
+ * @param frame Frame of an animated image.
+ * @param canvas Canvas of the image size, in the image pixel format.
+ * @param stride Distance between canvas rows in bytes.
+ */
+void image_frame_apply(image_frame_t *frame, unsigned char *canvas, size_t stride);
+
+/**
+ * Creates a frame renderer for GIF or PNG data. The data is referred to until
+ * the renderer is freed.
+ *
+ * @param data GIF/PNG data array.
+ * @param size Data size.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Return error value.
+ *
+ * @return Frame renderer or NULL in case of any errors.
+ */
+image_renderer_t *image_renderer_from_data(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Creates a frame renderer for a file at given path.
+ *
+ * @param path Path to GIF or PNG file.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Return error value.
+ *
+ * @return Frame renderer or NULL in case of any errors.
+ */
+image_renderer_t *image_renderer_from_path(
+  char *path,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Draws the next frame into a surface. The whole surface area of the image
+ * size is written.
+ *
+ * @param renderer Frame renderer.
+ * @param surface Output surface, that fits the image.
+ * @param duration_ms Output frame duration.
+ * @param error Return error value.
+ *
+ * @return 1 if a frame was drawn, or 0 after the last frame or in case of any
+ *   errors.
+ */
+int image_renderer_next_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+);
+
+/**
+ * Moves the renderer to a frame, so that it's drawn next. Seeking forward
+ * replays frames from the current one or from the nearest canvas snapshot,
+ * seeking backward only from the nearest snapshot or from the start.
+ *
+ * @param renderer Frame renderer.
+ * @param frame Index of the frame to draw next.
+ * @param error Return error value.
+ *
+ * @return 1 on success, or 0 if the frame is out of range or in case of any
+ *   errors.
+ */
+int image_renderer_seek(image_renderer_t *renderer, size_t frame, int *error);
+
+/**
+ * Draws a frame by its index into a surface, same as seeking to it and
+ * drawing the next frame.
+ *
+ * @param renderer Frame renderer.
+ * @param frame Frame index.
+ * @param surface Output surface, that fits the image.
+ * @param duration_ms Output frame duration.
+ * @param error Return error value.
+ *
+ * @return 1 if the frame was drawn, or 0 if the frame is out of range or in
+ *   case of any errors.
+ */
+int image_renderer_draw_frame(
+  image_renderer_t *renderer,
+  size_t frame,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+);
+
+/**
+ * Sets how often the canvas is snapshotted for seeking, and drops the
+ * snapshots taken so far. Defaults are a snapshot every 16 frames, and at most
+ * 8 snapshots.
+ *
+ * @param renderer Frame renderer.
+ * @param interval Number of frames between snapshots, 0 disables them.
+ * @param limit Maximum number of snapshots, at least 1.
+ */
+void image_renderer_set_keyframes(image_renderer_t *renderer, size_t interval, size_t limit);
+
+/**
+ * Restarts drawing from the first frame.
+ *
+ * @param renderer Frame renderer.
+ */
+void image_renderer_rewind(image_renderer_t *renderer);
+
+/**
+ * Frees the frame renderer.
+ *
+ * @param renderer Frame renderer.
+ */
+void image_renderer_free(image_renderer_t *renderer);
+
 /**
  * Frees the memory allocated for animated image data.
  *
@@ -0,0 +1,124 @@
+#ifndef PNGIF_OPTIONS_HEADER
+#define PNGIF_OPTIONS_HEADER
+
+#include <stdlib.h>
+
+#include <pngif/pool.h>
+
+/** Progress reporting **/
+
+typedef struct {
+  // Index of the image being decoded, in decoding order: the PNG default
+  // image or the first GIF image is 0, next animation frame is 1, and so on.
+  u_int32_t image;
+  // Number of completed interlace passes, and the total number of passes:
+  // 7 for interlaced PNG, 4 for interlaced GIF, and 1 for other images.
+  int pass;
+  int pass_count;
+  // Image canvas. Pixels of the passes that are not decoded yet are filled by
+  // replicating the decoded pixels over the blocks they represent. The canvas
+  // is only valid during the callback.
+  u_int32_t width;
+  u_int32_t height;
+  unsigned char *rgba;
+  // Distance between canvas rows in bytes, and canvas pixel format. Canvas is
+  // tightly packed RGBA, unless decoding into a caller-provided surface.
+  size_t stride;
+  int format;
+} pngif_progress_t;
+
+/**
+ * Progress callback, called after each completed interlace pass of each
+ * image, e.g. to show a preview of a partially decoded image.
+ *
+ * @param progress Progress report.
+ * @param context Context pointer from the options.
+ *
+ * @return 0 to continue decoding, anything else to stop. When stopped, the
+ *   decoder returns everything decoded so far, with the current image in the
+ *   state passed to the callback, and marks the result as partial.
+ */
+typedef int (*pngif_progress_fn)(pngif_progress_t *progress, void *context);
+
+/** Parallel decoding **/
+
+/**
+ * Task run for each index of a parallel job, e.g. to decode one animation
+ * frame. Tasks of a job are independent and may run in any order.
+ *
+ * @param job Job data.
+ * @param index Index of the task, from 0 to the task count - 1.
+ */
+typedef void (*pngif_task_fn)(void *job, size_t index);
+
+/**
+ * Executor callback, to run decoding tasks on the caller's own threads. It has
+ * to call the task function once for each index, on any threads, and return
+ * when all of them are done.
+ *
+ * @param task Task function.
+ * @param job Job data to pass to the task function.
+ * @param count Number of tasks.
+ * @param context Context pointer from the options.
+ */
+typedef void (*pngif_executor_fn)(pngif_task_fn task, void *job, size_t count, void *context);
+
+/** Options **/
+
+/**
+ * Decoding options. A zero-initialized struct means default behavior, same
+ * as passing no options at all.
+ */
+typedef struct {
+  // Optional progress callback and its context.
+  pngif_progress_fn progress;
+  void *progress_context;
+
+  // Reduced-resolution decoding: images are decoded at 1/scale of their size,
+  // rounded up. One of 1, 2, 4 or 8; 0 means 1. Non-interlaced PNG images are
+  // box-filtered row by row as they are decoded. Interlaced PNG images only
+  // decode the Adam7 passes that make up the reduced image, e.g. just the
+  // first pass for 1/8, so they are point-sampled, one pixel per block, not
+  // box-filtered. GIF sub-images are still LZW-decoded at full size, one at a
+  // time, and reduced right after, with each pixel either opaque or
+  // transparent. Animation frame offsets are scaled down too.
+  u_int32_t scale;
+
+  // Pixel format of decoded images: one of PNGIF_FORMAT_* byte orders,
+  // optionally with PNGIF_FORMAT_PREMULTIPLIED. 0 means straight RGBA. Pixels
+  // are produced in this format while decoding, with no conversion pass after.
+  // Surfaces passed to the *_into functions carry their own format instead.
+  int format;
+
+  // Parallel decoding of animation frames, into the same result as sequential
+  // decoding. Frames are decoded on the executor when there is one, otherwise
+  // on threads started for the call: the calling thread and threads - 1 more.
+  // 0 or 1 means no extra threads, a negative value means one thread per
+  // online CPU. Images are always decoded one by one when there's a progress
+  // callback.
+  int threads;
+  pngif_executor_fn executor;
+  void *executor_context;
+
+  // Pipelined composition of animations in image_from_*_with_options: frames
+  // are decoded on a separate thread, and each one is composed as soon as it's
+  // ready. At most this many decoded frames wait to be composed, so memory for
+  // them doesn't grow with the frame count. 0 means decoding all frames before
+  // composing them. Not used when there's a progress callback.
+  u_int32_t pipeline_depth;
+
+  // Delta frames in image_from_*_with_options: each animation frame after the
+  // first stores only the rectangle that changed since the previous frame,
+  // disposal of the previous frame included, so memory scales with the changed
+  // area rather than the image size. See image_frame_apply().
+  int delta_frames;
+
+  // Optional buffer pool: frames, canvases and decoding buffers (LZW indices,
+  // scanlines, zlib state, decoded images) are taken from it and released back
+  // to it, so that decoding similar images over and over doesn't allocate.
+  // Results keep the pool to release their buffers when freed. It has to be
+  // thread-safe for parallel or pipelined decoding.
+  pngif_pool_t *pool;
+} pngif_options_t;
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <pngif/errors.h>
 #include <pngif/png_parsed.h>
+#include <pngif/options.h>
+#include <pngif/surface.h>
 
 /** Data types **/
 
@@ -24,15 +26,23 @@ typedef struct {
 } png_frame_list_t;
 
 typedef struct {
-  // Dimensions.
+  // Dimensions, reduced when decoding at reduced resolution.
   u_int32_t width;
   u_int32_t height;
 
-  // Image data.
+  // Image data, and its pixel format, PNGIF_FORMAT_* value.
   unsigned char *data;
+  int format;
 
   // Additional data.
   png_frame_list_t *frames;
+
+  // Flag indicating that decoding was stopped by the progress callback, so
+  // the last decoded image may be incomplete and some frames may be missing.
+  unsigned char partial;
+
+  // Buffer pool image and frame data was allocated from, or NULL.
+  pngif_pool_t *pool;
 } png_decoded_t;
 
 /** Interface **/
@@ -54,6 +64,21 @@ void png_decoded_free(png_decoded_t *png);
  */
 png_decoded_t *png_decoded_from_parsed(png_parsed_t *parsed, int *error);
 
+/**
+ * Same as png_decoded_from_parsed(), with decoding options.
+ *
+ * @param parsed Parsed PNG data.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded PNG image, or NULL in case an error occurred.
+ */
+png_decoded_t *png_decoded_from_parsed_with_options(
+  png_parsed_t *parsed,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Creates a parsed PNG struct out of raw PNG data.
  *
@@ -65,6 +90,23 @@ png_decoded_t *png_decoded_from_parsed(png_parsed_t *parsed, int *error);
  */
 png_decoded_t *png_decoded_from_data(unsigned char *data, size_t size, int *error);
 
+/**
+ * Same as png_decoded_from_data(), with decoding options.
+ *
+ * @param data PNG data array.
+ * @param size Size of the data array.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded PNG data struct or NULL in case of an error.
+ */
+png_decoded_t *png_decoded_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Creates a parsed PNG struct out of data from file handle.
  *
@@ -75,6 +117,21 @@ png_decoded_t *png_decoded_from_data(unsigned char *data, size_t size, int *erro
  */
 png_decoded_t *png_decoded_from_file(FILE *file, int *error);
 
+/**
+ * Same as png_decoded_from_file(), with decoding options.
+ *
+ * @param file File handle.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded PNG data struct or NULL in case of an error.
+ */
+png_decoded_t *png_decoded_from_file_with_options(
+  FILE *file,
+  pngif_options_t *options,
+  int *error
+);
+
 /**
  * Creates a decoded PNG struct out of data from file at given path.
  *
@@ -85,4 +142,57 @@ png_decoded_t *png_decoded_from_file(FILE *file, int *error);
  */
 png_decoded_t *png_decoded_from_path(char *path, int *error);
 
+/**
+ * Same as png_decoded_from_path(), with decoding options.
+ *
+ * @param path File path to the PNG file.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ *
+ * @return Decoded PNG data struct or NULL in case of an error.
+ */
+png_decoded_t *png_decoded_from_path_with_options(
+  char *path,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Decodes the default image straight into a caller-provided surface, without
+ * allocating an output buffer. Parsed data in deferred mode is inflated row by
+ * row as it's decoded.
+ *
+ * @param parsed Parsed PNG data.
+ * @param surface Output surface. It has to fit the image, or its reduced size
+ *   when decoding at reduced resolution.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ */
+void png_decode_image_into(
+  png_parsed_t *parsed,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+);
+
+/**
+ * Decodes an animation frame straight into a caller-provided surface. Only
+ * the frame region is decoded, without compositing: to place the frame, point
+ * the surface at the frame offset in a larger surface.
+ *
+ * @param parsed Parsed PNG data.
+ * @param index Frame index.
+ * @param surface Output surface. It has to fit the frame, or its reduced
+ *   size when decoding at reduced resolution.
+ * @param options Decoding options, or NULL for defaults.
+ * @param error Error output.
+ */
+void png_decode_frame_into(
+  png_parsed_t *parsed,
+  u_int32_t index,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+);
+
 #endif
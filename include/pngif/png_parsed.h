@@ -25,6 +25,10 @@ typedef struct {
 typedef struct {
   u_int32_t length;
   void *data;
+  // Index of the first raw chunk of compressed data. Only used when data is
+  // parsed in deferred mode, in which case `data` is NULL and `length` is the
+  // size of data after decompression. -1 otherwise.
+  int chunk_index;
 } png_data_t;
 
 typedef struct {
@@ -91,6 +95,9 @@ typedef struct {
   png_animation_control_t *anim_control;
   png_frame_control_t *frame_controls;
   png_data_t *frames;
+  // Raw data that holds compressed image data in deferred mode. Not owned by
+  // the parsed struct.
+  png_raw_t *raw;
 } png_parsed_t;
 
 /** Interface **/
@@ -112,6 +119,21 @@ void png_parsed_free(png_parsed_t *png);
  */
 png_parsed_t *png_parsed_from_raw(png_raw_t *raw, int *error);
 
+/**
+ * Creates a parsed PNG struct out of raw PNG data without decompressing image
+ * data. Image data and frame data structs only point to their first raw
+ * chunk, and decoder inflates them on the fly, one scanline at a time.
+ *
+ * The parsed struct references the raw data, so the raw container (and its
+ * input array for chunk views) must outlive it.
+ *
+ * @param raw Raw chunk data.
+ * @param error Output error.
+ *
+ * @return New instance of PNG or NULL in case of an error.
+ */
+png_parsed_t *png_parsed_from_raw_deferred(png_raw_t *raw, int *error);
+
 /**
  * Creates a parsed PNG struct out of raw PNG data.
  *
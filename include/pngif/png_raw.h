@@ -23,6 +23,9 @@ typedef struct {
 typedef struct {
   unsigned int chunk_count;
   png_chunk_raw_t **chunks;
+  // If set, chunks' data points into the input array the container was
+  // created from, instead of being owned by the container.
+  unsigned char borrowed;
 } png_raw_t;
 
 /** Raw parsing - API **/
@@ -38,6 +41,24 @@ typedef struct {
  */
 png_raw_t *png_raw_from_data(unsigned char *data, size_t size, int fail_on_crc, int *error);
 
+/**
+ * Splits raw PNG data stream into a png_raw_t struct without copying chunk
+ * data. Each chunk is a view into the input array: its `data` pointer points
+ * at the chunk's body inside `data`, and CRC is checked over the input bytes
+ * in place.
+ *
+ * The input array is still owned by the caller. It must stay alive and
+ * unchanged until the returned container is freed with png_raw_free().
+ *
+ * @param data PNG data.
+ * @param size Size of the data.
+ * @param fail_on_crc Stop reading and return error of chunk's CRC is wrong.
+ * @param error Error output.
+ *
+ * @return Raw PNG data, or NULL in case of fatal errors.
+ */
+png_raw_t *png_raw_view_from_data(unsigned char *data, size_t size, int fail_on_crc, int *error);
+
 /**
  * Loads and splits PNG data from a file handle into png_raw_t struct.
  *
@@ -63,6 +84,10 @@ png_raw_t *png_raw_from_path(const char *filename, int fail_on_crc, int *error);
 /**
  * Frees the memory occupied by the raw data container.
  *
+ * For containers created with png_raw_view_from_data() only the container and
+ * chunk descriptors are freed. Chunk data belongs to the caller's input array,
+ * which can be released only after this call.
+ *
  * @param png Previously created png_raw_t instance.
  */
 void png_raw_free(png_raw_t *png);
@@ -0,0 +1,85 @@
+#ifndef PNGIF_POOL_HEADER
+#define PNGIF_POOL_HEADER
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/** Data types **/
+
+// Buffer size classes: powers of two from 64 bytes to 1 GB. Larger buffers
+// are allocated and freed right away.
+#define PNGIF_POOL_MIN_SHIFT 6
+#define PNGIF_POOL_CLASSES 25
+
+/**
+ * Pool of reusable buffers, to decode many images without allocating memory
+ * for each one. Released buffers are kept on a free list of their size class,
+ * and handed out again for the next request of that class, so decoding images
+ * of the same size over and over settles into reusing the same buffers.
+ */
+typedef struct {
+  // Free lists of released buffers, one per size class.
+  void *free_lists[PNGIF_POOL_CLASSES];
+  // Number of bytes held on free lists, and the limit on it. Buffers released
+  // past the limit are freed. 0 means no limit.
+  size_t cached;
+  size_t capacity;
+  // Flag indicating that the pool can be used by several threads at a time,
+  // with every call under the lock.
+  int thread_safe;
+  pthread_mutex_t lock;
+  // Number of requests served from free lists, and allocated anew.
+  size_t hits;
+  size_t misses;
+} pngif_pool_t;
+
+/** Functions **/
+
+/**
+ * Creates an empty buffer pool.
+ *
+ * @param capacity Maximum number of bytes kept on free lists, or 0 for no
+ *   limit.
+ * @param thread_safe Flag to make the pool safe to use from several threads,
+ *   e.g. for parallel or pipelined decoding, or to share the pool between
+ *   threads that decode images each.
+ *
+ * @return New pool, or NULL if memory couldn't be allocated.
+ */
+pngif_pool_t *pngif_pool_new(size_t capacity, int thread_safe);
+
+/**
+ * Allocates a buffer: takes a released buffer of the same size class, or
+ * allocates a new one. Buffers are aligned for any type.
+ *
+ * @param pool Buffer pool, or NULL to just call malloc().
+ * @param size Buffer size in bytes.
+ *
+ * @return Buffer, or NULL if memory couldn't be allocated.
+ */
+void *pngif_pool_alloc(pngif_pool_t *pool, size_t size);
+
+/**
+ * Returns a buffer to the pool it was allocated from.
+ *
+ * @param pool Buffer pool the buffer came from, or NULL to just call free().
+ * @param buffer Buffer, or NULL.
+ */
+void pngif_pool_release(pngif_pool_t *pool, void *buffer);
+
+/**
+ * Frees all buffers held on free lists.
+ *
+ * @param pool Buffer pool.
+ */
+void pngif_pool_trim(pngif_pool_t *pool);
+
+/**
+ * Frees the pool, along with the buffers on its free lists. Images and other
+ * results decoded with the pool have to be freed before.
+ *
+ * @param pool Buffer pool, or NULL.
+ */
+void pngif_pool_free(pngif_pool_t *pool);
+
+#endif
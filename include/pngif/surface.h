@@ -0,0 +1,37 @@
+#ifndef PNGIF_SURFACE_HEADER
+#define PNGIF_SURFACE_HEADER
+
+#include <stdlib.h>
+
+/** Pixel formats **/
+
+/* Byte order of 4-byte pixels in memory. */
+#define PNGIF_FORMAT_RGBA 0
+#define PNGIF_FORMAT_BGRA 1
+#define PNGIF_FORMAT_ARGB 2
+#define PNGIF_FORMAT_ABGR 3
+
+/* Flag to combine with the byte order for colors premultiplied by alpha. */
+#define PNGIF_FORMAT_PREMULTIPLIED 4
+
+/** Data types **/
+
+/**
+ * Caller-owned pixel memory to decode into, e.g. a mapped shared memory
+ * surface or a texture upload buffer. Rows may be padded, and a surface may
+ * point into a larger one to decode into a part of it.
+ */
+typedef struct {
+  // First pixel of the first row.
+  unsigned char *pixels;
+  // Distance between rows in bytes, at least width * 4.
+  size_t stride;
+  // Size in pixels. Decoders fail if the image doesn't fit.
+  u_int32_t width;
+  u_int32_t height;
+  // One of PNGIF_FORMAT_* byte orders, optionally with the premultiplied
+  // alpha flag.
+  int format;
+} pngif_surface_t;
+
+#endif
@@ -56,5 +56,67 @@ void rgba_to_argb(unsigned char *rgba, unsigned char *argb, size_t width, size_t
  */
 void rgba_to_bgra(unsigned char *rgba, unsigned char *argb, size_t width, size_t height);
 
+/**
+ * Packs color values into a 32-bit value with the memory layout of a pixel
+ * format, regardless of the byte order.
+ *
+ * @param format Pixel format, PNGIF_FORMAT_* value.
+ * @param red Red value.
+ * @param green Green value.
+ * @param blue Blue value.
+ * @param alpha Alpha value.
+ *
+ * @return Pixel value.
+ */
+u_int32_t pngif_pixel(
+  int format,
+  unsigned char red,
+  unsigned char green,
+  unsigned char blue,
+  unsigned char alpha
+);
+
+/**
+ * Converts RGBA pixels to a pixel format, e.g. BGRA with premultiplied alpha.
+ * Input and output may be the same array.
+ *
+ * @param rgba RGBA pixels.
+ * @param output Output pixels.
+ * @param count Number of pixels.
+ * @param format Output pixel format, PNGIF_FORMAT_* value.
+ */
+void pngif_convert_pixels(unsigned char *rgba, unsigned char *output, size_t count, int format);
+
+/**
+ * Multiplies colors by alpha in place, rounded to nearest.
+ *
+ * @param pixels Pixels with straight alpha.
+ * @param count Number of pixels.
+ * @param format Byte order of the pixels, PNGIF_FORMAT_* value.
+ */
+void pngif_premultiply_pixels(unsigned char *pixels, size_t count, int format);
+
+/**
+ * Divides premultiplied colors by alpha in place, rounded to nearest. Colors
+ * of fully transparent pixels become zero.
+ *
+ * @param pixels Pixels with premultiplied alpha.
+ * @param count Number of pixels.
+ * @param format Byte order of the pixels, PNGIF_FORMAT_* value.
+ */
+void pngif_unpremultiply_pixels(unsigned char *pixels, size_t count, int format);
+
+/**
+ * Composes pixels over canvas pixels in place, Porter-Duff "over" with integer
+ * rounding to nearest. Canvas alpha is composed too, so the canvas may be
+ * partially transparent.
+ *
+ * @param canvas Canvas pixels.
+ * @param pixels Pixels to draw over the canvas.
+ * @param count Number of pixels.
+ * @param format Pixel format of both, PNGIF_FORMAT_* value, straight or
+ *   premultiplied.
+ */
+void pngif_blend_pixels(unsigned char *canvas, unsigned char *pixels, size_t count, int format);
 
 #endif
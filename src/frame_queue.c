@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include <pngif/pool.h>
+#include "frame_queue.h"
+
+/** Public **/
+
+int frame_queue_init(frame_queue_t *queue, size_t depth) {
+  queue->items = malloc(depth * sizeof(frame_queue_item_t));
+  if (queue->items == NULL) {
+    return -1;
+  }
+
+  queue->depth = depth;
+  queue->head = 0;
+  queue->count = 0;
+  queue->closed = 0;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->changed, NULL);
+  return 0;
+}
+
+int frame_queue_push(frame_queue_t *queue, unsigned char *rgba, int error) {
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == queue->depth && !queue->closed) {
+    pthread_cond_wait(&queue->changed, &queue->mutex);
+  }
+
+  if (queue->closed) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+
+  frame_queue_item_t *item = queue->items + (queue->head + queue->count) % queue->depth;
+  item->rgba = rgba;
+  item->error = error;
+  queue->count += 1;
+
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+unsigned char *frame_queue_pop(frame_queue_t *queue, int *error) {
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0) {
+    pthread_cond_wait(&queue->changed, &queue->mutex);
+  }
+
+  frame_queue_item_t item = queue->items[queue->head];
+  queue->head = (queue->head + 1) % queue->depth;
+  queue->count -= 1;
+
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+
+  *error = item.error;
+  return item.rgba;
+}
+
+void frame_queue_close(frame_queue_t *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->closed = 1;
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+void frame_queue_free(frame_queue_t *queue, pngif_pool_t *pool) {
+  for (size_t idx = 0; idx < queue->count; idx++) {
+    pngif_pool_release(pool, queue->items[(queue->head + idx) % queue->depth].rgba);
+  }
+
+  pthread_cond_destroy(&queue->changed);
+  pthread_mutex_destroy(&queue->mutex);
+  free(queue->items);
+  queue->items = NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef _PNGIF_FRAME_QUEUE_INCLUDE
+#define _PNGIF_FRAME_QUEUE_INCLUDE
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <pngif/pool.h>
+
+/**
+ * Decoded frame image, or the error that stopped decoding.
+ */
+typedef struct {
+  unsigned char *rgba;
+  int error;
+} frame_queue_item_t;
+
+/**
+ * Bounded queue of decoded frame images, between a thread that decodes them
+ * and a thread that composes them. The decoding thread waits while the queue
+ * is full, so at most `depth` decoded images exist at a time.
+ */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  frame_queue_item_t *items;
+  size_t depth;
+  // Index of the oldest item, and the number of queued items.
+  size_t head;
+  size_t count;
+  // Flag set when the consumer gives up, so that the producer stops.
+  int closed;
+} frame_queue_t;
+
+/**
+ * Prepares an empty queue.
+ *
+ * @param queue Queue to initialize.
+ * @param depth Maximum number of queued images, at least 1.
+ *
+ * @return 0 on success, or -1 if memory couldn't be allocated.
+ */
+int frame_queue_init(frame_queue_t *queue, size_t depth);
+
+/**
+ * Adds an image to the queue, waiting while it's full.
+ *
+ * @param queue Frame queue.
+ * @param rgba Decoded image, owned by the queue once added, or NULL on errors.
+ * @param error Decoding error, or 0.
+ *
+ * @return 0 if the image was added, or -1 if the queue was closed. The image
+ *   is not taken then.
+ */
+int frame_queue_push(frame_queue_t *queue, unsigned char *rgba, int error);
+
+/**
+ * Takes the oldest image from the queue, waiting until there is one.
+ *
+ * @param queue Frame queue.
+ * @param error Output decoding error.
+ *
+ * @return Decoded image, owned by the caller, or NULL on errors.
+ */
+unsigned char *frame_queue_pop(frame_queue_t *queue, int *error);
+
+/**
+ * Closes the queue, so that the producer stops at its next push.
+ *
+ * @param queue Frame queue.
+ */
+void frame_queue_close(frame_queue_t *queue);
+
+/**
+ * Frees the queue and the images left in it.
+ *
+ * @param queue Frame queue.
+ * @param pool Buffer pool the images were allocated from, or NULL.
+ */
+void frame_queue_free(frame_queue_t *queue, pngif_pool_t *pool);
+
+#endif
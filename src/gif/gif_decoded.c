@@ -4,557 +4,815 @@
 
 #include <pngif/errors.h>
 #include <pngif/gif_decoded.h>
-
-/** Utils **/
-
-size_t gif_max_size(size_t a, size_t b) {
-  if (a > b) {
-    return a;
-  } else {
-    return b;
-  }
-}
-
-unsigned char gif_bit_mask(size_t bits) {
-  switch (bits) {
-  case 0:
-    return 0;
-  case 1:
-    return 1;
-  case 2:
-    return 3;
-  case 3:
-    return 7;
-  case 4:
-    return 15;
-  case 5:
-    return 31;
-  case 6:
-    return 63;
-  case 7:
-    return 127;
-  default:
-    return 255;
-  }
-}
+#include <pngif/options.h>
+#include <pngif/surface.h>
+#include <pngif/utils.h>
+#include "../parallel.h"
+#include "../pool.h"
+#include "../scale.h"
+#include "../surface.h"
 
 /** LZW **/
 
+// Maximum number of codes, defined by the maximum code size of 12 bits.
+#define GIF_LZW_MAX_CODES 4096
+// Prefix of single index strings.
+#define GIF_LZW_NO_CODE 0xffff
+
+/*
+ * Each code stands for a string of color indices, which is some earlier code's
+ * string plus one index. So the table only keeps that earlier code (prefix)
+ * and the last index (suffix) of each code, and strings are produced by
+ * following prefixes back to a single index code, from the last index to the
+ * first. String lengths are known upfront, so the output position of each
+ * index is too. The first index of each string is kept as well, since that's
+ * what new codes are made of.
+ */
 typedef struct {
-  // Size of the color table. This is needed to detect CLEAR and END codes.
-  size_t color_table_size;
-  // Max number of elements.
-  size_t size;
-  // Current number of elements.
+  // Number of codes for single indices. CLEAR and END codes follow them.
+  size_t clear_code;
+  // Current number of codes, including CLEAR and END.
   size_t element_count;
-  // Number of bytes that each element can occupy.
-  size_t stride;
-  /*
-   * Element storage:
-   * First two bytes of each element is it's length, next LENGTH bytes are
-   * color table indexes. The code table guarantees that there's enough space
-   * allocated for all elements at all times.
-   */
-  unsigned char *elements;
+  u_int16_t prefix[GIF_LZW_MAX_CODES];
+  u_int16_t length[GIF_LZW_MAX_CODES];
+  unsigned char suffix[GIF_LZW_MAX_CODES];
+  unsigned char first[GIF_LZW_MAX_CODES];
 } gif_lzw_code_table;
 
 /**
- * Creates a new code table, initializes it with codes corresponding to color
- * table.
+ * Creates a new code table, initializes it with single index codes.
  *
- * @param color_table_size Number of colors in a color table.
+ * @param min_code_size Minimum code size, the number of bits in color indices.
+ * @param pool Buffer pool, or NULL.
  *
- * @return New instance of a code table.
+ * @return New instance of a code table, or NULL if memory couldn't be
+ *   allocated.
  */
-gif_lzw_code_table *gif_lzw_code_table_init(size_t color_table_size) {
-  gif_lzw_code_table *table = calloc(1, sizeof(gif_lzw_code_table));
+gif_lzw_code_table *gif_lzw_code_table_init(unsigned char min_code_size, pngif_pool_t *pool) {
+  gif_lzw_code_table *table = pngif_pool_alloc(pool, sizeof(gif_lzw_code_table));
   if (table == NULL) {
     return NULL;
   }
 
-  table->color_table_size = color_table_size;
-  table->size = color_table_size * 2;
-  table->stride = 6;
-  table->elements = calloc(table->size, table->stride);
-  table->element_count = color_table_size + 2;
-
-  // Initial color table.
-  for (
-    size_t idx = 0, offset = 0;
-    idx < color_table_size;
-    idx++, offset += table->stride
-  ) {
-    u_int16_t *length = (u_int16_t *)(table->elements + offset);
-    *length = 1;
-    table->elements[offset + 2] = idx;
+  table->clear_code = (size_t)1 << min_code_size;
+  for (size_t code = 0; code < table->clear_code; code++) {
+    table->prefix[code] = GIF_LZW_NO_CODE;
+    table->length[code] = 1;
+    table->suffix[code] = code;
+    table->first[code] = code;
   }
+  table->element_count = table->clear_code + 2;
 
   return table;
 }
 
+/**
+ * Drops all codes added since the table was initialized. Single index codes
+ * never change, so this just resets the code count.
+ *
+ * @param table Code table to reset.
+ */
+static inline void gif_lzw_code_table_reset(gif_lzw_code_table *table) {
+  table->element_count = table->clear_code + 2;
+}
+
+/**
+ * Adds a code for the string of an existing code plus one index. The caller
+ * makes sure that the table isn't full.
+ *
+ * @param table Code table.
+ * @param prefix Existing code.
+ * @param index Color index to append.
+ */
+static inline void gif_lzw_code_table_append(gif_lzw_code_table *table, u_int16_t prefix, unsigned char index) {
+  size_t code = table->element_count;
+  table->prefix[code] = prefix;
+  table->length[code] = table->length[prefix] + 1;
+  table->suffix[code] = index;
+  table->first[code] = table->first[prefix];
+  table->element_count = code + 1;
+}
+
 /**
  * Deallocates code table.
  *
  * @param table Code table to deallocate.
+ * @param pool Buffer pool the table was allocated from, or NULL.
  */
-void gif_lzw_code_table_free(gif_lzw_code_table *table) {
-  if (table == NULL)
-    return;
+void gif_lzw_code_table_free(gif_lzw_code_table *table, pngif_pool_t *pool) {
+  pngif_pool_release(pool, table);
+}
+
+/** Private **/
 
-  if (table->elements != NULL)
-    free(table->elements);
+/**
+ * LZW compression packs "codes" into bytes on bit-by-bit basis, i. e.
+ * the data stream is treated as bit stream, not byte stream. After a code
+ * is put into the stream, the next code starts at the exact BIT position
+ * where the last one ended. For example, if we have code size of 3, the first
+ * few bytes would look like this:
+ *
+ * byte 1    byte 2    byte 3
+ * 33222111  65554443  88877766
+ *
+ * Here individual digits are code indexes. You can see that code 3 has first 2
+ * bits stored in the first byte, and the remaning bit stored in the second
+ * byte, code 6 starts at the last bit of byte 2, and spans into first 2 bits
+ * of byte 3, and so on.
+ *
+ * Since the first code sits in the lowest bits, the stream reads naturally as
+ * one long little-endian number. The reader keeps up to 64 of its next bits in
+ * a buffer, refills it with a whole 8-byte word at a time, and each code is
+ * then just the bottom bits of the buffer.
+ */
+typedef struct {
+  unsigned char *data;
+  size_t length;
+  // Offset of the next byte to load into the buffer.
+  size_t position;
+  // Bits not read yet, starting from the lowest one. Bits above the count may
+  // be set, but only to the data that follows.
+  u_int64_t buffer;
+  int bits;
+} gif_bit_reader_t;
 
-  free(table);
+/**
+ * Prepares a bit reader for a data stream.
+ *
+ * @param reader Reader to initialize.
+ * @param data Data stream.
+ * @param length Length of the data stream in bytes.
+ */
+void gif_bit_reader_init(gif_bit_reader_t *reader, unsigned char *data, size_t length) {
+  reader->data = data;
+  reader->length = length;
+  reader->position = 0;
+  reader->buffer = 0;
+  reader->bits = 0;
 }
 
 /**
- * Increases the size of the given code table
+ * Fills the buffer with at least 56 bits, or with whatever is left at the end
+ * of the data.
  *
- * @param old Code table to expand.
- * @param new_size New max number of elements.
- * @param new_stride New max length of a color index sequence for a code.
- * @param error Error output.
+ * @param reader Bit reader.
  */
-void gif_lzw_code_table_resize(
-  gif_lzw_code_table *old,
-  size_t new_size,
-  size_t new_stride,
-  int *error
-) {
-  // Allocate new storage.
-  unsigned char *new_elements = calloc(new_size, new_stride);
-  if (new_elements == NULL) {
-    *error = GIF_ERR_MEMIO;
+static inline void gif_bit_reader_refill(gif_bit_reader_t *reader) {
+  if (reader->length - reader->position >= 8) {
+    u_int64_t word;
+    memcpy(&word, reader->data + reader->position, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    // Only whole bytes are counted, the rest of the word gets loaded again
+    // into the same bits by the next refill.
+    reader->buffer |= word << reader->bits;
+    reader->position += (63 - reader->bits) >> 3;
+    reader->bits |= 56;
     return;
   }
 
-  /*
-   * If element size isn't changed, just copy the old storage to the new one.
-   * Otherwise, we have to copy each element separately because of the stride
-   * difference between two storages.
-   */
-  if (new_stride == old->stride) {
-    memcpy(new_elements, old->elements, old->stride * old->size);
-  } else {
-    for (
-      size_t idx = 0, old_off = 0, new_off = 0;
-      idx < old->element_count;
-      idx++, old_off += old->stride, new_off += new_stride
-    ) {
-      memcpy(new_elements + new_off, old->elements + old_off, old->stride);
+  // Close to the end, bytes are loaded one by one so nothing past the data is
+  // read.
+  while (reader->bits <= 56 && reader->position < reader->length) {
+    reader->buffer |= (u_int64_t)reader->data[reader->position] << reader->bits;
+    reader->position += 1;
+    reader->bits += 8;
+  }
+}
+
+/**
+ * Reads the next code.
+ *
+ * @param reader Bit reader.
+ * @param code_size Code size, i. e. number of bits to read, up to 56.
+ * @param code Output code.
+ *
+ * @return 1 if the code was read, or 0 if the data ended before it.
+ */
+static inline int gif_bit_reader_read(gif_bit_reader_t *reader, int code_size, u_int16_t *code) {
+  if (reader->bits < code_size) {
+    gif_bit_reader_refill(reader);
+    if (reader->bits < code_size) {
+      return 0;
     }
   }
 
-  // Switch the storage.
-  free(old->elements);
-  old->elements = new_elements;
-  old->size = new_size;
-  old->stride = new_stride;
+  *code = reader->buffer & (((u_int64_t)1 << code_size) - 1);
+  reader->buffer >>= code_size;
+  reader->bits -= code_size;
+  return 1;
 }
 
 /**
- * Returns an index sequence for a given code.
+ * Reads a single code at an arbitrary position in the code data stream.
  *
- * @param table The code will be searched in this code table.
- * @param index Code value.
- * @param is_clear Output flag indicating whether the code is a clear code.
- * @param is_end Output flag indicating whether the code is an end of data code.
+ * @param output Pointer to the output value.
+ * @param data Data stream.
+ * @param offset Current bit offset in the data stream.
+ * @param code_size Code size, i. e. number of bits to read.
  *
- * @return A pointer to the beginning of the index sequence, or NULL in case of
- *   a special code (CLEAR or END) or if code is not yet in the table.
+ * @return Bit offset after reading the code.
  */
-unsigned char *gif_lzw_code_table_element_at(
-  gif_lzw_code_table *table,
-  size_t index,
-  int *is_clear,
-  int *is_end
+u_int64_t gif_read_next_code(
+  u_int16_t *output,
+  unsigned char *data,
+  u_int64_t offset,
+  unsigned char code_size
 ) {
-  if (is_clear != NULL) {
-    if (index == table->color_table_size) {
-      *is_clear = 1;
-    } else {
-      *is_clear = 0;
-    }
+  gif_bit_reader_t reader;
+  u_int16_t skipped;
+  int skip = offset & 7;
+
+  // Only the bytes holding the code are read.
+  gif_bit_reader_init(&reader, data + offset / 8, (skip + code_size + 7) / 8);
+  if (skip > 0) {
+    gif_bit_reader_read(&reader, skip, &skipped);
   }
+  gif_bit_reader_read(&reader, code_size, output);
 
-  if (is_end != NULL) {
-    if (index == (table->color_table_size + 1)) {
-      *is_end = 1;
-    } else {
-      *is_end = 0;
-    }
-  }
+  return offset + code_size;
+}
 
-  if (index >= table->element_count) {
-    return NULL;
+/**
+ * Builds the table of output pixels for all color indices, in the output
+ * pixel format. The transparent color and indices past the end of the color
+ * table are fully transparent.
+ *
+ * @param palette Output table of 256 pixels.
+ * @param color_table Color table.
+ * @param color_table_size Number of colors in the color table.
+ * @param transparent_color_index Optional color index for transparent pixels.
+ * @param format Output pixel format.
+ */
+void gif_fill_palette(
+  u_int32_t *palette,
+  gif_color_t *color_table,
+  size_t color_table_size,
+  unsigned char *transparent_color_index,
+  int format
+) {
+  memset(palette, 0, 256 * sizeof(u_int32_t));
+  for (size_t idx = 0; color_table != NULL && idx < color_table_size && idx < 256; idx++) {
+    gif_color_t color = color_table[idx];
+    palette[idx] = pngif_pixel(format, color.red, color.green, color.blue, 255);
   }
 
-  return table->elements + (index * table->stride);
+  if (transparent_color_index != NULL) {
+    palette[*transparent_color_index] = 0;
+  }
 }
 
 /**
- * Adds new index sequence to the code table.
+ * Writes the index string of a code into the index storage, starting from its
+ * last index. Indices past the end of the storage are dropped.
  *
- * @param table Table to append new index sequence into.
- * @param element Index sequence to add.
- * @param error Error output.
+ * @param table Code table.
+ * @param code Code to write.
+ * @param indices Index storage to append to.
+ * @param offset Offset to the next unfilled pixel in the storage.
+ * @param size Size of the storage in pixels.
  *
- * @return New element count after adding the sequence.
+ * @return Offset to the next unfilled pixel after adding the string.
  */
-size_t gif_lzw_code_table_append_element(
+static inline size_t gif_lzw_write_string(
   gif_lzw_code_table *table,
-  unsigned char *element,
-  int *error
+  u_int16_t code,
+  unsigned char *indices,
+  size_t offset,
+  size_t size
 ) {
-  u_int16_t *elsize = (u_int16_t *)element;
-
-  // Resize code table if needed.
-  if (table->element_count == table->size || *elsize > (table->stride - 2)) {
-    size_t new_size = (table->element_count == table->size)
-      ? (table->size * 2)
-      : table->size;
-    size_t new_stride = (*elsize > (table->stride - 2))
-      ? gif_max_size(table->stride * 2, *elsize + 2)
-      : table->stride;
-
-    gif_lzw_code_table_resize(
-      table,
-      new_size,
-      new_stride,
-      error
-    );
+  size_t end = offset + table->length[code];
+  size_t position = end;
 
-    if (*error != 0) {
-      return table->element_count;
-    }
+  // Skip the part of the string that doesn't fit.
+  for (; position > size && code != GIF_LZW_NO_CODE; code = table->prefix[code]) {
+    position -= 1;
   }
 
-  unsigned char *target = table->elements + (table->element_count * table->stride);
-  memcpy(target, element, *elsize + 2);
+  for (; code != GIF_LZW_NO_CODE; code = table->prefix[code]) {
+    position -= 1;
+    indices[position] = table->suffix[code];
+  }
 
-  table->element_count = table->element_count + 1;
-  return table->element_count;
+  return end;
 }
 
-/** Private **/
+/**
+ * Maps color indices to pixels.
+ *
+ * @param indices Color indices.
+ * @param output Output pixels.
+ * @param count Number of pixels.
+ * @param palette Pixels for color indices, see gif_fill_palette().
+ */
+void gif_expand_indices(unsigned char *indices, unsigned char *output, size_t count, u_int32_t *palette) {
+  u_int32_t *pixels = (u_int32_t *)output;
+  for (size_t idx = 0; idx < count; idx++) {
+    pixels[idx] = palette[indices[idx]];
+  }
+}
+
+/** Interlacing **/
 
 /**
- * LZW compression packs "codes" into bytes on bit-by-bit basis, i. e.
- * the data stream is treated as bit stream, not byte stream. After a code
- * is put into the stream, the next code starts at the exact BIT position
- * where the last one ended. For example, if we have code size of 3, the first
- * few bytes would look like this:
+ * Interlaced GIF images store rows in 4 passes: every 8th row starting from
+ * row 0, every 8th row starting from row 4, every 4th row starting from row 2,
+ * and every 2nd row starting from row 1.
+ */
+static int gif_pass_offset[] = { 0, 4, 2, 1 };
+static int gif_pass_stride[] = { 8, 8, 4, 2 };
+// Number of rows each row of a pass stands for, once the pass is decoded.
+static int gif_pass_block[] = { 8, 4, 2, 1 };
+
+/**
+ * Returns the number of rows in an interlace pass.
  *
- * byte 1    byte 2    byte 3
- * 33222111  65554443  88877766
+ * @param pass Pass index, 0 to 3.
+ * @param height Image height.
  *
- * Here individual digits are code indexes. You can see that code 3 has first 2
- * bits stored in the first byte, and the remaning bit stored in the second
- * byte, code 6 starts at the last bit of byte 2, and spans into first 2 bits
- * of byte 3, and so on.
+ * @return Number of rows.
+ */
+u_int32_t gif_pass_rows(int pass, u_int32_t height) {
+  if (height <= gif_pass_offset[pass]) {
+    return 0;
+  }
+  return (height - gif_pass_offset[pass] + gif_pass_stride[pass] - 1) / gif_pass_stride[pass];
+}
+
+/**
+ * Returns the index of an image row in the data stream of an interlaced image.
+ *
+ * @param line Row in the image.
+ * @param height Image height.
  *
- * This makes the decoding a little tricky, as you'll see in the code below.
+ * @return Row in the data stream.
  */
+u_int32_t gif_stream_row(u_int32_t line, u_int32_t height) {
+  u_int32_t first = 0;
+  for (int pass = 0; pass < 4; pass++) {
+    u_int32_t offset = gif_pass_offset[pass];
+    if (line >= offset && (line - offset) % gif_pass_stride[pass] == 0) {
+      return first + (line - offset) / gif_pass_stride[pass];
+    }
+    first += gif_pass_rows(pass, height);
+  }
+  return first;
+}
 
 /**
- * Reads next code from the code data stream.
+ * Copies rows of an interlace pass from decoded color indices into their
+ * places in the output image.
  *
- * @param output Pointer to the output value.
- * @param data Data stream.
- * @param offset Current bit offset in the data stream.
- * @param code_size Code size, i. e. number of bits to read.
+ * @param indices Decoded color indices, rows in the order of the data stream.
+ * @param output Output image of color indices.
+ * @param width Image width.
+ * @param height Image height.
+ * @param pass Pass index, 0 to 3.
+ * @param line_in Index of the first pass row in decoded data.
+ * @param replicate Flag to also copy each row over the rows of the passes to
+ *   come, for progressive display.
  *
- * @return Bit offset after reading the code.
+ * @return Index of the first row of the next pass in decoded data.
  */
-u_int64_t gif_read_next_code(
-  u_int16_t *output,
-  unsigned char *data,
-  u_int64_t offset,
-  unsigned char code_size
+u_int32_t gif_deinterlace_pass(
+  unsigned char *indices,
+  unsigned char *output,
+  u_int32_t width,
+  u_int32_t height,
+  int pass,
+  u_int32_t line_in,
+  int replicate
 ) {
-  int current_offset = offset;
-  int bits_left = code_size;
-  int byte_value, result = 0;
-
-  // This could probably be heavily optimised, but I'm not smort enough.
-  while (bits_left > 0) {
-    // Get what byte we're in right now.
-    int current_byte = current_offset / 8;
-    // Get the number of bits to skip till the first code bit.
-    int shift_right = current_offset - (current_byte * 8);
-
-    // Read the byte.
-    byte_value = data[current_byte];
-    // Shift right to erase previous code data.
-    byte_value = byte_value >> shift_right;
-    // Erase everything past current code's end.
-    byte_value = byte_value & (gif_bit_mask(bits_left));
-
-    // Add what's left to the resulting code value, in a proper position.
-    result = result + (byte_value << (code_size - bits_left));
-
-    // Advance the bit offset past the data we've just read.
-    current_offset += (8 - shift_right);
-    // Substract the number of bits read from the total expected code size.
-    bits_left -= (8 - shift_right);
+  for (
+    u_int32_t line_out = gif_pass_offset[pass];
+    line_out < height;
+    line_out += gif_pass_stride[pass], line_in++
+  ) {
+    int copies = replicate ? gif_pass_block[pass] : 1;
+    for (u_int32_t line = line_out; line < line_out + copies && line < height; line++) {
+      memcpy(output + (size_t)width * line, indices + (size_t)width * line_in, width);
+    }
   }
 
-  *output = result;
-  return (offset + code_size);
+  return line_in;
 }
 
 /**
- * Converts color index sequence into colors and adds it to the color data
- * storage.
+ * Reports a completed pass to the progress callback, if there's one.
  *
- * @param rgba Color data storage to append to.
- * @param offset Offset to the next unfilled pixel in the storage.
- * @param sequence Color index sequence to add to the storage.
- * @param color_table Color table to look up colors from color indices.
- * @param transparent_color_index Optional color index for transparent pixels.
+ * @param options Decoding options.
+ * @param image Index of the image.
+ * @param pass Number of completed passes.
+ * @param pass_count Total number of passes.
+ * @param width Image width.
+ * @param height Image height.
+ * @param rgba Image canvas.
+ * @param format Canvas pixel format.
  *
- * @return Offset to the next unfilled pixel after adding the sequence.
+ * @return Flag indicating that decoding should stop.
  */
-int gif_rgba_add_sequence(
+int gif_report_progress(
+  pngif_options_t *options,
+  u_int32_t image,
+  int pass,
+  int pass_count,
+  u_int32_t width,
+  u_int32_t height,
   unsigned char *rgba,
-  u_int32_t offset,
-  unsigned char *sequence,
-  gif_color_t *color_table,
-  unsigned char *transparent_color_index
+  int format
 ) {
-  u_int16_t *seq_length = (u_int16_t *)sequence;
-  int new_offset = offset;
-
-  for (int idx = 0; idx < *seq_length; idx++) {
-    if (transparent_color_index != NULL && sequence[idx + 2] == *transparent_color_index) {
-      memset(rgba + new_offset, 0, 4);
-    } else {
-      gif_color_t color = color_table[sequence[idx + 2]];
-      rgba[new_offset + 0] = color.red;
-      rgba[new_offset + 1] = color.green;
-      rgba[new_offset + 2] = color.blue;
-      rgba[new_offset + 3] = 255;
-    }
-    new_offset += 4;
+  if (options == NULL || options->progress == NULL) {
+    return 0;
   }
 
-  return new_offset;
+  pngif_progress_t progress = {
+    .image = image,
+    .pass = pass,
+    .pass_count = pass_count,
+    .width = width,
+    .height = height,
+    .rgba = rgba,
+    .stride = width * 4,
+    .format = format,
+  };
+
+  return options->progress(&progress, options->progress_context) != 0;
 }
 
 /**
- * Decodes LZW-encoded image data into RGBA color data.
+ * Progress reporting for images decoded into pixels. Interlaced images are
+ * expanded into the pixel buffer after each pass, for the callback.
+ */
+typedef struct {
+  pngif_options_t *options;
+  u_int32_t image;
+  u_int32_t *palette;
+  unsigned char *rgba;
+  int format;
+} gif_pixel_report_t;
+
+/**
+ * Returns how many pixels of an image row were decoded, when the data may have
+ * ended before the end of the image.
+ *
+ * @param line Row in the image.
+ * @param width Image width.
+ * @param height Image height.
+ * @param interlaced Flag indicating whether the image is interlaced.
+ * @param decoded Number of pixels decoded, in data stream order.
+ *
+ * @return Number of decoded pixels at the start of the row.
+ */
+size_t gif_decoded_row_length(
+  u_int32_t line,
+  u_int32_t width,
+  u_int32_t height,
+  int interlaced,
+  size_t decoded
+) {
+  size_t start = (size_t)(interlaced ? gif_stream_row(line, height) : line) * width;
+  if (decoded <= start) {
+    return 0;
+  }
+  return (decoded - start < width) ? decoded - start : width;
+}
+
+/**
+ * Decodes LZW-encoded image data into color indices, one byte per pixel, in
+ * image row order.
  *
  * @param data Data to decode.
+ * @param data_length Length of the data in bytes.
  * @param min_code_size Minimum code size (from image block data).
- * @param color_table_size Number of colors in the color table.
  * @param width Image width.
  * @param height Image height.
- * @param color_table Color table.
- * @param transparent_color_index Optional color index of a color that should
- *   be treated as full transparency.
  * @param interlaced Flag indicating whether the image is interlaced.
+ * @param report Progress reporting for each interlace pass, or NULL.
+ * @param pool Buffer pool for the indices and working memory, or NULL.
+ * @param decoded Output number of pixels decoded, in data stream order. It's
+ *   less than the pixel count when the data ends early, and rows past it hold
+ *   undefined indices.
+ * @param stopped Output flag, set when the progress callback asked to stop.
  * @param error Output error code.
  *
- * @return Decoded image data in RGBA format.
+ * @return Decoded color indices.
  */
-unsigned char *gif_decode_image_data(
+unsigned char *gif_decode_image_indices(
   unsigned char *data,
+  size_t data_length,
   unsigned char min_code_size,
-  size_t color_table_size,
   u_int32_t width,
   u_int32_t height,
-  gif_color_t *color_table,
-  unsigned char *transparent_color_index,
   int interlaced,
+  gif_pixel_report_t *report,
+  pngif_pool_t *pool,
+  size_t *decoded,
+  int *stopped,
   int *error
 ) {
+  gif_bit_reader_t reader;
   int code_size = min_code_size + 1;
-  u_int64_t bit_offset = 0;
   u_int16_t current_code = 0;
-  unsigned char *sequence = NULL;
-  int is_end = 0, is_reset = 0;
-  unsigned char buffer[2048] = { 0 };
-  unsigned char seqtmp[2048] = { 0 };
-  int max_code_count = 1 << code_size;
+  u_int16_t previous_code = GIF_LZW_NO_CODE;
+
+  // Code size can't grow past 12 bits, and indices have to fit the palette.
+  if (min_code_size < 1 || min_code_size > 8) {
+    *error = GIF_ERR_BAD_ENCODING;
+    return NULL;
+  }
+  size_t max_code_count = (size_t)1 << code_size;
 
-  gif_lzw_code_table *table = gif_lzw_code_table_init(color_table_size);
+  gif_lzw_code_table *table = gif_lzw_code_table_init(min_code_size, pool);
   if (table == NULL) {
     *error = GIF_ERR_MEMIO;
     return NULL;
   }
+  size_t clear_code = table->clear_code;
 
   // Allocate space for all pixel indexes.
-  u_int32_t total_size = width * height * 4;
-  int rgba_offset = 0;
-  unsigned char *rgba = malloc(total_size);
-  if (rgba == NULL) {
-    gif_lzw_code_table_free(table);
+  size_t pixel_count = (size_t)width * height;
+  size_t index_offset = 0;
+  unsigned char *indices = pngif_pool_alloc(pool, pixel_count);
+  if (indices == NULL) {
+    gif_lzw_code_table_free(table, pool);
     *error = GIF_ERR_MEMIO;
     return NULL;
   }
 
+  // Interlaced images are decoded in data stream order, and then each pass is
+  // copied into its place as soon as it's complete.
+  unsigned char *deinterlaced = NULL;
+  int progressive = (report != NULL && report->options != NULL && report->options->progress != NULL);
+  int pass = 0;
+  u_int32_t line_in = 0;
+  size_t pass_end = 0;
+  if (interlaced) {
+    deinterlaced = pngif_pool_alloc(pool, pixel_count);
+    if (deinterlaced == NULL) {
+      gif_lzw_code_table_free(table, pool);
+      pngif_pool_release(pool, indices);
+      *error = GIF_ERR_MEMIO;
+      return NULL;
+    }
+    pass_end = (size_t)gif_pass_rows(0, height) * width;
+  }
+
   /** Main decode loop **/
 
-  // Current sequence and buffer lengths storage.
-  u_int16_t *seq_size = 0;
-  u_int16_t *buf_size = 0;
   // First code that is read has to be a RESET/CLEAR code.
   int expect_reset = 1;
+  int first_code = 1;
 
-  while (1) {
-    bit_offset = gif_read_next_code(&current_code, data, bit_offset, code_size);
-    sequence = gif_lzw_code_table_element_at(table, current_code, &is_reset, &is_end);
-    if (is_end) {
-      sequence = NULL;
+  // Data that ends without an END code is decoded as far as it goes.
+  gif_bit_reader_init(&reader, data, data_length);
+  while (gif_bit_reader_read(&reader, code_size, &current_code)) {
+    if (current_code == clear_code + 1) {
       break;
-    } else if (is_reset) {
-      // Reset table.
-      gif_lzw_code_table_free(table);
-      table = gif_lzw_code_table_init(color_table_size);
-
+    } else if (current_code == clear_code) {
       // Reset to start of data stream state.
+      gif_lzw_code_table_reset(table);
       code_size = min_code_size + 1;
-      max_code_count = 1 << code_size;
+      max_code_count = (size_t)1 << code_size;
+      previous_code = GIF_LZW_NO_CODE;
       expect_reset = 0;
-
-      // Output first index after reset and initialize code buffer.
-      bit_offset = gif_read_next_code(&current_code, data, bit_offset, code_size);
-      sequence = gif_lzw_code_table_element_at(table, current_code, &is_reset, &is_end);
-      rgba_offset = gif_rgba_add_sequence(
-        rgba,
-        rgba_offset,
-        sequence,
-        color_table,
-        transparent_color_index
-      );
-
-      // Initialize code buffer.
-      seq_size = (u_int16_t *)sequence;
-      memcpy(buffer, sequence, *seq_size + 2);
-    } else if (expect_reset && bit_offset == code_size) {
+      first_code = 0;
+      continue;
+    } else if (expect_reset) {
       /*
-       * Why this weird condition? Because some GIFs ignore standard's
-       * recommendation to put CLEAR code as a first code in the data stream.
-       * We have to treat it as a normal situation and do initialization as if
-       * the clear code was there.
+       * Some GIFs ignore standard's recommendation to put CLEAR code as a
+       * first code in the data stream. We have to treat it as a normal
+       * situation, as if the clear code was there. Otherwise the table is
+       * full, and the next code MUST be a reset code.
        */
+      if (!first_code) {
+        *error = GIF_ERR_NO_RESET;
+        break;
+      }
       expect_reset = 0;
+    }
+    first_code = 0;
 
-      // Output the code.
-      rgba_offset = gif_rgba_add_sequence(
-        rgba,
-        rgba_offset,
-        sequence,
-        color_table,
-        transparent_color_index
-      );
-
-      // Initialize code buffer.
-      seq_size = (u_int16_t *)sequence;
-      memcpy(buffer, sequence, *seq_size + 2);
-    } else {
-      // We were expecting code table reset, but got a normal code.
-      if (expect_reset) {
-        *error = GIF_ERR_NO_RESET;
+    if (previous_code == GIF_LZW_NO_CODE) {
+      // First code after reset is a single index, and makes no new code.
+      if (current_code >= clear_code) {
+        *error = GIF_ERR_BAD_ENCODING;
         break;
-      } else if (sequence == NULL) {
-        // New code entry: prev sequence + first element of prev sequence
-        buf_size = (u_int16_t *)buffer;
-        buffer[*buf_size + 2] = buffer[2];
-        *buf_size = *buf_size + 1;
-        // Output new sequence.
-        rgba_offset = gif_rgba_add_sequence(
-          rgba,
-          rgba_offset,
-          buffer,
-          color_table,
-          transparent_color_index
-        );
-        // Append new entry to the code table.
-        gif_lzw_code_table_append_element(table, buffer, error);
+      }
+      index_offset = gif_lzw_write_string(table, current_code, indices, index_offset, pixel_count);
+    } else if (current_code < table->element_count) {
+      // Known code: output it, new code is previous string + its first index.
+      index_offset = gif_lzw_write_string(table, current_code, indices, index_offset, pixel_count);
+      gif_lzw_code_table_append(table, previous_code, table->first[current_code]);
+    } else if (current_code > table->element_count) {
+      // Only the code being added can be used before it's in the table.
+      *error = GIF_ERR_BAD_ENCODING;
+      break;
+    } else {
+      // Code that's not in the table yet is the one being added: previous
+      // string + its own first index.
+      gif_lzw_code_table_append(table, previous_code, table->first[previous_code]);
+      index_offset = gif_lzw_write_string(table, table->element_count - 1, indices, index_offset, pixel_count);
+    }
+    previous_code = current_code;
+
+    // Check if need to increase code size.
+    if (table->element_count == max_code_count) {
+      /*
+       * Do not increase code size beyond 12, it's max value defined in GIF
+       * standard. Instead set the `expect_reset` flag on, becase the next
+       * code MUST be a reset code.
+       */
+      if (max_code_count == GIF_LZW_MAX_CODES) {
+        expect_reset = 1;
       } else {
-        // Output current sequence to the index stream.
-        rgba_offset = gif_rgba_add_sequence(
-          rgba,
-          rgba_offset,
-          sequence,
-          color_table,
-          transparent_color_index
-        );
-        /* New code entry: previous sequence + first element in new one */
-        // Copy sequence to temp store, because code table append can move the
-        // data to a different memory block.
-        seq_size = (u_int16_t *)sequence;
-        memcpy(seqtmp, sequence, *seq_size + 2);
-
-        // Append first element to the buffer.
-        seq_size = (u_int16_t *)seqtmp;
-        buf_size = (u_int16_t *)buffer;
-        buffer[*buf_size + 2] = sequence[2];
-        *buf_size = *buf_size + 1;
-
-        // Append new entry to the code table.
-        gif_lzw_code_table_append_element(table, buffer, error);
-
-        // Replace buffer with current sequence.
-        memcpy(buffer, seqtmp, *seq_size + 2);
-        sequence = NULL;
+        code_size += 1;
+        max_code_count = (size_t)1 << code_size;
       }
+    }
 
-      // Check if need to increase code size.
-      if (table->element_count == max_code_count) {
-        /*
-         * Do not increase code size beyond 12, it's max value defined in GIF
-         * standard. Instead set the `expect_reset` flag on, becase the next
-         * code MUST be a reset code.
-         */
-        if (max_code_count == 4096) {
-          expect_reset = 1;
-        } else {
-          code_size += 1;
-          max_code_count = 1 << code_size;
-        }
+    // Place completed interlace passes.
+    while (interlaced && pass < 4 && index_offset >= pass_end && !*stopped) {
+      line_in = gif_deinterlace_pass(indices, deinterlaced, width, height, pass, line_in, progressive);
+      pass += 1;
+      pass_end += (pass < 4) ? (size_t)gif_pass_rows(pass, height) * width : 0;
+      if (progressive) {
+        gif_expand_indices(deinterlaced, report->rgba, pixel_count, report->palette);
+        *stopped = gif_report_progress(
+          report->options,
+          report->image,
+          pass,
+          4,
+          width,
+          height,
+          report->rgba,
+          report->format
+        );
       }
     }
+
+    if (*stopped) {
+      break;
+    }
   }
 
+  gif_lzw_code_table_free(table, pool);
+  *decoded = index_offset;
+
   if (interlaced) {
-    unsigned char *deinterlaced = malloc(width * height * 4);
-    if (deinterlaced == NULL) {
-      free(rgba);
-      *error = GIF_ERR_MEMIO;
-      return NULL;
+    // Place the rest of the passes, in case the data ended early.
+    for (; pass < 4 && !*stopped; pass++) {
+      line_in = gif_deinterlace_pass(indices, deinterlaced, width, height, pass, line_in, 0);
     }
 
-    // Interweave decoded data into output according to interlacing rules.
-    static int pass_offset[] = { 0, 4, 2, 1 };
-    static int pass_stride[] = { 8, 8, 4, 2 };
-    u_int32_t line_in = 0;
-    for (int pass = 0; pass < 4; pass++) {
-      for (
-        u_int32_t line_out = pass_offset[pass];
-        line_out < height;
-        line_out += pass_stride[pass], line_in++
-      ) {
-        memcpy(deinterlaced + (width * line_out * 4), rgba + (width * line_in * 4), width * 4);
-      }
+    // Swap output with deinterlaced data.
+    pngif_pool_release(pool, indices);
+    indices = deinterlaced;
+  }
+
+  return indices;
+}
+
+/**
+ * Decodes LZW-encoded image data into color data. The data is decoded into a
+ * buffer of color indices first, which are mapped to pixels in the output
+ * format in a separate pass. Pixels missing from data that ends early are
+ * transparent.
+ *
+ * @param data Data to decode.
+ * @param data_length Length of the data in bytes.
+ * @param min_code_size Minimum code size (from image block data).
+ * @param color_table_size Number of colors in the color table.
+ * @param width Image width.
+ * @param height Image height.
+ * @param color_table Color table.
+ * @param transparent_color_index Optional color index of a color that should
+ *   be treated as full transparency.
+ * @param interlaced Flag indicating whether the image is interlaced.
+ * @param format Output pixel format.
+ * @param options Decoding options, or NULL. The progress callback is called
+ *   after each interlace pass, or once for non-interlaced images.
+ * @param image Index of the image, for progress reports.
+ * @param stopped Output flag, set when the progress callback asked to stop.
+ *   The image is returned as it was passed to the callback.
+ * @param opaque Output flag, set when every pixel of the image is opaque.
+ * @param error Output error code.
+ *
+ * @return Decoded image data in the output format.
+ */
+unsigned char *gif_decode_image_data(
+  unsigned char *data,
+  size_t data_length,
+  unsigned char min_code_size,
+  size_t color_table_size,
+  u_int32_t width,
+  u_int32_t height,
+  gif_color_t *color_table,
+  unsigned char *transparent_color_index,
+  int interlaced,
+  int format,
+  pngif_options_t *options,
+  u_int32_t image,
+  int *stopped,
+  int *opaque,
+  int *error
+) {
+  u_int32_t palette[256];
+  size_t decoded = 0;
+
+  gif_fill_palette(palette, color_table, color_table_size, transparent_color_index, format);
+
+  pngif_pool_t *pool = options_pool(options);
+  unsigned char *rgba = pngif_pool_alloc(pool, (size_t)width * height * 4);
+  if (rgba == NULL) {
+    *error = GIF_ERR_MEMIO;
+    return NULL;
+  }
+
+  gif_pixel_report_t report = { options, image, palette, rgba, format };
+  unsigned char *indices = gif_decode_image_indices(
+    data,
+    data_length,
+    min_code_size,
+    width,
+    height,
+    interlaced,
+    &report,
+    pool,
+    &decoded,
+    stopped,
+    error
+  );
+  if (indices == NULL) {
+    pngif_pool_release(pool, rgba);
+    return NULL;
+  }
+
+  // A stopped image is left as it was passed to the callback.
+  if (!*stopped) {
+    for (u_int32_t line = 0; line < height; line++) {
+      size_t length = gif_decoded_row_length(line, width, height, interlaced, decoded);
+      unsigned char *row = rgba + (size_t)line * width * 4;
+      gif_expand_indices(indices + (size_t)line * width, row, length, palette);
+      memset(row + length * 4, 0, (width - length) * 4);
     }
 
-    // Swap output with deinterlaced data.
-    free(rgba);
-    rgba = deinterlaced;
+    if (!interlaced) {
+      *stopped = gif_report_progress(options, image, 1, 1, width, height, rgba, format);
+    }
+  }
+
+  // Data only holds indices below the clear code, so the image is opaque when
+  // all of them map to opaque pixels and no pixel is missing. Opaque pixels
+  // are never all zeroes.
+  *opaque = !*stopped && decoded >= (size_t)width * height;
+  size_t reachable = (min_code_size < 8) ? (size_t)1 << min_code_size : 256;
+  for (size_t idx = 0; *opaque && idx < reachable; idx++) {
+    *opaque = palette[idx] != 0;
   }
 
+  pngif_pool_release(pool, indices);
   return rgba;
 }
 
 /**
- * Decoded a single image block.
+ * Returns the color table of an image block: the color table might be embedded
+ * in the image block, otherwise the global one is used.
+ *
+ * @param image Image block.
+ * @param global_color_table_size Global color table size, if present.
+ * @param global_color_table A pointer to a global color table, if present.
+ * @param color_table_size Output number of colors in the color table.
+ *
+ * @return Color table, or NULL if there's none.
+ */
+gif_color_t *gif_image_color_table(
+  gif_image_block_t *image,
+  size_t global_color_table_size,
+  gif_color_t *global_color_table,
+  size_t *color_table_size
+) {
+  if (image->color_table != NULL && image->descriptor.color_table_size > 0) {
+    *color_table_size = image->descriptor.color_table_size;
+    return image->color_table;
+  }
+
+  *color_table_size = global_color_table_size;
+  return global_color_table;
+}
+
+/**
+ * Decoded a single image block. When decoding at reduced resolution, the
+ * image is reduced right after decoding, along with its position.
  *
  * @param decoded Decoded data container. Will be filled with decoded data.
  * @param image Image block to decode.
  * @param global_color_table_size Global color table size, if present.
  * @param global_color_table A pointer to a global color table, if present.
+ * @param format Output pixel format.
+ * @param options Decoding options, or NULL.
+ * @param index Index of the image, for progress reports.
+ * @param stopped Output flag, set when the progress callback asked to stop.
  * @param error Output error code.
  */
 void gif_decode_image_block(
@@ -562,24 +820,21 @@ void gif_decode_image_block(
   gif_image_block_t *image,
   size_t global_color_table_size,
   gif_color_t *global_color_table,
+  int format,
+  pngif_options_t *options,
+  u_int32_t index,
+  int *stopped,
   int *error
 ) {
-  gif_color_t *color_table;
   size_t color_table_size;
+  gif_color_t *color_table = gif_image_color_table(
+    image,
+    global_color_table_size,
+    global_color_table,
+    &color_table_size
+  );
   unsigned char *transparent_color_index = NULL;
 
-  /*
-   * The color table might be embedded in the image block. Otherwise use global
-   * one.
-   */
-  if (image->color_table != NULL && image->descriptor.color_table_size > 0) {
-    color_table = image->color_table;
-    color_table_size = image->descriptor.color_table_size;
-  } else {
-    color_table = global_color_table;
-    color_table_size = global_color_table_size;
-  }
-
   // Check for transparency support.
   if (
     image->gc != NULL &&
@@ -588,9 +843,16 @@ void gif_decode_image_block(
     transparent_color_index = &(image->gc->transparent_color_index);
   }
 
-  // Decode image data into RGBA.
+  // Validated by the caller. Reduced images are decoded into RGBA for the box
+  // filter, that converts its output to the output format.
+  int shift = options_scale_shift(options);
+  pngif_pool_t *pool = options_pool(options);
+  int opaque = 0;
+
+  // Decode image data.
   unsigned char *rgba = gif_decode_image_data(
     image->data,
+    image->data_length,
     image->minimum_code_size,
     color_table_size,
     image->descriptor.width,
@@ -598,39 +860,261 @@ void gif_decode_image_block(
     color_table,
     transparent_color_index,
     image->descriptor.interlace,
+    (shift > 0) ? PNGIF_FORMAT_RGBA : format,
+    options,
+    index,
+    stopped,
+    &opaque,
     error
   );
 
   if (*error != 0) {
+    pngif_pool_release(pool, rgba);
     return;
   }
 
+  if (shift > 0) {
+    // Pixels stay either opaque or transparent, as the compositing expects.
+    // Boxes of opaque pixels are opaque, so the opaque flag holds too.
+    unsigned char *reduced = box_filter_image(
+      rgba,
+      image->descriptor.width,
+      image->descriptor.height,
+      shift,
+      1,
+      format,
+      pool
+    );
+    pngif_pool_release(pool, rgba);
+    if (reduced == NULL) {
+      *error = GIF_ERR_MEMIO;
+      return;
+    }
+    rgba = reduced;
+  }
+
   decoded->rgba = rgba;
+  decoded->top = image->descriptor.top >> shift;
+  decoded->left = image->descriptor.left >> shift;
+  decoded->width = scaled_size(image->descriptor.width, shift);
+  decoded->height = scaled_size(image->descriptor.height, shift);
+  decoded->opaque = opaque;
+  if (image->gc != NULL) {
+    decoded->dispose_method = image->gc->dispose_method;
+    decoded->delay_cs = image->gc->delay_cs;
+  }
+}
+
+/**
+ * Decodes a single image block into color indices.
+ *
+ * @param decoded Indexed image. Will be filled with decoded data.
+ * @param image Image block to decode.
+ * @param global_color_table_size Global color table size, if present.
+ * @param global_color_table A pointer to a global color table, if present.
+ * @param error Output error code.
+ */
+void gif_decode_image_block_indices(
+  gif_indexed_image_t *decoded,
+  gif_image_block_t *image,
+  size_t global_color_table_size,
+  gif_color_t *global_color_table,
+  int *error
+) {
+  size_t color_table_size;
+  gif_color_t *color_table = gif_image_color_table(
+    image,
+    global_color_table_size,
+    global_color_table,
+    &color_table_size
+  );
+
+  u_int32_t width = image->descriptor.width;
+  u_int32_t height = image->descriptor.height;
+  size_t pixels_decoded = 0;
+  int stopped = 0;
+  unsigned char *indices = gif_decode_image_indices(
+    image->data,
+    image->data_length,
+    image->minimum_code_size,
+    width,
+    height,
+    image->descriptor.interlace,
+    NULL,
+    NULL,
+    &pixels_decoded,
+    &stopped,
+    error
+  );
+  if (indices == NULL) {
+    return;
+  }
+
+  // The color table is copied, so that it doesn't depend on the parsed data.
+  gif_color_t *colors = NULL;
+  if (color_table != NULL && color_table_size > 0) {
+    colors = malloc(color_table_size * sizeof(gif_color_t));
+    if (colors == NULL) {
+      free(indices);
+      *error = GIF_ERR_MEMIO;
+      return;
+    }
+    memcpy(colors, color_table, color_table_size * sizeof(gif_color_t));
+  }
+
+  int transparent_index = -1;
+  if (image->gc != NULL && image->gc->transparency_flag) {
+    transparent_index = image->gc->transparent_color_index;
+  }
+
+  // Fill the pixels missing from data that ended early.
+  unsigned char missing = (transparent_index >= 0) ? transparent_index : 0;
+  for (u_int32_t line = 0; line < height; line++) {
+    size_t length = gif_decoded_row_length(line, width, height, image->descriptor.interlace, pixels_decoded);
+    memset(indices + (size_t)line * width + length, missing, width - length);
+  }
+
+  decoded->indices = indices;
+  decoded->color_table = colors;
+  decoded->color_table_size = (colors != NULL) ? color_table_size : 0;
+  decoded->transparent_index = transparent_index;
   decoded->top = image->descriptor.top;
   decoded->left = image->descriptor.left;
-  decoded->width = image->descriptor.width;
-  decoded->height = image->descriptor.height;
+  decoded->width = width;
+  decoded->height = height;
   if (image->gc != NULL) {
     decoded->dispose_method = image->gc->dispose_method;
     decoded->delay_cs = image->gc->delay_cs;
   }
 }
 
+/**
+ * Image blocks to decode in parallel, and the results for each of them.
+ */
+typedef struct {
+  gif_image_block_t **blocks;
+  gif_decoded_image_t *images;
+  int *errors;
+  size_t global_color_table_size;
+  gif_color_t *global_color_table;
+  int format;
+  pngif_options_t *options;
+} gif_decode_job_t;
+
+/**
+ * Decodes one image block of a parallel job.
+ *
+ * @param job Decoding job.
+ * @param index Index of the image.
+ */
+void gif_decode_task(void *job, size_t index) {
+  gif_decode_job_t *images = job;
+  int stopped = 0;
+
+  images->errors[index] = 0;
+  gif_decode_image_block(
+    images->images + index,
+    images->blocks[index],
+    images->global_color_table_size,
+    images->global_color_table,
+    images->format,
+    images->options,
+    index,
+    &stopped,
+    images->errors + index
+  );
+}
+
+/**
+ * Decodes all image blocks at once, on the executor or threads from the
+ * options. The result is the same as decoding them one by one: images up to
+ * the first one that failed, and the error of that one.
+ *
+ * @param decoded Decoded data container, with space for all images.
+ * @param parsed Parsed GIF data.
+ * @param blocks Image blocks, in order.
+ * @param image_count Number of image blocks.
+ * @param format Output pixel format.
+ * @param options Decoding options.
+ * @param error Output error code.
+ */
+void gif_decode_images_parallel(
+  gif_decoded_t *decoded,
+  gif_parsed_t *parsed,
+  gif_image_block_t **blocks,
+  size_t image_count,
+  int format,
+  pngif_options_t *options,
+  int *error
+) {
+  int *errors = malloc(image_count * sizeof(int));
+  if (errors == NULL) {
+    *error = GIF_ERR_MEMIO;
+    return;
+  }
+
+  gif_decode_job_t job = {
+    .blocks = blocks,
+    .images = decoded->images,
+    .errors = errors,
+    .global_color_table_size = parsed->screen.color_table_size,
+    .global_color_table = parsed->global_color_table,
+    .format = format,
+    .options = options,
+  };
+  parallel_run(options, gif_decode_task, &job, image_count);
+
+  size_t idx = 0;
+  for (; idx < image_count && errors[idx] == 0; idx++) {
+    decoded->image_count += 1;
+  }
+  if (idx < image_count) {
+    *error = errors[idx];
+  }
+
+  // Images decoded past the failed one are dropped.
+  for (idx += 1; idx < image_count; idx++) {
+    if (errors[idx] == 0) {
+      pngif_pool_release(decoded->pool, decoded->images[idx].rgba);
+    }
+  }
+
+  free(errors);
+}
+
 /** Public **/
 
 gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error) {
+  return gif_decoded_from_parsed_with_options(parsed, NULL, error);
+}
+
+gif_decoded_t *gif_decoded_from_parsed_with_options(
+  gif_parsed_t *parsed,
+  pngif_options_t *options,
+  int *error
+) {
   if (parsed == NULL) {
     return NULL;
   }
 
+  int shift = options_scale_shift(options);
+  int format = options_format(options);
+  if (shift < 0 || format < 0 || options_pool_check(options) != 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return NULL;
+  }
+
   gif_decoded_t *decoded = calloc(1, sizeof(gif_decoded_t));
   if (decoded == NULL) {
     *error = GIF_ERR_MEMIO;
     return NULL;
   }
 
-  decoded->width = parsed->screen.width;
-  decoded->height = parsed->screen.height;
+  decoded->format = format;
+  decoded->pool = options_pool(options);
+
+  decoded->width = scaled_size(parsed->screen.width, shift);
+  decoded->height = scaled_size(parsed->screen.height, shift);
   decoded->pixel_ratio = parsed->screen.pixel_aspect_ratio;
 
   if (parsed->screen.background_color_index > 0 && parsed->global_color_table != NULL) {
@@ -661,8 +1145,23 @@ gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error) {
     return NULL;
   }
 
+  // Image blocks are only collected while reading the other blocks when
+  // decoding in parallel.
+  int parallel = options_parallel(options);
+  gif_image_block_t **image_blocks = NULL;
+  if (parallel && image_count > 0) {
+    image_blocks = malloc(sizeof(gif_image_block_t *) * image_count);
+    if (image_blocks == NULL) {
+      *error = GIF_ERR_MEMIO;
+      free(images);
+      gif_decoded_free(decoded);
+      return NULL;
+    }
+  }
+
   int image_idx = 0;
-  for (int idx = 0; idx < parsed->block_count; idx++) {
+  int stopped = 0;
+  for (int idx = 0; idx < parsed->block_count && !stopped; idx++) {
     gif_block_t *block = parsed->blocks[idx];
 
     /*
@@ -676,6 +1175,9 @@ gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error) {
         u_int16_t repeat_count = *(u_int16_t*)(app->data + 1);
         decoded->repeat_count = repeat_count;
       }
+    } else if (block->type == GIF_BLOCK_IMAGE && parallel) {
+      image_blocks[image_idx] = (gif_image_block_t *)block;
+      image_idx += 1;
     } else if (block->type == GIF_BLOCK_IMAGE) {
       gif_image_block_t *image_block = (gif_image_block_t *)block;
       gif_decode_image_block(
@@ -683,6 +1185,10 @@ gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error) {
         image_block,
         parsed->screen.color_table_size,
         parsed->global_color_table,
+        format,
+        options,
+        image_idx,
+        &stopped,
         error
       );
 
@@ -697,13 +1203,32 @@ gif_decoded_t *gif_decoded_from_parsed(gif_parsed_t *parsed, int *error) {
     }
   }
 
+  if (parallel && image_count > 0) {
+    decoded->images = images;
+    gif_decode_images_parallel(decoded, parsed, image_blocks, image_count, format, options, error);
+    free(image_blocks);
+  }
+
   if (decoded->image_count > 0) {
     decoded->images = images;
+  } else {
+    decoded->images = NULL;
+    free(images);
   }
+  decoded->partial = stopped;
   return decoded;
 }
 
 gif_decoded_t *gif_decoded_from_data(unsigned char *data, size_t size, int *error) {
+  return gif_decoded_from_data_with_options(data, size, NULL, error);
+}
+
+gif_decoded_t *gif_decoded_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  pngif_options_t *options,
+  int *error
+) {
   if (data == NULL) {
     *error = GIF_ERR_NO_DATA;
     return NULL;
@@ -714,33 +1239,117 @@ gif_decoded_t *gif_decoded_from_data(unsigned char *data, size_t size, int *erro
     return NULL;
   }
 
-  gif_decoded_t *decoded = gif_decoded_from_parsed(parsed, error);
+  gif_decoded_t *decoded = gif_decoded_from_parsed_with_options(parsed, options, error);
   free(parsed);
   return decoded;
 }
 
 gif_decoded_t *gif_decoded_from_file(FILE *file, int *error) {
+  return gif_decoded_from_file_with_options(file, NULL, error);
+}
+
+gif_decoded_t *gif_decoded_from_file_with_options(
+  FILE *file,
+  pngif_options_t *options,
+  int *error
+) {
   gif_parsed_t *parsed = gif_parsed_from_file(file, error);
   if (*error != 0) {
     return NULL;
   }
 
-  gif_decoded_t *decoded = gif_decoded_from_parsed(parsed, error);
+  gif_decoded_t *decoded = gif_decoded_from_parsed_with_options(parsed, options, error);
   free(parsed);
   return decoded;
 }
 
 gif_decoded_t *gif_decoded_from_path(char *path, int *error) {
+  return gif_decoded_from_path_with_options(path, NULL, error);
+}
+
+gif_decoded_t *gif_decoded_from_path_with_options(
+  char *path,
+  pngif_options_t *options,
+  int *error
+) {
   gif_parsed_t *parsed = gif_parsed_from_path(path, error);
   if (*error != 0) {
     return NULL;
   }
 
-  gif_decoded_t *decoded = gif_decoded_from_parsed(parsed, error);
+  gif_decoded_t *decoded = gif_decoded_from_parsed_with_options(parsed, options, error);
   free(parsed);
   return decoded;
 }
 
+void gif_decode_image_into(
+  gif_parsed_t *parsed,
+  size_t index,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+) {
+  if (parsed == NULL) {
+    *error = GIF_ERR_NO_DATA;
+    return;
+  }
+
+  int shift = options_scale_shift(options);
+  if (shift < 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return;
+  }
+
+  // Find the image block.
+  gif_image_block_t *block = NULL;
+  for (size_t idx = 0, count = 0; idx < parsed->block_count; idx++) {
+    if (parsed->blocks[idx]->type == GIF_BLOCK_IMAGE && count++ == index) {
+      block = (gif_image_block_t *)parsed->blocks[idx];
+      break;
+    }
+  }
+
+  if (block == NULL) {
+    *error = GIF_ERR_NO_DATA;
+    return;
+  }
+
+  int err = surface_check(
+    surface,
+    scaled_size(block->descriptor.width, shift),
+    scaled_size(block->descriptor.height, shift)
+  );
+  if (err != 0) {
+    *error = err;
+    return;
+  }
+
+  // Image is decoded in the surface format, so rows are just copied.
+  gif_decoded_image_t image = { 0 };
+  int stopped = 0;
+  gif_decode_image_block(
+    &image,
+    block,
+    parsed->screen.color_table_size,
+    parsed->global_color_table,
+    surface->format,
+    options,
+    index,
+    &stopped,
+    error
+  );
+
+  if (*error != 0) {
+    return;
+  }
+
+  for (u_int32_t line = 0; line < image.height; line++) {
+    memcpy(surface_row(surface, line), image.rgba + line * image.width * 4, image.width * 4);
+  }
+
+  pngif_pool_release(options_pool(options), image.rgba);
+}
+
 void gif_decoded_free(gif_decoded_t *gif) {
   if (gif->background_color != NULL) {
     free(gif->background_color);
@@ -749,7 +1358,130 @@ void gif_decoded_free(gif_decoded_t *gif) {
   if (gif->images != NULL && gif->image_count > 0) {
     for (int idx = 0; idx < gif->image_count; idx++) {
       gif_decoded_image_t image = gif->images[idx];
-      free(image.rgba);
+      pngif_pool_release(gif->pool, image.rgba);
+    }
+
+    free(gif->images);
+  }
+}
+
+gif_indexed_t *gif_indexed_from_parsed(gif_parsed_t *parsed, int *error) {
+  if (parsed == NULL) {
+    return NULL;
+  }
+
+  gif_indexed_t *indexed = calloc(1, sizeof(gif_indexed_t));
+  if (indexed == NULL) {
+    *error = GIF_ERR_MEMIO;
+    return NULL;
+  }
+
+  indexed->width = parsed->screen.width;
+  indexed->height = parsed->screen.height;
+  indexed->pixel_ratio = parsed->screen.pixel_aspect_ratio;
+
+  if (parsed->screen.background_color_index > 0 && parsed->global_color_table != NULL) {
+    gif_color_t color = parsed->global_color_table[parsed->screen.background_color_index];
+    indexed->background_color = malloc(sizeof(gif_color_t));
+    if (indexed->background_color == NULL) {
+      free(indexed);
+      *error = GIF_ERR_MEMIO;
+      return NULL;
+    }
+    memcpy(indexed->background_color, &color, 3);
+  }
+
+  // Count images first.
+  size_t image_count = 0;
+  for (size_t idx = 0; idx < parsed->block_count; idx++) {
+    if (parsed->blocks[idx]->type == GIF_BLOCK_IMAGE) {
+      image_count += 1;
+    }
+  }
+
+  // Images are zeroed, so that a partially filled list can be freed.
+  indexed->images = calloc(image_count > 0 ? image_count : 1, sizeof(gif_indexed_image_t));
+  if (indexed->images == NULL) {
+    *error = GIF_ERR_MEMIO;
+    gif_indexed_free(indexed);
+    free(indexed);
+    return NULL;
+  }
+
+  for (size_t idx = 0; idx < parsed->block_count; idx++) {
+    gif_block_t *block = parsed->blocks[idx];
+
+    if (block->type == GIF_BLOCK_APPLICATION) {
+      gif_application_block_t *app = (gif_application_block_t *)block;
+      if (strcmp(app->identifier, "NETSCAPE") == 0 && strcmp(app->auth_code, "2.0") == 0) {
+        indexed->animated = 1;
+        u_int16_t repeat_count = *(u_int16_t*)(app->data + 1);
+        indexed->repeat_count = repeat_count;
+      }
+    } else if (block->type == GIF_BLOCK_IMAGE) {
+      gif_decode_image_block_indices(
+        indexed->images + indexed->image_count,
+        (gif_image_block_t *)block,
+        parsed->screen.color_table_size,
+        parsed->global_color_table,
+        error
+      );
+
+      if (*error != 0) {
+        break;
+      }
+      indexed->image_count += 1;
+    }
+  }
+
+  return indexed;
+}
+
+gif_indexed_t *gif_indexed_from_data(unsigned char *data, size_t size, int *error) {
+  if (data == NULL) {
+    *error = GIF_ERR_NO_DATA;
+    return NULL;
+  }
+
+  gif_parsed_t *parsed = gif_parsed_from_data(data, size, error);
+  if (*error != 0) {
+    return NULL;
+  }
+
+  gif_indexed_t *indexed = gif_indexed_from_parsed(parsed, error);
+  gif_parsed_free(parsed);
+  return indexed;
+}
+
+gif_indexed_t *gif_indexed_from_file(FILE *file, int *error) {
+  gif_parsed_t *parsed = gif_parsed_from_file(file, error);
+  if (*error != 0) {
+    return NULL;
+  }
+
+  gif_indexed_t *indexed = gif_indexed_from_parsed(parsed, error);
+  gif_parsed_free(parsed);
+  return indexed;
+}
+
+gif_indexed_t *gif_indexed_from_path(char *path, int *error) {
+  gif_parsed_t *parsed = gif_parsed_from_path(path, error);
+  if (*error != 0) {
+    return NULL;
+  }
+
+  gif_indexed_t *indexed = gif_indexed_from_parsed(parsed, error);
+  gif_parsed_free(parsed);
+  return indexed;
+}
+
+void gif_indexed_free(gif_indexed_t *gif) {
+  free(gif->background_color);
+
+  if (gif->images != NULL) {
+    for (size_t idx = 0; idx < gif->image_count; idx++) {
+      free(gif->images[idx].color_table);
+      free(gif->images[idx].indices);
     }
 
     free(gif->images);
@@ -1,19 +1,123 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <pngif/utils.h>
 #include <pngif/errors.h>
 #include <pngif/image.h>
+#include "frame_queue.h"
+#include "pool.h"
+#include "scale.h"
+#include "surface.h"
 
 /** Private declarations **/
 
+typedef struct {
+  u_int32_t x;
+  u_int32_t y;
+  u_int32_t width;
+  u_int32_t height;
+} image_rect_t;
+
+/**
+ * Canvas changes between frames, to store each frame as the rectangle that
+ * changed since the previous one.
+ */
+typedef struct {
+  // Canvas size.
+  u_int32_t width;
+  u_int32_t height;
+  // Canvas region that may differ from the cleared canvas, and the region
+  // changed by the disposal of the previous frame, the whole canvas before the
+  // first frame.
+  image_rect_t content;
+  image_rect_t disposed;
+  // Cleared canvas state: GIF background color, unless it's ignored, and
+  // transparent black otherwise.
+  gif_color_t *background_color;
+  int ignore_background;
+  int format;
+  // Canvas region under a frame that's disposed to the previous state.
+  unsigned char *saved;
+  // Buffer pool for frame pixels and the saved region, or NULL.
+  pngif_pool_t *pool;
+} frame_delta_t;
+
 #define DISPOSE_NONE 0
 #define DISPOSE_APPEND 1
 #define DISPOSE_BACKGROUND 2
 #define DISPOSE_RESTORE 3
 
-void image_frame_free(image_frame_t *frame);
+// Default canvas snapshot settings of frame renderers.
+#define RENDERER_KEYFRAME_INTERVAL 16
+#define RENDERER_KEYFRAME_LIMIT 8
+
+void image_frame_free(image_frame_t *frame, pngif_pool_t *pool);
+int image_frame_share(image_frame_t *frame, image_frame_t *previous, pngif_pool_t *pool);
+void image_frame_release(image_frame_t *frame, pngif_pool_t *pool);
+
+animated_image_t *image_compose_gif(
+  gif_decoded_t *gif,
+  int ignore_background,
+  int delta_frames,
+  int *error
+);
+animated_image_t *image_compose_png(png_decoded_t *png, int delta_frames, int *error);
+
+image_rect_t rect_clip(
+  u_int32_t x, u_int32_t y,
+  u_int32_t width, u_int32_t height,
+  u_int32_t canvas_width, u_int32_t canvas_height
+);
+image_rect_t rect_union(image_rect_t first, image_rect_t second);
+void canvas_copy_region(
+  unsigned char *canvas,
+  u_int32_t width,
+  image_rect_t rect,
+  unsigned char *buffer,
+  int restore
+);
+int frame_delta_init(
+  frame_delta_t *delta,
+  u_int32_t width, u_int32_t height,
+  gif_color_t *background_color,
+  int ignore_background,
+  int format,
+  pngif_pool_t *pool
+);
+void frame_delta_store(
+  frame_delta_t *delta,
+  image_frame_t *frame,
+  unsigned char *canvas,
+  image_rect_t rect,
+  int memio_error,
+  int *error
+);
+void frame_delta_dispose(
+  frame_delta_t *delta,
+  unsigned char *canvas,
+  image_rect_t rect,
+  int clear,
+  int restore
+);
+void frame_delta_free(frame_delta_t *delta);
+
+void gif_fill_background(
+  unsigned char *canvas,
+  size_t pixel_count,
+  gif_color_t *background_color,
+  int ignore_background,
+  int format
+);
+
+void gif_clip_subimage(
+  gif_decoded_image_t *image,
+  u_int32_t width,
+  u_int32_t height,
+  size_t *columns,
+  size_t *lines
+);
 
 void gif_draw_subimage(
   unsigned char *rgba,
@@ -21,6 +125,12 @@ void gif_draw_subimage(
   u_int32_t width, u_int32_t height
 );
 
+int gif_subimage_changes(
+  unsigned char *rgba,
+  gif_decoded_image_t *image,
+  u_int32_t width, u_int32_t height
+);
+
 void gif_draw_frame(
   image_frame_t *frame,
   unsigned char *canvas,
@@ -29,6 +139,10 @@ void gif_draw_frame(
   gif_color_t *background_color,
   gif_decoded_image_t *image,
   int ignore_background,
+  int format,
+  image_frame_t *previous,
+  frame_delta_t *delta,
+  pngif_pool_t *pool,
   int *error
 );
 
@@ -38,7 +152,18 @@ void png_draw_subimage(
   u_int32_t width, u_int32_t height,
   u_int32_t x_offset, u_int32_t y_offset,
   u_int32_t sub_width, u_int32_t sub_height,
-  unsigned short blend_type
+  unsigned short blend_type,
+  int format
+);
+
+int png_subimage_changes(
+  unsigned char *rgba,
+  unsigned char *data,
+  u_int32_t width,
+  u_int32_t x_offset, u_int32_t y_offset,
+  u_int32_t sub_width, u_int32_t sub_height,
+  unsigned short blend_type,
+  int format
 );
 
 void png_draw_frame(
@@ -47,157 +172,59 @@ void png_draw_frame(
   u_int32_t width,
   u_int32_t height,
   png_frame_t *image,
+  int format,
+  image_frame_t *previous,
+  frame_delta_t *delta,
+  pngif_pool_t *pool,
   int *error
 );
 
-/** Public **/
-
-animated_image_t *image_from_decoded_gif(gif_decoded_t *gif, int ignore_background, int *error) {
-  if (gif == NULL)
-    return NULL;
-
-  animated_image_t *output = malloc(sizeof(animated_image_t));
-  if (output == NULL) {
-    *error = GIF_ERR_MEMIO;
-    return NULL;
-  }
-
-  unsigned char *canvas = calloc(gif->width * gif->height * 4, 1);
-  if (canvas == NULL) {
-    free(output);
-    *error = GIF_ERR_MEMIO;
-    return NULL;
-  }
-
-  if (!ignore_background && gif->background_color != NULL) {
-    unsigned char back[] = {
-      gif->background_color->red,
-      gif->background_color->green,
-      gif->background_color->blue,
-      255
-    };
-
-    for (int idx = 0; idx < (gif->width * gif->height * 4); idx += 4) {
-      memcpy(canvas + idx, back, 4);
-    }
-  }
-
-  if (gif->animated) {
-    output->frames = malloc(sizeof(image_frame_t) * gif->image_count);
-    if (output->frames == NULL) {
-      *error = GIF_ERR_MEMIO;
-      free(output);
-      return NULL;
-    }
-
-    for (int idx = 0; idx < gif->image_count; idx++) {
-      gif_draw_frame(
-        output->frames + idx,
-        canvas,
-        gif->width,
-        gif->height,
-        gif->background_color,
-        gif->images + idx,
-        ignore_background,
-        error
-      );
-
-      if (*error != 0)
-        break;
-    }
-
-    output->frame_count = gif->image_count;
-    free(canvas);
-  } else {
-    output->frames = malloc(sizeof(image_frame_t));
-    if (output->frames == NULL) {
-      *error = GIF_ERR_MEMIO;
-      free(output);
-      return NULL;
-    }
+void renderer_clear_canvas(image_renderer_t *renderer);
+void renderer_save_region(
+  image_renderer_t *renderer,
+  u_int32_t x, u_int32_t y,
+  u_int32_t width, u_int32_t height,
+  int restore
+);
+void renderer_output(image_renderer_t *renderer, pngif_surface_t *surface);
+int renderer_draw_next(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+);
+void renderer_keep_keyframe(image_renderer_t *renderer);
+void renderer_thin_keyframes(image_renderer_t *renderer);
+void renderer_free_keyframes(image_renderer_t *renderer);
+int renderer_next_gif_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+);
+int renderer_next_png_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+);
 
-    for (int idx = 0; idx < gif->image_count; idx++) {
-      gif_decoded_image_t *image = gif->images + idx;
-      gif_draw_subimage(canvas, image, gif->width, gif->height);
-    }
+animated_image_t *image_from_data_pipelined(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+);
 
-    output->frame_count = 1;
-    output->frames->rgba = canvas;
-    output->frames->duration_ms = 0;
-  }
+/** Public **/
 
-  output->width = gif->width;
-  output->height = gif->height;
-  return output;
+animated_image_t *image_from_decoded_gif(gif_decoded_t *gif, int ignore_background, int *error) {
+  return image_compose_gif(gif, ignore_background, 0, error);
 }
 
 animated_image_t *image_from_decoded_png(png_decoded_t *png, int *error) {
-  if (png == NULL)
-    return NULL;
-
-  animated_image_t *output = malloc(sizeof(animated_image_t));
-  if (output == NULL) {
-    *error = PNG_ERR_MEMIO;
-    return NULL;
-  }
-
-  unsigned char *canvas = calloc(png->width * png->height * 4, 1);
-  if (canvas == NULL) {
-    free(output);
-    *error = PNG_ERR_MEMIO;
-    return NULL;
-  }
-
-  // TODO: Background color?
-  if (png->frames != NULL && png->frames->length > 0) {
-    output->frames = malloc(sizeof(image_frame_t) * png->frames->length);
-    if (output->frames == NULL) {
-      *error = PNG_ERR_MEMIO;
-      free(output);
-      return NULL;
-    }
-
-    for (int idx = 0; idx < png->frames->length; idx++) {
-      png_draw_frame(
-        output->frames + idx,
-        canvas,
-        png->width,
-        png->height,
-        png->frames->frames + idx,
-        error
-      );
-
-      if (*error != 0)
-        break;
-    }
-
-    output->frame_count = png->frames->length;
-    free(canvas);
-  } else {
-    output->frames = malloc(sizeof(image_frame_t));
-    if (output->frames == NULL) {
-      *error = PNG_ERR_MEMIO;
-      free(output);
-      return NULL;
-    }
-
-    png_draw_subimage(
-      canvas,
-      png->data,
-      png->width, png->height,
-      0, 0,
-      png->width, png->height,
-      APNG_BLEND_TYPE_SOURCE
-    );
-
-    output->frame_count = 1;
-    output->frames->rgba = canvas;
-    output->frames->duration_ms = 0;
-  }
-
-  output->width = png->width;
-  output->height = png->height;
-  return output;
+  return image_compose_png(png, 0, error);
 }
 
 /** Convenience API **/
@@ -207,26 +234,42 @@ animated_image_t *image_from_data(
   size_t size,
   int ignore_background,
   int *error
+) {
+  return image_from_data_with_options(data, size, ignore_background, NULL, error);
+}
+
+animated_image_t *image_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
 ) {
   char header[9] = { 0 };
   memcpy(header, data, 8);
 
+  if (options != NULL && options->pipeline_depth > 0 && options->progress == NULL) {
+    return image_from_data_pipelined(data, size, ignore_background, options, error);
+  }
+
+  int delta_frames = (options != NULL && options->delta_frames);
+
   if (strcmp(PNG_HEADER, header) == 0) {
-    png_decoded_t *decoded = png_decoded_from_data(data, size, error);
+    png_decoded_t *decoded = png_decoded_from_data_with_options(data, size, options, error);
     if (*error != 0 || decoded == NULL) {
       return NULL;
     }
 
-    animated_image_t *image = image_from_decoded_png(decoded, error);
+    animated_image_t *image = image_compose_png(decoded, delta_frames, error);
     png_decoded_free(decoded);
     return image;
   } else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F') {
-    gif_decoded_t *decoded = gif_decoded_from_data(data, size, error);
+    gif_decoded_t *decoded = gif_decoded_from_data_with_options(data, size, options, error);
     if (*error != 0 || decoded == NULL) {
       return NULL;
     }
 
-    animated_image_t *image = image_from_decoded_gif(decoded, ignore_background, error);
+    animated_image_t *image = image_compose_gif(decoded, ignore_background, delta_frames, error);
     gif_decoded_free(decoded);
     return image;
   } else {
@@ -236,6 +279,15 @@ animated_image_t *image_from_data(
 }
 
 animated_image_t *image_from_file(FILE *file, int ignore_background, int *error) {
+  return image_from_file_with_options(file, ignore_background, NULL, error);
+}
+
+animated_image_t *image_from_file_with_options(
+  FILE *file,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+) {
   unsigned char *data = NULL;
   size_t size = pngif_read_file(file, &data, error);
 
@@ -244,19 +296,28 @@ animated_image_t *image_from_file(FILE *file, int ignore_background, int *error)
     return NULL;
   }
 
-  animated_image_t *image = image_from_data(data, size, ignore_background, error);
+  animated_image_t *image = image_from_data_with_options(data, size, ignore_background, options, error);
   free(data);
   return image;
 }
 
 animated_image_t *image_from_path(char *path, int ignore_background, int *error) {
+  return image_from_path_with_options(path, ignore_background, NULL, error);
+}
+
+animated_image_t *image_from_path_with_options(
+  char *path,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+) {
   FILE *file = fopen(path, "r");
   if (file == NULL) {
     *error = PNGIF_ERR_FILEIO;
     return 0;
   }
 
-  animated_image_t *image = image_from_file(file, ignore_background, error);
+  animated_image_t *image = image_from_file_with_options(file, ignore_background, options, error);
   fclose(file);
   return image;
 }
@@ -265,12 +326,10 @@ void animated_image_free(animated_image_t *image) {
   if (image == NULL)
     return;
 
-  if (image->frames != NULL && image->frame_count > 0) {
+  // Frames may be allocated for an image that failed before its first frame.
+  if (image->frames != NULL) {
     for (int idx = 0; idx < image->frame_count; idx++) {
-      image_frame_t *frame = image->frames + idx;
-      if (frame->rgba != NULL) {
-        free(frame->rgba);
-      }
+      image_frame_release(image->frames + idx, image->pool);
     }
     free(image->frames);
   }
@@ -278,215 +337,2068 @@ void animated_image_free(animated_image_t *image) {
   free(image);
 }
 
-/** Private **/
-
-/**
- * Frees the memory occupied by an image frame.
- *
- * @param frame Image frame data to deallocate.
- */
-void image_frame_free(image_frame_t *frame) {
-  if (frame == NULL)
+void image_frame_apply(image_frame_t *frame, unsigned char *canvas, size_t stride) {
+  if (frame == NULL || frame->rgba == NULL)
     return;
 
-  if (frame->rgba != NULL)
-    free(frame->rgba);
-
-  free(frame);
+  for (u_int32_t line = 0; line < frame->height; line++) {
+    memcpy(
+      canvas + (size_t)(frame->y + line) * stride + (size_t)frame->x * 4,
+      frame->rgba + (size_t)line * frame->width * 4,
+      (size_t)frame->width * 4
+    );
+  }
 }
 
-/**
- * Draws a decoded image block into overall image "canvas".
- *
- * @param rgba Full image canvas container. It has to be at least as large as
- *   the image being drawn into it.
- * @param image Image data to draw into canvas.
- * @param width Width of the canvas.
- * @param height Height of the canvas.
- */
-void gif_draw_subimage(
-  unsigned char *rgba,
-  gif_decoded_image_t *image,
-  u_int32_t width,
-  u_int32_t height
+/** Frame renderer **/
+
+image_renderer_t *image_renderer_from_data(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
 ) {
-  for (int line = 0; line < image->height; line++) {
-    for (int pixel = 0; pixel < image->width; pixel++) {
-      unsigned char *colors = image->rgba + (image->width * line + pixel) * 4;
-      // Ignore transparent pixel. Overwrite every other pixel.
-      if (colors[3] != 0) {
-        memcpy(
-          rgba + (width * (image->top + line) * 4) + (image->left + pixel) * 4,
-          colors,
-          4
-        );
-      }
-    }
+  char header[9] = { 0 };
+  if (data == NULL || size < 8) {
+    *error = PNGIF_ERR_UNKNOWN_FORMAT;
+    return NULL;
   }
-}
+  memcpy(header, data, 8);
 
-/**
- * Draws a decoded image block as an image frame. Takes into account the
- * previous canvas state and frame's disposal method to update canvas state
- * for next frame drawing.
- *
- * @param frame Target frame container. It will hold the drawn frame data.
- * @param canvas Image canvas in a state before drawing the target frame.
- * @param width Canvas width.
- * @param height Canvas height.
- * @param background_color Background color value (from Logical Screen
- *   Descriptor).
- * @param image Image block to draw into the frame.
- * @param ignore_background Flag indicating whether we should ignore provided
+  int shift = options_scale_shift(options);
+  if (shift < 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return NULL;
+  }
+
+  image_renderer_t *renderer = calloc(1, sizeof(image_renderer_t));
+  if (renderer == NULL) {
+    *error = PNG_ERR_MEMIO;
+    return NULL;
+  }
+
+  renderer->ignore_background = ignore_background;
+  renderer->shift = shift;
+  renderer->keyframe_interval = RENDERER_KEYFRAME_INTERVAL;
+  renderer->keyframe_limit = RENDERER_KEYFRAME_LIMIT;
+  if (options != NULL) {
+    renderer->options = *options;
+  }
+
+  if (strcmp(PNG_HEADER, header) == 0) {
+    // Image data is inflated straight from the input array when drawn.
+    renderer->png_raw = png_raw_view_from_data(data, size, 1, error);
+    if (*error == 0) {
+      renderer->png = png_parsed_from_raw_deferred(renderer->png_raw, error);
+    }
+    if (*error != 0) {
+      image_renderer_free(renderer);
+      return NULL;
+    }
+
+    png_parsed_t *png = renderer->png;
+    renderer->width = png->header.width;
+    renderer->height = png->header.height;
+    if (png->anim_control != NULL && png->anim_control->num_frames > 0) {
+      renderer->frame_count = png->anim_control->num_frames;
+      renderer->repeat_count = png->anim_control->num_plays;
+    } else {
+      renderer->frame_count = 1;
+    }
+  } else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F') {
+    renderer->gif = gif_parsed_from_data(data, size, error);
+    if (*error != 0) {
+      image_renderer_free(renderer);
+      return NULL;
+    }
+
+    gif_parsed_t *gif = renderer->gif;
+    renderer->width = gif->screen.width;
+    renderer->height = gif->screen.height;
+    if (gif->screen.background_color_index > 0 && gif->global_color_table != NULL) {
+      renderer->background_color = gif->global_color_table + gif->screen.background_color_index;
+    }
+
+    size_t image_count = 0;
+    for (size_t idx = 0; idx < gif->block_count; idx++) {
+      gif_block_t *block = gif->blocks[idx];
+      if (block->type == GIF_BLOCK_IMAGE) {
+        image_count += 1;
+      } else if (block->type == GIF_BLOCK_APPLICATION) {
+        gif_application_block_t *app = (gif_application_block_t *)block;
+        if (strcmp(app->identifier, "NETSCAPE") == 0 && strcmp(app->auth_code, "2.0") == 0) {
+          renderer->animated = 1;
+          renderer->repeat_count = app->data[1] | (app->data[2] << 8);
+        }
+      }
+    }
+
+    // Still images compose all image blocks into a single frame.
+    renderer->frame_count = renderer->animated ? image_count : 1;
+  } else {
+    free(renderer);
+    *error = PNGIF_ERR_UNKNOWN_FORMAT;
+    return NULL;
+  }
+
+  renderer->width = scaled_size(renderer->width, shift);
+  renderer->height = scaled_size(renderer->height, shift);
+
+  // Still PNG images are decoded straight into the output, others are
+  // composed on a canvas. Frames are at most as large as the canvas.
+  if (renderer->gif != NULL || renderer->png->anim_control != NULL) {
+    size_t size = (size_t)renderer->width * renderer->height * 4;
+    renderer->canvas = malloc(size);
+    renderer->image = malloc(size);
+    renderer->saved = malloc(size);
+    renderer->image_size = size;
+    if (renderer->canvas == NULL || renderer->image == NULL || renderer->saved == NULL) {
+      image_renderer_free(renderer);
+      *error = PNG_ERR_MEMIO;
+      return NULL;
+    }
+    renderer_clear_canvas(renderer);
+  }
+
+  return renderer;
+}
+
+image_renderer_t *image_renderer_from_path(
+  char *path,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    *error = PNGIF_ERR_FILEIO;
+    return NULL;
+  }
+
+  unsigned char *data = NULL;
+  size_t size = pngif_read_file(file, &data, error);
+  fclose(file);
+  if (data == NULL || size == 0) {
+    *error = PNGIF_ERR_FILEIO;
+    return NULL;
+  }
+
+  image_renderer_t *renderer = image_renderer_from_data(data, size, ignore_background, options, error);
+  if (renderer == NULL) {
+    free(data);
+    return NULL;
+  }
+
+  // The renderer keeps referring to the data, so it takes the ownership.
+  renderer->data = data;
+  return renderer;
+}
+
+int image_renderer_next_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+) {
+  if (renderer == NULL || renderer->frame >= renderer->frame_count) {
+    return 0;
+  }
+
+  int err = surface_check(surface, renderer->width, renderer->height);
+  if (err != 0) {
+    *error = err;
+    return 0;
+  }
+
+  return renderer_draw_next(renderer, surface, duration_ms, error);
+}
+
+int image_renderer_seek(image_renderer_t *renderer, size_t frame, int *error) {
+  if (renderer == NULL || frame >= renderer->frame_count) {
+    return 0;
+  }
+
+  // Nearest snapshot at or before the frame.
+  image_keyframe_t *keyframe = NULL;
+  for (size_t idx = renderer->keyframe_count; idx > 0; idx--) {
+    if (renderer->keyframes[idx - 1].frame <= frame) {
+      keyframe = renderer->keyframes + idx - 1;
+      break;
+    }
+  }
+
+  // Frames are replayed from the current one when it's closer than the
+  // snapshot, otherwise from the snapshot or the first frame.
+  size_t start = (keyframe != NULL) ? keyframe->frame : 0;
+  if (renderer->frame > frame || renderer->frame < start) {
+    if (keyframe != NULL) {
+      memcpy(renderer->canvas, keyframe->canvas, (size_t)renderer->width * renderer->height * 4);
+      renderer->frame = keyframe->frame;
+      renderer->block = keyframe->block;
+    } else {
+      image_renderer_rewind(renderer);
+    }
+  }
+
+  while (renderer->frame < frame) {
+    u_int32_t duration_ms;
+    if (!renderer_draw_next(renderer, NULL, &duration_ms, error)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int image_renderer_draw_frame(
+  image_renderer_t *renderer,
+  size_t frame,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+) {
+  if (!image_renderer_seek(renderer, frame, error)) {
+    return 0;
+  }
+
+  return image_renderer_next_frame(renderer, surface, duration_ms, error);
+}
+
+void image_renderer_set_keyframes(image_renderer_t *renderer, size_t interval, size_t limit) {
+  if (renderer == NULL)
+    return;
+
+  renderer_free_keyframes(renderer);
+  renderer->keyframe_interval = interval;
+  renderer->keyframe_limit = (limit > 0) ? limit : 1;
+}
+
+void image_renderer_rewind(image_renderer_t *renderer) {
+  if (renderer == NULL)
+    return;
+
+  renderer->frame = 0;
+  renderer->block = 0;
+  if (renderer->canvas != NULL) {
+    renderer_clear_canvas(renderer);
+  }
+}
+
+void image_renderer_free(image_renderer_t *renderer) {
+  if (renderer == NULL)
+    return;
+
+  png_parsed_free(renderer->png);
+  png_raw_free(renderer->png_raw);
+  if (renderer->gif != NULL) {
+    gif_parsed_free(renderer->gif);
+  }
+  free(renderer->canvas);
+  free(renderer->image);
+  free(renderer->saved);
+  renderer_free_keyframes(renderer);
+  free(renderer->data);
+  free(renderer);
+}
+
+/** Private **/
+
+/**
+ * Frees the memory occupied by an image frame.
+ *
+ * @param frame Image frame data to deallocate.
+ * @param pool Buffer pool the frame pixels were allocated from, or NULL.
+ */
+void image_frame_free(image_frame_t *frame, pngif_pool_t *pool) {
+  if (frame == NULL)
+    return;
+
+  image_frame_release(frame, pool);
+  free(frame);
+}
+
+/**
+ * Makes a frame share the pixels of the previous frame.
+ *
+ * @param frame Target frame container.
+ * @param previous Previous frame.
+ * @param pool Buffer pool, or NULL.
+ *
+ * @return 0 on success, or -1 if memory couldn't be allocated.
+ */
+int image_frame_share(image_frame_t *frame, image_frame_t *previous, pngif_pool_t *pool) {
+  if (previous->refcount == NULL) {
+    previous->refcount = pngif_pool_alloc(pool, sizeof(u_int32_t));
+    if (previous->refcount == NULL) {
+      return -1;
+    }
+    *previous->refcount = 1;
+  }
+
+  *previous->refcount += 1;
+  *frame = *previous;
+  return 0;
+}
+
+/**
+ * Frees the pixels of a frame, once no other frame shares them.
+ *
+ * @param frame Image frame.
+ * @param pool Buffer pool the pixels were allocated from, or NULL.
+ */
+void image_frame_release(image_frame_t *frame, pngif_pool_t *pool) {
+  if (frame->refcount != NULL) {
+    *frame->refcount -= 1;
+    if (*frame->refcount == 0) {
+      pngif_pool_release(pool, frame->refcount);
+      pngif_pool_release(pool, frame->rgba);
+    }
+  } else if (frame->rgba != NULL) {
+    pngif_pool_release(pool, frame->rgba);
+  }
+
+  frame->rgba = NULL;
+  frame->refcount = NULL;
+}
+
+/**
+ * Composes decoded GIF images into an animated image.
+ *
+ * @param gif Decoded GIF data.
+ * @param ignore_background Flag to ignore the background color.
+ * @param delta_frames Flag to store frames as changed rectangles.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_compose_gif(
+  gif_decoded_t *gif,
+  int ignore_background,
+  int delta_frames,
+  int *error
+) {
+  if (gif == NULL)
+    return NULL;
+
+  animated_image_t *output = calloc(1, sizeof(animated_image_t));
+  if (output == NULL) {
+    *error = GIF_ERR_MEMIO;
+    return NULL;
+  }
+  output->repeat_count = gif->repeat_count;
+
+  // Frames are allocated from the pool the images were decoded with.
+  pngif_pool_t *pool = gif->pool;
+  unsigned char *canvas = pngif_pool_alloc(pool, (size_t)gif->width * gif->height * 4);
+  if (canvas == NULL) {
+    free(output);
+    *error = GIF_ERR_MEMIO;
+    return NULL;
+  }
+
+  gif_fill_background(
+    canvas,
+    (size_t)gif->width * gif->height,
+    gif->background_color,
+    ignore_background,
+    gif->format
+  );
+
+  frame_delta_t delta = { 0 };
+  if (gif->animated) {
+    output->frames = malloc(sizeof(image_frame_t) * gif->image_count);
+    if (
+      output->frames == NULL ||
+      (delta_frames && frame_delta_init(
+        &delta,
+        gif->width, gif->height,
+        gif->background_color,
+        ignore_background,
+        gif->format,
+        pool
+      ) != 0)
+    ) {
+      *error = GIF_ERR_MEMIO;
+      free(output->frames);
+      free(output);
+      pngif_pool_release(pool, canvas);
+      return NULL;
+    }
+
+    image_frame_t *previous = NULL;
+    for (int idx = 0; idx < gif->image_count; idx++) {
+      gif_draw_frame(
+        output->frames + idx,
+        canvas,
+        gif->width,
+        gif->height,
+        gif->background_color,
+        gif->images + idx,
+        ignore_background,
+        gif->format,
+        previous,
+        delta_frames ? &delta : NULL,
+        pool,
+        error
+      );
+
+      if (*error != 0)
+        break;
+
+      // The canvas keeps holding the frame, unless it's disposed.
+      int dispose = gif->images[idx].dispose_method;
+      previous = (dispose == DISPOSE_NONE || dispose == DISPOSE_APPEND) ? output->frames + idx : NULL;
+    }
+
+    output->frame_count = gif->image_count;
+    frame_delta_free(&delta);
+    pngif_pool_release(pool, canvas);
+  } else {
+    output->frames = malloc(sizeof(image_frame_t));
+    if (output->frames == NULL) {
+      *error = GIF_ERR_MEMIO;
+      free(output);
+      pngif_pool_release(pool, canvas);
+      return NULL;
+    }
+
+    for (int idx = 0; idx < gif->image_count; idx++) {
+      gif_decoded_image_t *image = gif->images + idx;
+      gif_draw_subimage(canvas, image, gif->width, gif->height);
+    }
+
+    output->frame_count = 1;
+    *output->frames = (image_frame_t){
+      .rgba = canvas,
+      .width = gif->width,
+      .height = gif->height,
+    };
+  }
+
+  output->width = gif->width;
+  output->height = gif->height;
+  output->format = gif->format;
+  output->delta_frames = delta_frames;
+  output->pool = pool;
+  return output;
+}
+
+/**
+ * Composes decoded PNG frames into an animated image.
+ *
+ * @param png Decoded PNG data.
+ * @param delta_frames Flag to store frames as changed rectangles.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_compose_png(png_decoded_t *png, int delta_frames, int *error) {
+  if (png == NULL)
+    return NULL;
+
+  animated_image_t *output = calloc(1, sizeof(animated_image_t));
+  if (output == NULL) {
+    *error = PNG_ERR_MEMIO;
+    return NULL;
+  }
+  if (png->frames != NULL) {
+    output->repeat_count = png->frames->plays;
+  }
+
+  // Frames are allocated from the pool the frames were decoded with.
+  pngif_pool_t *pool = png->pool;
+  size_t canvas_size = (size_t)png->width * png->height * 4;
+  unsigned char *canvas = pngif_pool_alloc(pool, canvas_size);
+  if (canvas == NULL) {
+    free(output);
+    *error = PNG_ERR_MEMIO;
+    return NULL;
+  }
+  memset(canvas, 0, canvas_size);
+
+  // TODO: Background color?
+  frame_delta_t delta = { 0 };
+  if (png->frames != NULL && png->frames->length > 0) {
+    output->frames = malloc(sizeof(image_frame_t) * png->frames->length);
+    if (
+      output->frames == NULL ||
+      (delta_frames && frame_delta_init(&delta, png->width, png->height, NULL, 1, png->format, pool) != 0)
+    ) {
+      *error = PNG_ERR_MEMIO;
+      free(output->frames);
+      free(output);
+      pngif_pool_release(pool, canvas);
+      return NULL;
+    }
+
+    image_frame_t *previous = NULL;
+    for (int idx = 0; idx < png->frames->length; idx++) {
+      png_draw_frame(
+        output->frames + idx,
+        canvas,
+        png->width,
+        png->height,
+        png->frames->frames + idx,
+        png->format,
+        previous,
+        delta_frames ? &delta : NULL,
+        pool,
+        error
+      );
+
+      if (*error != 0)
+        break;
+
+      // The canvas keeps holding the frame, unless it's disposed.
+      int dispose = png->frames->frames[idx].dispose_type;
+      previous = (dispose == APNG_DISPOSE_TYPE_NONE) ? output->frames + idx : NULL;
+    }
+
+    output->frame_count = png->frames->length;
+    frame_delta_free(&delta);
+    pngif_pool_release(pool, canvas);
+  } else {
+    output->frames = malloc(sizeof(image_frame_t));
+    if (output->frames == NULL) {
+      *error = PNG_ERR_MEMIO;
+      free(output);
+      pngif_pool_release(pool, canvas);
+      return NULL;
+    }
+
+    png_draw_subimage(
+      canvas,
+      png->data,
+      png->width, png->height,
+      0, 0,
+      png->width, png->height,
+      APNG_BLEND_TYPE_SOURCE,
+      png->format
+    );
+
+    output->frame_count = 1;
+    *output->frames = (image_frame_t){
+      .rgba = canvas,
+      .width = png->width,
+      .height = png->height,
+    };
+  }
+
+  output->width = png->width;
+  output->height = png->height;
+  output->format = png->format;
+  output->delta_frames = delta_frames;
+  output->pool = pool;
+  return output;
+}
+
+/**
+ * Fills a GIF canvas with its initial state: background color, unless it's
+ * ignored, and transparent black otherwise.
+ *
+ * @param canvas Canvas to fill.
+ * @param pixel_count Number of canvas pixels.
+ * @param background_color Optional background color.
+ * @param ignore_background Flag to ignore the background color.
+ * @param format Canvas pixel format.
+ */
+void gif_fill_background(
+  unsigned char *canvas,
+  size_t pixel_count,
+  gif_color_t *background_color,
+  int ignore_background,
+  int format
+) {
+  if (ignore_background || background_color == NULL) {
+    memset(canvas, 0, pixel_count * 4);
+    return;
+  }
+
+  u_int32_t back = pngif_pixel(
+    format,
+    background_color->red,
+    background_color->green,
+    background_color->blue,
+    255
+  );
+  for (size_t idx = 0; idx < pixel_count; idx++) {
+    memcpy(canvas + idx * 4, &back, 4);
+  }
+}
+
+/**
+ * Clips a decoded image block to the canvas.
+ *
+ * @param image Image block.
+ * @param width Width of the canvas.
+ * @param height Height of the canvas.
+ * @param columns Output number of visible pixels per row.
+ * @param lines Output number of visible rows.
+ */
+void gif_clip_subimage(
+  gif_decoded_image_t *image,
+  u_int32_t width,
+  u_int32_t height,
+  size_t *columns,
+  size_t *lines
+) {
+  *columns = (image->left < width) ? width - image->left : 0;
+  *lines = (image->top < height) ? height - image->top : 0;
+  if (*columns > image->width) {
+    *columns = image->width;
+  }
+  if (*lines > image->height) {
+    *lines = image->height;
+  }
+}
+
+/**
+ * Finds the end of a run of pixels that are either all transparent or all
+ * opaque. Transparent pixels are all zeroes in every pixel format.
+ *
+ * @param colors Row of pixels.
+ * @param start Index of the first pixel of the run.
+ * @param count Number of pixels in the row.
+ * @param transparent Flag indicating whether the run is transparent.
+ *
+ * @return Index of the first pixel past the run.
+ */
+static inline size_t gif_run_end(unsigned char *colors, size_t start, size_t count, int transparent) {
+  size_t idx = start;
+  for (; idx < count; idx++) {
+    u_int32_t value;
+    memcpy(&value, colors + idx * 4, 4);
+    if ((value == 0) != transparent) {
+      break;
+    }
+  }
+  return idx;
+}
+
+/**
+ * Draws a decoded image block into overall image "canvas". Transparent pixels
+ * are skipped, and every run of other pixels is copied at once, or the whole
+ * row when the image is opaque.
+ *
+ * @param rgba Full image canvas container. It has to be at least as large as
+ *   the image being drawn into it.
+ * @param image Image data to draw into canvas.
+ * @param width Width of the canvas.
+ * @param height Height of the canvas.
+ */
+void gif_draw_subimage(
+  unsigned char *rgba,
+  gif_decoded_image_t *image,
+  u_int32_t width,
+  u_int32_t height
+) {
+  // Parts of the image outside of the canvas are clipped.
+  size_t columns, lines;
+  gif_clip_subimage(image, width, height, &columns, &lines);
+  if (columns == 0) {
+    return;
+  }
+
+  unsigned char *colors = image->rgba;
+  unsigned char *canvas = rgba + ((size_t)width * image->top + image->left) * 4;
+  for (size_t line = 0; line < lines; line++) {
+    if (image->opaque) {
+      memcpy(canvas, colors, columns * 4);
+    } else {
+      size_t start = gif_run_end(colors, 0, columns, 1);
+      while (start < columns) {
+        size_t end = gif_run_end(colors, start, columns, 0);
+        memcpy(canvas + start * 4, colors + start * 4, (end - start) * 4);
+        start = gif_run_end(colors, end, columns, 1);
+      }
+    }
+
+    colors += (size_t)image->width * 4;
+    canvas += (size_t)width * 4;
+  }
+}
+
+/**
+ * Checks whether drawing a decoded image block would change any canvas pixel.
+ *
+ * @param rgba Canvas.
+ * @param image Image data to draw into canvas.
+ * @param width Width of the canvas.
+ * @param height Height of the canvas.
+ *
+ * @return 1 if any pixel would change, 0 otherwise.
+ */
+int gif_subimage_changes(
+  unsigned char *rgba,
+  gif_decoded_image_t *image,
+  u_int32_t width,
+  u_int32_t height
+) {
+  size_t columns, lines;
+  gif_clip_subimage(image, width, height, &columns, &lines);
+  if (columns == 0) {
+    return 0;
+  }
+
+  unsigned char *colors = image->rgba;
+  unsigned char *canvas = rgba + ((size_t)width * image->top + image->left) * 4;
+  for (size_t line = 0; line < lines; line++) {
+    if (image->opaque) {
+      if (memcmp(canvas, colors, columns * 4) != 0) {
+        return 1;
+      }
+    } else {
+      size_t start = gif_run_end(colors, 0, columns, 1);
+      while (start < columns) {
+        size_t end = gif_run_end(colors, start, columns, 0);
+        if (memcmp(canvas + start * 4, colors + start * 4, (end - start) * 4) != 0) {
+          return 1;
+        }
+        start = gif_run_end(colors, end, columns, 1);
+      }
+    }
+
+    colors += (size_t)image->width * 4;
+    canvas += (size_t)width * 4;
+  }
+
+  return 0;
+}
+
+/**
+ * Draws a decoded image block as an image frame. Takes into account the
+ * previous canvas state and frame's disposal method to update canvas state
+ * for next frame drawing.
+ *
+ * @param frame Target frame container. It will hold the drawn frame data.
+ * @param canvas Image canvas in a state before drawing the target frame.
+ * @param width Canvas width.
+ * @param height Canvas height.
+ * @param background_color Background color value (from Logical Screen
+ *   Descriptor).
+ * @param image Image block to draw into the frame.
+ * @param ignore_background Flag indicating whether we should ignore provided
  *   background color value (for better compliance with modern browser
  *   rendering).
+ * @param format Pixel format of the canvas and the image.
+ * @param previous Previous frame, if the canvas still holds it, or NULL. A
+ *   full frame that doesn't change the canvas shares its pixels.
+ * @param delta Canvas changes, to draw a delta frame, or NULL for a full frame.
+ * @param pool Buffer pool for frame pixels, or NULL.
+ * @param error Return error value.
+ */
+void gif_draw_frame(
+  image_frame_t *frame,
+  unsigned char *canvas,
+  u_int32_t width,
+  u_int32_t height,
+  gif_color_t *background_color,
+  gif_decoded_image_t *image,
+  int ignore_background,
+  int format,
+  image_frame_t *previous,
+  frame_delta_t *delta,
+  pngif_pool_t *pool,
+  int *error
+) {
+  if (delta != NULL) {
+    // The frame is drawn right on the canvas, and only its changes are kept.
+    // A frame that changes nothing since the previous one is empty.
+    image_rect_t rect = rect_clip(image->left, image->top, image->width, image->height, width, height);
+    if (
+      (delta->disposed.width == 0 || delta->disposed.height == 0) &&
+      !gif_subimage_changes(canvas, image, width, height)
+    ) {
+      rect = (image_rect_t){ 0 };
+    }
+    if (image->dispose_method == DISPOSE_RESTORE) {
+      canvas_copy_region(canvas, width, rect, delta->saved, 0);
+    }
+
+    gif_draw_subimage(canvas, image, width, height);
+    frame_delta_store(delta, frame, canvas, rect, GIF_ERR_MEMIO, error);
+    frame->duration_ms = image->delay_cs * 10;
+    frame_delta_dispose(
+      delta,
+      canvas,
+      rect,
+      image->dispose_method == DISPOSE_BACKGROUND,
+      image->dispose_method == DISPOSE_RESTORE
+    );
+    return;
+  }
+
+  if (previous != NULL && !gif_subimage_changes(canvas, image, width, height)) {
+    if (image_frame_share(frame, previous, pool) != 0) {
+      *error = GIF_ERR_MEMIO;
+      return;
+    }
+    frame->duration_ms = image->delay_cs * 10;
+
+    // The canvas already holds the frame, or is left at the same state.
+    if (image->dispose_method == DISPOSE_BACKGROUND) {
+      gif_fill_background(canvas, (size_t)width * height, background_color, ignore_background, format);
+    }
+    return;
+  }
+
+  unsigned char *rgba = pngif_pool_alloc(pool, (size_t)width * height * 4);
+  if (rgba == NULL) {
+    *error = GIF_ERR_MEMIO;
+    return;
+  }
+
+  // Paint previous state into frame.
+  memcpy(rgba, canvas, width * height * 4);
+
+  // Paint image into frame.
+  gif_draw_subimage(rgba, image, width, height);
+
+  *frame = (image_frame_t){
+    .rgba = rgba,
+    .duration_ms = image->delay_cs * 10,
+    .width = width,
+    .height = height,
+  };
+
+  switch (image->dispose_method) {
+  case DISPOSE_NONE:
+  case DISPOSE_APPEND:
+    // Canvas is set to the current frame.
+    memcpy(canvas, rgba, width * height * 4);
+    break;
+  case DISPOSE_BACKGROUND:
+    // Canvas is set to background color.
+    gif_fill_background(canvas, (size_t)width * height, background_color, ignore_background, format);
+    break;
+  case DISPOSE_RESTORE:
+    // Canvas is left at previous state.
+    break;
+  }
+}
+
+/**
+ * Draws a frame image into the canvas, either replacing or blending over the
+ * canvas pixels.
+ *
+ * @param rgba Canvas.
+ * @param data Frame image.
+ * @param width Canvas width.
+ * @param height Canvas height.
+ * @param x_offset Frame column.
+ * @param y_offset Frame row.
+ * @param sub_width Frame width.
+ * @param sub_height Frame height.
+ * @param blend_type APNG_BLEND_TYPE_* value.
+ * @param format Pixel format of the canvas and the frame image.
+ */
+void png_draw_subimage(
+  unsigned char *rgba,
+  unsigned char *data,
+  u_int32_t width, u_int32_t height,
+  u_int32_t x_offset, u_int32_t y_offset,
+  u_int32_t sub_width, u_int32_t sub_height,
+  unsigned short blend_type,
+  int format
+) {
+  // Rows are copied as is, or blended over the canvas, including its alpha.
+  for (u_int32_t line = 0; line < sub_height; line++) {
+    unsigned char *row = rgba + ((size_t)width * (y_offset + line) + x_offset) * 4;
+    unsigned char *colors = data + (size_t)sub_width * line * 4;
+    if (blend_type == APNG_BLEND_TYPE_SOURCE) {
+      memcpy(row, colors, (size_t)sub_width * 4);
+    } else {
+      pngif_blend_pixels(row, colors, sub_width, format);
+    }
+  }
+}
+
+/**
+ * Checks whether drawing a frame image would change any canvas pixel. Pixels
+ * blended with partial alpha are assumed to change.
+ *
+ * @param rgba Canvas.
+ * @param data Frame image.
+ * @param width Canvas width.
+ * @param x_offset Frame column.
+ * @param y_offset Frame row.
+ * @param sub_width Frame width.
+ * @param sub_height Frame height.
+ * @param blend_type APNG_BLEND_TYPE_* value.
+ * @param format Pixel format of the canvas and the frame image.
+ *
+ * @return 1 if any pixel would change, 0 otherwise.
+ */
+int png_subimage_changes(
+  unsigned char *rgba,
+  unsigned char *data,
+  u_int32_t width,
+  u_int32_t x_offset, u_int32_t y_offset,
+  u_int32_t sub_width, u_int32_t sub_height,
+  unsigned short blend_type,
+  int format
+) {
+  int order = format & ~PNGIF_FORMAT_PREMULTIPLIED;
+  int alpha = (order == PNGIF_FORMAT_ARGB || order == PNGIF_FORMAT_ABGR) ? 0 : 3;
+
+  for (u_int32_t line = 0; line < sub_height; line++) {
+    unsigned char *row = rgba + ((size_t)width * (y_offset + line) + x_offset) * 4;
+    unsigned char *colors = data + (size_t)sub_width * line * 4;
+    if (blend_type == APNG_BLEND_TYPE_SOURCE) {
+      if (memcmp(row, colors, (size_t)sub_width * 4) != 0) {
+        return 1;
+      }
+      continue;
+    }
+
+    for (u_int32_t pixel = 0; pixel < sub_width; pixel++, row += 4, colors += 4) {
+      if (colors[alpha] != 0 && (colors[alpha] != 255 || memcmp(row, colors, 4) != 0)) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Draws a decoded image block as an image frame. Takes into account the
+ * previous canvas state and frame's disposal method to update canvas state
+ * for next frame drawing.
+ *
+ * @param frame Target frame container. It will hold the drawn frame data.
+ * @param canvas Image canvas in a state before drawing the target frame.
+ * @param width Canvas width.
+ * @param height Canvas height.
+ * @param image Image block to draw into the frame.
+ * @param format Pixel format of the canvas and the image.
+ * @param previous Previous frame, if the canvas still holds it, or NULL. A
+ *   full frame that doesn't change the canvas shares its pixels.
+ * @param delta Canvas changes, to draw a delta frame, or NULL for a full frame.
+ * @param pool Buffer pool for frame pixels, or NULL.
  * @param error Return error value.
  */
-void gif_draw_frame(
+void png_draw_frame(
   image_frame_t *frame,
   unsigned char *canvas,
   u_int32_t width,
   u_int32_t height,
+  png_frame_t *png,
+  int format,
+  image_frame_t *previous,
+  frame_delta_t *delta,
+  pngif_pool_t *pool,
+  int *error
+) {
+  // Delta frames keep track of the previous frame themselves.
+  int unchanged_canvas = (delta != NULL)
+    ? (delta->disposed.width == 0 || delta->disposed.height == 0)
+    : (previous != NULL);
+  int changes = 1;
+  if (unchanged_canvas) {
+    changes = png_subimage_changes(
+      canvas,
+      png->data,
+      width,
+      png->x_offset, png->y_offset,
+      png->width, png->height,
+      png->blend_type,
+      format
+    );
+  }
+
+  if (delta != NULL) {
+    // The frame is drawn right on the canvas, and only its changes are kept.
+    // A frame that changes nothing since the previous one is empty.
+    image_rect_t rect = rect_clip(png->x_offset, png->y_offset, png->width, png->height, width, height);
+    if (!changes) {
+      rect = (image_rect_t){ 0 };
+    }
+    if (png->dispose_type == APNG_DISPOSE_TYPE_PREVIOUS) {
+      canvas_copy_region(canvas, width, rect, delta->saved, 0);
+    }
+
+    png_draw_subimage(
+      canvas,
+      png->data,
+      width, height,
+      png->x_offset, png->y_offset,
+      png->width, png->height,
+      png->blend_type,
+      format
+    );
+    frame_delta_store(delta, frame, canvas, rect, PNG_ERR_MEMIO, error);
+    frame->duration_ms = png->delay * 1000;
+    frame_delta_dispose(
+      delta,
+      canvas,
+      rect,
+      png->dispose_type == APNG_DISPOSE_TYPE_BACKGROUND,
+      png->dispose_type == APNG_DISPOSE_TYPE_PREVIOUS
+    );
+    return;
+  }
+
+  if (!changes) {
+    if (image_frame_share(frame, previous, pool) != 0) {
+      *error = PNG_ERR_MEMIO;
+      return;
+    }
+    frame->duration_ms = png->delay * 1000;
+
+    // The canvas already holds the frame, or is left at the same state.
+    if (png->dispose_type == APNG_DISPOSE_TYPE_BACKGROUND) {
+      memset(canvas, 0, (width * height * 4));
+    }
+    return;
+  }
+
+  unsigned char *rgba = pngif_pool_alloc(pool, (size_t)width * height * 4);
+  if (rgba == NULL) {
+    *error = PNG_ERR_MEMIO;
+    return;
+  }
+
+  // Paint previous state into frame.
+  memcpy(rgba, canvas, width * height * 4);
+
+  // Paint image into frame.
+  png_draw_subimage(
+    rgba,
+    png->data,
+    width, height,
+    png->x_offset, png->y_offset,
+    png->width, png->height,
+    png->blend_type,
+    format
+  );
+
+  *frame = (image_frame_t){
+    .rgba = rgba,
+    .duration_ms = png->delay * 1000,
+    .width = width,
+    .height = height,
+  };
+
+  switch (png->dispose_type) {
+  case APNG_DISPOSE_TYPE_NONE:
+    // Canvas is set to the current frame.
+    memcpy(canvas, rgba, width * height * 4);
+    break;
+  case APNG_DISPOSE_TYPE_BACKGROUND:
+    // Canvas is set to background color.
+    memset(canvas, 0, (width * height * 4));
+    break;
+  case APNG_DISPOSE_TYPE_PREVIOUS:
+    // Canvas is left at previous state.
+    break;
+  }
+}
+
+
+/**
+ * Clips a rectangle to the canvas.
+ *
+ * @param x Rectangle column.
+ * @param y Rectangle row.
+ * @param width Rectangle width.
+ * @param height Rectangle height.
+ * @param canvas_width Canvas width.
+ * @param canvas_height Canvas height.
+ *
+ * @return Clipped rectangle, empty if it's entirely outside of the canvas.
+ */
+image_rect_t rect_clip(
+  u_int32_t x, u_int32_t y,
+  u_int32_t width, u_int32_t height,
+  u_int32_t canvas_width, u_int32_t canvas_height
+) {
+  image_rect_t rect = { 0 };
+  if (x >= canvas_width || y >= canvas_height) {
+    return rect;
+  }
+
+  rect.x = x;
+  rect.y = y;
+  rect.width = (width < canvas_width - x) ? width : canvas_width - x;
+  rect.height = (height < canvas_height - y) ? height : canvas_height - y;
+  return rect;
+}
+
+/**
+ * Bounding rectangle of two rectangles, either of which may be empty.
+ *
+ * @param first First rectangle.
+ * @param second Second rectangle.
+ *
+ * @return Rectangle that covers both.
+ */
+image_rect_t rect_union(image_rect_t first, image_rect_t second) {
+  if (first.width == 0 || first.height == 0) {
+    return second;
+  }
+  if (second.width == 0 || second.height == 0) {
+    return first;
+  }
+
+  u_int32_t right = first.x + first.width;
+  u_int32_t bottom = first.y + first.height;
+  if (second.x + second.width > right) {
+    right = second.x + second.width;
+  }
+  if (second.y + second.height > bottom) {
+    bottom = second.y + second.height;
+  }
+
+  image_rect_t rect = {
+    .x = (first.x < second.x) ? first.x : second.x,
+    .y = (first.y < second.y) ? first.y : second.y,
+  };
+  rect.width = right - rect.x;
+  rect.height = bottom - rect.y;
+  return rect;
+}
+
+/**
+ * Copies a canvas region into a tightly packed buffer, or back.
+ *
+ * @param canvas Canvas.
+ * @param width Canvas width.
+ * @param rect Region, within the canvas.
+ * @param buffer Buffer that fits the region.
+ * @param restore Flag to copy the buffer into the canvas instead.
+ */
+void canvas_copy_region(
+  unsigned char *canvas,
+  u_int32_t width,
+  image_rect_t rect,
+  unsigned char *buffer,
+  int restore
+) {
+  for (u_int32_t line = 0; line < rect.height; line++) {
+    unsigned char *row = canvas + ((size_t)(rect.y + line) * width + rect.x) * 4;
+    unsigned char *copy = buffer + (size_t)line * rect.width * 4;
+    if (restore) {
+      memcpy(row, copy, rect.width * 4);
+    } else {
+      memcpy(copy, row, rect.width * 4);
+    }
+  }
+}
+
+/**
+ * Prepares to track canvas changes of an animation, starting from a cleared
+ * canvas.
+ *
+ * @param delta Canvas changes to initialize.
+ * @param width Canvas width.
+ * @param height Canvas height.
+ * @param background_color Optional GIF background color.
+ * @param ignore_background Flag to ignore the background color.
+ * @param format Canvas pixel format.
+ * @param pool Buffer pool for frame pixels and the saved region, or NULL.
+ *
+ * @return 0 on success, or -1 if memory couldn't be allocated.
+ */
+int frame_delta_init(
+  frame_delta_t *delta,
+  u_int32_t width, u_int32_t height,
   gif_color_t *background_color,
-  gif_decoded_image_t *image,
   int ignore_background,
+  int format,
+  pngif_pool_t *pool
+) {
+  *delta = (frame_delta_t){
+    .width = width,
+    .height = height,
+    .disposed = { .width = width, .height = height },
+    .background_color = background_color,
+    .ignore_background = ignore_background,
+    .format = format,
+    .pool = pool,
+  };
+
+  delta->saved = pngif_pool_alloc(pool, (size_t)width * height * 4);
+  return (delta->saved == NULL) ? -1 : 0;
+}
+
+/**
+ * Stores a frame drawn on the canvas as the rectangle that changed since the
+ * previous frame: the frame's own rectangle and whatever the previous frame's
+ * disposal changed.
+ *
+ * @param delta Canvas changes.
+ * @param frame Target frame container.
+ * @param canvas Canvas with the frame drawn on it.
+ * @param rect Frame rectangle, clipped to the canvas.
+ * @param memio_error Error value to report allocation errors with.
+ * @param error Return error value.
+ */
+void frame_delta_store(
+  frame_delta_t *delta,
+  image_frame_t *frame,
+  unsigned char *canvas,
+  image_rect_t rect,
+  int memio_error,
   int *error
 ) {
-  unsigned char *rgba = malloc(width * height * 4);
-  if (rgba == NULL) {
-    *error = GIF_ERR_MEMIO;
+  image_rect_t changed = rect_union(delta->disposed, rect);
+  *frame = (image_frame_t){
+    .x = changed.x,
+    .y = changed.y,
+    .width = changed.width,
+    .height = changed.height,
+  };
+
+  if (changed.width > 0 && changed.height > 0) {
+    frame->rgba = pngif_pool_alloc(delta->pool, (size_t)changed.width * changed.height * 4);
+    if (frame->rgba == NULL) {
+      *error = memio_error;
+      return;
+    }
+    canvas_copy_region(canvas, delta->width, changed, frame->rgba, 0);
+  }
+
+  delta->content = rect_union(delta->content, rect);
+}
+
+/**
+ * Disposes a frame drawn on the canvas. Clearing only has to touch the region
+ * drawn since the last time the canvas was cleared.
+ *
+ * @param delta Canvas changes.
+ * @param canvas Canvas with the frame drawn on it.
+ * @param rect Frame rectangle, clipped to the canvas.
+ * @param clear Flag to clear the canvas.
+ * @param restore Flag to restore the region saved before drawing the frame.
+ */
+void frame_delta_dispose(
+  frame_delta_t *delta,
+  unsigned char *canvas,
+  image_rect_t rect,
+  int clear,
+  int restore
+) {
+  if (clear) {
+    image_rect_t content = delta->content;
+    for (u_int32_t line = 0; line < content.height; line++) {
+      gif_fill_background(
+        canvas + ((size_t)(content.y + line) * delta->width + content.x) * 4,
+        content.width,
+        delta->background_color,
+        delta->ignore_background,
+        delta->format
+      );
+    }
+    delta->disposed = content;
+    delta->content = (image_rect_t){ 0 };
+  } else if (restore) {
+    canvas_copy_region(canvas, delta->width, rect, delta->saved, 1);
+    delta->disposed = rect;
+  } else {
+    delta->disposed = (image_rect_t){ 0 };
+  }
+}
+
+/**
+ * Frees the memory used to track canvas changes.
+ *
+ * @param delta Canvas changes.
+ */
+void frame_delta_free(frame_delta_t *delta) {
+  pngif_pool_release(delta->pool, delta->saved);
+  delta->saved = NULL;
+}
+
+/**
+ * Sets the renderer canvas to its initial state: background color for GIF
+ * images, unless it's ignored, and transparent black otherwise.
+ *
+ * @param renderer Frame renderer.
+ */
+void renderer_clear_canvas(image_renderer_t *renderer) {
+  gif_fill_background(
+    renderer->canvas,
+    (size_t)renderer->width * renderer->height,
+    renderer->background_color,
+    renderer->ignore_background,
+    PNGIF_FORMAT_RGBA
+  );
+}
+
+/**
+ * Saves a canvas region before drawing a frame that has to be disposed to the
+ * previous state, or restores it afterwards.
+ *
+ * @param renderer Frame renderer.
+ * @param x Region column.
+ * @param y Region row.
+ * @param width Region width.
+ * @param height Region height.
+ * @param restore Flag to restore the region instead of saving it.
+ */
+void renderer_save_region(
+  image_renderer_t *renderer,
+  u_int32_t x, u_int32_t y,
+  u_int32_t width, u_int32_t height,
+  int restore
+) {
+  // Regions are clipped to the canvas, same as the frames.
+  if (x >= renderer->width || y >= renderer->height) {
+    return;
+  }
+  width = (width < renderer->width - x) ? width : renderer->width - x;
+  height = (height < renderer->height - y) ? height : renderer->height - y;
+
+  for (u_int32_t line = 0; line < height; line++) {
+    unsigned char *canvas = renderer->canvas + ((size_t)(y + line) * renderer->width + x) * 4;
+    unsigned char *saved = renderer->saved + (size_t)line * width * 4;
+    if (restore) {
+      memcpy(canvas, saved, width * 4);
+    } else {
+      memcpy(saved, canvas, width * 4);
+    }
+  }
+}
+
+/**
+ * Stores the canvas into the output surface, in the surface pixel format.
+ *
+ * @param renderer Frame renderer.
+ * @param surface Output surface, or NULL to only update the canvas.
+ */
+void renderer_output(image_renderer_t *renderer, pngif_surface_t *surface) {
+  if (surface == NULL) {
+    return;
+  }
+
+  for (u_int32_t line = 0; line < renderer->height; line++) {
+    unsigned char *row = renderer->canvas + (size_t)line * renderer->width * 4;
+    surface_store_row(surface, 0, line, row, renderer->width);
+  }
+}
+
+/**
+ * Draws the next frame, and snapshots the canvas if the frame after it is due
+ * for a keyframe.
+ *
+ * @param renderer Frame renderer.
+ * @param surface Output surface, or NULL when seeking.
+ * @param duration_ms Output frame duration.
+ * @param error Error output.
+ *
+ * @return 1 if the frame was drawn, or 0 in case of an error.
+ */
+int renderer_draw_next(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
+) {
+  int drawn;
+  *duration_ms = 0;
+  if (renderer->gif != NULL) {
+    drawn = renderer_next_gif_frame(renderer, surface, duration_ms, error);
+  } else {
+    drawn = renderer_next_png_frame(renderer, surface, duration_ms, error);
+  }
+
+  if (drawn) {
+    renderer_keep_keyframe(renderer);
+  }
+  return drawn;
+}
+
+/**
+ * Snapshots the canvas before the next frame, if its index is a multiple of
+ * the keyframe interval and there's no snapshot for it yet. Snapshots are
+ * optional, so the frame is just skipped if memory can't be allocated.
+ *
+ * @param renderer Frame renderer.
+ */
+void renderer_keep_keyframe(image_renderer_t *renderer) {
+  size_t frame = renderer->frame;
+  if (
+    renderer->canvas == NULL ||
+    renderer->keyframe_interval == 0 ||
+    frame == 0 ||
+    frame >= renderer->frame_count ||
+    frame % renderer->keyframe_interval != 0
+  ) {
     return;
   }
 
-  // Paint previous state into frame.
-  memcpy(rgba, canvas, width * height * 4);
+  // Snapshots are sorted by frame.
+  size_t position = renderer->keyframe_count;
+  while (position > 0 && renderer->keyframes[position - 1].frame >= frame) {
+    if (renderer->keyframes[position - 1].frame == frame) {
+      return;
+    }
+    position -= 1;
+  }
+
+  if (renderer->keyframes == NULL) {
+    renderer->keyframes = malloc(renderer->keyframe_limit * sizeof(image_keyframe_t));
+    if (renderer->keyframes == NULL) {
+      return;
+    }
+  }
 
-  // Paint image into frame.
-  gif_draw_subimage(rgba, image, width, height);
+  if (renderer->keyframe_count == renderer->keyframe_limit) {
+    renderer_thin_keyframes(renderer);
+    if (frame % renderer->keyframe_interval != 0) {
+      return;
+    }
+    position = renderer->keyframe_count;
+    while (position > 0 && renderer->keyframes[position - 1].frame > frame) {
+      position -= 1;
+    }
+  }
 
-  frame->rgba = rgba;
-  frame->duration_ms = image->delay_cs * 10;
+  size_t size = (size_t)renderer->width * renderer->height * 4;
+  unsigned char *canvas = malloc(size);
+  if (canvas == NULL) {
+    return;
+  }
+  memcpy(canvas, renderer->canvas, size);
 
-  switch (image->dispose_method) {
-  case DISPOSE_NONE:
-  case DISPOSE_APPEND:
-    // Canvas is set to the current frame.
-    memcpy(canvas, rgba, width * height * 4);
-    break;
-  case DISPOSE_BACKGROUND:
-    // Canvas is set to background color.
-    if (!ignore_background && background_color != NULL) {
-      for (int pixel = 0; pixel < (width * height); pixel++) {
-        canvas[pixel * 4 + 0] = background_color->red;
-        canvas[pixel * 4 + 1] = background_color->green;
-        canvas[pixel * 4 + 2] = background_color->blue;
-        canvas[pixel * 4 + 3] = 255;
+  image_keyframe_t *keyframe = renderer->keyframes + position;
+  memmove(keyframe + 1, keyframe, (renderer->keyframe_count - position) * sizeof(image_keyframe_t));
+  keyframe->frame = frame;
+  keyframe->block = renderer->block;
+  keyframe->canvas = canvas;
+  renderer->keyframe_count += 1;
+}
+
+/**
+ * Doubles the keyframe interval, and drops the snapshots that are no longer
+ * at a multiple of it, until there's room for another snapshot.
+ *
+ * @param renderer Frame renderer.
+ */
+void renderer_thin_keyframes(image_renderer_t *renderer) {
+  while (renderer->keyframe_count == renderer->keyframe_limit) {
+    renderer->keyframe_interval *= 2;
+
+    size_t kept = 0;
+    for (size_t idx = 0; idx < renderer->keyframe_count; idx++) {
+      image_keyframe_t *keyframe = renderer->keyframes + idx;
+      if (keyframe->frame % renderer->keyframe_interval == 0) {
+        renderer->keyframes[kept++] = *keyframe;
+      } else {
+        free(keyframe->canvas);
       }
-    } else {
-      memset(canvas, 0, (width * height * 4));
     }
-    break;
-  case DISPOSE_RESTORE:
-    // Canvas is left at previous state.
-    break;
+    renderer->keyframe_count = kept;
   }
 }
 
-void png_draw_subimage(
-  unsigned char *rgba,
-  unsigned char *data,
-  u_int32_t width, u_int32_t height,
-  u_int32_t x_offset, u_int32_t y_offset,
-  u_int32_t sub_width, u_int32_t sub_height,
-  unsigned short blend_type
+/**
+ * Frees all canvas snapshots of the renderer.
+ *
+ * @param renderer Frame renderer.
+ */
+void renderer_free_keyframes(image_renderer_t *renderer) {
+  for (size_t idx = 0; idx < renderer->keyframe_count; idx++) {
+    free(renderer->keyframes[idx].canvas);
+  }
+  free(renderer->keyframes);
+  renderer->keyframes = NULL;
+  renderer->keyframe_count = 0;
+}
+
+/**
+ * Draws the next GIF frame. Each image block of an animated GIF is a frame,
+ * and a still GIF composes all its image blocks into a single frame.
+ *
+ * @param renderer Frame renderer.
+ * @param surface Output surface.
+ * @param duration_ms Output frame duration.
+ * @param error Error output.
+ *
+ * @return 1 if the frame was drawn, or 0 in case of an error.
+ */
+int renderer_next_gif_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
+  int *error
 ) {
-  for (int line = 0; line < sub_height; line++) {
-    for (int pixel = 0; pixel < sub_width; pixel++) {
-      unsigned char *colors = data + (sub_width * line + pixel) * 4;
-      if (blend_type == APNG_BLEND_TYPE_SOURCE) {
-          memcpy(
-            rgba + (width * (y_offset + line) * 4) + (x_offset + pixel) * 4,
-            colors,
-            4
-          );
-      } else {
-        if (colors[3] == 0) {
-          continue;
-        } else if (colors[3] == 255) {
-          memcpy(
-            rgba + (width * (y_offset + line) * 4) + (x_offset + pixel) * 4,
-            colors,
-            4
-          );
-        } else {
-          // TODO: Seems like a good place for some SIMD commands.
-          float source_alpha = (float)(colors[3]) / (float)255;
-          float comp_alpha = 1.0 - source_alpha;
-          u_int32_t offset = (width * (y_offset + line) * 4) + (x_offset + pixel) * 4;
-          for (u_int32_t idx = 0; idx < 3; idx++, offset++) {
-            *(rgba + offset) = ((float)colors[idx] * source_alpha)
-              + ((float)rgba[offset] * comp_alpha);
-          }
-        }
+  gif_parsed_t *gif = renderer->gif;
+  int shift = renderer->shift;
+  size_t index = renderer->frame;
+
+  for (; renderer->block < gif->block_count; renderer->block++) {
+    if (gif->blocks[renderer->block]->type != GIF_BLOCK_IMAGE) {
+      continue;
+    }
+
+    gif_image_block_t *block = (gif_image_block_t *)gif->blocks[renderer->block];
+    gif_decoded_image_t image = {
+      .top = block->descriptor.top >> shift,
+      .left = block->descriptor.left >> shift,
+      .width = scaled_size(block->descriptor.width, shift),
+      .height = scaled_size(block->descriptor.height, shift),
+      .rgba = renderer->image,
+    };
+    if (block->gc != NULL) {
+      image.dispose_method = block->gc->dispose_method;
+      image.delay_cs = block->gc->delay_cs;
+    }
+
+    // Images may be larger than the canvas, and are clipped when drawn.
+    size_t size = (size_t)image.width * image.height * 4;
+    if (size > renderer->image_size) {
+      unsigned char *larger = realloc(renderer->image, size);
+      if (larger == NULL) {
+        *error = GIF_ERR_MEMIO;
+        return 0;
       }
+      renderer->image = image.rgba = larger;
+      renderer->image_size = size;
+    }
+
+    pngif_surface_t scratch;
+    surface_from_rgba(&scratch, renderer->image, image.width, image.height);
+    gif_decode_image_into(gif, index, &scratch, &renderer->options, error);
+    if (*error != 0) {
+      return 0;
+    }
+    index += 1;
+
+    if (!renderer->animated) {
+      gif_draw_subimage(renderer->canvas, &image, renderer->width, renderer->height);
+      continue;
+    }
+
+    if (image.dispose_method == DISPOSE_RESTORE) {
+      renderer_save_region(renderer, image.left, image.top, image.width, image.height, 0);
+    }
+
+    gif_draw_subimage(renderer->canvas, &image, renderer->width, renderer->height);
+    renderer_output(renderer, surface);
+    *duration_ms = image.delay_cs * 10;
+
+    switch (image.dispose_method) {
+    case DISPOSE_BACKGROUND:
+      renderer_clear_canvas(renderer);
+      break;
+    case DISPOSE_RESTORE:
+      renderer_save_region(renderer, image.left, image.top, image.width, image.height, 1);
+      break;
     }
+
+    renderer->block += 1;
+    renderer->frame += 1;
+    return 1;
+  }
+
+  // Either the still image is complete, or an animated one has no more image
+  // blocks.
+  if (renderer->animated) {
+    renderer->frame = renderer->frame_count;
+    return 0;
   }
+
+  renderer_output(renderer, surface);
+  renderer->frame += 1;
+  return 1;
 }
 
 /**
- * Draws a decoded image block as an image frame. Takes into account the
- * previous canvas state and frame's disposal method to update canvas state
- * for next frame drawing.
+ * Draws the next PNG frame. A still PNG image is decoded straight into the
+ * output surface.
  *
- * @param frame Target frame container. It will hold the drawn frame data.
- * @param canvas Image canvas in a state before drawing the target frame.
- * @param width Canvas width.
- * @param height Canvas height.
- * @param image Image block to draw into the frame.
- * @param error Return error value.
+ * @param renderer Frame renderer.
+ * @param surface Output surface.
+ * @param duration_ms Output frame duration.
+ * @param error Error output.
+ *
+ * @return 1 if the frame was drawn, or 0 in case of an error.
  */
-void png_draw_frame(
-  image_frame_t *frame,
-  unsigned char *canvas,
-  u_int32_t width,
-  u_int32_t height,
-  png_frame_t *png,
+int renderer_next_png_frame(
+  image_renderer_t *renderer,
+  pngif_surface_t *surface,
+  u_int32_t *duration_ms,
   int *error
 ) {
-  unsigned char *rgba = malloc(width * height * 4);
-  if (rgba == NULL) {
-    *error = PNG_ERR_MEMIO;
-    return;
+  png_parsed_t *png = renderer->png;
+  int shift = renderer->shift;
+
+  if (png->anim_control == NULL || png->anim_control->num_frames == 0) {
+    png_decode_image_into(png, surface, &renderer->options, error);
+    if (*error != 0) {
+      return 0;
+    }
+    renderer->frame += 1;
+    return 1;
   }
 
-  // Paint previous state into frame.
-  memcpy(rgba, canvas, width * height * 4);
+  u_int32_t index = renderer->frame;
+  png_frame_control_t *control = png->frame_controls + index;
+  u_int32_t x_offset = control->x_offset >> shift;
+  u_int32_t y_offset = control->y_offset >> shift;
+  u_int32_t width = scaled_size(control->width, shift);
+  u_int32_t height = scaled_size(control->height, shift);
+
+  pngif_surface_t scratch;
+  surface_from_rgba(&scratch, renderer->image, width, height);
+  png_decode_frame_into(png, index, &scratch, &renderer->options, error);
+  if (*error != 0) {
+    return 0;
+  }
+
+  if (control->dispose_type == APNG_DISPOSE_TYPE_PREVIOUS) {
+    renderer_save_region(renderer, x_offset, y_offset, width, height, 0);
+  }
 
-  // Paint image into frame.
   png_draw_subimage(
-    rgba,
-    png->data,
+    renderer->canvas,
+    renderer->image,
+    renderer->width, renderer->height,
+    x_offset, y_offset,
     width, height,
-    png->x_offset, png->y_offset,
-    png->width, png->height,
-    png->blend_type
+    control->blend_type,
+    PNGIF_FORMAT_RGBA
   );
+  renderer_output(renderer, surface);
 
-  frame->rgba = rgba;
-  frame->duration_ms = png->delay * 1000;
+  float delay = (control->delay_den == 0)
+    ? (float)(control->delay_num) / 100.0
+    : (float)(control->delay_num) / (float)(control->delay_den);
+  *duration_ms = delay * 1000;
 
-  switch (png->dispose_type) {
-  case APNG_DISPOSE_TYPE_NONE:
-    // Canvas is set to the current frame.
-    memcpy(canvas, rgba, width * height * 4);
-    break;
+  switch (control->dispose_type) {
   case APNG_DISPOSE_TYPE_BACKGROUND:
-    // Canvas is set to background color.
-    memset(canvas, 0, (width * height * 4));
+    memset(renderer->canvas, 0, (size_t)renderer->width * renderer->height * 4);
     break;
   case APNG_DISPOSE_TYPE_PREVIOUS:
-    // Canvas is left at previous state.
+    renderer_save_region(renderer, x_offset, y_offset, width, height, 1);
     break;
   }
+
+  renderer->frame += 1;
+  return 1;
+}
+
+/** Pipelined composition **/
+
+/**
+ * Animation frames decoded on a separate thread, one by one, and handed over
+ * for composition through a bounded queue. Either the PNG or the GIF data is
+ * set.
+ */
+typedef struct {
+  frame_queue_t queue;
+  png_parsed_t *png;
+  gif_parsed_t *gif;
+  pngif_options_t *options;
+  pngif_pool_t *pool;
+  int shift;
+  int format;
+} image_pipeline_t;
+
+/**
+ * Decodes every frame image of the pipeline in order, and queues them up. Stops
+ * at the first error, after queueing it, or when the queue is closed.
+ *
+ * @param data Pipeline.
+ *
+ * @return NULL.
+ */
+void *image_pipeline_decode(void *data) {
+  image_pipeline_t *pipeline = data;
+  size_t count = (pipeline->png != NULL)
+    ? pipeline->png->anim_control->num_frames
+    : pipeline->gif->block_count;
+  size_t index = 0;
+
+  for (size_t idx = 0; idx < count; idx++) {
+    u_int32_t width, height;
+    if (pipeline->png != NULL) {
+      width = pipeline->png->frame_controls[idx].width;
+      height = pipeline->png->frame_controls[idx].height;
+    } else if (pipeline->gif->blocks[idx]->type == GIF_BLOCK_IMAGE) {
+      gif_image_block_t *block = (gif_image_block_t *)pipeline->gif->blocks[idx];
+      width = block->descriptor.width;
+      height = block->descriptor.height;
+    } else {
+      continue;
+    }
+
+    pngif_surface_t surface;
+    int error = 0;
+    width = scaled_size(width, pipeline->shift);
+    height = scaled_size(height, pipeline->shift);
+    unsigned char *rgba = pngif_pool_alloc(pipeline->pool, (size_t)width * height * 4);
+    if (rgba == NULL) {
+      error = (pipeline->png != NULL) ? PNG_ERR_MEMIO : GIF_ERR_MEMIO;
+    } else {
+      surface_from_rgba(&surface, rgba, width, height);
+      surface.format = pipeline->format;
+      if (pipeline->png != NULL) {
+        png_decode_frame_into(pipeline->png, index, &surface, pipeline->options, &error);
+      } else {
+        gif_decode_image_into(pipeline->gif, index, &surface, pipeline->options, &error);
+      }
+    }
+    index += 1;
+
+    if (error != 0) {
+      pngif_pool_release(pipeline->pool, rgba);
+      rgba = NULL;
+    }
+
+    if (frame_queue_push(&pipeline->queue, rgba, error) != 0) {
+      pngif_pool_release(pipeline->pool, rgba);
+      break;
+    }
+    if (error != 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Composes the frames of an animated PNG as they come out of the pipeline.
+ *
+ * @param pipeline Pipeline with PNG data, with its decoding thread running.
+ * @param output Animated image, with its size set.
+ * @param error Return error value.
+ */
+void png_compose_pipelined(image_pipeline_t *pipeline, animated_image_t *output, int *error) {
+  png_parsed_t *png = pipeline->png;
+  pngif_pool_t *pool = pipeline->pool;
+  int shift = pipeline->shift;
+
+  size_t canvas_size = (size_t)output->width * output->height * 4;
+  unsigned char *canvas = pngif_pool_alloc(pool, canvas_size);
+  frame_delta_t delta = { 0 };
+  if (
+    canvas == NULL ||
+    (output->delta_frames && frame_delta_init(
+      &delta,
+      output->width, output->height,
+      NULL, 1,
+      output->format,
+      pool
+    ) != 0)
+  ) {
+    pngif_pool_release(pool, canvas);
+    *error = PNG_ERR_MEMIO;
+    return;
+  }
+  memset(canvas, 0, canvas_size);
+
+  image_frame_t *previous = NULL;
+  for (u_int32_t idx = 0; idx < png->anim_control->num_frames; idx++) {
+    png_frame_t frame;
+    png_frame_control_t *control = png->frame_controls + idx;
+
+    frame.data = frame_queue_pop(&pipeline->queue, error);
+    if (*error != 0) {
+      break;
+    }
+
+    frame.width = scaled_size(control->width, shift);
+    frame.height = scaled_size(control->height, shift);
+    frame.x_offset = control->x_offset >> shift;
+    frame.y_offset = control->y_offset >> shift;
+    frame.dispose_type = control->dispose_type;
+    frame.blend_type = control->blend_type;
+    if (control->delay_den == 0) {
+      frame.delay = (float)(control->delay_num) / 100.0;
+    } else {
+      frame.delay = (float)(control->delay_num) / (float)(control->delay_den);
+    }
+
+    png_draw_frame(
+      output->frames + idx,
+      canvas,
+      output->width,
+      output->height,
+      &frame,
+      output->format,
+      previous,
+      output->delta_frames ? &delta : NULL,
+      pool,
+      error
+    );
+    pngif_pool_release(pool, frame.data);
+    if (*error != 0) {
+      break;
+    }
+
+    // The canvas keeps holding the frame, unless it's disposed.
+    previous = (frame.dispose_type == APNG_DISPOSE_TYPE_NONE) ? output->frames + idx : NULL;
+    output->frame_count += 1;
+  }
+
+  frame_delta_free(&delta);
+  pngif_pool_release(pool, canvas);
+}
+
+/**
+ * Composes the images of a GIF as they come out of the pipeline. Each image
+ * of an animated GIF is a frame, a still GIF composes all its images into a
+ * single frame.
+ *
+ * @param pipeline Pipeline with GIF data, with its decoding thread running.
+ * @param output Animated image, with its size set.
+ * @param animated Flag indicating whether the GIF is animated.
+ * @param ignore_background Flag to ignore the background color.
+ * @param error Return error value.
+ */
+void gif_compose_pipelined(
+  image_pipeline_t *pipeline,
+  animated_image_t *output,
+  int animated,
+  int ignore_background,
+  int *error
+) {
+  gif_parsed_t *gif = pipeline->gif;
+  pngif_pool_t *pool = pipeline->pool;
+  int shift = pipeline->shift;
+  size_t pixel_count = (size_t)output->width * output->height;
+
+  gif_color_t *background_color = NULL;
+  if (gif->screen.background_color_index > 0 && gif->global_color_table != NULL) {
+    background_color = gif->global_color_table + gif->screen.background_color_index;
+  }
+
+  unsigned char *canvas = pngif_pool_alloc(pool, pixel_count * 4);
+  frame_delta_t delta = { 0 };
+  if (
+    canvas == NULL ||
+    (animated && output->delta_frames && frame_delta_init(
+      &delta,
+      output->width, output->height,
+      background_color,
+      ignore_background,
+      output->format,
+      pool
+    ) != 0)
+  ) {
+    pngif_pool_release(pool, canvas);
+    *error = GIF_ERR_MEMIO;
+    return;
+  }
+  gif_fill_background(canvas, pixel_count, background_color, ignore_background, output->format);
+
+  image_frame_t *previous = NULL;
+  for (size_t idx = 0; idx < gif->block_count; idx++) {
+    if (gif->blocks[idx]->type != GIF_BLOCK_IMAGE) {
+      continue;
+    }
+
+    gif_image_block_t *block = (gif_image_block_t *)gif->blocks[idx];
+    gif_decoded_image_t image = {
+      .top = block->descriptor.top >> shift,
+      .left = block->descriptor.left >> shift,
+      .width = scaled_size(block->descriptor.width, shift),
+      .height = scaled_size(block->descriptor.height, shift),
+    };
+    if (block->gc != NULL) {
+      image.dispose_method = block->gc->dispose_method;
+      image.delay_cs = block->gc->delay_cs;
+    }
+
+    image.rgba = frame_queue_pop(&pipeline->queue, error);
+    if (*error != 0) {
+      break;
+    }
+
+    if (animated) {
+      gif_draw_frame(
+        output->frames + output->frame_count,
+        canvas,
+        output->width,
+        output->height,
+        background_color,
+        &image,
+        ignore_background,
+        output->format,
+        previous,
+        output->delta_frames ? &delta : NULL,
+        pool,
+        error
+      );
+    } else {
+      gif_draw_subimage(canvas, &image, output->width, output->height);
+    }
+    pngif_pool_release(pool, image.rgba);
+    if (*error != 0) {
+      break;
+    }
+
+    if (animated) {
+      // The canvas keeps holding the frame, unless it's disposed.
+      int dispose = image.dispose_method;
+      previous = (dispose == DISPOSE_NONE || dispose == DISPOSE_APPEND)
+        ? output->frames + output->frame_count
+        : NULL;
+      output->frame_count += 1;
+    }
+  }
+
+  frame_delta_free(&delta);
+  if (animated || *error != 0) {
+    pngif_pool_release(pool, canvas);
+    return;
+  }
+
+  *output->frames = (image_frame_t){
+    .rgba = canvas,
+    .width = output->width,
+    .height = output->height,
+  };
+  output->frame_count = 1;
 }
 
+/**
+ * Same as image_from_data_with_options(), but animation frames are decoded on
+ * a separate thread while earlier frames are composed. Still PNG images are
+ * decoded the usual way.
+ *
+ * @param data GIF/PNG data array.
+ * @param size Data size.
+ * @param ignore_background Don't use "background color index" values from the
+ *   Logical Screen Descriptor in GIF.
+ * @param options Decoding options, with a pipeline depth.
+ * @param error Return error value.
+ *
+ * @return Animated image data or NULL in case of any errors.
+ */
+animated_image_t *image_from_data_pipelined(
+  unsigned char *data,
+  size_t size,
+  int ignore_background,
+  pngif_options_t *options,
+  int *error
+) {
+  image_pipeline_t pipeline = { .options = options, .pool = options_pool(options) };
+  png_raw_t *raw = NULL;
+  size_t frame_count = 0;
+  int animated = 0;
+
+  // Decoding and composing threads share the pool.
+  pipeline.shift = options_scale_shift(options);
+  pipeline.format = options_format(options);
+  if (
+    pipeline.shift < 0 ||
+    pipeline.format < 0 ||
+    (pipeline.pool != NULL && !pipeline.pool->thread_safe)
+  ) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return NULL;
+  }
+
+  animated_image_t *output = calloc(1, sizeof(animated_image_t));
+  if (output == NULL) {
+    *error = PNG_ERR_MEMIO;
+    return NULL;
+  }
+  output->format = pipeline.format;
+  output->delta_frames = options->delta_frames;
+  output->pool = pipeline.pool;
+
+  if (size >= 8 && memcmp(PNG_HEADER, data, 8) == 0) {
+    // Frame data is inflated straight from the input array.
+    raw = png_raw_view_from_data(data, size, 1, error);
+    if (*error == 0) {
+      pipeline.png = png_parsed_from_raw_deferred(raw, error);
+    }
+    if (*error != 0) {
+      png_raw_free(raw);
+      free(output);
+      return NULL;
+    }
+
+    png_parsed_t *png = pipeline.png;
+    if (png->anim_control == NULL || png->anim_control->num_frames == 0) {
+      free(output);
+      png_decoded_t *decoded = png_decoded_from_parsed_with_options(png, options, error);
+      animated_image_t *image = (*error == 0) ? image_compose_png(decoded, options->delta_frames, error) : NULL;
+      png_decoded_free(decoded);
+      png_parsed_free(png);
+      png_raw_free(raw);
+      return image;
+    }
+
+    output->width = scaled_size(png->header.width, pipeline.shift);
+    output->height = scaled_size(png->header.height, pipeline.shift);
+    output->repeat_count = png->anim_control->num_plays;
+    frame_count = png->anim_control->num_frames;
+  } else if (size >= 3 && memcmp("GIF", data, 3) == 0) {
+    pipeline.gif = gif_parsed_from_data(data, size, error);
+    if (*error != 0) {
+      free(output);
+      return NULL;
+    }
+
+    gif_parsed_t *gif = pipeline.gif;
+    for (size_t idx = 0; idx < gif->block_count; idx++) {
+      gif_block_t *block = gif->blocks[idx];
+      if (block->type == GIF_BLOCK_IMAGE) {
+        frame_count += 1;
+      } else if (block->type == GIF_BLOCK_APPLICATION) {
+        gif_application_block_t *app = (gif_application_block_t *)block;
+        if (strcmp(app->identifier, "NETSCAPE") == 0 && strcmp(app->auth_code, "2.0") == 0) {
+          animated = 1;
+          output->repeat_count = app->data[1] | (app->data[2] << 8);
+        }
+      }
+    }
+
+    output->width = scaled_size(gif->screen.width, pipeline.shift);
+    output->height = scaled_size(gif->screen.height, pipeline.shift);
+    frame_count = animated ? frame_count : 1;
+  } else {
+    free(output);
+    *error = PNGIF_ERR_UNKNOWN_FORMAT;
+    return NULL;
+  }
+
+  pthread_t thread;
+  output->frames = calloc(frame_count > 0 ? frame_count : 1, sizeof(image_frame_t));
+  if (output->frames == NULL || frame_queue_init(&pipeline.queue, options->pipeline_depth) != 0) {
+    *error = (pipeline.png != NULL) ? PNG_ERR_MEMIO : GIF_ERR_MEMIO;
+  } else if (pthread_create(&thread, NULL, image_pipeline_decode, &pipeline) != 0) {
+    // Without a thread, frames are decoded before composing them instead.
+    frame_queue_free(&pipeline.queue, pipeline.pool);
+    pngif_options_t sequential = *options;
+    sequential.pipeline_depth = 0;
+    animated_image_t *image = image_from_data_with_options(data, size, ignore_background, &sequential, error);
+    animated_image_free(output);
+    output = image;
+  } else {
+    if (pipeline.png != NULL) {
+      png_compose_pipelined(&pipeline, output, error);
+    } else {
+      gif_compose_pipelined(&pipeline, output, animated, ignore_background, error);
+    }
+
+    // The decoding thread may still be waiting for space in the queue when
+    // composition stopped early.
+    frame_queue_close(&pipeline.queue);
+    pthread_join(thread, NULL);
+    frame_queue_free(&pipeline.queue, pipeline.pool);
+  }
+
+  if (pipeline.png != NULL) {
+    png_parsed_free(pipeline.png);
+    png_raw_free(raw);
+  } else {
+    gif_parsed_free(pipeline.gif);
+  }
+
+  if (*error != 0) {
+    animated_image_free(output);
+    return NULL;
+  }
+
+  return output;
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <pngif/options.h>
+#include "parallel.h"
+
+/** Private **/
+
+typedef struct {
+  pngif_task_fn task;
+  void *job;
+  size_t count;
+  // Index of the next task to take.
+  size_t next;
+} parallel_queue_t;
+
+/**
+ * Number of threads to run tasks on, including the calling thread.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return Thread count, at least 1.
+ */
+size_t options_thread_count(pngif_options_t *options) {
+  if (options == NULL || options->threads == 0) {
+    return 1;
+  }
+
+  if (options->threads < 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 1) ? cpus : 1;
+  }
+
+  return options->threads;
+}
+
+/**
+ * Takes tasks from the queue until there are none left.
+ *
+ * @param queue Task queue.
+ *
+ * @return NULL.
+ */
+void *parallel_worker(void *queue) {
+  parallel_queue_t *tasks = queue;
+
+  for (;;) {
+    size_t index = __atomic_fetch_add(&tasks->next, 1, __ATOMIC_RELAXED);
+    if (index >= tasks->count) {
+      break;
+    }
+    tasks->task(tasks->job, index);
+  }
+
+  return NULL;
+}
+
+/** Public **/
+
+int options_parallel(pngif_options_t *options) {
+  if (options == NULL || options->progress != NULL) {
+    return 0;
+  }
+
+  return options->executor != NULL || options_thread_count(options) > 1;
+}
+
+void parallel_run(pngif_options_t *options, pngif_task_fn task, void *job, size_t count) {
+  if (count == 0) {
+    return;
+  }
+
+  if (options != NULL && options->executor != NULL) {
+    options->executor(task, job, count, options->executor_context);
+    return;
+  }
+
+  parallel_queue_t queue = { task, job, count, 0 };
+  size_t thread_count = options_thread_count(options);
+  if (thread_count > count) {
+    thread_count = count;
+  }
+
+  pthread_t *threads = NULL;
+  size_t started = 0;
+  if (thread_count > 1) {
+    threads = malloc((thread_count - 1) * sizeof(pthread_t));
+  }
+  for (; threads != NULL && started < thread_count - 1; started++) {
+    if (pthread_create(&threads[started], NULL, parallel_worker, &queue) != 0) {
+      break;
+    }
+  }
+
+  parallel_worker(&queue);
+
+  for (size_t idx = 0; idx < started; idx++) {
+    pthread_join(threads[idx], NULL);
+  }
+  free(threads);
+}
@@ -0,0 +1,31 @@
+#ifndef _PNGIF_PARALLEL_INCLUDE
+#define _PNGIF_PARALLEL_INCLUDE
+
+#include <stdlib.h>
+
+#include <pngif/options.h>
+
+/**
+ * Tells whether the options ask for parallel decoding. Images are decoded one
+ * by one when there's a progress callback, so that reports come in order.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return 1 if tasks should be run in parallel, or 0.
+ */
+int options_parallel(pngif_options_t *options);
+
+/**
+ * Runs a task for every index from 0 to count - 1, and returns when all of
+ * them are done. Tasks run on the executor from the options if there is one,
+ * otherwise on the calling thread plus the extra threads the options ask for.
+ * If threads can't be started, the calling thread runs the rest of the tasks.
+ *
+ * @param options Decoding options, or NULL to run tasks one by one.
+ * @param task Task function.
+ * @param job Job data to pass to the task function.
+ * @param count Number of tasks.
+ */
+void parallel_run(pngif_options_t *options, pngif_task_fn task, void *job, size_t count);
+
+#endif
@@ -1,13 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <math.h>
 
 #include <pngif/utils.h>
 #include <pngif/png_raw.h>
 #include <pngif/png_parsed.h>
 #include <pngif/png_decoded.h>
+#include "png_util.h"
+#include "png_inflate.h"
+#include "png_filter.h"
+#include "png_unpack.h"
+#include "../parallel.h"
+#include "../pool.h"
+#include "../scale.h"
+#include "../surface.h"
 
 /** Private **/
 
@@ -45,33 +51,6 @@ int verify_color_bit_depth(png_parsed_t *parsed) {
   return 0;
 }
 
-/**
- * Returns the number of samples that compose a pixel for given color type.
- * For example, if the color type is TrueColor, it means that each pixel has
- * R, G, and B values, thus the number of samples is 3.
- *
- * @param type Color type value.
- *
- * @return Number of samples composing a pixel.
- */
-int samples_per_pixel(int type) {
-  switch (type) {
-  case COLOR_TYPE_GRAYSCALE:
-    return 1;
-  case COLOR_TYPE_TRUECOLOR:
-    return 3;
-  case COLOR_TYPE_INDEXED:
-    return 1;
-  case COLOR_TYPE_GRAYSCALE_ALPHA:
-    return 2;
-  case COLOR_TYPE_TRUECOLOR_ALPHA:
-    return 4;
-  }
-
-  // Unknown color type. We shouldn't be here.
-  return -1;
-}
-
 /**
  * De-filtering functions
  *
@@ -96,574 +75,709 @@ int samples_per_pixel(int type) {
  **/
 
 /**
- * For given scanline number and byte position in a scanline, returns a
- * corresponding byte value in a previous pixel.
+ * Returns a distance in bytes between a byte and its 'previous byte' in a
+ * scanline, i.e. the number of bytes per pixel, rounded up to 1 for bit depths
+ * lower than 8.
  *
- * @param data Array of pixel data.
- * @param width Size of a single scanline.
- * @param pos Byte offset to the target positon within a scanline
- * @param depth Bit depth of the image data.
- * @param bpp Number of bytes per pixel in the image.
+ * @param type Color type of the image.
+ * @param depth Bit depth of the image.
  *
- * @return Byte value for the previous pixel in the same byte position.
+ * @return Number of bytes per complete pixel.
  */
-unsigned char prev_byte(unsigned char *data, size_t width, size_t line, size_t pos, int depth, int bpp) {
-  if (pos < bpp) {
-    return 0;
-  }
-
-  if (depth < 8) {
-    return data[width * line + pos - 1];
-  } else {
-    return data[width * line + pos - bpp];
-  }
+int filter_bpp(int type, int depth) {
+  return (depth < 8) ? 1 : (samples_per_pixel(type) * (depth / 8));
 }
 
+/** Decoding **/
+
 /**
- * For given scanline number and byte position in a scanline, returns a
- * corresponding byte value in a pixel above current pixel.
- *
- * @param data Array of pixel data.
- * @param width Size of a single scanline.
- * @param pos Byte offset to the target positon within a scanline
- * @param depth Bit depth of the image data.
- * @param bpp Number of samples per pixel in the image.
- *
- * @return Byte value for the pixel above in the same byte position.
+ * Source of filtered scanlines. Scanlines are either taken from image data
+ * that was inflated beforehand, or inflated on demand, one at a time, straight
+ * from the raw data chunks.
  */
-unsigned char up_byte(unsigned char *data, size_t width, size_t line, size_t pos, int depth, int bpp) {
-  if (line == 0)
-    return 0;
-
-  return data[width * (line - 1) + pos];
-}
+typedef struct {
+  // Inflated image data, or NULL if data is inflated on demand.
+  unsigned char *data;
+  size_t length;
+  size_t offset;
+  // Inflater for on demand decompression.
+  png_inflate_t *inflater;
+} png_row_source_t;
 
 /**
- * For given scanline number and byte position in a scanline, returns an
- * average of previous byte and the byte above current byte.
+ * Returns next filtered scanline from the source.
  *
- * @param data Array of pixel data.
- * @param width Size of a single scanline.
- * @param pos Byte offset to the target positon within a scanline
- * @param depth Bit depth of the image data.
- * @param bpp Number of samples per pixel in the image.
+ * @param source Scanline source.
+ * @param buffer Buffer to inflate the scanline into, if needed.
+ * @param size Scanline size, including the filter type byte.
+ * @param error Error output.
  *
- * @return Average of the byte in the previous pixel and a byte above current
- *   pixel.
+ * @return Pointer to the filtered scanline, or NULL in case of an error.
  */
-unsigned char avg_byte(unsigned char *data, size_t width, size_t line, size_t pos, int depth, int bpp) {
-  // Using unsigned short to avoid overflow. Overflow is expected in other
-  // restoration functions, but not in Average or Paeth math.
-  unsigned short uprev = prev_byte(data, width, line, pos, depth, bpp);
-  unsigned short uup = up_byte(data, width, line, pos, depth, bpp);
-  unsigned short result = (uprev + uup) >> 1;
-  return (unsigned char)result;
+unsigned char *row_source_next(
+  png_row_source_t *source,
+  unsigned char *buffer,
+  size_t size,
+  int *error
+) {
+  if (source->inflater != NULL) {
+    int err = png_inflate_read(source->inflater, buffer, size);
+    if (err != 0) {
+      *error = err;
+      return NULL;
+    }
+    return buffer;
+  }
+
+  if (size > source->length - source->offset) {
+    *error = PNG_ERR_DATA_SIZE;
+    return NULL;
+  }
+
+  unsigned char *row = source->data + source->offset;
+  source->offset += size;
+  return row;
 }
 
 /**
- * For given scanline number and byte position in a scanline, returns a
- * corresponding byte value for a pixel right before the pixel above the target
- * pixel.
- *
- * @param data Array of pixel data.
- * @param width Size of a single scanline.
- * @param pos Byte offset to the target positon within a scanline
- * @param depth Bit depth of the image data.
- * @param bpp Number of samples per pixel in the image.
- *
- * @return A byte value from the pixel that is one pixel above and before the
- *   pixel containing target byte.
+ * Working memory for decoding: previous and current defiltered scanlines, a
+ * buffer for inflated filtered scanline, and a row of unpacked pixels. Sized for
+ * the full image width, so it fits every Adam7 pass.
  */
-unsigned char prev_up_byte(unsigned char *data, size_t width, size_t line, size_t pos, int depth, int bpp) {
-  if (line == 0)
-    return 0;
-
-  if (pos < bpp)
-    return 0;
-
-  if (depth < 8) {
-    return data[width * (line - 1) + pos - 1];
-  } else {
-    return data[width * (line - 1) + pos - bpp];
-  }
-}
+typedef struct {
+  // All buffers share one allocation, from the pool if there's one.
+  pngif_pool_t *pool;
+  unsigned char *memory;
+  unsigned char *previous;
+  unsigned char *current;
+  unsigned char *buffer;
+  unsigned char *pixels;
+} png_row_buffers_t;
 
 /**
- * For given scanline number and byte position in a scanline, returns a
- * Paeth predictor value, which is calculated from the previous byte value
- * above byte value, and the byte value previous to the above byte value.
+ * Allocates row buffers.
  *
- * @param data Array of pixel data.
- * @param width Size of a single scanline.
- * @param pos Byte offset to the target positon within a scanline
- * @param depth Bit depth of the image data.
- * @param bpp Number of samples per pixel in the image.
+ * @param buffers Buffers to allocate.
+ * @param scanline_size Size of the widest scanline, without the filter byte.
+ * @param width Width of the widest scanline in pixels.
+ * @param pool Buffer pool, or NULL.
  *
- * @return Paeth predictor value for the given byte.
+ * @return Error code, or 0 on success.
  */
-unsigned char paeth_byte(unsigned char *data, size_t width, size_t line, size_t pos, int depth, int bpp) {
-  short a = prev_byte(data, width, line, pos, depth, bpp);
-  short b = up_byte(data, width, line, pos, depth, bpp);
-  short c = prev_up_byte(data, width, line, pos, depth, bpp);
-
-  short p = a + b - c;
-  short pa = abs(p - a);
-  short pb = abs(p - b);
-  short pc = abs(p - c);
-
-  if ((pa <= pb) && (pa <= pc)) {
-    return a;
-  } else if (pb <= pc) {
-    return b;
-  } else {
-    return c;
+int row_buffers_alloc(png_row_buffers_t *buffers, size_t scanline_size, size_t width, pngif_pool_t *pool) {
+  unsigned char *memory = pngif_pool_alloc(pool, 3 * (scanline_size + 1) + width * 4);
+  buffers->pool = pool;
+  buffers->memory = memory;
+  if (memory == NULL) {
+    return PNG_ERR_MEMIO;
   }
+
+  buffers->previous = memory;
+  buffers->current = memory + (scanline_size + 1);
+  buffers->buffer = memory + 2 * (scanline_size + 1);
+  buffers->pixels = memory + 3 * (scanline_size + 1);
+  return 0;
+}
+
+void row_buffers_free(png_row_buffers_t *buffers) {
+  pngif_pool_release(buffers->pool, buffers->memory);
 }
 
-/** De-filetering algorithm **/
+/**
+ * Placement of a reduced image, i.e. a single Adam7 pass, or the whole image
+ * if it's not interlaced, in the final image.
+ */
+typedef struct {
+  // Pass dimensions.
+  size_t width;
+  size_t height;
+  // Position of the first pass pixel in the final image.
+  size_t x_start;
+  size_t y_start;
+  // Distance between pass pixels in the final image.
+  size_t x_step;
+  size_t y_step;
+  // Size of the block each pass pixel is replicated over for progressive
+  // display, or 0 to not replicate.
+  size_t block_width;
+  size_t block_height;
+  // Box filter to reduce the image with, or NULL to decode at full size.
+  box_filter_t *filter;
+} png_pass_t;
 
 /**
- * Reverses the filter applications for given image data. In PNG, all scanlines
- * are stored filtered. A filtered scanlane consists of a byte value of the
- * filter, followed by the byte values calculated as a result of applying the
- * selected filter to the original image data.
+ * State shared by decoding of all images of a file.
+ */
+typedef struct {
+  pngif_options_t *options;
+  // Reduced-resolution decoding scale, as a power of two.
+  int scale_shift;
+  // Pixel format of images decoded into new buffers.
+  int format;
+  // Index of the image being decoded, in decoding order.
+  u_int32_t image;
+  // Flag indicating that the progress callback asked to stop decoding.
+  int stopped;
+} png_decode_context_t;
+
+/**
+ * Reports a completed pass to the progress callback, if there's one.
  *
- * @param data Image data in a filtered format. It should be larger than the
- *   clear image data, because each scanline is preceded by a filter byte.
- * @param width Image width in pixels.
- * @param height Image height in pixels.
- * @param type Color type of the image.
- * @oaram depth Bit dfepth of the image.
- * @param error Error return value.
+ * @param context Decoding context.
+ * @param pass Number of completed passes.
+ * @param pass_count Total number of passes.
+ * @param surface Image canvas.
+ * @param width Image width.
+ * @param height Image height.
  *
- * @return Defiltered data of size (width * height) * (samples) * (depth / 8).
+ * @return Flag indicating that decoding should stop.
  */
-unsigned char *defilter_data(unsigned char *data, size_t width, size_t height, int type, int depth, int *error) {
-  int bytes_per_line = (width * samples_per_pixel(type) * depth + 8 - 1) / 8;
-  // Number of bytes per pixel.
-  int bpp = (depth < 8) ? 1 : (samples_per_pixel(type) * (depth / 8));
+int report_progress(
+  png_decode_context_t *context,
+  int pass,
+  int pass_count,
+  pngif_surface_t *surface,
+  size_t width,
+  size_t height
+) {
+  if (context->options == NULL || context->options->progress == NULL) {
+    return 0;
+  }
 
-  unsigned char *output = malloc(bytes_per_line * height);
-  if (output == NULL) {
-    *error = PNG_ERR_MEMIO;
-    return NULL;
+  pngif_progress_t progress = {
+    .image = context->image,
+    .pass = pass,
+    .pass_count = pass_count,
+    .width = width,
+    .height = height,
+    .rgba = surface->pixels,
+    .stride = surface->stride,
+    .format = surface->format,
+  };
+
+  if (context->options->progress(&progress, context->options->progress_context) != 0) {
+    context->stopped = 1;
   }
 
-  for (size_t line = 0; line < height; line++) {
-    // Filter type. One of 'None', 'Sub', 'Up', 'Average', 'Paeth'.
-    u_int8_t filter_type = data[line * (bytes_per_line + 1)];
+  return context->stopped;
+}
 
-    // Transform each byte.
-    for (u_int32_t byte = 0; byte < bytes_per_line; byte++) {
-      u_int32_t out_offset = line * (bytes_per_line) + byte;
-      u_int32_t in_offset = line * (bytes_per_line + 1) + byte + 1;
+/**
+ * Replicates pixels of a decoded pass row over their blocks: to the right on
+ * the same row, and then the whole row down over the rows of the next passes.
+ * Pixels of the earlier passes on the same row are already replicated, so the
+ * row ends up complete.
+ *
+ * @param pass Pass placement.
+ * @param surface Output surface.
+ * @param y Row index in the final image.
+ * @param width Final image width.
+ * @param height Final image height.
+ */
+void replicate_row(png_pass_t *pass, pngif_surface_t *surface, size_t y, size_t width, size_t height) {
+  unsigned char *row = surface_row(surface, y);
 
-      switch (filter_type) {
-      case FILTER_NONE:
-        output[out_offset] = data[in_offset];
-        break;
-      case FILTER_SUB:
-        output[out_offset] = data[in_offset] + prev_byte(output, bytes_per_line, line, byte, depth, bpp);
-        break;
-      case FILTER_UP:
-        output[out_offset] = data[in_offset] + up_byte(output, bytes_per_line, line, byte, depth, bpp);
-        break;
-      case FILTER_AVG:
-        output[out_offset] = data[in_offset] + avg_byte(output, bytes_per_line, line, byte, depth, bpp);
-        break;
-      case FILTER_PAETH:
-        output[out_offset] = data[in_offset] + paeth_byte(output, bytes_per_line, line, byte, depth, bpp);
-        break;
+  if (pass->block_width > 1) {
+    for (size_t x = pass->x_start; x < width; x += pass->x_step) {
+      for (size_t fill = x + 1; fill < x + pass->block_width && fill < width; fill++) {
+        memcpy(row + fill * 4, row + x * 4, 4);
       }
     }
   }
 
-  return output;
+  for (size_t line = y + 1; line < y + pass->block_height && line < height; line++) {
+    memcpy(surface_row(surface, line), row, width * 4);
+  }
 }
 
 /**
- * Max unsigned integer value for given bit depth.
+ * Decodes a reduced image straight into the final image. Each scanline is
+ * taken from the source, defiltered against the previous scanline and
+ * unpacked right away, in the surface pixel format. Pass pixels spread over
+ * the image are unpacked into a row buffer first, and then copied to their
+ * places. With a box filter, RGBA rows are unpacked into the row buffer and
+ * fed to the filter instead, which converts output rows itself.
  *
- * @param depth Bit depth.
+ * @param source Source of filtered scanlines.
+ * @param buffers Row buffers.
+ * @param unpacker Scanline unpacker for the image format.
+ * @param pass Pass placement.
+ * @param surface Output surface for the final image.
+ * @param width Final image width in pixels.
+ * @param height Final image height in pixels.
  *
- * @return Maximum integer value for given number of bits.
+ * @return Error code, or 0 on success.
  */
-u_int16_t max_int(int depth) {
-  switch (depth) {
-  case 1:
-    return 1;
-  case 2:
-    return 3;
-  case 4:
-    return 15;
-  case 8:
-    return 255;
-  case 16:
-    return 65535;
-  default:
-    return 0; // Unsupported bit depth. We shouldn't be here
+int decode_pass(
+  png_row_source_t *source,
+  png_row_buffers_t *buffers,
+  png_unpacker_t *unpacker,
+  png_pass_t *pass,
+  pngif_surface_t *surface,
+  size_t width,
+  size_t height
+) {
+  size_t scanline_size = png_scanline_size(pass->width, unpacker->type, unpacker->depth);
+  int bpp = filter_bpp(unpacker->type, unpacker->depth);
+  int direct = (pass->x_step == 1);
+  int err = 0;
+
+  // Previous scanline is all zeroes for the first line of a pass.
+  unsigned char *previous = buffers->previous;
+  unsigned char *current = buffers->current;
+  memset(previous, 0, scanline_size);
+
+  for (size_t line = 0; line < pass->height; line++) {
+    unsigned char *filtered = row_source_next(source, buffers->buffer, scanline_size + 1, &err);
+    if (filtered == NULL) {
+      break;
+    }
+
+    err = png_defilter_row(filtered, current, previous, scanline_size, bpp);
+    if (err != 0) {
+      break;
+    }
+
+    size_t y = pass->y_start + line * pass->y_step;
+    unsigned char *row = surface_row(surface, y) + pass->x_start * 4;
+    if (pass->filter != NULL) {
+      unpacker->unpack(unpacker, current, pass->width, buffers->pixels);
+      box_filter_push_row(pass->filter, buffers->pixels, surface);
+    } else if (direct) {
+      unpacker->unpack(unpacker, current, pass->width, row);
+    } else {
+      unpacker->unpack(unpacker, current, pass->width, buffers->pixels);
+      for (size_t x = 0; x < pass->width; x++) {
+        memcpy(row + x * pass->x_step * 4, buffers->pixels + x * 4, 4);
+      }
+    }
+
+    if (pass->block_width > 0) {
+      replicate_row(pass, surface, y, width, height);
+    }
+
+    // Current scanline becomes previous for the next one.
+    unsigned char *tmp = previous;
+    previous = current;
+    current = tmp;
   }
+
+  return err;
 }
 
 /**
- * Returns a sample value extracted from the image data at given byte offset and bit offset.
+ * Decodes non-interlaced image data. For reduced-resolution decoding, rows go
+ * through a box filter, so only the reduced image is written.
  *
- * @param data Image data.
- * @param byte_offset Byte offset within the image data.
- * @param bit_offset Bit offset to the target sample value within the byte.
- * @param depth Bit depth of the image.
- * @param type Color type of the image.
+ * @param source Source of filtered scanlines.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param unpacker Scanline unpacker for the image format.
+ * @param surface Output surface.
+ * @param context Decoding context.
  *
- * @return Sample value extracted from the image data at given position.
+ * @return Error code, or 0 on success.
  */
-u_int16_t take_sample(
-  unsigned char *data,
-  u_int32_t byte_offset,
-  u_int32_t bit_offset,
-  int depth,
-  int type
+int decode_normal_data(
+  png_row_source_t *source,
+  size_t width,
+  size_t height,
+  png_unpacker_t *unpacker,
+  pngif_surface_t *surface,
+  png_decode_context_t *context
 ) {
-  u_int16_t sample = 0;
-  if (depth == 16) {
-    // 16-bit values are in network byte order, so we read and reverse it (if needed).
-    sample = ntohs(*(u_int16_t*)(data + byte_offset));
-  } else if (depth == 8) {
-    sample = data[byte_offset];
-  } else {
-    // To isolate sample value in a byte we first erase bit_index previous bits,
-    // and then erase all bits after the sample. For example, let's say we have
-    // bit depth of 2, and current sample offset of 2:
-    //   input byte: 01[11]0101
-    //   1. erase bit_index first bits by shift left: 01[11]0101 -> [11]010100
-    //   2. erase bits after sample by shift right: [11]010100 -> 0000000[11]
-    unsigned char byte = data[byte_offset];
-    unsigned char sample_value = byte << bit_offset;
-    sample = sample_value >> (8 - depth);
-  }
-
-  return sample;
-}
+  png_row_buffers_t buffers;
+  box_filter_t filter = { 0 };
+  png_pass_t pass = { width, height, 0, 0, 1, 1, 0, 0, NULL };
 
-/**
- * Converts 16-bit pixel values to 8-bit ones.
- *
- * @param original Original pixel color values.
- * @param dest Pointer to the destination pixel values.
- * @param color_type Image's color type.
- * @param depth Image's bit depth.
- */
-void scale_pixel(u_int16_t *original, unsigned char *dest, int color_type, int depth) {
-  for (int idx = 0; idx < 4; idx++) {
-    if (depth == 16) {
-      dest[idx] = (unsigned char)floor(((float)original[idx] * (float)max_int(8) / (float)max_int(16)) + 0.5);
-    } else if (depth == 8 || color_type == COLOR_TYPE_INDEXED) {
-      dest[idx] = original[idx];
-    } else {
-      dest[idx] = original[idx] * 255 / max_int(depth);
+  if (context->scale_shift > 0) {
+    if (box_filter_init(&filter, width, height, context->scale_shift, 0, options_pool(context->options)) != 0) {
+      return PNG_ERR_MEMIO;
     }
+    pass.filter = &filter;
   }
+
+  size_t scanline_size = png_scanline_size(width, unpacker->type, unpacker->depth);
+  int err = row_buffers_alloc(&buffers, scanline_size, width, options_pool(context->options));
+  if (err == 0) {
+    err = decode_pass(source, &buffers, unpacker, &pass, surface, width, height);
+  }
+  row_buffers_free(&buffers);
+  box_filter_free(&filter);
+
+  if (err == 0) {
+    size_t out_width = scaled_size(width, context->scale_shift);
+    size_t out_height = scaled_size(height, context->scale_shift);
+    report_progress(context, 1, 1, surface, out_width, out_height);
+  }
+
+  return err;
 }
 
 /**
- * Transforms "packed" image data, i. e. an array of concatenated pixel values
- * with a specific sample size into an array of RGBA values.
+ * Decodes interlaced image data.
+ *
+ * Adam7 Interlacing method defines 7 passes for interlacing:
+ *
+ * 1 6 4 6 2 6 4 6
+ * 7 7 7 7 7 7 7 7
+ * 5 6 5 6 5 6 5 6
+ * 7 7 7 7 7 7 7 7
+ * 3 6 4 6 3 6 4 6
+ * 7 7 7 7 7 7 7 7
+ * 5 6 5 6 5 6 5 6
+ * 7 7 7 7 7 7 7 7
+ *
+ * This pattern is placed on top of the image data starting from upper left
+ * pixel, and repeated. Thus each pixel gets a "pass" number assigned to it.
+ * Then pixels with the matching pass number are extracted into a separate
+ * "reduced image", thus forming 1 to 7 new sub-images. Each image is then
+ * serialized as a normal PNG image, and all serialized images' data is
+ * concatenated to form the final data stream.
  *
- * @param data Image data in a packed format.
+ * So, to deinterlace the image, we iterate over pass numbers and decode each
+ * "reduced image" straight into the final image. The target pixel's position
+ * is determined from the source pixel's coordinates in the reduced image and
+ * current pass number.
+ *
+ * If there's a progress callback, it's called after each pass, with pixels
+ * of the passes to come filled in by replicating the decoded ones.
+ *
+ * Pixels of the first passes form a regular grid: every 8th pixel in both
+ * directions after pass 1, every 4th after pass 3, and every 2nd after pass 5.
+ * So a reduced image at 1/8, 1/4 or 1/2 scale is decoded from those passes
+ * only, placed with their grids scaled down, and the rest of the data is
+ * never inflated.
+ *
+ * @param source Source of filtered scanlines.
  * @param width Image width in pixels.
  * @param height Image height in pixels.
- * @param type Color type of the image.
- * @param depth Sample bit depth of the image.
- * @param palette Optional pointer to the image's palette. Relevant for
- *   Index-Colored images.
- * @param transparency Optional transparency data. Used to change transparency
- *   of certain pixels based on the data.
+ * @param unpacker Scanline unpacker for the image format.
+ * @param surface Output surface.
+ * @param context Decoding context.
  *
- * @return An array of RGBA pixel values extracted from the original samples.
+ * @return Error code, or 0 on success.
  */
-unsigned char *unpack_data(
-  unsigned char *data,
+int decode_interlaced_data(
+  png_row_source_t *source,
   size_t width,
   size_t height,
-  int type,
-  int depth,
-  png_palette_t *palette,
-  png_transparency_t *transparency,
-  int *error
+  png_unpacker_t *unpacker,
+  pngif_surface_t *surface,
+  png_decode_context_t *context
 ) {
-  // Number of bytes in a scanline.
-  u_int32_t scanline_size = (width * samples_per_pixel(type) * depth + 8 - 1) / 8;
-  // Offset to current pixel in output.
-  u_int32_t out_offset = 0;
-  // Temp storage for 'current' pixel we're reading from image data.
-  u_int16_t pixel[4] = { 0 };
-  // Pixel color value offset;
-  u_int32_t pixel_offset = 0;
-
-  unsigned char *output = malloc(width * height * 4); // 4-byte RGBA.
-  if (output == NULL) {
-    *error = PNG_ERR_MEMIO;
-    return NULL;
-  }
-
-  if (type == COLOR_TYPE_INDEXED && palette == NULL) {
-    *error = PNG_ERR_INVALID_FORMAT;
-    return NULL;
-  }
+  png_row_buffers_t buffers;
+  int progressive = (context->options != NULL && context->options->progress != NULL);
+  int shift = context->scale_shift;
+  int pass_count = 7 - 2 * shift;
+  size_t out_width = scaled_size(width, shift);
+  size_t out_height = scaled_size(height, shift);
+
+  // The last pass has full-width scanlines, so buffers fit all passes.
+  size_t scanline_size = png_scanline_size(width, unpacker->type, unpacker->depth);
+  int err = row_buffers_alloc(&buffers, scanline_size, width, options_pool(context->options));
+
+  for (int idx = 0; idx < pass_count && err == 0; idx++) {
+    png_pass_t pass = { 0 };
+    adam7_pass_size(idx, width, height, &pass.width, &pass.height);
+    adam7_pass_grid(idx, &pass.x_start, &pass.y_start, &pass.x_step, &pass.y_step);
+    if (progressive) {
+      adam7_pass_block(idx, &pass.block_width, &pass.block_height);
+    }
 
-  for (int line = 0; line < height; line++) {
-    for (int idx = 0; idx < width * samples_per_pixel(type); idx++) {
-      // Bit offset to current sample: [scanline offset] + [sample index] * [bits per sample];
-      u_int32_t sample_offset = (line * scanline_size) * 8 + idx * depth;
-      // Full byte offset to current sample.
-      u_int32_t byte_offset = sample_offset / 8;
-      // Bit offset within current byte.
-      u_int32_t bit_offset = sample_offset % 8;
-
-      // Sample value.
-      u_int16_t sample = take_sample(data, byte_offset, bit_offset, depth, type);
-
-      switch (type) {
-      case COLOR_TYPE_GRAYSCALE:
-        pixel[0] = sample;
-        pixel[1] = sample;
-        pixel[2] = sample;
-        if (transparency != NULL && transparency->grayscale == sample) {
-          pixel[3] = 0;
-        } else {
-          pixel[3] = max_int(depth);
-        }
-
-        pixel_offset += 4;
-        break;
-      case COLOR_TYPE_TRUECOLOR:
-        // First three samples are R, G, B
-        pixel[pixel_offset] = sample;
-        pixel_offset += 1;
-        // Next byte is alpha, check transparency table.
-        if (pixel_offset == 3) {
-          if (transparency != NULL &&
-            transparency->red == pixel[0] &&
-            transparency->green == pixel[1] &&
-            transparency->blue == pixel[2]
-          ) {
-            pixel[3] = 0;
-          } else {
-            pixel[3] = max_int(depth);
-          }
-          pixel_offset += 1;
-        }
-        break;
-      case COLOR_TYPE_GRAYSCALE_ALPHA:
-        // first sample -> same value for each of RGB, next sample -> alpha
-        if ((pixel_offset % 4) == 0) {
-          pixel[pixel_offset + 0] = sample; // R
-          pixel[pixel_offset + 1] = sample; // G
-          pixel[pixel_offset + 2] = sample; // B
-          pixel_offset += 3;
-        } else {
-          pixel[pixel_offset] = sample; // A
-          pixel_offset += 1;
-        }
-        break;
-      case COLOR_TYPE_TRUECOLOR_ALPHA:
-        // Each sample is 1-to-1 match to output.
-        pixel[pixel_offset] = sample;
-        pixel_offset += 1;
-        break;
-      case COLOR_TYPE_INDEXED:
-        // Sample value should be within the palette size. Otherwise it's an error
-        // and we skip it.
-        if (sample < palette->length) {
-          png_color_index_t color = palette->entries[sample];
-          pixel[0] = color.red;
-          pixel[1] = color.green;
-          pixel[2] = color.blue;
-          if (transparency != NULL) {
-            pixel[3] = transparency->entries[sample];
-          } else {
-            pixel[3] = max_int(8);
-          }
-        }
-        pixel_offset += 4;
-        break;
-      }
+    // All coordinates of the used passes are multiples of the scale.
+    pass.x_start >>= shift;
+    pass.y_start >>= shift;
+    pass.x_step >>= shift;
+    pass.y_step >>= shift;
+    pass.block_width >>= shift;
+    pass.block_height >>= shift;
+
+    // Passes without pixels are absent from the data.
+    if (pass.width > 0 && pass.height > 0) {
+      err = decode_pass(source, &buffers, unpacker, &pass, surface, out_width, out_height);
+    }
 
-      // Full pixel is filled, convert it to 8-bit and save.
-      if (pixel_offset == 4) {
-        scale_pixel(pixel, output + out_offset, type, depth);
-        out_offset += 4;
-        pixel_offset = 0;
-      }
+    if (err == 0 && report_progress(context, idx + 1, pass_count, surface, out_width, out_height)) {
+      break;
     }
   }
 
-  return output;
+  row_buffers_free(&buffers);
+  return err;
 }
 
-unsigned char *decode_normal_data(
-  unsigned char *data,
-  size_t width,
-  size_t height,
-  int type,
-  int depth,
-  png_palette_t *palette,
-  png_transparency_t *transparency,
-  int *error
+/**
+ * Decodes image data of the default image or an animation frame into a
+ * surface. The image is reduced when decoding at reduced resolution.
+ *
+ * @param parsed Parsed PNG data.
+ * @param width Image width.
+ * @param height Image height.
+ * @param data Image data, either inflated or deferred.
+ * @param surface Output surface.
+ * @param context Decoding context.
+ *
+ * @return Error code, or 0 on success.
+ */
+int decode_image_into(
+  png_parsed_t *parsed,
+  u_int32_t width,
+  u_int32_t height,
+  png_data_t *data,
+  pngif_surface_t *surface,
+  png_decode_context_t *context
 ) {
-  // Defilter data.
-  unsigned char *defiltered = defilter_data(
-    data,
-    width,
-    height,
-    type,
-    depth,
-    error
-  );
+  png_row_source_t source = { 0 };
+  png_inflate_t inflater;
+  png_unpacker_t unpacker;
 
-  if (defiltered == NULL || *error != 0) {
-    return NULL;
+  if (parsed->header.interlace != 0 && parsed->header.interlace != 1) {
+    return PNG_ERR_UNSUPPORTED_FORMAT;
   }
 
-  // Decode pixel data.
-  unsigned char *unpacked = unpack_data(
-    defiltered,
-    width,
-    height,
-    type,
-    depth,
-    palette,
-    transparency,
-    error
+  // Box filter averages straight RGBA pixels, and converts its output.
+  int filtered = (parsed->header.interlace == 0 && context->scale_shift > 0);
+  int err = png_unpacker_init(
+    &unpacker,
+    parsed->header.color_type,
+    parsed->header.depth,
+    parsed->palette,
+    parsed->transparency,
+    filtered ? PNGIF_FORMAT_RGBA : surface->format
   );
+  if (err != 0) {
+    return err;
+  }
+
+  if (data->data != NULL) {
+    source.data = data->data;
+    source.length = data->length;
+  } else {
+    err = png_inflate_init(&inflater, parsed->raw, data->chunk_index, options_pool(context->options));
+    if (err != 0) {
+      return err;
+    }
+    source.inflater = &inflater;
+  }
+
+  if (parsed->header.interlace == 1) {
+    err = decode_interlaced_data(&source, width, height, &unpacker, surface, context);
+  } else {
+    err = decode_normal_data(&source, width, height, &unpacker, surface, context);
+  }
 
-  free (defiltered);
-  return unpacked;
+  // Make sure there's nothing left in the stream after the last scanline,
+  // unless decoding was stopped early, or skipped the last interlace passes.
+  int complete = !context->stopped && (parsed->header.interlace == 0 || context->scale_shift == 0);
+  if (source.inflater != NULL) {
+    if (err == 0 && complete) {
+      err = png_inflate_finish(&inflater);
+    } else {
+      png_inflate_end(&inflater);
+    }
+  }
+
+  return err;
 }
 
-unsigned char *decode_interlaced_data(
-  unsigned char *data,
-  size_t width,
-  size_t height,
-  int type,
-  int depth,
-  png_palette_t *palette,
-  png_transparency_t *transparency,
+/**
+ * Decodes image data of the default image or an animation frame into a new
+ * buffer, in the pixel format of the context.
+ *
+ * @param parsed Parsed PNG data.
+ * @param width Image width.
+ * @param height Image height.
+ * @param data Image data, either inflated or deferred.
+ * @param context Decoding context.
+ * @param error Error output.
+ *
+ * @return An array of pixel values, or NULL in case of an error.
+ */
+unsigned char *decode_image(
+  png_parsed_t *parsed,
+  u_int32_t width,
+  u_int32_t height,
+  png_data_t *data,
+  png_decode_context_t *context,
   int *error
 ) {
-  unsigned char *output = malloc(width * height * 4); // 4-byte RGBA.
+  pngif_surface_t surface;
+  size_t out_width = scaled_size(width, context->scale_shift);
+  size_t out_height = scaled_size(height, context->scale_shift);
+
+  pngif_pool_t *pool = options_pool(context->options);
+  unsigned char *output = pngif_pool_alloc(pool, out_width * out_height * 4); // 4-byte pixels.
   if (output == NULL) {
     *error = PNG_ERR_MEMIO;
     return NULL;
   }
 
-  /**
-   * Adam7 Interlacing method defines 7 passes for interlacing:
-   *
-   * 1 6 4 6 2 6 4 6
-   * 7 7 7 7 7 7 7 7
-   * 5 6 5 6 5 6 5 6
-   * 7 7 7 7 7 7 7 7
-   * 3 6 4 6 3 6 4 6
-   * 7 7 7 7 7 7 7 7
-   * 5 6 5 6 5 6 5 6
-   * 7 7 7 7 7 7 7 7
-   *
-   * This pattern is placed on top of the image data starting from upper left
-   * pixel, and repeated. Thus each pixel gets a "pass" number assigned to it.
-   * Then pixels with the matching pass number are extracted into a separate
-   * "reduced image", thus forming 1 to 7 new sub-images. Each image is then
-   * serialized as a normal PNG image, and all serialized images' data is
-   * concatenated to form the final data stream.
-   *
-   * So, to deinterlace the image, we iterate over pass numbers, extract and
-   * decode each "reduce image", and then place pixels from that image into the
-   * final image. The target pixel's position is determined from the source
-   * pixel's coordinates in the reduced image and current pass number.
-   */
-  int starting_row[7]  = { 0, 0, 4, 0, 2, 0, 1 };
-  int starting_col[7]  = { 0, 4, 0, 2, 0, 1, 0 };
-  int row_increment[7] = { 8, 8, 8, 4, 4, 2, 2 };
-  int col_increment[7] = { 8, 8, 4, 4, 2, 2, 1 };
-
-  size_t offset = 0;
-  for (int pass = 0; pass < 7; pass++) {
-    if (width > starting_col[pass] && height > starting_row[pass]) {
-      // Number of pixels per line in a reduced image.
-      size_t pixels_per_line = (width - starting_col[pass] + col_increment[pass] - 1) / col_increment[pass];
-      // Number of lines in a reduced image.
-      size_t line_count = (height - starting_row[pass] + row_increment[pass] - 1) / row_increment[pass];
-      // Number of bytes in a scanline + 1 extra for filter byte.
-      size_t scanline_size = (pixels_per_line * samples_per_pixel(type) * depth + 8 - 1) / 8 + 1;
-
-      // Decode reduced image
-      unsigned char *reduced_image = decode_normal_data(
-        data + offset,
-        pixels_per_line,
-        line_count,
-        type,
-        depth,
-        palette,
-        transparency,
-        error
-      );
-
-      if (reduced_image == NULL || *error != 0) {
-        free(output);
-        return NULL;
-      }
+  surface_from_rgba(&surface, output, out_width, out_height);
+  surface.format = context->format;
+  int err = decode_image_into(parsed, width, height, data, &surface, context);
+  if (err != 0) {
+    *error = err;
+    pngif_pool_release(pool, output);
+    return NULL;
+  }
 
-      // Fill the image from reduced image.
-      for (size_t row = starting_row[pass], rrow = 0; row < height; row += row_increment[pass], rrow += 1) {
-        for (size_t col = starting_col[pass], rcol = 0; col < width; col += col_increment[pass], rcol += 1) {
-          memcpy(output + (row * width + col) * 4, reduced_image + (pixels_per_line * rrow + rcol) * 4, 4);
-        }
-      }
+  return output;
+}
+
+/**
+ * Frees the frame list and all frames' data.
+ *
+ * @param list Frame list to free.
+ * @param count Number of frames with decoded data.
+ * @param pool Buffer pool frames' data was allocated from, or NULL.
+ */
+void png_frame_list_free(png_frame_list_t *list, u_int32_t count, pngif_pool_t *pool) {
+  if (list == NULL)
+    return;
 
-      // Cleanup.
-      free(reduced_image);
-      offset += (scanline_size * line_count);
+  if (list->frames != NULL) {
+    for (u_int32_t idx = 0; idx < count; idx++) {
+      pngif_pool_release(pool, list->frames[idx].data);
     }
+    free(list->frames);
   }
 
-  return output;
+  free(list);
 }
 
-unsigned char *decode_image(
+/**
+ * Checks that an animation frame fits into the image. Frames are checked
+ * against the full image size, before any reduction.
+ *
+ * @param parsed Parsed PNG data.
+ * @param control Frame control data.
+ *
+ * @return 1 if the frame fits, 0 otherwise.
+ */
+int frame_fits(png_parsed_t *parsed, png_frame_control_t *control) {
+  u_int32_t width = parsed->header.width;
+  u_int32_t height = parsed->header.height;
+
+  return !(
+    control->width == 0 || control->height == 0 ||
+    control->x_offset > width || control->width > width - control->x_offset ||
+    control->y_offset > height || control->height > height - control->y_offset
+  );
+}
+
+/**
+ * Decodes a single animation frame, or copies the default image when it's the
+ * first frame.
+ *
+ * @param png Decoded PNG data, with the default image.
+ * @param parsed Parsed PNG data.
+ * @param idx Index of the frame.
+ * @param frame Output frame.
+ * @param context Decoding context.
+ * @param error Error output.
+ */
+void decode_frame(
+  png_decoded_t *png,
   png_parsed_t *parsed,
-  u_int32_t width,
-  u_int32_t height,
-  unsigned char *data,
+  u_int32_t idx,
+  png_frame_t *frame,
+  png_decode_context_t *context,
   int *error
 ) {
-  if (parsed->header.interlace == 1) {
-   return decode_interlaced_data(
-      data,
-      width,
-      height,
-      parsed->header.color_type,
-      parsed->header.depth,
-      parsed->palette,
-      parsed->transparency,
-      error
-    );
-  } else if (parsed->header.interlace == 0) {
-    return decode_normal_data(
-      data,
-      width,
-      height,
-      parsed->header.color_type,
-      parsed->header.depth,
-      parsed->palette,
-      parsed->transparency,
+  png_frame_control_t *control = parsed->frame_controls + idx;
+  unsigned char *decoded_frame = NULL;
+  int shift = context->scale_shift;
+
+  if (!frame_fits(parsed, control)) {
+    *error = PNG_ERR_BAD_FRAME_DATA;
+    return;
+  }
+
+  if (idx != 0 || parsed->is_data_first_frame != 1) {
+    // Decode image.
+    decoded_frame = decode_image(
+      parsed,
+      control->width,
+      control->height,
+      parsed->frames + idx,
+      context,
       error
     );
   } else {
-    *error = PNG_ERR_UNSUPPORTED_FORMAT;
-    return NULL;
+    // First frame is default image, copy it.
+    u_int32_t total_size = 4 * png->width * png->height;
+    if ((decoded_frame = pngif_pool_alloc(png->pool, total_size)) != NULL) {
+      memcpy(decoded_frame, png->data, total_size);
+    } else {
+      *error = PNG_ERR_MEMIO;
+    }
+  }
+
+  if (decoded_frame == NULL || *error != 0) {
+    return;
+  }
+
+  // Reduced frames are placed at reduced offsets, rounded down, so they
+  // still fit into the reduced image.
+  frame->data = decoded_frame;
+  frame->width = scaled_size(control->width, shift);
+  frame->height = scaled_size(control->height, shift);
+  frame->x_offset = control->x_offset >> shift;
+  frame->y_offset = control->y_offset >> shift;
+  frame->dispose_type = control->dispose_type;
+  frame->blend_type = control->blend_type;
+
+  if (control->delay_den == 0) {
+    frame->delay = (float)(control->delay_num) / 100.0;
+  } else {
+    frame->delay = (float)(control->delay_num) / (float)(control->delay_den);
   }
 }
 
-void decode_frames(png_decoded_t *png, png_parsed_t *parsed, int *error) {
+/**
+ * Animation frames to decode in parallel, and the errors for each of them.
+ */
+typedef struct {
+  png_decoded_t *png;
+  png_parsed_t *parsed;
+  png_frame_list_t *list;
+  png_decode_context_t *context;
+  int *errors;
+} png_decode_job_t;
+
+/**
+ * Decodes one frame of a parallel job. Every frame is an independent zlib
+ * stream, so each task inflates, defilters and unpacks its own frame.
+ *
+ * @param job Decoding job.
+ * @param index Index of the frame.
+ */
+void decode_frame_task(void *job, size_t index) {
+  png_decode_job_t *frames = job;
+
+  // Each task has its own context, with the image index it would get when
+  // decoding one by one.
+  png_decode_context_t context = *frames->context;
+  context.image += index + (frames->parsed->is_data_first_frame == 1 ? 0 : 1);
+
+  frames->errors[index] = 0;
+  decode_frame(
+    frames->png,
+    frames->parsed,
+    index,
+    frames->list->frames + index,
+    &context,
+    frames->errors + index
+  );
+}
+
+void decode_frames(
+  png_decoded_t *png,
+  png_parsed_t *parsed,
+  png_decode_context_t *context,
+  int *error
+) {
   u_int32_t num_frames = parsed->anim_control->num_frames;
   if (num_frames <= 0) {
     return;
@@ -675,58 +789,57 @@ void decode_frames(png_decoded_t *png, png_parsed_t *parsed, int *error) {
     return;
   }
 
+  // Frames are zeroed, so that frames of a failed parallel job can be freed.
   list->length = num_frames;
   list->plays = parsed->anim_control->num_plays;
-  list->frames = malloc(sizeof(png_frame_t) * num_frames);
-
-  u_int32_t idx;
-  for (idx = 0; idx < num_frames; idx++) {
-    png_frame_control_t *control = parsed->frame_controls + idx;
-    unsigned char *decoded_frame = NULL;
-
-    if (idx != 0 || parsed->is_data_first_frame != 1) {
-      // Decode image.
-      png_data_t data = parsed->frames[idx];
-      decoded_frame = decode_image(
-        parsed,
-        control->width,
-        control->height,
-        data.data,
-        error
-      );
-    } else {
-      // First frame is default image, copy it.
-      u_int32_t total_size = 4 * png->width * png->height;
-      if ((decoded_frame = malloc(total_size)) != NULL) {
-        memcpy(decoded_frame, png->data, total_size);
-      }
-    }
+  list->frames = calloc(num_frames, sizeof(png_frame_t));
+  if (list->frames == NULL) {
+    free(list);
+    *error = PNG_ERR_MEMIO;
+    return;
+  }
 
-    if (decoded_frame == NULL || *error != 0) {
-      break;
+  u_int32_t idx = 0;
+  if (options_parallel(context->options)) {
+    int *errors = malloc(num_frames * sizeof(int));
+    if (errors == NULL) {
+      png_frame_list_free(list, 0, png->pool);
+      *error = PNG_ERR_MEMIO;
+      return;
     }
 
-    list->frames[idx].data = decoded_frame;
-    list->frames[idx].width = control->width;
-    list->frames[idx].height = control->height;
-    list->frames[idx].x_offset = control->x_offset;
-    list->frames[idx].y_offset = control->y_offset;
-    list->frames[idx].dispose_type = control->dispose_type;
-    list->frames[idx].blend_type = control->blend_type;
+    png_decode_job_t job = { png, parsed, list, context, errors };
+    parallel_run(context->options, decode_frame_task, &job, num_frames);
 
-    if (control->delay_den == 0) {
-      list->frames[idx].delay = (float)(control->delay_num) / 100.0;
-    } else {
-      list->frames[idx].delay = (float)(control->delay_num) / (float)(control->delay_den);
+    // Same error as decoding one by one: the one of the first failed frame.
+    for (idx = 0; idx < num_frames && *error == 0; idx++) {
+      *error = errors[idx];
     }
-  }
+    free(errors);
+    if (*error != 0) {
+      png_frame_list_free(list, num_frames, png->pool);
+      return;
+    }
+  } else {
+    for (idx = 0; idx < num_frames && !context->stopped; idx++) {
+      if (idx != 0 || parsed->is_data_first_frame != 1) {
+        context->image += 1;
+      }
 
-  if (*error != 0) {
-    // Cleanup. TODO: Better cleanup.
-    free(list);
-    return;
+      decode_frame(png, parsed, idx, list->frames + idx, context, error);
+      if (*error != 0) {
+        break;
+      }
+    }
+
+    if (*error != 0) {
+      png_frame_list_free(list, idx, png->pool);
+      return;
+    }
   }
 
+  // Decoding might have been stopped by the progress callback.
+  list->length = idx;
   png->frames = list;
 }
 
@@ -738,13 +851,13 @@ void png_decoded_free(png_decoded_t *png) {
   }
 
   if (png->data != NULL) {
-    free(png->data);
+    pngif_pool_release(png->pool, png->data);
   }
 
   if (png->frames != NULL) {
     if (png->frames->frames != NULL) {
       for (int idx = 0; idx < png->frames->length; idx++) {
-        free(png->frames->frames[idx].data);
+        pngif_pool_release(png->pool, png->frames->frames[idx].data);
       }
       free(png->frames->frames);
     }
@@ -755,7 +868,19 @@ void png_decoded_free(png_decoded_t *png) {
 }
 
 png_decoded_t *png_decoded_from_parsed(png_parsed_t *parsed, int *error) {
-  if (parsed == NULL || parsed->data.length == 0 || parsed->data.data == NULL) {
+  return png_decoded_from_parsed_with_options(parsed, NULL, error);
+}
+
+png_decoded_t *png_decoded_from_parsed_with_options(
+  png_parsed_t *parsed,
+  pngif_options_t *options,
+  int *error
+) {
+  if (
+    parsed == NULL ||
+    parsed->data.length == 0 ||
+    (parsed->data.data == NULL && parsed->raw == NULL)
+  ) {
     return NULL;
   }
 
@@ -766,35 +891,23 @@ png_decoded_t *png_decoded_from_parsed(png_parsed_t *parsed, int *error) {
     return NULL;
   }
 
-  unsigned char *decoded = NULL;
-
-  if (parsed->header.interlace == 1) {
-    decoded = decode_interlaced_data(
-      parsed->data.data,
-      parsed->header.width,
-      parsed->header.height,
-      parsed->header.color_type,
-      parsed->header.depth,
-      parsed->palette,
-      parsed->transparency,
-      &err
-    );
-  } else if (parsed->header.interlace == 0) {
-    decoded = decode_normal_data(
-      parsed->data.data,
-      parsed->header.width,
-      parsed->header.height,
-      parsed->header.color_type,
-      parsed->header.depth,
-      parsed->palette,
-      parsed->transparency,
-      &err
-    );
-  } else {
-    *error = PNG_ERR_UNSUPPORTED_FORMAT;
+  int shift = options_scale_shift(options);
+  int format = options_format(options);
+  if (shift < 0 || format < 0 || options_pool_check(options) != 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
     return NULL;
   }
 
+  png_decode_context_t context = { options, shift, format, 0, 0 };
+  unsigned char *decoded = decode_image(
+    parsed,
+    parsed->header.width,
+    parsed->header.height,
+    &parsed->data,
+    &context,
+    &err
+  );
+
   if (err != 0 || decoded == NULL) {
     *error = err;
     return NULL;
@@ -803,53 +916,191 @@ png_decoded_t *png_decoded_from_parsed(png_parsed_t *parsed, int *error) {
   // Allocate PNG struct.
   png_decoded_t *result = malloc(sizeof(png_decoded_t));
   if (result == NULL) {
+    pngif_pool_release(options_pool(options), decoded);
     *error = PNG_ERR_MEMIO;
     return NULL;
   }
 
-  result->width = parsed->header.width;
-  result->height = parsed->header.height;
+  result->width = scaled_size(parsed->header.width, shift);
+  result->height = scaled_size(parsed->header.height, shift);
   result->data = decoded;
+  result->format = format;
+  result->frames = NULL;
+  result->pool = options_pool(options);
 
   // Decode animation data.
-  if (parsed->anim_control != NULL) {
-    decode_frames(result, parsed, &err);
-  } else {
-    result->frames = NULL;
+  if (parsed->anim_control != NULL && !context.stopped) {
+    decode_frames(result, parsed, &context, &err);
+    if (err != 0) {
+      *error = err;
+      png_decoded_free(result);
+      return NULL;
+    }
   }
 
+  result->partial = context.stopped;
   return result;
 }
 
 png_decoded_t *png_decoded_from_data(unsigned char *data, size_t size, int *error) {
-  png_parsed_t *parsed = png_parsed_from_data(data, size, error);
+  return png_decoded_from_data_with_options(data, size, NULL, error);
+}
+
+png_decoded_t *png_decoded_from_data_with_options(
+  unsigned char *data,
+  size_t size,
+  pngif_options_t *options,
+  int *error
+) {
+  // Image data is inflated straight from the input array, row by row, so
+  // neither chunks nor the whole decompressed stream are copied.
+  png_raw_t *raw = png_raw_view_from_data(data, size, 1, error);
   if (*error != 0) {
     return NULL;
   }
 
-  png_decoded_t *decoded = png_decoded_from_parsed(parsed, error);
+  png_parsed_t *parsed = png_parsed_from_raw_deferred(raw, error);
+  if (*error != 0) {
+    png_raw_free(raw);
+    return NULL;
+  }
+
+  png_decoded_t *decoded = png_decoded_from_parsed_with_options(parsed, options, error);
   png_parsed_free(parsed);
+  png_raw_free(raw);
   return decoded;
 }
 
 png_decoded_t *png_decoded_from_file(FILE *file, int *error) {
-  png_parsed_t *parsed = png_parsed_from_file(file, error);
+  return png_decoded_from_file_with_options(file, NULL, error);
+}
+
+png_decoded_t *png_decoded_from_file_with_options(
+  FILE *file,
+  pngif_options_t *options,
+  int *error
+) {
+  unsigned char *data = NULL;
+
+  size_t size = pngif_read_file(file, &data, error);
   if (*error != 0) {
     return NULL;
   }
 
-  png_decoded_t *decoded = png_decoded_from_parsed(parsed, error);
-  png_parsed_free(parsed);
+  png_decoded_t *decoded = png_decoded_from_data_with_options(data, size, options, error);
+  free(data);
   return decoded;
 }
 
 png_decoded_t *png_decoded_from_path(char *path, int *error) {
-  png_parsed_t *parsed = png_parsed_from_path(path, error);
-  if (*error != 0) {
+  return png_decoded_from_path_with_options(path, NULL, error);
+}
+
+png_decoded_t *png_decoded_from_path_with_options(
+  char *path,
+  pngif_options_t *options,
+  int *error
+) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    *error = PNG_ERR_FILEIO;
     return NULL;
   }
 
-  png_decoded_t *decoded = png_decoded_from_parsed(parsed, error);
-  png_parsed_free(parsed);
+  png_decoded_t *decoded = png_decoded_from_file_with_options(file, options, error);
+  fclose(file);
   return decoded;
 }
+
+void png_decode_image_into(
+  png_parsed_t *parsed,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+) {
+  if (
+    parsed == NULL ||
+    parsed->data.length == 0 ||
+    (parsed->data.data == NULL && parsed->raw == NULL)
+  ) {
+    *error = PNG_ERR_NO_DATA;
+    return;
+  }
+
+  int err = verify_color_bit_depth(parsed);
+  if (err != 0) {
+    *error = err;
+    return;
+  }
+
+  int shift = options_scale_shift(options);
+  if (shift < 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return;
+  }
+
+  u_int32_t width = parsed->header.width;
+  u_int32_t height = parsed->header.height;
+  err = surface_check(surface, scaled_size(width, shift), scaled_size(height, shift));
+  if (err != 0) {
+    *error = err;
+    return;
+  }
+
+  png_decode_context_t context = { options, shift, surface->format, 0, 0 };
+  err = decode_image_into(parsed, width, height, &parsed->data, surface, &context);
+  if (err != 0) {
+    *error = err;
+  }
+}
+
+void png_decode_frame_into(
+  png_parsed_t *parsed,
+  u_int32_t index,
+  pngif_surface_t *surface,
+  pngif_options_t *options,
+  int *error
+) {
+  if (parsed == NULL || parsed->anim_control == NULL || index >= parsed->anim_control->num_frames) {
+    *error = PNG_ERR_BAD_FRAME_COUNT;
+    return;
+  }
+
+  int err = verify_color_bit_depth(parsed);
+  if (err != 0) {
+    *error = err;
+    return;
+  }
+
+  int shift = options_scale_shift(options);
+  if (shift < 0) {
+    *error = PNGIF_ERR_BAD_OPTIONS;
+    return;
+  }
+
+  png_frame_control_t *control = parsed->frame_controls + index;
+  if (!frame_fits(parsed, control)) {
+    *error = PNG_ERR_BAD_FRAME_DATA;
+    return;
+  }
+
+  err = surface_check(surface, scaled_size(control->width, shift), scaled_size(control->height, shift));
+  if (err != 0) {
+    *error = err;
+    return;
+  }
+
+  // The first frame may be the default image. Otherwise the default image is
+  // image 0 in progress reports, and frames follow it.
+  png_data_t *data = parsed->frames + index;
+  png_decode_context_t context = { options, shift, surface->format, index + 1, 0 };
+  if (index == 0 && parsed->is_data_first_frame == 1) {
+    data = &parsed->data;
+    context.image = 0;
+  }
+
+  err = decode_image_into(parsed, control->width, control->height, data, surface, &context);
+  if (err != 0) {
+    *error = err;
+  }
+}
@@ -0,0 +1,484 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pngif/utils.h>
+#include <pngif/errors.h>
+#include "png_filter.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PNGIF_FILTER_SIMD 1
+#include <immintrin.h>
+#endif
+
+/** Private **/
+
+/**
+ * Paeth predictor function. Calculates a linear function of the previous byte
+ * value, above byte value, and the byte value previous to the above byte
+ * value, and picks one of the three that is closest to the result.
+ *
+ * @param a Byte value in the previous pixel.
+ * @param b Byte value in the pixel above.
+ * @param c Byte value in the pixel previous to the pixel above.
+ *
+ * @return Paeth predictor value.
+ */
+unsigned char paeth_predictor(short a, short b, short c) {
+  short p = a + b - c;
+  short pa = abs(p - a);
+  short pb = abs(p - b);
+  short pc = abs(p - c);
+
+  if ((pa <= pb) && (pa <= pc)) {
+    return a;
+  } else if (pb <= pc) {
+    return b;
+  } else {
+    return c;
+  }
+}
+
+/** Scalar kernels **/
+
+/**
+ * The kernels below are generic over the number of bytes per pixel. They are
+ * instantiated for every possible value, so that the compiler sees a constant
+ * distance to the previous pixel and can keep it in registers.
+ *
+ * First pixel doesn't have a previous one, which is treated as zero.
+ */
+
+void defilter_none(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) {
+  memcpy(output, data, length);
+}
+
+void defilter_up(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) {
+  for (size_t byte = 0; byte < length; byte++)
+    output[byte] = data[byte] + previous[byte];
+}
+
+static inline void defilter_sub_bpp(
+  unsigned char *data,
+  unsigned char *output,
+  size_t length,
+  size_t bpp
+) {
+  size_t byte = 0;
+  for (; byte < bpp && byte < length; byte++)
+    output[byte] = data[byte];
+  for (; byte < length; byte++)
+    output[byte] = data[byte] + output[byte - bpp];
+}
+
+static inline void defilter_avg_bpp(
+  unsigned char *data,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  size_t bpp
+) {
+  // Average is calculated without overflow, unlike the other filters.
+  size_t byte = 0;
+  for (; byte < bpp && byte < length; byte++)
+    output[byte] = data[byte] + (previous[byte] >> 1);
+  for (; byte < length; byte++)
+    output[byte] = data[byte] + (((unsigned short)output[byte - bpp] + previous[byte]) >> 1);
+}
+
+/**
+ * Same as paeth_predictor(), written so that the compiler can use conditional
+ * moves instead of branches, which mispredict a lot on real image data.
+ */
+static inline unsigned char paeth_predictor_branchless(int a, int b, int c) {
+  int pa = abs(b - c);
+  int pb = abs(a - c);
+  int pc = abs(a + b - c - c);
+
+  if (pb < pa) {
+    pa = pb;
+    a = b;
+  }
+  if (pc < pa) {
+    a = c;
+  }
+  return a;
+}
+
+static inline void defilter_paeth_bpp(
+  unsigned char *data,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  size_t bpp
+) {
+  size_t byte = 0;
+  for (; byte < bpp && byte < length; byte++)
+    output[byte] = data[byte] + previous[byte];
+  for (; byte < length; byte++)
+    output[byte] = data[byte] + paeth_predictor_branchless(output[byte - bpp], previous[byte], previous[byte - bpp]);
+}
+
+#define DEFILTER_SCALAR_KERNELS(bpp) \
+  void defilter_sub_##bpp(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    defilter_sub_bpp(data, output, length, bpp); \
+  } \
+  void defilter_avg_##bpp(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    defilter_avg_bpp(data, output, previous, length, bpp); \
+  } \
+  void defilter_paeth_##bpp(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    defilter_paeth_bpp(data, output, previous, length, bpp); \
+  }
+
+DEFILTER_SCALAR_KERNELS(1)
+DEFILTER_SCALAR_KERNELS(2)
+DEFILTER_SCALAR_KERNELS(3)
+DEFILTER_SCALAR_KERNELS(4)
+DEFILTER_SCALAR_KERNELS(6)
+DEFILTER_SCALAR_KERNELS(8)
+
+#define ANY_BPP(kernel) { \
+  [1] = kernel, [2] = kernel, [3] = kernel, [4] = kernel, [6] = kernel, [8] = kernel \
+}
+
+#define PER_BPP(prefix) { \
+  [1] = prefix##_1, [2] = prefix##_2, [3] = prefix##_3, \
+  [4] = prefix##_4, [6] = prefix##_6, [8] = prefix##_8 \
+}
+
+const png_defilter_table_t defilter_scalar = { .kernels = {
+  [FILTER_NONE] = ANY_BPP(defilter_none),
+  [FILTER_SUB] = PER_BPP(defilter_sub),
+  [FILTER_UP] = ANY_BPP(defilter_up),
+  [FILTER_AVG] = PER_BPP(defilter_avg),
+  [FILTER_PAETH] = PER_BPP(defilter_paeth),
+} };
+
+#ifdef PNGIF_FILTER_SIMD
+
+/** SIMD kernels **/
+
+/**
+ * Up filter doesn't depend on the current scanline, so it's a plain vector
+ * addition. Sub filter is a running sum of pixels, which is computed with a
+ * log-step prefix sum over the pixels of a vector, plus the last pixel of the
+ * previous vector. Average and Paeth filters depend on the previous pixel in
+ * a non-linear way, so they process one pixel at a time, with all of its
+ * bytes in separate lanes, like libpng does. This only pays off for 3 bytes
+ * per pixel and more, scalar kernels are used otherwise.
+ *
+ * Pixels are loaded and stored 8 bytes at a time, the extra bytes belong to
+ * the next pixel and get overwritten. Near the end of a scanline exactly bpp
+ * bytes are copied to never touch memory past it.
+ */
+
+static inline __m128i load_pixel(unsigned char *src, size_t bpp, size_t available) {
+  if (available >= 8) {
+    return _mm_loadl_epi64((__m128i *)src);
+  }
+  long long value = 0;
+  memcpy(&value, src, bpp);
+  return _mm_cvtsi64_si128(value);
+}
+
+static inline void store_pixel(unsigned char *dest, __m128i pixel, size_t bpp, size_t available) {
+  if (available >= 8) {
+    _mm_storel_epi64((__m128i *)dest, pixel);
+    return;
+  }
+  long long value = _mm_cvtsi128_si64(pixel);
+  memcpy(dest, &value, bpp);
+}
+
+void defilter_up_sse2(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) {
+  size_t byte = 0;
+  for (; byte + 16 <= length; byte += 16) {
+    __m128i x = _mm_loadu_si128((__m128i *)(data + byte));
+    __m128i b = _mm_loadu_si128((__m128i *)(previous + byte));
+    _mm_storeu_si128((__m128i *)(output + byte), _mm_add_epi8(x, b));
+  }
+  for (; byte < length; byte++)
+    output[byte] = data[byte] + previous[byte];
+}
+
+__attribute__((target("avx2")))
+void defilter_up_avx2(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) {
+  size_t byte = 0;
+  for (; byte + 32 <= length; byte += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i *)(data + byte));
+    __m256i b = _mm256_loadu_si256((__m256i *)(previous + byte));
+    _mm256_storeu_si256((__m256i *)(output + byte), _mm256_add_epi8(x, b));
+  }
+  for (; byte + 16 <= length; byte += 16) {
+    __m128i x = _mm_loadu_si128((__m128i *)(data + byte));
+    __m128i b = _mm_loadu_si128((__m128i *)(previous + byte));
+    _mm_storeu_si128((__m128i *)(output + byte), _mm_add_epi8(x, b));
+  }
+  for (; byte < length; byte++)
+    output[byte] = data[byte] + previous[byte];
+}
+
+/**
+ * Sub filter. A vector holds (16 / bpp) whole pixels, the last pixel of the
+ * output is carried over to the first lanes of the next vector. Lanes past the
+ * last whole pixel are garbage, they get overwritten by the next store.
+ */
+#define DEFILTER_SUB_SSE2(bpp) \
+  void defilter_sub_sse2_##bpp(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    const size_t step = (16 / bpp) * bpp; \
+    const __m128i low = _mm_srli_si128(_mm_set1_epi8(-1), 16 - bpp); \
+    __m128i carry = _mm_setzero_si128(); \
+    size_t byte = 0; \
+    for (; byte + 16 <= length; byte += step) { \
+      __m128i x = _mm_add_epi8(_mm_loadu_si128((__m128i *)(data + byte)), carry); \
+      x = _mm_add_epi8(x, _mm_slli_si128(x, bpp)); \
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 2 * bpp)); \
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4 * bpp)); \
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8 * bpp)); \
+      _mm_storeu_si128((__m128i *)(output + byte), x); \
+      carry = _mm_and_si128(_mm_srli_si128(x, (16 / bpp) * bpp - bpp), low); \
+    } \
+    for (; byte < bpp && byte < length; byte++) \
+      output[byte] = data[byte]; \
+    for (; byte < length; byte++) \
+      output[byte] = data[byte] + output[byte - bpp]; \
+  }
+
+DEFILTER_SUB_SSE2(1)
+DEFILTER_SUB_SSE2(2)
+DEFILTER_SUB_SSE2(3)
+DEFILTER_SUB_SSE2(4)
+DEFILTER_SUB_SSE2(6)
+DEFILTER_SUB_SSE2(8)
+
+/**
+ * Average filter. _mm_avg_epu8 rounds up, so the lowest bit of (a ^ b) is
+ * subtracted to get the rounded down average.
+ */
+#define DEFILTER_AVG_SSE2(bpp) \
+  void defilter_avg_sse2_##bpp(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    const __m128i one = _mm_set1_epi8(1); \
+    __m128i a = _mm_setzero_si128(); \
+    size_t byte = 0; \
+    for (; byte + bpp <= length; byte += bpp) { \
+      __m128i b = load_pixel(previous + byte, bpp, length - byte); \
+      __m128i x = load_pixel(data + byte, bpp, length - byte); \
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)); \
+      a = _mm_add_epi8(x, avg); \
+      store_pixel(output + byte, a, bpp, length - byte); \
+    } \
+  }
+
+DEFILTER_AVG_SSE2(3)
+DEFILTER_AVG_SSE2(4)
+DEFILTER_AVG_SSE2(6)
+DEFILTER_AVG_SSE2(8)
+
+/**
+ * Paeth filter, computed in 16-bit lanes. Since p = a + b - c, the distances
+ * are pa = |b - c|, pb = |a - c| and pc = |a + b - 2c|. Ties are broken in
+ * favor of a, then b, like the scalar predictor does.
+ */
+#define DEFILTER_PAETH_SIMD(name, bpp, isa, abs) \
+  __attribute__((target(isa))) \
+  void name(unsigned char *data, unsigned char *output, unsigned char *previous, size_t length) { \
+    const __m128i zero = _mm_setzero_si128(); \
+    __m128i a = zero, c = zero; \
+    size_t byte = 0; \
+    for (; byte + bpp <= length; byte += bpp) { \
+      __m128i b = _mm_unpacklo_epi8(load_pixel(previous + byte, bpp, length - byte), zero); \
+      __m128i x = load_pixel(data + byte, bpp, length - byte); \
+      __m128i pa = _mm_sub_epi16(b, c); \
+      __m128i pb = _mm_sub_epi16(a, c); \
+      __m128i pc = _mm_add_epi16(pa, pb); \
+      pa = abs(pa); \
+      pb = abs(pb); \
+      pc = abs(pc); \
+      __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+      __m128i is_a = _mm_cmpeq_epi16(smallest, pa); \
+      __m128i is_b = _mm_cmpeq_epi16(smallest, pb); \
+      __m128i nearest = _mm_or_si128(_mm_and_si128(is_b, b), _mm_andnot_si128(is_b, c)); \
+      nearest = _mm_or_si128(_mm_and_si128(is_a, a), _mm_andnot_si128(is_a, nearest)); \
+      x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest)); \
+      store_pixel(output + byte, x, bpp, length - byte); \
+      a = _mm_unpacklo_epi8(x, zero); \
+      c = b; \
+    } \
+  }
+
+static inline __m128i abs_epi16_sse2(__m128i x) {
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+DEFILTER_PAETH_SIMD(defilter_paeth_sse2_3, 3, "sse2", abs_epi16_sse2)
+DEFILTER_PAETH_SIMD(defilter_paeth_sse2_4, 4, "sse2", abs_epi16_sse2)
+DEFILTER_PAETH_SIMD(defilter_paeth_sse2_6, 6, "sse2", abs_epi16_sse2)
+DEFILTER_PAETH_SIMD(defilter_paeth_sse2_8, 8, "sse2", abs_epi16_sse2)
+
+DEFILTER_PAETH_SIMD(defilter_paeth_ssse3_3, 3, "ssse3", _mm_abs_epi16)
+DEFILTER_PAETH_SIMD(defilter_paeth_ssse3_4, 4, "ssse3", _mm_abs_epi16)
+DEFILTER_PAETH_SIMD(defilter_paeth_ssse3_6, 6, "ssse3", _mm_abs_epi16)
+DEFILTER_PAETH_SIMD(defilter_paeth_ssse3_8, 8, "ssse3", _mm_abs_epi16)
+
+const png_defilter_table_t defilter_sse2 = { .kernels = {
+  [FILTER_NONE] = ANY_BPP(defilter_none),
+  [FILTER_SUB] = PER_BPP(defilter_sub_sse2),
+  [FILTER_UP] = ANY_BPP(defilter_up_sse2),
+  [FILTER_AVG] = {
+    [1] = defilter_avg_1, [2] = defilter_avg_2, [3] = defilter_avg_sse2_3,
+    [4] = defilter_avg_sse2_4, [6] = defilter_avg_sse2_6, [8] = defilter_avg_sse2_8
+  },
+  [FILTER_PAETH] = {
+    [1] = defilter_paeth_1, [2] = defilter_paeth_2, [3] = defilter_paeth_sse2_3,
+    [4] = defilter_paeth_sse2_4, [6] = defilter_paeth_sse2_6, [8] = defilter_paeth_sse2_8
+  },
+} };
+
+const png_defilter_table_t defilter_ssse3 = { .kernels = {
+  [FILTER_NONE] = ANY_BPP(defilter_none),
+  [FILTER_SUB] = PER_BPP(defilter_sub_sse2),
+  [FILTER_UP] = ANY_BPP(defilter_up_sse2),
+  [FILTER_AVG] = {
+    [1] = defilter_avg_1, [2] = defilter_avg_2, [3] = defilter_avg_sse2_3,
+    [4] = defilter_avg_sse2_4, [6] = defilter_avg_sse2_6, [8] = defilter_avg_sse2_8
+  },
+  [FILTER_PAETH] = {
+    [1] = defilter_paeth_1, [2] = defilter_paeth_2, [3] = defilter_paeth_ssse3_3,
+    [4] = defilter_paeth_ssse3_4, [6] = defilter_paeth_ssse3_6, [8] = defilter_paeth_ssse3_8
+  },
+} };
+
+// Only Up filter benefits from wider vectors, the rest are bound by the
+// dependency on the previous pixel.
+const png_defilter_table_t defilter_avx2 = { .kernels = {
+  [FILTER_NONE] = ANY_BPP(defilter_none),
+  [FILTER_SUB] = PER_BPP(defilter_sub_sse2),
+  [FILTER_UP] = ANY_BPP(defilter_up_avx2),
+  [FILTER_AVG] = {
+    [1] = defilter_avg_1, [2] = defilter_avg_2, [3] = defilter_avg_sse2_3,
+    [4] = defilter_avg_sse2_4, [6] = defilter_avg_sse2_6, [8] = defilter_avg_sse2_8
+  },
+  [FILTER_PAETH] = {
+    [1] = defilter_paeth_1, [2] = defilter_paeth_2, [3] = defilter_paeth_ssse3_3,
+    [4] = defilter_paeth_ssse3_4, [6] = defilter_paeth_ssse3_6, [8] = defilter_paeth_ssse3_8
+  },
+} };
+
+#endif
+
+/** CPU dispatch **/
+
+/* Selected kernel table. Resolved on first use. */
+const png_defilter_table_t *defilter_impl = NULL;
+
+/**
+ * Picks the kernels of the highest instruction set level supported by the CPU.
+ *
+ * @return Kernel table.
+ */
+const png_defilter_table_t *defilter_select_impl(void) {
+  for (int level = DEFILTER_AVX2; level > DEFILTER_SCALAR; level--) {
+    const png_defilter_table_t *table = png_defilter_table(level);
+    if (table != NULL) {
+      return table;
+    }
+  }
+  return &defilter_scalar;
+}
+
+/** Public **/
+
+const png_defilter_table_t *png_defilter_table(int level) {
+#ifdef PNGIF_FILTER_SIMD
+  __builtin_cpu_init();
+  switch (level) {
+  case DEFILTER_AVX2:
+    return __builtin_cpu_supports("avx2") ? &defilter_avx2 : NULL;
+  case DEFILTER_SSSE3:
+    return __builtin_cpu_supports("ssse3") ? &defilter_ssse3 : NULL;
+  case DEFILTER_SSE2:
+    return &defilter_sse2;
+  }
+#endif
+  return (level == DEFILTER_SCALAR) ? &defilter_scalar : NULL;
+}
+
+int png_defilter_row(
+  unsigned char *filtered,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  int bpp
+) {
+  // Filter type. One of 'None', 'Sub', 'Up', 'Average', 'Paeth'.
+  u_int8_t filter_type = filtered[0];
+  if (filter_type > FILTER_PAETH) {
+    return PNG_ERR_INVALID_FORMAT;
+  }
+
+  if (bpp < 1 || bpp > 8) {
+    return png_defilter_row_bytewise(filtered, output, previous, length, bpp);
+  }
+
+  // Racing threads would all pick the same table, and tables are constant.
+  const png_defilter_table_t *impl = __atomic_load_n(&defilter_impl, __ATOMIC_ACQUIRE);
+  if (impl == NULL) {
+    impl = defilter_select_impl();
+    __atomic_store_n(&defilter_impl, impl, __ATOMIC_RELEASE);
+  }
+
+  png_defilter_fn kernel = impl->kernels[filter_type][bpp];
+  if (kernel == NULL) {
+    return png_defilter_row_bytewise(filtered, output, previous, length, bpp);
+  }
+
+  kernel(filtered + 1, output, previous, length);
+  return 0;
+}
+
+int png_defilter_row_bytewise(
+  unsigned char *filtered,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  int bpp
+) {
+  // Filter type. One of 'None', 'Sub', 'Up', 'Average', 'Paeth'.
+  u_int8_t filter_type = filtered[0];
+  unsigned char *data = filtered + 1;
+  size_t byte = 0;
+
+  // First pixel doesn't have a previous one, which is treated as zero.
+  switch (filter_type) {
+  case FILTER_NONE:
+    memcpy(output, data, length);
+    break;
+  case FILTER_SUB:
+    for (; byte < bpp && byte < length; byte++)
+      output[byte] = data[byte];
+    for (; byte < length; byte++)
+      output[byte] = data[byte] + output[byte - bpp];
+    break;
+  case FILTER_UP:
+    for (; byte < length; byte++)
+      output[byte] = data[byte] + previous[byte];
+    break;
+  case FILTER_AVG:
+    // Average is calculated without overflow, unlike the other filters.
+    for (; byte < bpp && byte < length; byte++)
+      output[byte] = data[byte] + (previous[byte] >> 1);
+    for (; byte < length; byte++)
+      output[byte] = data[byte] + (((unsigned short)output[byte - bpp] + previous[byte]) >> 1);
+    break;
+  case FILTER_PAETH:
+    for (; byte < bpp && byte < length; byte++)
+      output[byte] = data[byte] + paeth_predictor(0, previous[byte], 0);
+    for (; byte < length; byte++)
+      output[byte] = data[byte] + paeth_predictor(output[byte - bpp], previous[byte], previous[byte - bpp]);
+    break;
+  default:
+    return PNG_ERR_INVALID_FORMAT;
+  }
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef _PNG_FILTER_INCLUDE
+#define _PNG_FILTER_INCLUDE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <pngif/utils.h>
+
+/**
+ * Instruction set levels of the defilter kernels. Each level includes all
+ * kernels of the previous one and replaces some of them with faster ones.
+ */
+#define DEFILTER_SCALAR 0
+#define DEFILTER_SSE2 1
+#define DEFILTER_SSSE3 2
+#define DEFILTER_AVX2 3
+
+/**
+ * Reverses a single filter for a scanline of a fixed number of bytes per pixel.
+ *
+ * @param data Filtered scanline, not including the filter type byte.
+ * @param output Output array for the defiltered scanline.
+ * @param previous Previous defiltered scanline.
+ * @param length Scanline size in bytes.
+ */
+typedef void (*png_defilter_fn)(
+  unsigned char *data,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length
+);
+
+/**
+ * Defilter kernels, indexed by filter type and bytes per pixel (1, 2, 3, 4, 6
+ * or 8, other entries are NULL).
+ */
+typedef struct {
+  png_defilter_fn kernels[5][9];
+} png_defilter_table_t;
+
+/**
+ * Reverses the filter application for a single scanline. In PNG, all
+ * scanlines are stored filtered. A filtered scanlane consists of a byte value
+ * of the filter, followed by the byte values calculated as a result of
+ * applying the selected filter to the original image data.
+ *
+ * Uses the kernels of the highest instruction set level supported by the CPU.
+ *
+ * @param filtered Filtered scanline, starting with the filter type byte.
+ * @param output Output array for the defiltered scanline.
+ * @param previous Previous defiltered scanline. For the first scanline of an
+ *   image it should be filled with zeroes.
+ * @param length Scanline size in bytes, not including the filter type byte.
+ * @param bpp Distance to the 'previous byte', i.e. the number of bytes per
+ *   pixel, rounded up to 1 for bit depths lower than 8.
+ *
+ * @return Error code, or 0 on success.
+ */
+int png_defilter_row(
+  unsigned char *filtered,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  int bpp
+);
+
+/**
+ * Same as png_defilter_row(), but processes the scanline one byte at a time
+ * with any bytes per pixel value. This is the reference implementation.
+ */
+int png_defilter_row_bytewise(
+  unsigned char *filtered,
+  unsigned char *output,
+  unsigned char *previous,
+  size_t length,
+  int bpp
+);
+
+/**
+ * Returns defilter kernels for given instruction set level.
+ *
+ * @param level One of DEFILTER_* levels.
+ *
+ * @return Kernel table, or NULL if the level isn't supported by the CPU.
+ */
+const png_defilter_table_t *png_defilter_table(int level);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include <pngif/errors.h>
+#include <pngif/png_raw.h>
+#include <pngif/pool.h>
+#include "png_inflate.h"
+
+/** Private **/
+
+/**
+ * Zlib allocator that takes memory from a buffer pool.
+ *
+ * @param opaque Buffer pool.
+ * @param items Number of items.
+ * @param size Size of an item.
+ *
+ * @return Allocated memory, or Z_NULL.
+ */
+voidpf png_inflate_zalloc(voidpf opaque, uInt items, uInt size) {
+  return pngif_pool_alloc(opaque, (size_t)items * size);
+}
+
+/**
+ * Zlib deallocator that returns memory to a buffer pool.
+ *
+ * @param opaque Buffer pool.
+ * @param address Memory to release.
+ */
+void png_inflate_zfree(voidpf opaque, voidpf address) {
+  pngif_pool_release(opaque, address);
+}
+
+/**
+ * Feeds the next data chunk to the Zlib stream. Data chunks of a single
+ * stream go one after another, so the stream can't continue past a chunk of
+ * another type, e.g. into the data of the next frame.
+ *
+ * @param inflater Inflater.
+ * @param next Index of the next chunk.
+ *
+ * @return Error code, or 0 on success.
+ */
+int png_inflate_next_chunk(png_inflate_t *inflater, int next) {
+  png_raw_t *raw = inflater->raw;
+
+  // Data chunks ended, but the stream didn't.
+  if (next >= raw->chunk_count || memcmp(raw->chunks[next]->type, inflater->type, 4) != 0) {
+    return PNG_ERR_ZLIB;
+  }
+
+  png_chunk_raw_t *chunk = raw->chunks[next];
+  size_t skip = 4 * inflater->include_seqnum;
+  if (chunk->length < skip) {
+    return PNG_ERR_CHUNK_FORMAT;
+  }
+
+  inflater->idx = next;
+  inflater->strm.avail_in = chunk->length - skip;
+  inflater->strm.next_in = chunk->data + skip;
+  return 0;
+}
+
+/**
+ * Runs a single inflate step into the given output.
+ *
+ * @param inflater Inflater.
+ * @param output Output array.
+ * @param length Size of the output array.
+ * @param produced Output number of bytes written.
+ *
+ * @return Error code, or 0 on success.
+ */
+int png_inflate_step(png_inflate_t *inflater, unsigned char *output, uInt length, size_t *produced) {
+  int err = 0;
+
+  // Current chunk is consumed, move to the next one.
+  if (inflater->strm.avail_in == 0) {
+    err = png_inflate_next_chunk(inflater, inflater->idx + 1);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  inflater->strm.next_out = output;
+  inflater->strm.avail_out = length;
+
+  int ret = inflate(&inflater->strm, Z_NO_FLUSH);
+  switch (ret) {
+  case Z_STREAM_ERROR:
+  case Z_NEED_DICT:
+  case Z_DATA_ERROR:
+  case Z_MEM_ERROR:
+    return PNG_ERR_ZLIB;
+  case Z_STREAM_END:
+    inflater->finished = 1;
+    break;
+  }
+
+  *produced = length - inflater->strm.avail_out;
+  return 0;
+}
+
+/** Public **/
+
+int png_inflate_init(png_inflate_t *inflater, png_raw_t *raw, int idx, pngif_pool_t *pool) {
+  if (raw == NULL || idx < 0 || idx >= raw->chunk_count) {
+    return PNG_ERR_NO_DATA;
+  }
+
+  memset(inflater, 0, sizeof(png_inflate_t));
+  inflater->raw = raw;
+  memcpy(inflater->type, raw->chunks[idx]->type, 4);
+  inflater->include_seqnum = (memcmp(inflater->type, "fdAT", 4) == 0);
+
+  // Zlib initialization. Zlib state and window come from the pool, if any.
+  inflater->strm.zalloc = (pool != NULL) ? png_inflate_zalloc : Z_NULL;
+  inflater->strm.zfree = (pool != NULL) ? png_inflate_zfree : Z_NULL;
+  inflater->strm.opaque = pool;
+  inflater->strm.avail_in = 0;
+  inflater->strm.next_in = Z_NULL;
+  if (inflateInit(&inflater->strm) != Z_OK) {
+    return PNG_ERR_ZLIB;
+  }
+
+  int err = png_inflate_next_chunk(inflater, idx);
+  if (err != 0) {
+    (void)inflateEnd(&inflater->strm);
+  }
+
+  return err;
+}
+
+int png_inflate_read(png_inflate_t *inflater, unsigned char *output, size_t length) {
+  size_t written = 0;
+
+  while (written < length) {
+    // Stream ended before filling the output.
+    if (inflater->finished) {
+      return PNG_ERR_DATA_SIZE;
+    }
+
+    size_t left = length - written, produced = 0;
+    uInt step = (left > UINT32_MAX) ? UINT32_MAX : left;
+    int err = png_inflate_step(inflater, output + written, step, &produced);
+    if (err != 0) {
+      return err;
+    }
+
+    written += produced;
+  }
+
+  return 0;
+}
+
+int png_inflate_finish(png_inflate_t *inflater) {
+  // Scratch space to detect data past the expected end of the stream.
+  unsigned char overflow[1];
+  int err = 0;
+
+  while (!inflater->finished) {
+    size_t produced = 0;
+    err = png_inflate_step(inflater, overflow, sizeof(overflow), &produced);
+    if (err != 0) {
+      break;
+    }
+
+    if (produced > 0) {
+      err = PNG_ERR_DATA_SIZE;
+      break;
+    }
+  }
+
+  png_inflate_end(inflater);
+  return err;
+}
+
+void png_inflate_end(png_inflate_t *inflater) {
+  (void)inflateEnd(&inflater->strm);
+}
@@ -0,0 +1,69 @@
+#ifndef _PNG_INFLATE_INCLUDE
+#define _PNG_INFLATE_INCLUDE
+
+#include <zlib.h>
+
+#include <pngif/png_raw.h>
+#include <pngif/pool.h>
+
+/**
+ * Incremental decompression of a Zlib stream that is split across several
+ * data chunks (IDAT or fdAT). Lets the caller inflate exactly as many bytes
+ * as it needs at a time, e.g. a single scanline.
+ */
+typedef struct {
+  png_raw_t *raw;
+  // Chunk type of the data chunks.
+  char type[4];
+  // Flag indicating whether chunk data starts with a sequence number.
+  int include_seqnum;
+  // Index of the chunk currently being inflated.
+  int idx;
+  // Flag indicating that the end of Zlib stream was reached.
+  int finished;
+  z_stream strm;
+} png_inflate_t;
+
+/**
+ * Initializes the inflater.
+ *
+ * @param inflater Inflater to initialize.
+ * @param raw Raw PNG data.
+ * @param idx Index of the first data chunk. Its type defines the type of all
+ *   following data chunks.
+ * @param pool Buffer pool for the Zlib state, or NULL.
+ *
+ * @return Error code, or 0 on success.
+ */
+int png_inflate_init(png_inflate_t *inflater, png_raw_t *raw, int idx, pngif_pool_t *pool);
+
+/**
+ * Decompresses exactly `length` bytes from the stream.
+ *
+ * @param inflater Inflater.
+ * @param output Output array, at least `length` bytes long.
+ * @param length Number of bytes to decompress.
+ *
+ * @return Error code, or 0 on success. If the stream ends before `length`
+ *   bytes were produced, PNG_ERR_DATA_SIZE is returned.
+ */
+int png_inflate_read(png_inflate_t *inflater, unsigned char *output, size_t length);
+
+/**
+ * Checks that the stream ends right at the current position and releases
+ * the inflater. `idx` is left at the last chunk of the stream.
+ *
+ * @param inflater Inflater.
+ *
+ * @return Error code, or 0 if the stream ended without any extra data.
+ */
+int png_inflate_finish(png_inflate_t *inflater);
+
+/**
+ * Releases the inflater without checking the rest of the stream.
+ *
+ * @param inflater Inflater.
+ */
+void png_inflate_end(png_inflate_t *inflater);
+
+#endif
@@ -2,17 +2,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
-#include <arpa/inet.h>
-#include <zlib.h>
 
 #include <pngif/utils.h>
 #include <pngif/png_raw.h>
 #include <pngif/png_parsed.h>
+#include "png_util.h"
+#include "png_inflate.h"
 
 /** Private **/
 
-#define CHUNK 32768
-
 /**
  * Compares two strings as if they're headers of a PNG chunk, i.e. check first
  * four bytes of each string. If either string is less than four bytes, the
@@ -37,8 +35,8 @@ int cmphdr(char *target, char *source) {
 }
 
 int parse_header(unsigned char *data, png_header_t *header) {
-  header->width = ntohl(*(u_int32_t*)data);
-  header->height = ntohl(*(u_int32_t*)(data + 4));
+  header->width = u_read_be32(data);
+  header->height = u_read_be32(data + 4);
   header->depth = *(u_int8_t*)(data + 8);
   header->color_type = *(u_int8_t*)(data + 9);
   header->compression = *(u_int8_t*)(data + 10);
@@ -54,7 +52,7 @@ int parse_gamma(unsigned char *data, png_gamma_t **gamma) {
     return PNG_ERR_MEMIO;
   }
 
-  out->gamma = ntohl(*(u_int32_t*)data);
+  out->gamma = u_read_be32(data);
 
   *gamma = out;
   return 0;
@@ -101,14 +99,14 @@ int parse_transparency(
   }
 
   if (color_type == COLOR_TYPE_GRAYSCALE) {
-    output->grayscale = ntohs(*(u_int16_t*)data);
+    output->grayscale = u_read_be16(data);
   } else if (color_type == COLOR_TYPE_TRUECOLOR) {
-    output->red = ntohs(*(u_int16_t*)data);
-    output->green = ntohs(*(u_int16_t*)(data + 2));
-    output->blue = ntohs(*(u_int16_t*)(data + 4));
+    output->red = u_read_be16(data);
+    output->green = u_read_be16(data + 2);
+    output->blue = u_read_be16(data + 4);
   } else if (color_type == COLOR_TYPE_INDEXED) {
     memset(output->entries, 255, 256);
-    for (int idx = 0; idx < length; idx++) {
+    for (int idx = 0; idx < length && idx < 256; idx++) {
       output->entries[idx] = data[idx];
     }
   } else {
@@ -159,113 +157,125 @@ int parse_sbits(
 }
 
 /**
- * Data parsing is mostly just a Zlib stream decompression. The code for this
- * function is adapter from the Zlib tutorial [https://zlib.net/zlib_how.html]
+ * Data parsing is mostly just a Zlib stream decompression. The code for
+ * inflating is adapted from the Zlib tutorial [https://zlib.net/zlib_how.html]
+ * and lives in png_inflate.c.
+ *
+ * The size of decompressed data is known beforehand from the image header and
+ * frame control chunks, so the stream is inflated straight into a single
+ * buffer of that size. Streams that decompress into less or more data than
+ * expected are rejected.
+ *
+ * In deferred mode nothing is inflated, the data struct only remembers where
+ * the compressed stream starts.
  *
  * @param raw Raw PNG data struct
- * @param type Chunk type to expect.
- * @param include_seqnum Flag indicating whether first byte of data is a
- *   sequence number.
- * @param idx Starting index of the first data chunk.
+ * @param idx Index of the first data chunk. Will be set to the index of the
+ *   last data chunk of the stream.
+ * @param size Expected size of the decompressed data.
+ * @param deferred Flag indicating whether decompression should be deferred.
  * @param data Output struct.
  *
  * @return Error code if there was a parsing error, or 0 if parsing was
  * successful.
  */
-int parse_data(png_raw_t *raw, char *type, int include_seqnum, int *idx, png_data_t *data) {
-  int ret;
-  size_t have = 0, total = 0;
-  z_stream strm;
-  unsigned char out[CHUNK];
-  unsigned char *uncompressed = NULL;
-
-  // Zlib initialization.
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
-  ret = inflateInit(&strm);
-  if (ret != Z_OK)
-    return ret;
-
-  // Go through all chunks and process data ones.
-  for (; *idx < raw->chunk_count; *idx = *idx + 1) {
-    png_chunk_raw_t *chunk = raw->chunks[*idx];
-    if (cmphdr(type, chunk->type) != 0) {
-      continue;
-    }
-
-    // Set up to parse next chunk.
-    strm.avail_in = chunk->length - 4 * include_seqnum;
-    strm.next_in = chunk->data + 4 * include_seqnum;
-
-    // Inflate until output buffer is not full.
-    do {
-      strm.avail_out = CHUNK;
-      strm.next_out = out;
-      ret = inflate(&strm, Z_NO_FLUSH);
-      switch (ret) {
-      case Z_STREAM_ERROR:
-      case Z_NEED_DICT:
-      case Z_DATA_ERROR:
-      case Z_MEM_ERROR:
-        (void)inflateEnd(&strm);
-        free(uncompressed);
-        return ret;
-      }
+int parse_data(
+  png_raw_t *raw,
+  int *idx,
+  size_t size,
+  int deferred,
+  png_data_t *data
+) {
+  if (size == 0 || size > UINT32_MAX) {
+    return PNG_ERR_INVALID_FORMAT;
+  }
 
-      // Reallocate output array to fit the new chunk.
-      have = CHUNK - strm.avail_out;
-      uncompressed = realloc(uncompressed, total + have);
+  if (deferred) {
+    data->length = size;
+    data->data = NULL;
+    data->chunk_index = *idx;
 
-      // Allocation error.
-      if (uncompressed == NULL) {
-        (void)inflateEnd(&strm);
-        free(uncompressed);
-        return PNG_ERR_MEMIO;
-      }
+    // Data chunks of a single stream go one after another.
+    char *type = raw->chunks[*idx]->type;
+    while (*idx + 1 < raw->chunk_count && cmphdr(type, raw->chunks[*idx + 1]->type) == 0) {
+      *idx = *idx + 1;
+    }
+    return 0;
+  }
 
-      // Copy the new data to the uncompressed stream.
-      memcpy(uncompressed + total, out, have);
-      total += have;
-    } while (strm.avail_out == 0);
+  unsigned char *uncompressed = malloc(size);
+  if (uncompressed == NULL) {
+    return PNG_ERR_MEMIO;
+  }
 
-    if (ret == Z_STREAM_END) {
-      break;
-    }
+  png_inflate_t inflater;
+  int err = png_inflate_init(&inflater, raw, *idx, NULL);
+  if (err != 0) {
+    free(uncompressed);
+    return err;
   }
 
-  // Deinit Zlib.
-  (void)inflateEnd(&strm);
+  err = png_inflate_read(&inflater, uncompressed, size);
+  if (err != 0) {
+    png_inflate_end(&inflater);
+    free(uncompressed);
+    return err;
+  }
 
-  // Check if the Zlib is finished. Anything other than Z_STREAM_END means
-  // the data is incomplete.
-  if (ret != Z_STREAM_END) {
+  err = png_inflate_finish(&inflater);
+  if (err != 0) {
     free(uncompressed);
-    return PNG_ERR_ZLIB;
+    return err;
   }
 
   // Copy the data to the output.
-  data->length = total;
+  *idx = inflater.idx;
+  data->length = size;
   data->data = uncompressed;
+  data->chunk_index = -1;
 
   return 0;
 }
 
-int parse_idata(png_raw_t *raw, png_data_t *data) {
+int parse_idata(png_raw_t *raw, png_parsed_t *png) {
   // Find first IDAT chunk.
   int idx = 0;
-  while (cmphdr(raw->chunks[idx]->type, "IDAT") != 0) {
+  while (idx < raw->chunk_count && cmphdr(raw->chunks[idx]->type, "IDAT") != 0) {
     idx += 1;
   }
 
+  if (idx == raw->chunk_count) {
+    return PNG_ERR_NO_DATA;
+  }
+
+  size_t size = png_filtered_size(
+    png->header.width,
+    png->header.height,
+    png->header.color_type,
+    png->header.depth,
+    png->header.interlace
+  );
+
   // Parse data starting from the first IDAT chunk position.
-  return parse_data(raw, "IDAT", 0, &idx, data);
+  return parse_data(raw, &idx, size, png->raw != NULL, &png->data);
 }
 
-int parse_frame_data(png_raw_t *raw, int *idx, png_data_t *data) {
-  return parse_data(raw, "fdAT", 1, idx, data);
+int parse_frame_data(
+  png_raw_t *raw,
+  int *idx,
+  png_parsed_t *png,
+  png_frame_control_t *control,
+  png_data_t *data
+) {
+  size_t size = png_filtered_size(
+    control->width,
+    control->height,
+    png->header.color_type,
+    png->header.depth,
+    png->header.interlace
+  );
+
+  return parse_data(raw, idx, size, png->raw != NULL, data);
 }
 
 int parse_anim_control(unsigned char *data, png_animation_control_t **anim) {
@@ -274,20 +284,20 @@ int parse_anim_control(unsigned char *data, png_animation_control_t **anim) {
     return PNG_ERR_MEMIO;
   }
 
-  out->num_frames = ntohl(*(u_int32_t*)data);
-  out->num_plays = ntohl(*(u_int32_t*)(data + 4));
+  out->num_frames = u_read_be32(data);
+  out->num_plays = u_read_be32(data + 4);
 
   *anim = out;
   return 0;
 }
 
 int parse_frame_control(unsigned char *data, png_frame_control_t *frame) {
-  frame->width = ntohl(*(u_int32_t*)(data + 4));
-  frame->height = ntohl(*(u_int32_t*)(data + 8));
-  frame->x_offset = ntohl(*(u_int32_t*)(data + 12));
-  frame->y_offset = ntohl(*(u_int32_t*)(data + 16));
-  frame->delay_num = ntohs(*(u_int16_t*)(data + 20));
-  frame->delay_den = ntohs(*(u_int16_t*)(data + 22));
+  frame->width = u_read_be32(data + 4);
+  frame->height = u_read_be32(data + 8);
+  frame->x_offset = u_read_be32(data + 12);
+  frame->y_offset = u_read_be32(data + 16);
+  frame->delay_num = u_read_be16(data + 20);
+  frame->delay_den = u_read_be16(data + 22);
   frame->dispose_type = data[24];
   frame->blend_type = data[25];
 
@@ -316,15 +326,22 @@ int parse_anim(png_raw_t *raw, png_parsed_t *png) {
 
   if (anim == NULL || anim->num_frames == 0) {
     // Not an animated PNG, stop here.
+    free(anim);
     return 0;
   }
 
   // Now we have frame count, we can allocate space for frame data.
-  png_frame_control_t *controls = malloc(sizeof(png_frame_control_t) * anim->num_frames);
+  png_frame_control_t *controls = calloc(anim->num_frames, sizeof(png_frame_control_t));
   png_data_t *frames = calloc(anim->num_frames, sizeof(png_data_t));
+  if (controls == NULL || frames == NULL) {
+    free(controls);
+    free(frames);
+    free(anim);
+    return PNG_ERR_MEMIO;
+  }
 
   // Skip to first 'fcTL' chunk.
-  while (cmphdr("fcTL", raw->chunks[idx]->type) != 0) {
+  while (idx < raw->chunk_count && cmphdr("fcTL", raw->chunks[idx]->type) != 0) {
     idx += 1;
   }
 
@@ -333,10 +350,23 @@ int parse_anim(png_raw_t *raw, png_parsed_t *png) {
   for (; idx < raw->chunk_count; idx++) {
     png_chunk_raw_t *chunk = raw->chunks[idx];
     if ((cmphdr("fcTL", chunk->type) == 0) && (control == 1)) {
+      if (frame_index >= anim->num_frames) {
+        err = PNG_ERR_BAD_FRAME_COUNT;
+        break;
+      }
       parse_frame_control(chunk->data, controls + frame_index);
       control = 0;
     } else if (cmphdr("fdAT", chunk->type) == 0 && (control == 0)) {
-      err = parse_frame_data(raw, &idx, frames + frame_index);
+      err = parse_frame_data(
+        raw,
+        &idx,
+        png,
+        controls + frame_index,
+        frames + frame_index
+      );
+      if (err != 0) {
+        break;
+      }
       frame_index += 1;
       control = 1;
     } else if ((cmphdr("IDAT", chunk->type) == 0) && (control == 0) && (frame_index == 0)) {
@@ -346,7 +376,7 @@ int parse_anim(png_raw_t *raw, png_parsed_t *png) {
       // Skip all IDAT chunks.
       do {
         idx += 1;
-      } while (cmphdr("IDAT", raw->chunks[idx]->type) == 0);
+      } while (idx < raw->chunk_count && cmphdr("IDAT", raw->chunks[idx]->type) == 0);
       // First frame is filled, advance the frame index.
       idx -= 1;
       frame_index += 1;
@@ -361,11 +391,17 @@ int parse_anim(png_raw_t *raw, png_parsed_t *png) {
   if (err != 0) {
     free(controls);
     for (int i = 0; i < anim->num_frames; i++) {
+      // First frame might be the default image, which is owned by png->data.
+      if (i == 0 && png->is_data_first_frame) {
+        continue;
+      }
       if (frames[i].data != NULL) {
         free(frames[i].data);
       }
     }
     free(frames);
+    free(anim);
+    return err;
   }
 
   png->anim_control = anim;
@@ -404,6 +440,7 @@ void png_parsed_free(png_parsed_t *png) {
       }
       free(png->frames);
     }
+    free(png->anim_control);
   }
   if (png->sbits != NULL)
     free(png->sbits);
@@ -411,7 +448,17 @@ void png_parsed_free(png_parsed_t *png) {
   free(png);
 }
 
-png_parsed_t *png_parsed_from_raw(png_raw_t *raw, int *error) {
+/**
+ * Parses raw PNG chunks.
+ *
+ * @param raw Raw chunk data.
+ * @param deferred Flag indicating whether image data should be left
+ *   compressed.
+ * @param error Output error.
+ *
+ * @return New instance of PNG or NULL in case of an error.
+ */
+png_parsed_t *png_parsed_parse(png_raw_t *raw, int deferred, int *error) {
   if (raw == NULL) {
     return NULL;
   }
@@ -422,11 +469,21 @@ png_parsed_t *png_parsed_from_raw(png_raw_t *raw, int *error) {
     return NULL;
   }
 
-  int err = 0;
+  png->data.chunk_index = -1;
+  if (deferred) {
+    png->raw = raw;
+  }
+
+  int err = 0, has_header = 0;
   for (int idx = 0; idx < raw->chunk_count; idx++) {
     png_chunk_raw_t *chunk = raw->chunks[idx];
     if (cmphdr("IHDR", chunk->type) == 0) {
-      err = parse_header(chunk->data, &png->header);
+      if (chunk->length < 13) {
+        err = PNG_ERR_CHUNK_FORMAT;
+      } else {
+        err = parse_header(chunk->data, &png->header);
+        has_header = 1;
+      }
     } else if (cmphdr("gAMA", chunk->type) == 0) {
       err = parse_gamma(chunk->data, &png->gamma);
     } else if (cmphdr("PLTE", chunk->type) == 0) {
@@ -444,21 +501,40 @@ png_parsed_t *png_parsed_from_raw(png_raw_t *raw, int *error) {
     }
   }
 
+  if (err == 0 && has_header == 0) {
+    err = PNG_ERR_NO_HEADER;
+  }
+
   // Parse IDAT chunks.
-  err = parse_idata(raw, &png->data);
-  if (err != 0) {
-    *error = err;
+  if (err == 0) {
+    err = parse_idata(raw, png);
   }
 
   // Check and parse animation data.
-  err = parse_anim(raw, png);
+  if (err == 0) {
+    err = parse_anim(raw, png);
+  }
+
+  if (err != 0) {
+    *error = err;
+    png_parsed_free(png);
+    return NULL;
+  }
 
-  *error = err;
   return png;
 }
 
+png_parsed_t *png_parsed_from_raw(png_raw_t *raw, int *error) {
+  return png_parsed_parse(raw, 0, error);
+}
+
+png_parsed_t *png_parsed_from_raw_deferred(png_raw_t *raw, int *error) {
+  return png_parsed_parse(raw, 1, error);
+}
+
 png_parsed_t *png_parsed_from_data(unsigned char *data, size_t size, int *error) {
-  png_raw_t *raw = png_raw_from_data(data, size, 1, error);
+  // Parsed data doesn't reference raw chunks, so there's no need to copy them.
+  png_raw_t *raw = png_raw_view_from_data(data, size, 1, error);
   if (*error != 0) {
     return NULL;
   }
@@ -469,23 +545,26 @@ png_parsed_t *png_parsed_from_data(unsigned char *data, size_t size, int *error)
 }
 
 png_parsed_t *png_parsed_from_file(FILE *file, int *error) {
-  png_raw_t *raw = png_raw_from_file(file, 1, error);
+  unsigned char *data = NULL;
+
+  size_t size = pngif_read_file(file, &data, error);
   if (*error != 0) {
     return NULL;
   }
 
-  png_parsed_t *parsed = png_parsed_from_raw(raw, error);
-  png_raw_free(raw);
+  png_parsed_t *parsed = png_parsed_from_data(data, size, error);
+  free(data);
   return parsed;
 }
 
 png_parsed_t *png_parsed_from_path(char *path, int *error) {
-  png_raw_t *raw = png_raw_from_path(path, 1, error);
-  if (*error != 0) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    *error = PNG_ERR_FILEIO;
     return NULL;
   }
 
-  png_parsed_t * parsed = png_parsed_from_raw(raw, error);
-  png_raw_free(raw);
+  png_parsed_t *parsed = png_parsed_from_file(file, error);
+  fclose(file);
   return parsed;
 }
@@ -9,97 +9,112 @@
 
 /** Private **/
 
-png_raw_t *png_raw_create() {
+png_raw_t *png_raw_create(int borrowed) {
   png_raw_t *png = malloc(sizeof(png_raw_t));
   if (png != NULL) {
     png->chunk_count = 0;
     png->chunks = 0;
+    png->borrowed = borrowed;
   }
 
   return png;
 }
 
-void png_chunk_free(png_chunk_raw_t *chunk) {
-  if (chunk->length > 0 && chunk->data != NULL) {
+void png_chunk_free(png_chunk_raw_t *chunk, int borrowed) {
+  if (!borrowed && chunk->length > 0 && chunk->data != NULL) {
     free(chunk->data);
   }
 
   free(chunk);
 }
 
+/**
+ * Reads a single chunk from the PNG data stream.
+ *
+ * @param data PNG data stream.
+ * @param size Size of the data stream.
+ * @param offset Offset to the start of the chunk.
+ * @param fail_on_crc Flag indicating whether CRC mismatch is an error.
+ * @param borrowed If set, chunk data will point into the data stream instead
+ *   of being copied into its own array.
+ * @param new_offset Output offset to the next chunk.
+ * @param error Error output.
+ *
+ * @return New chunk, or NULL if there are no more chunks or an error occurred.
+ */
 png_chunk_raw_t *read_chunk(
   unsigned char *data,
-  u_int32_t size,
-  u_int32_t offset,
+  size_t size,
+  size_t offset,
   int fail_on_crc,
-  u_int32_t *new_offset,
+  int borrowed,
+  size_t *new_offset,
   int *error
 ) {
   uint32_t length = 0, crc = 0;
-  char type[4] = { 0 };
   unsigned char *body = NULL;
-  unsigned char *type_with_body = NULL;
+
+  // Not enough data left for another chunk.
+  if (offset + 12 > size) {
+    return NULL;
+  }
 
   // Length.
   memcpy(&length, data + offset, 4);
   length = __builtin_bswap32(length);
 
-  type_with_body = malloc(length + 4);
-  if (type_with_body == NULL) {
-    *error = PNG_ERR_MEMIO;
+  // Chunk goes past the end of the stream.
+  if (length > size - offset - 12) {
+    *error = PNG_ERR_CHUNK_FORMAT;
     return NULL;
   }
 
-  // Read type + body to a single array. We do this because CRC checksum is
-  // calculated for [type+data] instead of just [data].
-  memcpy(type_with_body, data + offset + 4, length + 4);
-
-  // Type.
-  memcpy(type, type_with_body, 4);
-
-  // Body.
-  if (length > 0) {
-    body = malloc(length);
-    if (body == NULL) {
-      *error = PNG_ERR_MEMIO;
-      return NULL;
-    }
-
-    memcpy(body, type_with_body + 4, length);
-  }
-
   // CRC.
   memcpy(&crc, data + offset + length + 8, 4);
   crc = __builtin_bswap32(crc);
 
-  // Update offset.
-  *new_offset = offset + length + 12;
-
-  // Verify the CRC checksum.
+  // Verify the CRC checksum. It is calculated for [type+data] instead of just
+  // [data], which are adjacent in the input stream, so there's no need to
+  // copy anything to check it.
   if (fail_on_crc) {
-    uint32_t calc_crc = u_crc32(type_with_body, length + 4);
+    uint32_t calc_crc = u_crc32(data + offset + 4, length + 4);
     if (crc != calc_crc) {
       *error = PNG_ERR_CRC;
-      free(body);
       return NULL;
     }
   }
 
-  // No need for raw data array below this point.
-  free(type_with_body);
+  // Body.
+  if (length > 0) {
+    if (borrowed) {
+      body = data + offset + 8;
+    } else {
+      body = malloc(length);
+      if (body == NULL) {
+        *error = PNG_ERR_MEMIO;
+        return NULL;
+      }
+
+      memcpy(body, data + offset + 8, length);
+    }
+  }
+
+  // Update offset.
+  *new_offset = offset + length + 12;
 
   // Make chunk.
   png_chunk_raw_t *chunk = malloc(sizeof(png_chunk_raw_t));
   if (chunk == NULL) {
-    *error = PNG_ERR_FILEIO;
-    free(body);
+    *error = PNG_ERR_MEMIO;
+    if (!borrowed)
+      free(body);
     return NULL;
   }
 
   chunk->length = length;
   chunk->crc = crc;
   chunk->data = body;
-  memcpy(chunk->type, type, 4);
+  memcpy(chunk->type, data + offset + 4, 4);
   return chunk;
 }
 
@@ -108,32 +123,40 @@ int append_chunk(png_raw_t *png, png_chunk_raw_t *chunk) {
     return 1;
   }
 
-  png->chunks = realloc(png->chunks, sizeof(void *) * (png->chunk_count + 1));
-  if (png->chunks == NULL) {
+  png_chunk_raw_t **chunks = realloc(png->chunks, sizeof(void *) * (png->chunk_count + 1));
+  if (chunks == NULL) {
     return 1;
   }
 
+  png->chunks = chunks;
   png->chunks[png->chunk_count] = chunk;
   png->chunk_count += 1;
   return 0;
 }
 
-/** Public **/
-
-void png_raw_free(png_raw_t *png) {
-  if (png == NULL) {
-    return;
-  }
-
-  for (int idx = 0; idx < png->chunk_count; idx++) {
-    png_chunk_free(png->chunks[idx]);
-  }
-
-  free(png);
-}
-
-png_raw_t *png_raw_from_data(unsigned char *data, size_t size, int fail_on_crc, int *error) {
+/**
+ * Splits PNG data into chunks.
+ *
+ * @param data PNG data.
+ * @param size Size of the data.
+ * @param fail_on_crc Stop reading and return error of chunk's CRC is wrong.
+ * @param borrowed Don't copy chunk data, point into the input array instead.
+ * @param error Error output.
+ *
+ * @return Raw PNG data, or NULL in case of fatal errors.
+ */
+png_raw_t *png_raw_split(
+  unsigned char *data,
+  size_t size,
+  int fail_on_crc,
+  int borrowed,
+  int *error
+) {
   char header[9] = { 0 };
+  if (size < 8) {
+    *error = PNG_ERR_WRONG_HEADER;
+    return NULL;
+  }
   memcpy(header, data, 8);
 
   // Verify header.
@@ -143,7 +166,7 @@ png_raw_t *png_raw_from_data(unsigned char *data, size_t size, int fail_on_crc,
   }
 
   // Create container.
-  png_raw_t *png = png_raw_create();
+  png_raw_t *png = png_raw_create(borrowed);
   if (png == NULL) {
     *error = PNG_ERR_MEMIO;
     return NULL;
@@ -152,32 +175,53 @@ png_raw_t *png_raw_from_data(unsigned char *data, size_t size, int fail_on_crc,
   // Read chunks.
   int parse_error = 0;
   png_chunk_raw_t *chunk = NULL;
-  u_int32_t offset = 8;
-  while ((chunk = read_chunk(data, size, offset, fail_on_crc, &offset, &parse_error)) != NULL) {
-    if (parse_error != 0) {
-      break;
-    }
-
-    parse_error = append_chunk(png, chunk);
-    if (parse_error != 0) {
+  size_t offset = 8;
+  while ((chunk = read_chunk(data, size, offset, fail_on_crc, borrowed, &offset, &parse_error)) != NULL) {
+    if (append_chunk(png, chunk) != 0) {
+      png_chunk_free(chunk, borrowed);
+      parse_error = PNG_ERR_MEMIO;
       break;
     }
 
     // End the parsing if we got final chunk.
-    if (strcmp("IEND", chunk->type) == 0) {
+    if (memcmp("IEND", chunk->type, 4) == 0) {
       break;
     }
   }
 
   // Check for error.
   if (parse_error != 0) {
-    *error = PNG_ERR_MEMIO;
+    *error = parse_error;
+    png_raw_free(png);
+    return NULL;
   }
 
-  // Clean up and return.
   return png;
 }
 
+/** Public **/
+
+void png_raw_free(png_raw_t *png) {
+  if (png == NULL) {
+    return;
+  }
+
+  for (int idx = 0; idx < png->chunk_count; idx++) {
+    png_chunk_free(png->chunks[idx], png->borrowed);
+  }
+
+  free(png->chunks);
+  free(png);
+}
+
+png_raw_t *png_raw_from_data(unsigned char *data, size_t size, int fail_on_crc, int *error) {
+  return png_raw_split(data, size, fail_on_crc, 0, error);
+}
+
+png_raw_t *png_raw_view_from_data(unsigned char *data, size_t size, int fail_on_crc, int *error) {
+  return png_raw_split(data, size, fail_on_crc, 1, error);
+}
+
 png_raw_t *png_raw_from_file(FILE *file, int fail_on_crc, int *error) {
   unsigned char *data = NULL;
 
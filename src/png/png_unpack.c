@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pngif/utils.h>
+#include <pngif/errors.h>
+#include <pngif/png_parsed.h>
+#include <pngif/surface.h>
+#include "png_unpack.h"
+
+/** Private **/
+
+/**
+ * Converts a 16-bit sample to 8-bit with rounding to nearest, i.e.
+ * round(value * 255 / 65535). Since 65535 = 255 * 257, that's value / 257
+ * rounded, which is never a tie.
+ */
+static inline unsigned char scale_16(unsigned char *sample) {
+  u_int32_t value = ((u_int32_t)sample[0] << 8) | sample[1];
+  return (value + 128) / 257;
+}
+
+/** Lookup table kernels **/
+
+/**
+ * Indexed and Grayscale images with bit depth of 8 and lower have at most 256
+ * distinct sample values, so each pixel is a single table lookup.
+ */
+
+void unpack_lut_8(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  u_int32_t *lut = unpacker->lut;
+  for (size_t x = 0; x < width; x++) {
+    memcpy(output + x * 4, &lut[data[x]], 4);
+  }
+}
+
+static inline void unpack_lut_packed(
+  png_unpacker_t *unpacker,
+  unsigned char *data,
+  size_t width,
+  unsigned char *output,
+  int depth
+) {
+  u_int32_t *lut = unpacker->lut;
+  const int per_byte = 8 / depth;
+  const unsigned char mask = (1 << depth) - 1;
+
+  // Samples are packed starting from the most significant bits.
+  size_t x = 0;
+  for (; x + per_byte <= width; x += per_byte) {
+    unsigned char byte = *data++;
+    for (int idx = 0; idx < per_byte; idx++) {
+      memcpy(output, &lut[(byte >> (8 - depth * (idx + 1))) & mask], 4);
+      output += 4;
+    }
+  }
+
+  // Last byte of a scanline may be partially filled.
+  if (x < width) {
+    unsigned char byte = *data;
+    for (int shift = 8 - depth; x < width; x++, shift -= depth) {
+      memcpy(output, &lut[(byte >> shift) & mask], 4);
+      output += 4;
+    }
+  }
+}
+
+void unpack_lut_1(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  unpack_lut_packed(unpacker, data, width, output, 1);
+}
+
+void unpack_lut_2(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  unpack_lut_packed(unpacker, data, width, output, 2);
+}
+
+void unpack_lut_4(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  unpack_lut_packed(unpacker, data, width, output, 4);
+}
+
+/** 8-bit kernels **/
+
+void unpack_rgba_8(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  // Scanline is already RGBA, so it's converted straight into the output.
+  pngif_convert_pixels(data, output, width, unpacker->format);
+}
+
+void unpack_rgb_8(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  // Every pixel but the last is copied as 4 bytes, with the byte of the next
+  // pixel replaced by opaque alpha.
+  const u_int32_t opaque = pngif_pixel(PNGIF_FORMAT_RGBA, 0, 0, 0, 255);
+  size_t x = 0;
+  for (; x + 1 < width; x++) {
+    u_int32_t pixel;
+    memcpy(&pixel, data + x * 3, 4);
+    pixel |= opaque;
+    memcpy(output + x * 4, &pixel, 4);
+  }
+
+  for (; x < width; x++) {
+    output[x * 4 + 0] = data[x * 3 + 0];
+    output[x * 4 + 1] = data[x * 3 + 1];
+    output[x * 4 + 2] = data[x * 3 + 2];
+    output[x * 4 + 3] = 255;
+  }
+}
+
+void unpack_rgb_8_key(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  // Pixels matching the transparency color are fully transparent.
+  png_transparency_t *transparency = unpacker->transparency;
+  for (size_t x = 0; x < width; x++, data += 3, output += 4) {
+    output[0] = data[0];
+    output[1] = data[1];
+    output[2] = data[2];
+    output[3] = (
+      transparency->red == data[0] &&
+      transparency->green == data[1] &&
+      transparency->blue == data[2]
+    ) ? 0 : 255;
+  }
+}
+
+void unpack_ga_8(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  for (size_t x = 0; x < width; x++, data += 2, output += 4) {
+    output[0] = data[0];
+    output[1] = data[0];
+    output[2] = data[0];
+    output[3] = data[1];
+  }
+}
+
+/** 16-bit kernels **/
+
+void unpack_16(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  png_transparency_t *transparency = unpacker->transparency;
+
+  switch (unpacker->type) {
+  case COLOR_TYPE_GRAYSCALE:
+    for (size_t x = 0; x < width; x++, data += 2, output += 4) {
+      u_int16_t sample = (data[0] << 8) | data[1];
+      output[0] = output[1] = output[2] = scale_16(data);
+      output[3] = (transparency != NULL && transparency->grayscale == sample) ? 0 : 255;
+    }
+    break;
+  case COLOR_TYPE_TRUECOLOR:
+    for (size_t x = 0; x < width; x++, data += 6, output += 4) {
+      output[0] = scale_16(data);
+      output[1] = scale_16(data + 2);
+      output[2] = scale_16(data + 4);
+      output[3] = (
+        transparency != NULL &&
+        transparency->red == ((data[0] << 8) | data[1]) &&
+        transparency->green == ((data[2] << 8) | data[3]) &&
+        transparency->blue == ((data[4] << 8) | data[5])
+      ) ? 0 : 255;
+    }
+    break;
+  case COLOR_TYPE_GRAYSCALE_ALPHA:
+    for (size_t x = 0; x < width; x++, data += 4, output += 4) {
+      output[0] = output[1] = output[2] = scale_16(data);
+      output[3] = scale_16(data + 2);
+    }
+    break;
+  case COLOR_TYPE_TRUECOLOR_ALPHA:
+    for (size_t x = 0; x < width; x++, data += 8, output += 4) {
+      output[0] = scale_16(data);
+      output[1] = scale_16(data + 2);
+      output[2] = scale_16(data + 4);
+      output[3] = scale_16(data + 6);
+    }
+    break;
+  }
+}
+
+/** Format conversion **/
+
+/**
+ * Runs the RGBA kernel and converts its output in place, while the row is
+ * still in cache.
+ */
+void unpack_converted(png_unpacker_t *unpacker, unsigned char *data, size_t width, unsigned char *output) {
+  unpacker->kernel(unpacker, data, width, output);
+  pngif_convert_pixels(output, output, width, unpacker->format);
+}
+
+/** Setup **/
+
+/**
+ * Fills the lookup table of a Grayscale image. Samples are scaled to 8 bits,
+ * a sample matching the transparency value is fully transparent.
+ */
+void fill_grayscale_lut(png_unpacker_t *unpacker) {
+  int max_sample = (1 << unpacker->depth) - 1;
+  png_transparency_t *transparency = unpacker->transparency;
+
+  memset(unpacker->lut, 0, sizeof(unpacker->lut));
+  for (int sample = 0; sample <= max_sample; sample++) {
+    unsigned char value = sample * 255 / max_sample;
+    unsigned char alpha = (transparency != NULL && transparency->grayscale == sample) ? 0 : 255;
+    unpacker->lut[sample] = pngif_pixel(unpacker->format, value, value, value, alpha);
+  }
+}
+
+/**
+ * Fills the lookup table of an Indexed image from the palette. Indices past
+ * the end of the palette are invalid and decode to transparent black.
+ */
+void fill_palette_lut(png_unpacker_t *unpacker, png_palette_t *palette) {
+  png_transparency_t *transparency = unpacker->transparency;
+
+  memset(unpacker->lut, 0, sizeof(unpacker->lut));
+  for (size_t idx = 0; idx < palette->length && idx < 256; idx++) {
+    png_color_index_t color = palette->entries[idx];
+    unsigned char alpha = (transparency != NULL) ? transparency->entries[idx] : 255;
+    unpacker->lut[idx] = pngif_pixel(unpacker->format, color.red, color.green, color.blue, alpha);
+  }
+}
+
+/** Public **/
+
+int png_unpacker_init(
+  png_unpacker_t *unpacker,
+  int type,
+  int depth,
+  png_palette_t *palette,
+  png_transparency_t *transparency,
+  int format
+) {
+  unpacker->unpack = NULL;
+  unpacker->type = type;
+  unpacker->depth = depth;
+  unpacker->format = format;
+  unpacker->kernel = NULL;
+  unpacker->transparency = transparency;
+
+  if (depth == 16) {
+    if (type != COLOR_TYPE_INDEXED) {
+      unpacker->unpack = unpack_16;
+    }
+  } else if (type == COLOR_TYPE_GRAYSCALE || type == COLOR_TYPE_INDEXED) {
+    if (type == COLOR_TYPE_INDEXED) {
+      if (palette == NULL) {
+        return PNG_ERR_INVALID_FORMAT;
+      }
+      fill_palette_lut(unpacker, palette);
+    } else {
+      fill_grayscale_lut(unpacker);
+    }
+
+    switch (depth) {
+    case 1:
+      unpacker->unpack = unpack_lut_1;
+      break;
+    case 2:
+      unpacker->unpack = unpack_lut_2;
+      break;
+    case 4:
+      unpacker->unpack = unpack_lut_4;
+      break;
+    case 8:
+      unpacker->unpack = unpack_lut_8;
+      break;
+    }
+  } else if (depth == 8) {
+    switch (type) {
+    case COLOR_TYPE_TRUECOLOR:
+      unpacker->unpack = (transparency != NULL) ? unpack_rgb_8_key : unpack_rgb_8;
+      break;
+    case COLOR_TYPE_GRAYSCALE_ALPHA:
+      unpacker->unpack = unpack_ga_8;
+      break;
+    case COLOR_TYPE_TRUECOLOR_ALPHA:
+      unpacker->unpack = unpack_rgba_8;
+      break;
+    }
+  }
+
+  if (unpacker->unpack == NULL) {
+    return PNG_ERR_INVALID_FORMAT;
+  }
+
+  // Lookup tables and RGBA scanlines are in the output format already.
+  int native = (
+    format == PNGIF_FORMAT_RGBA ||
+    unpacker->unpack == unpack_rgba_8 ||
+    (depth < 16 && (type == COLOR_TYPE_GRAYSCALE || type == COLOR_TYPE_INDEXED))
+  );
+  if (!native) {
+    unpacker->kernel = unpacker->unpack;
+    unpacker->unpack = unpack_converted;
+  }
+
+  return 0;
+}
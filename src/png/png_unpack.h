@@ -0,0 +1,69 @@
+#ifndef _PNG_UNPACK_INCLUDE
+#define _PNG_UNPACK_INCLUDE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <pngif/utils.h>
+#include <pngif/png_parsed.h>
+
+typedef struct png_unpacker png_unpacker_t;
+
+/**
+ * Transforms a "packed" scanline, i. e. an array of concatenated pixel values
+ * with a specific sample size into an array of 4-byte pixels in the output
+ * format of the unpacker.
+ *
+ * @param unpacker Unpacker prepared for the image.
+ * @param data Defiltered scanline data.
+ * @param width Number of pixels in the scanline.
+ * @param output Output array for pixel values, at least width * 4 bytes.
+ */
+typedef void (*png_unpack_fn)(
+  png_unpacker_t *unpacker,
+  unsigned char *data,
+  size_t width,
+  unsigned char *output
+);
+
+/**
+ * Scanline unpacker for a specific color type and bit depth. Prepared once
+ * per image, so that per-pixel work doesn't depend on the image format.
+ */
+struct png_unpacker {
+  png_unpack_fn unpack;
+  int type;
+  int depth;
+  // Output pixel format. Kernels that don't support it directly produce RGBA
+  // into the output row, that's converted in place right after.
+  int format;
+  png_unpack_fn kernel;
+  // Optional transparency data for Truecolor and 16-bit Grayscale images.
+  png_transparency_t *transparency;
+  // Output pixel for each sample value of Indexed and Grayscale images with
+  // bit depth of 8 and lower. Out of palette indices are transparent black.
+  u_int32_t lut[256];
+};
+
+/**
+ * Prepares an unpacker for given image format.
+ *
+ * @param unpacker Unpacker to initialize.
+ * @param type Color type of the image.
+ * @param depth Sample bit depth of the image.
+ * @param palette Palette of the image, required for Indexed images.
+ * @param transparency Optional transparency data.
+ * @param format Output pixel format, PNGIF_FORMAT_* value.
+ *
+ * @return Error code, or 0 on success.
+ */
+int png_unpacker_init(
+  png_unpacker_t *unpacker,
+  int type,
+  int depth,
+  png_palette_t *palette,
+  png_transparency_t *transparency,
+  int format
+);
+
+#endif
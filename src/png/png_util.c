@@ -1,6 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#include <pngif/utils.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PNGIF_CRC_PCLMUL 1
+#include <immintrin.h>
+#endif
 
 /**
  * The code below is taken verbatim from the PNG standard
@@ -42,7 +50,344 @@ u_int32_t update_crc(u_int32_t crc, unsigned char *buf, int len) {
   return c;
 }
 
+/**
+ * Slicing-by-8. Same algorithm as above, but processes 8 bytes per iteration
+ * using 8 tables, where table K holds CRCs of a byte followed by K zero bytes.
+ * See https://create.stephan-brumme.com/crc32/ for detailed explanation.
+ **/
+
+/* Tables for slicing-by-8 CRC. First table is the same as crc_table. */
+u_int32_t crc_slice_table[8][256];
+
+/* Flag: have the tables been computed? Initially false. */
+int crc_slice_table_computed = 0;
+
+/* Make the tables for slicing-by-8 CRC. */
+void make_crc_slice_table(void) {
+  if (!crc_table_computed)
+    make_crc_table();
+
+  for (int n = 0; n < 256; n++) {
+    crc_slice_table[0][n] = crc_table[n];
+  }
+
+  for (int n = 0; n < 256; n++) {
+    for (int k = 1; k < 8; k++) {
+      u_int32_t prev = crc_slice_table[k - 1][n];
+      crc_slice_table[k][n] = (prev >> 8) ^ crc_table[prev & 0xff];
+    }
+  }
+  crc_slice_table_computed = 1;
+}
+
+u_int32_t update_crc_slice8(u_int32_t crc, unsigned char *buf, size_t len) {
+  u_int32_t c = crc;
+
+  if (!crc_slice_table_computed)
+    make_crc_slice_table();
+
+  // Bytes are combined explicitly in little-endian order, so this works the
+  // same on big-endian machines.
+  while (len >= 8) {
+    u_int32_t one = c ^ ((u_int32_t)buf[0] | (u_int32_t)buf[1] << 8 |
+      (u_int32_t)buf[2] << 16 | (u_int32_t)buf[3] << 24);
+    u_int32_t two = (u_int32_t)buf[4] | (u_int32_t)buf[5] << 8 |
+      (u_int32_t)buf[6] << 16 | (u_int32_t)buf[7] << 24;
+
+    c = crc_slice_table[7][one & 0xff] ^
+      crc_slice_table[6][(one >> 8) & 0xff] ^
+      crc_slice_table[5][(one >> 16) & 0xff] ^
+      crc_slice_table[4][one >> 24] ^
+      crc_slice_table[3][two & 0xff] ^
+      crc_slice_table[2][(two >> 8) & 0xff] ^
+      crc_slice_table[1][(two >> 16) & 0xff] ^
+      crc_slice_table[0][two >> 24];
+
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len-- > 0) {
+    c = crc_slice_table[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
+  }
+
+  return c;
+}
+
+#ifdef PNGIF_CRC_PCLMUL
+
+/**
+ * CRC folding with carry-less multiplication, as described in Intel's "Fast
+ * CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" paper.
+ * The constants are the folding multipliers for the reflected PNG/zlib
+ * polynomial, the same ones used by the Linux kernel and Chromium's zlib.
+ *
+ * The input length has to be at least 64 bytes and a multiple of 16. The
+ * remaining bytes are handled by the slicing-by-8 code.
+ **/
+
+static const u_int64_t crc_k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+static const u_int64_t crc_k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+static const u_int64_t crc_k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+static const u_int64_t crc_poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+__attribute__((target("pclmul,sse4.1")))
+u_int32_t update_crc_pclmul_blocks(u_int32_t crc, unsigned char *buf, size_t len) {
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128((__m128i *)(buf + 0x00));
+  x2 = _mm_loadu_si128((__m128i *)(buf + 0x10));
+  x3 = _mm_loadu_si128((__m128i *)(buf + 0x20));
+  x4 = _mm_loadu_si128((__m128i *)(buf + 0x30));
+
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  x0 = _mm_load_si128((__m128i *)crc_k1k2);
+
+  buf += 64;
+  len -= 64;
+
+  // Fold 4 x 128 bits in parallel while there are 64-byte blocks left.
+  while (len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+    y5 = _mm_loadu_si128((__m128i *)(buf + 0x00));
+    y6 = _mm_loadu_si128((__m128i *)(buf + 0x10));
+    y7 = _mm_loadu_si128((__m128i *)(buf + 0x20));
+    y8 = _mm_loadu_si128((__m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+    buf += 64;
+    len -= 64;
+  }
+
+  // Fold 4 x 128 bits into 128 bits.
+  x0 = _mm_load_si128((__m128i *)crc_k3k4);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Fold remaining 16-byte blocks.
+  while (len >= 16) {
+    x2 = _mm_loadu_si128((__m128i *)buf);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    buf += 16;
+    len -= 16;
+  }
+
+  // Fold 128 bits into 64 bits.
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x0 = _mm_loadl_epi64((__m128i *)crc_k5k0);
+
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  x0 = _mm_load_si128((__m128i *)crc_poly);
+
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (u_int32_t)_mm_extract_epi32(x1, 1);
+}
+
+u_int32_t update_crc_pclmul(u_int32_t crc, unsigned char *buf, size_t len) {
+  if (len >= 64) {
+    size_t blocks = len & ~(size_t)15;
+    crc = update_crc_pclmul_blocks(crc, buf, blocks);
+    buf += blocks;
+    len -= blocks;
+  }
+
+  return update_crc_slice8(crc, buf, len);
+}
+
+#endif
+
+/** CPU dispatch **/
+
+typedef u_int32_t (*crc_update_fn)(u_int32_t crc, unsigned char *buf, size_t len);
+
+/* Selected CRC implementation. Resolved on first use. */
+crc_update_fn crc_update_impl = NULL;
+
+/**
+ * Picks the fastest CRC implementation supported by the CPU.
+ *
+ * @return CRC update function.
+ */
+crc_update_fn crc_select_impl(void) {
+#ifdef PNGIF_CRC_PCLMUL
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    return update_crc_pclmul;
+  }
+#endif
+  return update_crc_slice8;
+}
+
 u_int32_t u_crc32(void *buf, size_t length) {
+  // Racing threads would all pick the same function, so the only thing to
+  // guarantee is that the tables are built before the pointer is published.
+  crc_update_fn impl = __atomic_load_n(&crc_update_impl, __ATOMIC_ACQUIRE);
+  if (impl == NULL) {
+    make_crc_slice_table();
+    impl = crc_select_impl();
+    __atomic_store_n(&crc_update_impl, impl, __ATOMIC_RELEASE);
+  }
+
+  return impl(0xffffffff, buf, length) ^ 0xffffffff;
+}
+
+u_int32_t u_crc32_bytewise(void *buf, size_t length) {
   return update_crc(0xffffffff, buf, length) ^ 0xffffffff;
 }
 
+/** Byte order **/
+
+u_int32_t u_read_be32(unsigned char *data) {
+  return ((u_int32_t)data[0] << 24) | ((u_int32_t)data[1] << 16) |
+    ((u_int32_t)data[2] << 8) | (u_int32_t)data[3];
+}
+
+u_int16_t u_read_be16(unsigned char *data) {
+  return (u_int16_t)((data[0] << 8) | data[1]);
+}
+
+/** Image data layout **/
+
+/* Adam7 pass parameters. */
+static const int adam7_starting_row[7]  = { 0, 0, 4, 0, 2, 0, 1 };
+static const int adam7_starting_col[7]  = { 0, 4, 0, 2, 0, 1, 0 };
+static const int adam7_row_increment[7] = { 8, 8, 8, 4, 4, 2, 2 };
+static const int adam7_col_increment[7] = { 8, 8, 4, 4, 2, 2, 1 };
+// Size of the area each pixel represents once the pass is decoded.
+static const int adam7_block_width[7]  = { 8, 4, 4, 2, 2, 1, 1 };
+static const int adam7_block_height[7] = { 8, 8, 4, 4, 2, 2, 1 };
+
+int samples_per_pixel(int type) {
+  switch (type) {
+  case COLOR_TYPE_GRAYSCALE:
+    return 1;
+  case COLOR_TYPE_TRUECOLOR:
+    return 3;
+  case COLOR_TYPE_INDEXED:
+    return 1;
+  case COLOR_TYPE_GRAYSCALE_ALPHA:
+    return 2;
+  case COLOR_TYPE_TRUECOLOR_ALPHA:
+    return 4;
+  }
+
+  // Unknown color type. We shouldn't be here.
+  return -1;
+}
+
+size_t png_scanline_size(size_t width, int type, int depth) {
+  return (width * samples_per_pixel(type) * depth + 8 - 1) / 8;
+}
+
+void adam7_pass_grid(
+  int pass,
+  size_t *x_start,
+  size_t *y_start,
+  size_t *x_step,
+  size_t *y_step
+) {
+  *x_start = adam7_starting_col[pass];
+  *y_start = adam7_starting_row[pass];
+  *x_step = adam7_col_increment[pass];
+  *y_step = adam7_row_increment[pass];
+}
+
+void adam7_pass_block(int pass, size_t *block_width, size_t *block_height) {
+  *block_width = adam7_block_width[pass];
+  *block_height = adam7_block_height[pass];
+}
+
+void adam7_pass_size(
+  int pass,
+  size_t width,
+  size_t height,
+  size_t *pass_width,
+  size_t *pass_height
+) {
+  if (width > adam7_starting_col[pass] && height > adam7_starting_row[pass]) {
+    *pass_width = (width - adam7_starting_col[pass] + adam7_col_increment[pass] - 1)
+      / adam7_col_increment[pass];
+    *pass_height = (height - adam7_starting_row[pass] + adam7_row_increment[pass] - 1)
+      / adam7_row_increment[pass];
+  } else {
+    *pass_width = 0;
+    *pass_height = 0;
+  }
+}
+
+size_t png_filtered_size(size_t width, size_t height, int type, int depth, int interlace) {
+  if (width == 0 || height == 0 || samples_per_pixel(type) < 0 || interlace > 1) {
+    return 0;
+  }
+
+  // Guard against overflow in scanline size math.
+  if (width > (SIZE_MAX - 7) / 64) {
+    return 0;
+  }
+
+  if (interlace == 0) {
+    size_t line = png_scanline_size(width, type, depth) + 1;
+    if (line > SIZE_MAX / height) {
+      return 0;
+    }
+    return line * height;
+  }
+
+  size_t total = 0;
+  for (int pass = 0; pass < 7; pass++) {
+    size_t pass_width = 0, pass_height = 0;
+    adam7_pass_size(pass, width, height, &pass_width, &pass_height);
+    if (pass_width == 0 || pass_height == 0) {
+      continue;
+    }
+
+    size_t line = png_scanline_size(pass_width, type, depth) + 1;
+    if (line > (SIZE_MAX - total) / pass_height) {
+      return 0;
+    }
+    total += line * pass_height;
+  }
+
+  return total;
+}
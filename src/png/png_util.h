@@ -2,7 +2,8 @@
 #define _PNG_UTIL_INCLUDE
 
 /**
- * CRC32 from a byte array.
+ * CRC32 from a byte array. Uses the fastest implementation available on the
+ * current CPU: carry-less multiplication on x86-64, slicing-by-8 elsewhere.
  *
  * @param input Byte array for which to calculate CRC32
  * @oaram length Length of the array.
@@ -11,4 +12,119 @@
  **/
 u_int32_t u_crc32(void *input, size_t length);
 
+/**
+ * CRC32 from a byte array, calculated one byte at a time. This is the
+ * reference implementation from the PNG standard.
+ *
+ * @param input Byte array for which to calculate CRC32
+ * @oaram length Length of the array.
+ *
+ * @return CRC32 checksum for given array.
+ **/
+u_int32_t u_crc32_bytewise(void *input, size_t length);
+
+/**
+ * Reads a big-endian 32-bit integer, e.g. a field of a chunk. The data
+ * doesn't have to be aligned.
+ *
+ * @param data Pointer to the first byte of the integer.
+ *
+ * @return Integer value.
+ */
+u_int32_t u_read_be32(unsigned char *data);
+
+/**
+ * Reads a big-endian 16-bit integer. The data doesn't have to be aligned.
+ *
+ * @param data Pointer to the first byte of the integer.
+ *
+ * @return Integer value.
+ */
+u_int16_t u_read_be16(unsigned char *data);
+
+/**
+ * Returns the number of samples that compose a pixel for given color type.
+ * For example, if the color type is TrueColor, it means that each pixel has
+ * R, G, and B values, thus the number of samples is 3.
+ *
+ * @param type Color type value.
+ *
+ * @return Number of samples composing a pixel.
+ */
+int samples_per_pixel(int type);
+
+/**
+ * Number of bytes in a single scanline of image data, not including the
+ * filter type byte.
+ *
+ * @param width Image width in pixels.
+ * @param type Color type of the image.
+ * @param depth Bit depth of the image.
+ *
+ * @return Scanline size in bytes.
+ */
+size_t png_scanline_size(size_t width, int type, int depth);
+
+/**
+ * Adam7 pass pixel grid: position of the first pixel of a pass in the full
+ * image, and the distance between pixels of the pass.
+ *
+ * @param pass Pass index, 0 to 6.
+ * @param x_start Output column of the first pixel.
+ * @param y_start Output row of the first pixel.
+ * @param x_step Output distance between columns.
+ * @param y_step Output distance between rows.
+ */
+void adam7_pass_grid(
+  int pass,
+  size_t *x_start,
+  size_t *y_start,
+  size_t *x_step,
+  size_t *y_step
+);
+
+/**
+ * Adam7 pass block size. Once a pass is decoded, pixels decoded so far form
+ * a regular grid, and each of them stands for a block of pixels to its right
+ * and below, up to the next decoded pixel.
+ *
+ * @param pass Pass index, 0 to 6.
+ * @param block_width Output block width.
+ * @param block_height Output block height.
+ */
+void adam7_pass_block(int pass, size_t *block_width, size_t *block_height);
+
+/**
+ * Adam7 pass dimensions. Passes that don't contain any pixels for given image
+ * size have zero width or height.
+ *
+ * @param pass Pass index, 0 to 6.
+ * @param width Full image width.
+ * @param height Full image height.
+ * @param pass_width Output number of pixels in a pass scanline.
+ * @param pass_height Output number of scanlines in a pass.
+ */
+void adam7_pass_size(
+  int pass,
+  size_t width,
+  size_t height,
+  size_t *pass_width,
+  size_t *pass_height
+);
+
+/**
+ * Size of the decompressed (filtered) image data, i.e. all scanlines with
+ * their filter type bytes, including all Adam7 passes for interlaced images.
+ *
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param type Color type of the image.
+ * @param depth Bit depth of the image.
+ * @param interlace Interlace method of the image.
+ *
+ * @return Data size in bytes, or 0 if dimensions are invalid or the size
+ *   doesn't fit into memory.
+ */
+size_t png_filtered_size(size_t width, size_t height, int type, int depth, int interlace);
+
 #endif
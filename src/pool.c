@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <pngif/options.h>
+#include <pngif/pool.h>
+#include "parallel.h"
+#include "pool.h"
+
+/** Private **/
+
+/**
+ * Header in front of every pool buffer. 16 bytes, so buffers keep the
+ * alignment of malloc().
+ */
+typedef struct pool_header {
+  // Size class, or PNGIF_POOL_CLASSES for buffers too large to keep.
+  size_t size_class;
+  // Next buffer on the free list, while the buffer is released.
+  struct pool_header *next;
+} pool_header_t;
+
+/**
+ * Finds the size class of a buffer size.
+ *
+ * @param size Buffer size in bytes.
+ *
+ * @return Size class, or PNGIF_POOL_CLASSES if the size is too large.
+ */
+size_t pool_size_class(size_t size) {
+  if (size <= ((size_t)1 << PNGIF_POOL_MIN_SHIFT)) {
+    return 0;
+  }
+
+  // Bits needed for size - 1, i.e. the power of two at or above the size.
+  size_t bits = sizeof(unsigned long long) * 8 - __builtin_clzll((unsigned long long)size - 1);
+  size_t size_class = bits - PNGIF_POOL_MIN_SHIFT;
+  return (size_class < PNGIF_POOL_CLASSES) ? size_class : PNGIF_POOL_CLASSES;
+}
+
+/**
+ * Size of the buffers in a size class.
+ *
+ * @param size_class Size class.
+ *
+ * @return Buffer size in bytes.
+ */
+size_t pool_class_size(size_t size_class) {
+  return (size_t)1 << (size_class + PNGIF_POOL_MIN_SHIFT);
+}
+
+/**
+ * Takes the lock of a thread-safe pool.
+ *
+ * @param pool Buffer pool.
+ */
+void pool_lock(pngif_pool_t *pool) {
+  if (pool->thread_safe) {
+    pthread_mutex_lock(&pool->lock);
+  }
+}
+
+/**
+ * Releases the lock of a thread-safe pool.
+ *
+ * @param pool Buffer pool.
+ */
+void pool_unlock(pngif_pool_t *pool) {
+  if (pool->thread_safe) {
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/** Public **/
+
+pngif_pool_t *pngif_pool_new(size_t capacity, int thread_safe) {
+  pngif_pool_t *pool = calloc(1, sizeof(pngif_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->capacity = capacity;
+  pool->thread_safe = thread_safe;
+  if (thread_safe) {
+    pthread_mutex_init(&pool->lock, NULL);
+  }
+  return pool;
+}
+
+void *pngif_pool_alloc(pngif_pool_t *pool, size_t size) {
+  if (pool == NULL) {
+    return malloc(size);
+  }
+
+  size_t size_class = pool_size_class(size);
+  pool_header_t *header = NULL;
+
+  if (size_class < PNGIF_POOL_CLASSES) {
+    pool_lock(pool);
+    header = pool->free_lists[size_class];
+    if (header != NULL) {
+      pool->free_lists[size_class] = header->next;
+      pool->cached -= pool_class_size(size_class);
+      pool->hits += 1;
+    } else {
+      pool->misses += 1;
+    }
+    pool_unlock(pool);
+
+    if (header == NULL) {
+      header = malloc(sizeof(pool_header_t) + pool_class_size(size_class));
+    }
+  } else {
+    header = malloc(sizeof(pool_header_t) + size);
+  }
+
+  if (header == NULL) {
+    return NULL;
+  }
+
+  header->size_class = size_class;
+  header->next = NULL;
+  return header + 1;
+}
+
+void pngif_pool_release(pngif_pool_t *pool, void *buffer) {
+  if (pool == NULL || buffer == NULL) {
+    free(buffer);
+    return;
+  }
+
+  pool_header_t *header = (pool_header_t *)buffer - 1;
+  size_t size_class = header->size_class;
+  if (size_class >= PNGIF_POOL_CLASSES) {
+    free(header);
+    return;
+  }
+
+  size_t size = pool_class_size(size_class);
+  pool_lock(pool);
+  int keep = (pool->capacity == 0 || pool->cached + size <= pool->capacity);
+  if (keep) {
+    header->next = pool->free_lists[size_class];
+    pool->free_lists[size_class] = header;
+    pool->cached += size;
+  }
+  pool_unlock(pool);
+
+  if (!keep) {
+    free(header);
+  }
+}
+
+void pngif_pool_trim(pngif_pool_t *pool) {
+  if (pool == NULL) {
+    return;
+  }
+
+  pool_lock(pool);
+  for (size_t idx = 0; idx < PNGIF_POOL_CLASSES; idx++) {
+    pool_header_t *header = pool->free_lists[idx];
+    while (header != NULL) {
+      pool_header_t *next = header->next;
+      free(header);
+      header = next;
+    }
+    pool->free_lists[idx] = NULL;
+  }
+  pool->cached = 0;
+  pool_unlock(pool);
+}
+
+void pngif_pool_free(pngif_pool_t *pool) {
+  if (pool == NULL) {
+    return;
+  }
+
+  pngif_pool_trim(pool);
+  if (pool->thread_safe) {
+    pthread_mutex_destroy(&pool->lock);
+  }
+  free(pool);
+}
+
+pngif_pool_t *options_pool(pngif_options_t *options) {
+  return (options != NULL) ? options->pool : NULL;
+}
+
+int options_pool_check(pngif_options_t *options) {
+  if (options == NULL || options->pool == NULL || options->pool->thread_safe) {
+    return 0;
+  }
+
+  return options_parallel(options) ? -1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _PNGIF_POOL_INCLUDE
+#define _PNGIF_POOL_INCLUDE
+
+#include <stdlib.h>
+
+#include <pngif/options.h>
+#include <pngif/pool.h>
+
+/**
+ * Returns the buffer pool to decode with.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return Buffer pool, or NULL to allocate with malloc().
+ */
+pngif_pool_t *options_pool(pngif_options_t *options);
+
+/**
+ * Validates the pool option: a pool that isn't thread-safe can't be used when
+ * images are decoded in parallel. Pipelined composition checks on its own.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return 0 if the pool can be used, or -1 otherwise.
+ */
+int options_pool_check(pngif_options_t *options);
+
+#endif
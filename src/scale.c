@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pngif/options.h>
+#include <pngif/utils.h>
+#include "scale.h"
+#include "surface.h"
+
+/** Private **/
+
+/**
+ * Writes the output row for the accumulated box row and resets the sums.
+ *
+ * @param filter Box filter.
+ * @param rows Number of source rows in the box row.
+ * @param output Output row.
+ */
+void box_filter_flush(box_filter_t *filter, size_t rows, unsigned char *output) {
+  u_int32_t *sums = filter->sums;
+  size_t box = (size_t)1 << filter->shift;
+
+  for (size_t x = 0; x < filter->out_width; x++, sums += 4, output += 4) {
+    size_t columns = filter->width - x * box;
+    if (columns > box) {
+      columns = box;
+    }
+    u_int32_t count = columns * rows;
+    u_int32_t alpha = sums[3];
+
+    // Transparent pixels are all zeroes, in every pixel format.
+    if (alpha == 0 || (filter->binary_alpha && alpha * 2 < count * 255)) {
+      memset(output, 0, 4);
+      continue;
+    }
+
+    // Colors are weighted by alpha, so they are divided by the alpha sum.
+    output[0] = (sums[0] + alpha / 2) / alpha;
+    output[1] = (sums[1] + alpha / 2) / alpha;
+    output[2] = (sums[2] + alpha / 2) / alpha;
+    if (filter->binary_alpha) {
+      output[3] = 255;
+    } else {
+      output[3] = (alpha + count / 2) / count;
+    }
+  }
+
+  memset(filter->sums, 0, filter->out_width * 4 * sizeof(u_int32_t));
+}
+
+/** Public **/
+
+int options_scale_shift(pngif_options_t *options) {
+  if (options == NULL) {
+    return 0;
+  }
+
+  switch (options->scale) {
+  case 0:
+  case 1:
+    return 0;
+  case 2:
+    return 1;
+  case 4:
+    return 2;
+  case 8:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+size_t scaled_size(size_t size, int shift) {
+  return (size + ((size_t)1 << shift) - 1) >> shift;
+}
+
+int box_filter_init(
+  box_filter_t *filter,
+  size_t width,
+  size_t height,
+  int shift,
+  int binary_alpha,
+  pngif_pool_t *pool
+) {
+  filter->shift = shift;
+  filter->binary_alpha = binary_alpha;
+  filter->width = width;
+  filter->height = height;
+  filter->out_width = scaled_size(width, shift);
+  filter->line = 0;
+  filter->pool = pool;
+  filter->sums = pngif_pool_alloc(pool, filter->out_width * 4 * sizeof(u_int32_t));
+  if (filter->sums == NULL) {
+    return -1;
+  }
+
+  memset(filter->sums, 0, filter->out_width * 4 * sizeof(u_int32_t));
+  return 0;
+}
+
+void box_filter_push_row(box_filter_t *filter, unsigned char *rgba, pngif_surface_t *output) {
+  u_int32_t *sums = filter->sums;
+  int shift = filter->shift;
+
+  // Sums fit easily: 64 pixels of 255 * 255 at most.
+  for (size_t x = 0; x < filter->width; x++, rgba += 4) {
+    u_int32_t *sum = sums + (x >> shift) * 4;
+    u_int32_t alpha = rgba[3];
+    sum[0] += rgba[0] * alpha;
+    sum[1] += rgba[1] * alpha;
+    sum[2] += rgba[2] * alpha;
+    sum[3] += alpha;
+  }
+
+  filter->line += 1;
+
+  size_t box = (size_t)1 << shift;
+  size_t rows = ((filter->line - 1) & (box - 1)) + 1;
+  if (rows == box || filter->line == filter->height) {
+    unsigned char *row = surface_row(output, (filter->line - 1) >> shift);
+    box_filter_flush(filter, rows, row);
+    if (output->format != PNGIF_FORMAT_RGBA) {
+      pngif_convert_pixels(row, row, filter->out_width, output->format);
+    }
+  }
+}
+
+void box_filter_free(box_filter_t *filter) {
+  pngif_pool_release(filter->pool, filter->sums);
+  filter->sums = NULL;
+}
+
+unsigned char *box_filter_image(
+  unsigned char *rgba,
+  size_t width,
+  size_t height,
+  int shift,
+  int binary_alpha,
+  int format,
+  pngif_pool_t *pool
+) {
+  box_filter_t filter;
+  pngif_surface_t surface;
+  size_t out_width = scaled_size(width, shift);
+  size_t out_height = scaled_size(height, shift);
+  unsigned char *output = pngif_pool_alloc(pool, out_width * out_height * 4);
+  if (output == NULL) {
+    return NULL;
+  }
+  surface_from_rgba(&surface, output, out_width, out_height);
+  surface.format = format;
+
+  if (box_filter_init(&filter, width, height, shift, binary_alpha, pool) != 0) {
+    pngif_pool_release(pool, output);
+    return NULL;
+  }
+
+  for (size_t line = 0; line < height; line++) {
+    box_filter_push_row(&filter, rgba + line * width * 4, &surface);
+  }
+
+  box_filter_free(&filter);
+  return output;
+}
@@ -0,0 +1,115 @@
+#ifndef _PNGIF_SCALE_INCLUDE
+#define _PNGIF_SCALE_INCLUDE
+
+#include <stdlib.h>
+
+#include <pngif/options.h>
+#include <pngif/surface.h>
+
+/**
+ * Box filter that reduces an image by a power of two, one source row at a
+ * time. Each output pixel is the average of a box of source pixels, weighted
+ * by alpha so that colors of transparent pixels don't bleed into visible ones.
+ * Boxes on the right and bottom edges may be smaller than the others.
+ */
+typedef struct {
+  // Scale as a power of two, i.e. boxes are (1 << shift) pixels wide.
+  int shift;
+  // Flag to make each output pixel either fully opaque or fully transparent,
+  // depending on whether at least half of its box is visible.
+  int binary_alpha;
+  // Source dimensions.
+  size_t width;
+  size_t height;
+  // Output width.
+  size_t out_width;
+  // Number of source rows pushed so far.
+  size_t line;
+  // Per output pixel sums of alpha-weighted colors and alpha, and the buffer
+  // pool they were allocated from.
+  u_int32_t *sums;
+  pngif_pool_t *pool;
+} box_filter_t;
+
+/**
+ * Validates the scale option.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return Scale as a power of two, 0 to 3, or -1 if the scale is invalid.
+ */
+int options_scale_shift(pngif_options_t *options);
+
+/**
+ * Size of an image dimension after reduction, rounded up.
+ *
+ * @param size Original size.
+ * @param shift Scale as a power of two.
+ *
+ * @return Reduced size.
+ */
+size_t scaled_size(size_t size, int shift);
+
+/**
+ * Prepares a box filter for an image.
+ *
+ * @param filter Filter to initialize.
+ * @param width Source image width.
+ * @param height Source image height.
+ * @param shift Scale as a power of two.
+ * @param binary_alpha Flag to only produce fully opaque or transparent pixels.
+ * @param pool Buffer pool, or NULL.
+ *
+ * @return 0 on success, or -1 if memory couldn't be allocated.
+ */
+int box_filter_init(
+  box_filter_t *filter,
+  size_t width,
+  size_t height,
+  int shift,
+  int binary_alpha,
+  pngif_pool_t *pool
+);
+
+/**
+ * Adds the next source row to the filter. Once the last row of a box is
+ * added, the corresponding output row is written.
+ *
+ * @param filter Box filter.
+ * @param rgba Source row of RGBA pixels.
+ * @param output Output surface, that fits scaled_size(width) by
+ *   scaled_size(height) pixels.
+ */
+void box_filter_push_row(box_filter_t *filter, unsigned char *rgba, pngif_surface_t *output);
+
+/**
+ * Frees the memory used by the filter.
+ *
+ * @param filter Box filter.
+ */
+void box_filter_free(box_filter_t *filter);
+
+/**
+ * Reduces a whole RGBA image into a new image in an output pixel format.
+ *
+ * @param rgba Source image.
+ * @param width Source image width.
+ * @param height Source image height.
+ * @param shift Scale as a power of two.
+ * @param binary_alpha Flag to only produce fully opaque or transparent pixels.
+ * @param format Output pixel format.
+ * @param pool Buffer pool to allocate the reduced image from, or NULL.
+ *
+ * @return Reduced image, or NULL if memory couldn't be allocated.
+ */
+unsigned char *box_filter_image(
+  unsigned char *rgba,
+  size_t width,
+  size_t height,
+  int shift,
+  int binary_alpha,
+  int format,
+  pngif_pool_t *pool
+);
+
+#endif
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pngif/errors.h>
+#include <pngif/options.h>
+#include <pngif/surface.h>
+#include <pngif/utils.h>
+#include "surface.h"
+
+/** Public **/
+
+int format_valid(int format) {
+  return (format & ~(PNGIF_FORMAT_ABGR | PNGIF_FORMAT_PREMULTIPLIED)) == 0;
+}
+
+int options_format(pngif_options_t *options) {
+  if (options == NULL) {
+    return PNGIF_FORMAT_RGBA;
+  }
+
+  return format_valid(options->format) ? options->format : -1;
+}
+
+int surface_check(pngif_surface_t *surface, size_t width, size_t height) {
+  if (
+    surface == NULL ||
+    surface->pixels == NULL ||
+    !format_valid(surface->format) ||
+    surface->width < width ||
+    surface->height < height ||
+    surface->stride < (size_t)surface->width * 4
+  ) {
+    return PNGIF_ERR_BAD_SURFACE;
+  }
+
+  return 0;
+}
+
+void surface_from_rgba(pngif_surface_t *surface, unsigned char *rgba, size_t width, size_t height) {
+  surface->pixels = rgba;
+  surface->stride = width * 4;
+  surface->width = width;
+  surface->height = height;
+  surface->format = PNGIF_FORMAT_RGBA;
+}
+
+void surface_store_row(pngif_surface_t *surface, size_t x, size_t y, unsigned char *rgba, size_t width) {
+  unsigned char *row = surface_row(surface, y) + x * 4;
+  if (surface->format == PNGIF_FORMAT_RGBA) {
+    memcpy(row, rgba, width * 4);
+  } else {
+    pngif_convert_pixels(rgba, row, width, surface->format);
+  }
+}
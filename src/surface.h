@@ -0,0 +1,71 @@
+#ifndef _PNGIF_SURFACE_INCLUDE
+#define _PNGIF_SURFACE_INCLUDE
+
+#include <stdlib.h>
+
+#include <pngif/options.h>
+#include <pngif/surface.h>
+
+/**
+ * Checks that a pixel format is a byte order with optional flags.
+ *
+ * @param format Pixel format.
+ *
+ * @return 1 if the format is valid, or 0.
+ */
+int format_valid(int format);
+
+/**
+ * Validates the pixel format option.
+ *
+ * @param options Decoding options, or NULL.
+ *
+ * @return Pixel format, or -1 if the format is invalid.
+ */
+int options_format(pngif_options_t *options);
+
+/**
+ * Checks that a surface is usable and fits an image.
+ *
+ * @param surface Output surface.
+ * @param width Image width.
+ * @param height Image height.
+ *
+ * @return PNGIF_ERR_BAD_SURFACE if the surface is invalid or too small, or 0.
+ */
+int surface_check(pngif_surface_t *surface, size_t width, size_t height);
+
+/**
+ * Wraps a tightly packed RGBA buffer into a surface.
+ *
+ * @param surface Surface to initialize.
+ * @param rgba RGBA pixels.
+ * @param width Image width.
+ * @param height Image height.
+ */
+void surface_from_rgba(pngif_surface_t *surface, unsigned char *rgba, size_t width, size_t height);
+
+/**
+ * Returns a pointer to the first pixel of a surface row.
+ *
+ * @param surface Surface.
+ * @param y Row index.
+ *
+ * @return Row pointer.
+ */
+static inline unsigned char *surface_row(pngif_surface_t *surface, size_t y) {
+  return surface->pixels + y * surface->stride;
+}
+
+/**
+ * Stores a row of RGBA pixels into a surface, in the surface pixel format.
+ *
+ * @param surface Surface.
+ * @param x Column of the first pixel.
+ * @param y Row index.
+ * @param rgba RGBA pixels.
+ * @param width Number of pixels.
+ */
+void surface_store_row(pngif_surface_t *surface, size_t x, size_t y, unsigned char *rgba, size_t width);
+
+#endif
@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include <pngif/errors.h>
+#include <pngif/surface.h>
+#include <pngif/utils.h>
 
 size_t pngif_read_file(FILE *file, unsigned char **output, int *error) {
   // Get the size.
@@ -35,41 +37,743 @@ size_t pngif_read_file(FILE *file, unsigned char **output, int *error) {
 }
 
 void rgba_to_argb(unsigned char *rgba, unsigned char *argb, size_t width, size_t height) {
-  int byte_count = width * height * 4;
-  unsigned char pixel[4];
+  pngif_convert_pixels(rgba, argb, width * height, PNGIF_FORMAT_ARGB);
+}
+
+void rgba_to_bgra(unsigned char *src, unsigned char *dest, size_t width, size_t height) {
+  pngif_convert_pixels(src, dest, width * height, PNGIF_FORMAT_BGRA);
+}
+
+/** Pixel formats **/
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PNGIF_PIXELS_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Instruction set levels of pixel kernels. */
+#define PIXELS_SCALAR 0
+#define PIXELS_SSSE3 1
+#define PIXELS_AVX2 2
+
+/**
+ * Pixel kernels of one instruction set level. Premultiply and unpremultiply
+ * work in place on pixels of any byte order, with alpha at a given index.
+ * Blend composes pixels over canvas pixels of the same format.
+ */
+typedef struct {
+  void (*convert)(unsigned char *rgba, unsigned char *output, size_t count, int format);
+  void (*premultiply)(unsigned char *pixels, size_t count, int alpha);
+  void (*unpremultiply)(unsigned char *pixels, size_t count, int alpha);
+  void (*blend)(unsigned char *canvas, unsigned char *pixels, size_t count, int format);
+} pngif_pixel_kernels_t;
 
-  // We use temp buffer to allow input and output to be a pointer to the same
-  // array. It's not as clean looking, but it's more handy in case you don't
-  // want to make the conversion inline without spawning more memory blocks.
-  for (int idx = 0; idx < byte_count; idx += 4) {
-    // Save current pixel.
-    pixel[0] = rgba[idx + 3];
-    pixel[1] = rgba[idx + 0];
-    pixel[2] = rgba[idx + 1];
-    pixel[3] = rgba[idx + 2];
-    // Write it to output array.
-    memcpy(argb + idx, pixel, 4);
+/**
+ * Byte order of pixel formats: for each output byte, the index of the RGBA
+ * byte it's taken from.
+ */
+static const unsigned char pixel_orders[4][4] = {
+  { 0, 1, 2, 3 }, // RGBA
+  { 2, 1, 0, 3 }, // BGRA
+  { 3, 0, 1, 2 }, // ARGB
+  { 3, 2, 1, 0 }, // ABGR
+};
+
+/**
+ * Returns the index of the alpha byte in pixels of a format.
+ */
+static inline int alpha_index(int format) {
+  return (pixel_orders[format & 3][0] == 3) ? 0 : 3;
+}
+
+/**
+ * Divides a value up to 255 * 255 by 255, rounded to nearest, computed exactly
+ * without division.
+ */
+static inline unsigned char div255(u_int32_t value) {
+  value += 128;
+  return (value + (value >> 8)) >> 8;
+}
+
+/**
+ * Multiplies a color value by alpha, rounded to nearest: round(c * a / 255).
+ */
+static inline unsigned char premultiply(unsigned char color, unsigned char alpha) {
+  return div255(color * alpha);
+}
+
+/**
+ * Divides a premultiplied color value by alpha, rounded to nearest:
+ * round(c * 255 / a), saturated for colors larger than alpha. Colors of fully
+ * transparent pixels are zero.
+ */
+static inline unsigned char unpremultiply(unsigned char color, unsigned char alpha) {
+  if (alpha == 0) {
+    return 0;
   }
+  u_int32_t value = (color * 255 + alpha / 2) / alpha;
+  return (value > 255) ? 255 : value;
 }
 
-void rgba_to_bgra(unsigned char *src, unsigned char *dest, size_t width, size_t height) {
-  int byte_count = width * height * 4;
+/** Scalar kernels **/
+
+void convert_pixels_scalar(unsigned char *rgba, unsigned char *output, size_t count, int format) {
+  const unsigned char *order = pixel_orders[format & 3];
   unsigned char pixel[4];
 
-  // We use temp buffer to allow input and output to be a pointer to the same
-  // array. It's not as clean looking, but it's more handy in case you don't
-  // want to make the conversion inline without spawning more memory blocks.
-  for (int idx = 0; idx < byte_count; idx += 4) {
-    // Save current pixel.
-    pixel[0] = src[idx + 2];
-    pixel[1] = src[idx + 1];
-    pixel[2] = src[idx + 0];
-    pixel[3] = src[idx + 3];
-    // Write it to output array.
-    memcpy(dest + idx, pixel, 4);
+  if (format == PNGIF_FORMAT_RGBA) {
+    memmove(output, rgba, count * 4);
+    return;
+  }
+
+  // Pixel is read whole before writing, so conversion works in place.
+  for (size_t idx = 0; idx < count; idx++, rgba += 4, output += 4) {
+    memcpy(pixel, rgba, 4);
+    if (format & PNGIF_FORMAT_PREMULTIPLIED) {
+      pixel[0] = premultiply(pixel[0], pixel[3]);
+      pixel[1] = premultiply(pixel[1], pixel[3]);
+      pixel[2] = premultiply(pixel[2], pixel[3]);
+    }
+    output[0] = pixel[order[0]];
+    output[1] = pixel[order[1]];
+    output[2] = pixel[order[2]];
+    output[3] = pixel[order[3]];
+  }
+}
+
+void premultiply_pixels_scalar(unsigned char *pixels, size_t count, int alpha) {
+  // Colors are either the bytes after alpha, or the ones before it.
+  int first = (alpha == 0) ? 1 : 0;
+  for (size_t idx = 0; idx < count; idx++, pixels += 4) {
+    pixels[first + 0] = premultiply(pixels[first + 0], pixels[alpha]);
+    pixels[first + 1] = premultiply(pixels[first + 1], pixels[alpha]);
+    pixels[first + 2] = premultiply(pixels[first + 2], pixels[alpha]);
+  }
+}
+
+void unpremultiply_pixels_scalar(unsigned char *pixels, size_t count, int alpha) {
+  int first = (alpha == 0) ? 1 : 0;
+  for (size_t idx = 0; idx < count; idx++, pixels += 4) {
+    pixels[first + 0] = unpremultiply(pixels[first + 0], pixels[alpha]);
+    pixels[first + 1] = unpremultiply(pixels[first + 1], pixels[alpha]);
+    pixels[first + 2] = unpremultiply(pixels[first + 2], pixels[alpha]);
   }
 }
 
+/**
+ * Composes a partially transparent pixel over a canvas pixel. Premultiplied
+ * pixels, alpha included, are s + d * (255 - sa) / 255. Straight alpha is
+ * composed the same way, and colors are weighted by the alpha of each side:
+ * (s * sa * 255 + d * da * (255 - sa)) / (sa * 255 + da * (255 - sa)).
+ */
+static inline void blend_pixel(unsigned char *canvas, unsigned char *pixel, int alpha, int premultiplied) {
+  u_int32_t inverse = 255 - pixel[alpha];
+
+  if (premultiplied) {
+    for (int idx = 0; idx < 4; idx++) {
+      u_int32_t value = pixel[idx] + premultiply(canvas[idx], inverse);
+      canvas[idx] = (value > 255) ? 255 : value;
+    }
+    return;
+  }
+
+  u_int32_t source = pixel[alpha] * 255;
+  u_int32_t weight = canvas[alpha] * inverse;
+  u_int32_t total = source + weight;
+  for (int idx = 0; idx < 4; idx++) {
+    if (idx != alpha) {
+      canvas[idx] = (pixel[idx] * source + canvas[idx] * weight + total / 2) / total;
+    }
+  }
+  canvas[alpha] = div255(total);
+}
+
+void blend_pixels_scalar(unsigned char *canvas, unsigned char *pixels, size_t count, int format) {
+  int alpha = alpha_index(format);
+  int premultiplied = format & PNGIF_FORMAT_PREMULTIPLIED;
+
+  size_t idx = 0;
+  while (idx < count) {
+    // Runs of opaque pixels are copied, and runs of transparent ones skipped.
+    size_t run = idx;
+    unsigned char value = pixels[idx * 4 + alpha];
+    if (value == 255 || value == 0) {
+      while (run < count && pixels[run * 4 + alpha] == value) {
+        run++;
+      }
+      if (value == 255) {
+        memcpy(canvas + idx * 4, pixels + idx * 4, (run - idx) * 4);
+      }
+      idx = run;
+      continue;
+    }
+
+    blend_pixel(canvas + idx * 4, pixels + idx * 4, alpha, premultiplied);
+    idx++;
+  }
+}
+
+const pngif_pixel_kernels_t pixel_kernels_scalar = {
+  .convert = convert_pixels_scalar,
+  .premultiply = premultiply_pixels_scalar,
+  .unpremultiply = unpremultiply_pixels_scalar,
+  .blend = blend_pixels_scalar,
+};
+
+#ifdef PNGIF_PIXELS_SIMD
+
+/** SIMD kernels **/
+
+/**
+ * Channels are reordered with a byte shuffle, 4 pixels per 128-bit lane.
+ * Premultiplication is done in 16-bit lanes: the alpha of each pixel is
+ * shuffled into all of its bytes, with 255 in the alpha byte itself so alpha
+ * is multiplied by one, and the product is divided by 255 exactly with
+ * (v + 128 + ((v + 128) >> 8)) >> 8.
+ *
+ * Unpremultiplication divides (c * 255 + a / 2) by alpha in single precision.
+ * Both are integers below 2^24, and a non-integer quotient is at least 1 / a
+ * away from an integer, much more than the rounding error of the division, so
+ * truncating the quotient gives the exact integer result. Division by zero
+ * alpha results in an invalid value, that is saturated to zero when packed.
+ *
+ * Blending checks the alpha of each vector of source pixels first: fully
+ * opaque vectors are stored as is, and fully transparent ones are skipped.
+ * Premultiplied pixels are blended in 16-bit lanes like premultiplication,
+ * with a saturating add. Straight alpha colors are divided by the composed
+ * alpha in single precision, which is exact for the same reasons as in
+ * unpremultiplication: the numerator is below 255^3 + 255^2 < 2^24, and the
+ * divisor below 2^16. Source pixels with zero alpha keep the canvas pixel, as
+ * in the scalar kernel, which also covers the division by zero over a
+ * transparent canvas.
+ *
+ * Masks are built for 16-byte lanes, AVX2 kernels use the same masks in both
+ * lanes. Pixels that don't fill a whole vector are left to narrower kernels.
+ */
+
+typedef struct {
+  // Channel reorder.
+  unsigned char swizzle[16];
+  // Alpha of each pixel in every byte of the pixel.
+  unsigned char broadcast[16];
+  // All ones in alpha bytes.
+  unsigned char alpha[16];
+} pixel_masks_t;
+
+/**
+ * Fills shuffle masks for a pixel format. Alpha masks are built for the
+ * byte order of the output.
+ */
+static void pixel_masks(pixel_masks_t *masks, int format) {
+  const unsigned char *order = pixel_orders[format & 3];
+  int alpha = alpha_index(format);
+  for (int byte = 0; byte < 16; byte++) {
+    int pixel = byte & ~3;
+    masks->swizzle[byte] = pixel + order[byte & 3];
+    masks->broadcast[byte] = pixel + alpha;
+    masks->alpha[byte] = ((byte & 3) == alpha) ? 0xff : 0;
+  }
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i div255_epu16_sse(__m128i value) {
+  value = _mm_add_epi16(value, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i premultiply_sse(__m128i x, __m128i broadcast, __m128i alpha_mask) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i alpha = _mm_or_si128(_mm_shuffle_epi8(x, broadcast), alpha_mask);
+  __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(alpha, zero));
+  __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(alpha, zero));
+  return _mm_packus_epi16(div255_epu16_sse(lo), div255_epu16_sse(hi));
+}
+
+/**
+ * Divides 4 colors of 16-bit lanes (the low or the high half) by alpha.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i unpremultiply_half_sse(__m128i colors, __m128i alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i value = _mm_add_epi16(
+    _mm_mullo_epi16(colors, _mm_set1_epi16(255)),
+    _mm_srli_epi16(alpha, 1)
+  );
+  __m128 lo = _mm_div_ps(
+    _mm_cvtepi32_ps(_mm_unpacklo_epi16(value, zero)),
+    _mm_cvtepi32_ps(_mm_unpacklo_epi16(alpha, zero))
+  );
+  __m128 hi = _mm_div_ps(
+    _mm_cvtepi32_ps(_mm_unpackhi_epi16(value, zero)),
+    _mm_cvtepi32_ps(_mm_unpackhi_epi16(alpha, zero))
+  );
+  return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i unpremultiply_sse(__m128i x, __m128i broadcast, __m128i alpha_mask) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i alpha = _mm_shuffle_epi8(x, broadcast);
+  __m128i lo = unpremultiply_half_sse(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(alpha, zero));
+  __m128i hi = unpremultiply_half_sse(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(alpha, zero));
+  __m128i colors = _mm_packus_epi16(lo, hi);
+  return _mm_or_si128(_mm_andnot_si128(alpha_mask, colors), _mm_and_si128(alpha_mask, x));
+}
+
+__attribute__((target("ssse3")))
+void convert_pixels_ssse3(unsigned char *rgba, unsigned char *output, size_t count, int format) {
+  pixel_masks_t masks;
+  pixel_masks(&masks, format);
+  const __m128i swizzle = _mm_loadu_si128((__m128i *)masks.swizzle);
+  const __m128i broadcast = _mm_loadu_si128((__m128i *)masks.broadcast);
+  const __m128i alpha_mask = _mm_loadu_si128((__m128i *)masks.alpha);
+  int premultiplied = format & PNGIF_FORMAT_PREMULTIPLIED;
+
+  size_t idx = 0;
+  for (; idx + 4 <= count; idx += 4) {
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(rgba + idx * 4)), swizzle);
+    if (premultiplied) {
+      x = premultiply_sse(x, broadcast, alpha_mask);
+    }
+    _mm_storeu_si128((__m128i *)(output + idx * 4), x);
+  }
+  convert_pixels_scalar(rgba + idx * 4, output + idx * 4, count - idx, format);
+}
+
+__attribute__((target("ssse3")))
+void premultiply_pixels_ssse3(unsigned char *pixels, size_t count, int alpha) {
+  pixel_masks_t masks;
+  // Alpha masks only depend on the alpha position.
+  pixel_masks(&masks, (alpha == 0) ? PNGIF_FORMAT_ARGB : PNGIF_FORMAT_RGBA);
+  const __m128i broadcast = _mm_loadu_si128((__m128i *)masks.broadcast);
+  const __m128i alpha_mask = _mm_loadu_si128((__m128i *)masks.alpha);
+
+  size_t idx = 0;
+  for (; idx + 4 <= count; idx += 4) {
+    __m128i x = _mm_loadu_si128((__m128i *)(pixels + idx * 4));
+    _mm_storeu_si128((__m128i *)(pixels + idx * 4), premultiply_sse(x, broadcast, alpha_mask));
+  }
+  premultiply_pixels_scalar(pixels + idx * 4, count - idx, alpha);
+}
+
+__attribute__((target("ssse3")))
+void unpremultiply_pixels_ssse3(unsigned char *pixels, size_t count, int alpha) {
+  pixel_masks_t masks;
+  // Alpha masks only depend on the alpha position.
+  pixel_masks(&masks, (alpha == 0) ? PNGIF_FORMAT_ARGB : PNGIF_FORMAT_RGBA);
+  const __m128i broadcast = _mm_loadu_si128((__m128i *)masks.broadcast);
+  const __m128i alpha_mask = _mm_loadu_si128((__m128i *)masks.alpha);
+
+  size_t idx = 0;
+  for (; idx + 4 <= count; idx += 4) {
+    __m128i x = _mm_loadu_si128((__m128i *)(pixels + idx * 4));
+    _mm_storeu_si128((__m128i *)(pixels + idx * 4), unpremultiply_sse(x, broadcast, alpha_mask));
+  }
+  unpremultiply_pixels_scalar(pixels + idx * 4, count - idx, alpha);
+}
+
+/**
+ * Composes 2 straight alpha pixels in 16-bit lanes (the low or the high half),
+ * with alpha of each pixel in all of its lanes. Alpha lanes are left to the
+ * caller.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i blend_straight_half_sse(
+  __m128i colors,
+  __m128i canvas,
+  __m128i source,
+  __m128i weight,
+  __m128i total
+) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_mullo_epi16(canvas, weight);
+  __m128i high = _mm_mulhi_epu16(canvas, weight);
+  __m128i half = _mm_srli_epi16(total, 1);
+
+  __m128 lo = _mm_add_ps(
+    _mm_add_ps(
+      _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(colors, zero)), _mm_cvtepi32_ps(_mm_unpacklo_epi16(source, zero))),
+      _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, high))
+    ),
+    _mm_cvtepi32_ps(_mm_unpacklo_epi16(half, zero))
+  );
+  __m128 hi = _mm_add_ps(
+    _mm_add_ps(
+      _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(colors, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(source, zero))),
+      _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, high))
+    ),
+    _mm_cvtepi32_ps(_mm_unpackhi_epi16(half, zero))
+  );
+  lo = _mm_div_ps(lo, _mm_cvtepi32_ps(_mm_unpacklo_epi16(total, zero)));
+  hi = _mm_div_ps(hi, _mm_cvtepi32_ps(_mm_unpackhi_epi16(total, zero)));
+  return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i blend_sse(
+  __m128i x,
+  __m128i canvas,
+  __m128i broadcast,
+  __m128i alpha_mask,
+  int premultiplied
+) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16(255);
+  __m128i alpha = _mm_shuffle_epi8(x, broadcast);
+  __m128i inverse = _mm_xor_si128(alpha, _mm_set1_epi8(-1));
+  __m128i transparent = _mm_cmpeq_epi8(alpha, zero);
+  __m128i result;
+
+  if (premultiplied) {
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(canvas, zero), _mm_unpacklo_epi8(inverse, zero));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(canvas, zero), _mm_unpackhi_epi8(inverse, zero));
+    result = _mm_adds_epu8(x, _mm_packus_epi16(div255_epu16_sse(lo), div255_epu16_sse(hi)));
+    return _mm_or_si128(_mm_and_si128(transparent, canvas), _mm_andnot_si128(transparent, result));
+  }
+
+  // Weights of both sides, in units of 1 / 255^2, and their sum.
+  __m128i canvas_alpha = _mm_shuffle_epi8(canvas, broadcast);
+  __m128i source_lo = _mm_mullo_epi16(_mm_unpacklo_epi8(alpha, zero), max);
+  __m128i source_hi = _mm_mullo_epi16(_mm_unpackhi_epi8(alpha, zero), max);
+  __m128i weight_lo = _mm_mullo_epi16(_mm_unpacklo_epi8(canvas_alpha, zero), _mm_unpacklo_epi8(inverse, zero));
+  __m128i weight_hi = _mm_mullo_epi16(_mm_unpackhi_epi8(canvas_alpha, zero), _mm_unpackhi_epi8(inverse, zero));
+  __m128i total_lo = _mm_add_epi16(source_lo, weight_lo);
+  __m128i total_hi = _mm_add_epi16(source_hi, weight_hi);
+
+  __m128i colors = _mm_packus_epi16(
+    blend_straight_half_sse(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(canvas, zero), source_lo, weight_lo, total_lo),
+    blend_straight_half_sse(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(canvas, zero), source_hi, weight_hi, total_hi)
+  );
+  __m128i alphas = _mm_packus_epi16(div255_epu16_sse(total_lo), div255_epu16_sse(total_hi));
+  result = _mm_or_si128(_mm_andnot_si128(alpha_mask, colors), _mm_and_si128(alpha_mask, alphas));
+  return _mm_or_si128(_mm_and_si128(transparent, canvas), _mm_andnot_si128(transparent, result));
+}
+
+__attribute__((target("ssse3")))
+void blend_pixels_ssse3(unsigned char *canvas, unsigned char *pixels, size_t count, int format) {
+  pixel_masks_t masks;
+  pixel_masks(&masks, format);
+  const __m128i broadcast = _mm_loadu_si128((__m128i *)masks.broadcast);
+  const __m128i alpha_mask = _mm_loadu_si128((__m128i *)masks.alpha);
+  const __m128i zero = _mm_setzero_si128();
+  int premultiplied = format & PNGIF_FORMAT_PREMULTIPLIED;
+
+  size_t idx = 0;
+  for (; idx + 4 <= count; idx += 4) {
+    __m128i x = _mm_loadu_si128((__m128i *)(pixels + idx * 4));
+    __m128i alpha = _mm_and_si128(x, alpha_mask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(alpha, alpha_mask)) == 0xffff) {
+      _mm_storeu_si128((__m128i *)(canvas + idx * 4), x);
+    } else if (_mm_movemask_epi8(_mm_cmpeq_epi8(alpha, zero)) != 0xffff) {
+      __m128i under = _mm_loadu_si128((__m128i *)(canvas + idx * 4));
+      _mm_storeu_si128((__m128i *)(canvas + idx * 4), blend_sse(x, under, broadcast, alpha_mask, premultiplied));
+    }
+  }
+  blend_pixels_scalar(canvas + idx * 4, pixels + idx * 4, count - idx, format);
+}
+
+const pngif_pixel_kernels_t pixel_kernels_ssse3 = {
+  .convert = convert_pixels_ssse3,
+  .premultiply = premultiply_pixels_ssse3,
+  .unpremultiply = unpremultiply_pixels_ssse3,
+  .blend = blend_pixels_ssse3,
+};
+
+__attribute__((target("avx2")))
+static inline __m256i load_mask_avx2(unsigned char *mask) {
+  return _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)mask));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_epu16_avx2(__m256i value) {
+  value = _mm256_add_epi16(value, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i premultiply_avx2(__m256i x, __m256i broadcast, __m256i alpha_mask) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i alpha = _mm256_or_si256(_mm256_shuffle_epi8(x, broadcast), alpha_mask);
+  __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero), _mm256_unpacklo_epi8(alpha, zero));
+  __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero), _mm256_unpackhi_epi8(alpha, zero));
+  return _mm256_packus_epi16(div255_epu16_avx2(lo), div255_epu16_avx2(hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i unpremultiply_half_avx2(__m256i colors, __m256i alpha) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i value = _mm256_add_epi16(
+    _mm256_mullo_epi16(colors, _mm256_set1_epi16(255)),
+    _mm256_srli_epi16(alpha, 1)
+  );
+  __m256 lo = _mm256_div_ps(
+    _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(value, zero)),
+    _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(alpha, zero))
+  );
+  __m256 hi = _mm256_div_ps(
+    _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(value, zero)),
+    _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(alpha, zero))
+  );
+  return _mm256_packs_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i unpremultiply_avx2(__m256i x, __m256i broadcast, __m256i alpha_mask) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i alpha = _mm256_shuffle_epi8(x, broadcast);
+  __m256i lo = unpremultiply_half_avx2(_mm256_unpacklo_epi8(x, zero), _mm256_unpacklo_epi8(alpha, zero));
+  __m256i hi = unpremultiply_half_avx2(_mm256_unpackhi_epi8(x, zero), _mm256_unpackhi_epi8(alpha, zero));
+  __m256i colors = _mm256_packus_epi16(lo, hi);
+  return _mm256_blendv_epi8(colors, x, alpha_mask);
+}
+
+__attribute__((target("avx2")))
+void convert_pixels_avx2(unsigned char *rgba, unsigned char *output, size_t count, int format) {
+  pixel_masks_t masks;
+  pixel_masks(&masks, format);
+  const __m256i swizzle = load_mask_avx2(masks.swizzle);
+  const __m256i broadcast = load_mask_avx2(masks.broadcast);
+  const __m256i alpha_mask = load_mask_avx2(masks.alpha);
+  int premultiplied = format & PNGIF_FORMAT_PREMULTIPLIED;
+
+  size_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    __m256i x = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *)(rgba + idx * 4)), swizzle);
+    if (premultiplied) {
+      x = premultiply_avx2(x, broadcast, alpha_mask);
+    }
+    _mm256_storeu_si256((__m256i *)(output + idx * 4), x);
+  }
+  convert_pixels_ssse3(rgba + idx * 4, output + idx * 4, count - idx, format);
+}
+
+__attribute__((target("avx2")))
+void premultiply_pixels_avx2(unsigned char *pixels, size_t count, int alpha) {
+  pixel_masks_t masks;
+  // Alpha masks only depend on the alpha position.
+  pixel_masks(&masks, (alpha == 0) ? PNGIF_FORMAT_ARGB : PNGIF_FORMAT_RGBA);
+  const __m256i broadcast = load_mask_avx2(masks.broadcast);
+  const __m256i alpha_mask = load_mask_avx2(masks.alpha);
+
+  size_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    __m256i x = _mm256_loadu_si256((__m256i *)(pixels + idx * 4));
+    _mm256_storeu_si256((__m256i *)(pixels + idx * 4), premultiply_avx2(x, broadcast, alpha_mask));
+  }
+  premultiply_pixels_ssse3(pixels + idx * 4, count - idx, alpha);
+}
+
+__attribute__((target("avx2")))
+void unpremultiply_pixels_avx2(unsigned char *pixels, size_t count, int alpha) {
+  pixel_masks_t masks;
+  // Alpha masks only depend on the alpha position.
+  pixel_masks(&masks, (alpha == 0) ? PNGIF_FORMAT_ARGB : PNGIF_FORMAT_RGBA);
+  const __m256i broadcast = load_mask_avx2(masks.broadcast);
+  const __m256i alpha_mask = load_mask_avx2(masks.alpha);
+
+  size_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    __m256i x = _mm256_loadu_si256((__m256i *)(pixels + idx * 4));
+    _mm256_storeu_si256((__m256i *)(pixels + idx * 4), unpremultiply_avx2(x, broadcast, alpha_mask));
+  }
+  unpremultiply_pixels_ssse3(pixels + idx * 4, count - idx, alpha);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_straight_half_avx2(
+  __m256i colors,
+  __m256i canvas,
+  __m256i source,
+  __m256i weight,
+  __m256i total
+) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i low = _mm256_mullo_epi16(canvas, weight);
+  __m256i high = _mm256_mulhi_epu16(canvas, weight);
+  __m256i half = _mm256_srli_epi16(total, 1);
+
+  __m256 lo = _mm256_add_ps(
+    _mm256_add_ps(
+      _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(colors, zero)),
+        _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(source, zero))
+      ),
+      _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(low, high))
+    ),
+    _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(half, zero))
+  );
+  __m256 hi = _mm256_add_ps(
+    _mm256_add_ps(
+      _mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(colors, zero)),
+        _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(source, zero))
+      ),
+      _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(low, high))
+    ),
+    _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(half, zero))
+  );
+  lo = _mm256_div_ps(lo, _mm256_cvtepi32_ps(_mm256_unpacklo_epi16(total, zero)));
+  hi = _mm256_div_ps(hi, _mm256_cvtepi32_ps(_mm256_unpackhi_epi16(total, zero)));
+  return _mm256_packs_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_avx2(
+  __m256i x,
+  __m256i canvas,
+  __m256i broadcast,
+  __m256i alpha_mask,
+  int premultiplied
+) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi16(255);
+  __m256i alpha = _mm256_shuffle_epi8(x, broadcast);
+  __m256i inverse = _mm256_xor_si256(alpha, _mm256_set1_epi8(-1));
+
+  if (premultiplied) {
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(canvas, zero), _mm256_unpacklo_epi8(inverse, zero));
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(canvas, zero), _mm256_unpackhi_epi8(inverse, zero));
+    __m256i result = _mm256_adds_epu8(x, _mm256_packus_epi16(div255_epu16_avx2(lo), div255_epu16_avx2(hi)));
+    return _mm256_blendv_epi8(result, canvas, _mm256_cmpeq_epi8(alpha, zero));
+  }
+
+  __m256i canvas_alpha = _mm256_shuffle_epi8(canvas, broadcast);
+  __m256i source_lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(alpha, zero), max);
+  __m256i source_hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(alpha, zero), max);
+  __m256i weight_lo = _mm256_mullo_epi16(
+    _mm256_unpacklo_epi8(canvas_alpha, zero),
+    _mm256_unpacklo_epi8(inverse, zero)
+  );
+  __m256i weight_hi = _mm256_mullo_epi16(
+    _mm256_unpackhi_epi8(canvas_alpha, zero),
+    _mm256_unpackhi_epi8(inverse, zero)
+  );
+  __m256i total_lo = _mm256_add_epi16(source_lo, weight_lo);
+  __m256i total_hi = _mm256_add_epi16(source_hi, weight_hi);
+
+  __m256i colors = _mm256_packus_epi16(
+    blend_straight_half_avx2(
+      _mm256_unpacklo_epi8(x, zero),
+      _mm256_unpacklo_epi8(canvas, zero),
+      source_lo, weight_lo, total_lo
+    ),
+    blend_straight_half_avx2(
+      _mm256_unpackhi_epi8(x, zero),
+      _mm256_unpackhi_epi8(canvas, zero),
+      source_hi, weight_hi, total_hi
+    )
+  );
+  __m256i alphas = _mm256_packus_epi16(div255_epu16_avx2(total_lo), div255_epu16_avx2(total_hi));
+  __m256i result = _mm256_blendv_epi8(colors, alphas, alpha_mask);
+  return _mm256_blendv_epi8(result, canvas, _mm256_cmpeq_epi8(alpha, zero));
+}
+
+__attribute__((target("avx2")))
+void blend_pixels_avx2(unsigned char *canvas, unsigned char *pixels, size_t count, int format) {
+  pixel_masks_t masks;
+  pixel_masks(&masks, format);
+  const __m256i broadcast = load_mask_avx2(masks.broadcast);
+  const __m256i alpha_mask = load_mask_avx2(masks.alpha);
+  int premultiplied = format & PNGIF_FORMAT_PREMULTIPLIED;
+
+  size_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    __m256i x = _mm256_loadu_si256((__m256i *)(pixels + idx * 4));
+    __m256i alpha = _mm256_and_si256(x, alpha_mask);
+    if (_mm256_testc_si256(alpha, alpha_mask)) {
+      _mm256_storeu_si256((__m256i *)(canvas + idx * 4), x);
+    } else if (!_mm256_testz_si256(alpha, alpha_mask)) {
+      __m256i under = _mm256_loadu_si256((__m256i *)(canvas + idx * 4));
+      _mm256_storeu_si256((__m256i *)(canvas + idx * 4), blend_avx2(x, under, broadcast, alpha_mask, premultiplied));
+    }
+  }
+  blend_pixels_ssse3(canvas + idx * 4, pixels + idx * 4, count - idx, format);
+}
+
+const pngif_pixel_kernels_t pixel_kernels_avx2 = {
+  .convert = convert_pixels_avx2,
+  .premultiply = premultiply_pixels_avx2,
+  .unpremultiply = unpremultiply_pixels_avx2,
+  .blend = blend_pixels_avx2,
+};
+
+#endif
+
+/** CPU dispatch **/
+
+/* Selected kernels. Resolved on first use. */
+const pngif_pixel_kernels_t *pixel_kernels_impl = NULL;
+
+/**
+ * Returns pixel kernels of an instruction set level.
+ *
+ * @param level PIXELS_* value.
+ *
+ * @return Kernels, or NULL if the CPU doesn't support the level.
+ */
+const pngif_pixel_kernels_t *pngif_pixel_kernels(int level) {
+#ifdef PNGIF_PIXELS_SIMD
+  __builtin_cpu_init();
+  switch (level) {
+  case PIXELS_AVX2:
+    return __builtin_cpu_supports("avx2") ? &pixel_kernels_avx2 : NULL;
+  case PIXELS_SSSE3:
+    return __builtin_cpu_supports("ssse3") ? &pixel_kernels_ssse3 : NULL;
+  }
+#endif
+  return (level == PIXELS_SCALAR) ? &pixel_kernels_scalar : NULL;
+}
+
+/**
+ * Returns the kernels of the highest instruction set level supported by the
+ * CPU.
+ */
+static const pngif_pixel_kernels_t *pixel_kernels(void) {
+  const pngif_pixel_kernels_t *impl = __atomic_load_n(&pixel_kernels_impl, __ATOMIC_ACQUIRE);
+  if (impl == NULL) {
+    for (int level = PIXELS_AVX2; level >= PIXELS_SCALAR && impl == NULL; level--) {
+      impl = pngif_pixel_kernels(level);
+    }
+    __atomic_store_n(&pixel_kernels_impl, impl, __ATOMIC_RELEASE);
+  }
+  return impl;
+}
+
+u_int32_t pngif_pixel(
+  int format,
+  unsigned char red,
+  unsigned char green,
+  unsigned char blue,
+  unsigned char alpha
+) {
+  unsigned char rgba[4] = { red, green, blue, alpha };
+  u_int32_t pixel;
+  convert_pixels_scalar(rgba, (unsigned char *)&pixel, 1, format);
+  return pixel;
+}
+
+void pngif_convert_pixels(unsigned char *rgba, unsigned char *output, size_t count, int format) {
+  if (format == PNGIF_FORMAT_RGBA) {
+    memmove(output, rgba, count * 4);
+    return;
+  }
+
+  pixel_kernels()->convert(rgba, output, count, format);
+}
+
+void pngif_premultiply_pixels(unsigned char *pixels, size_t count, int format) {
+  pixel_kernels()->premultiply(pixels, count, alpha_index(format));
+}
+
+void pngif_unpremultiply_pixels(unsigned char *pixels, size_t count, int format) {
+  pixel_kernels()->unpremultiply(pixels, count, alpha_index(format));
+}
+
+void pngif_blend_pixels(unsigned char *canvas, unsigned char *pixels, size_t count, int format) {
+  pixel_kernels()->blend(canvas, pixels, count, format);
+}
+
 void print_binary(unsigned char x) {
   static char b[9];
   b[0] = '\0';
@@ -3,6 +3,14 @@
 
 #include <pngif/image.h>
 
+/* Pixel format the viewer displays without converting: X11 wants BGRA data,
+ * premultiplied by alpha. */
+#ifdef __APPLE__
+#define IMAGE_VIEWER_FORMAT PNGIF_FORMAT_RGBA
+#else
+#define IMAGE_VIEWER_FORMAT (PNGIF_FORMAT_BGRA | PNGIF_FORMAT_PREMULTIPLIED)
+#endif
+
 void show_image(animated_image_t *image);
 void show_decoded_gif(gif_decoded_t *gif);
 void show_decoded_png(png_decoded_t *png);
@@ -13,6 +13,7 @@
 #include <pngif/gif_decoded.h>
 #include <pngif/image.h>
 #include <pngif/utils.h>
+#include "image_viewer.h"
 
 /** Private **/
 
@@ -30,54 +31,55 @@ int max_fd(int count, ...) {
   return max;
 }
 
+/**
+ * Draws an image into an X11 canvas. Images decoded in IMAGE_VIEWER_FORMAT are
+ * copied as is, straight RGBA ones are converted one pixel at a time.
+ */
 void draw_subimage(
   unsigned char *dest,
   unsigned char *source,
+  int format,
   int32_t canvas_width, int32_t canvas_height,
   int32_t offset_x, int32_t offset_y,
   int32_t width, int32_t height,
   int transparent
 ) {
-  // XLib wants BGRA data instead of RGBA.
-  unsigned char *bgra = malloc(width * height * 4);
-  rgba_to_bgra(source, bgra, width, height);
+  unsigned char pixel[4];
 
   for (int row = 0; row < height; row++) {
-    for (int col = 0; col < width; col++) {
-      int32_t canvas_offset = (canvas_width * (offset_y + row) * 4) + (offset_x + col) * 4;
-      int32_t offset = (row * width + col) * 4;
+    unsigned char *input = source + (size_t)row * width * 4;
+    unsigned char *output = dest + ((size_t)canvas_width * (offset_y + row) + offset_x) * 4;
+    for (int col = 0; col < width; col++, input += 4, output += 4) {
       // X11 can't work with 32-bit color space properly (or I'm dumb and can't
-      // find appropriate info on it), so here we do a color transform: for each
-      // pixel we explicitly multiply it by its alpha value to get it
-      // proportionally closer to the window's 'background pixel', which is set
-      // to 0x00000000 on window's creation.
+      // find appropriate info on it), so pixels are premultiplied by their
+      // alpha value to get them proportionally closer to the window's
+      // 'background pixel', which is set to 0x00000000 on window's creation.
       //
       // This should not be required on systems that do support ARGB properly,
       // they should be able to just take and apply pixel's alpha value.
-      if (bgra[offset + 3] != 0) {
+      if (format == IMAGE_VIEWER_FORMAT) {
+        memcpy(pixel, input, 4);
+      } else {
+        pngif_convert_pixels(input, pixel, 1, IMAGE_VIEWER_FORMAT);
+      }
+
+      if (pixel[3] != 0) {
         if (transparent) {
-          dest[canvas_offset + 0] = (u_int16_t)(bgra[offset + 0]) * bgra[offset + 3] / 255;
-          dest[canvas_offset + 1] = (u_int16_t)(bgra[offset + 1]) * bgra[offset + 3] / 255;
-          dest[canvas_offset + 2] = (u_int16_t)(bgra[offset + 2]) * bgra[offset + 3] / 255;
-          dest[canvas_offset + 3] = bgra[offset + 3];
+          memcpy(output, pixel, 4);
         } else {
-          dest[canvas_offset + 0] = (u_int16_t)(bgra[offset + 0]) * bgra[offset + 3] / 255
-            + (u_int16_t)(dest[canvas_offset + 0]) * (255 - bgra[offset + 3]) / 255;
-          dest[canvas_offset + 1] = (u_int16_t)(bgra[offset + 1]) * bgra[offset + 3] / 255
-            + (u_int16_t)(dest[canvas_offset + 1]) * (255 - bgra[offset + 3]) / 255;
-          dest[canvas_offset + 2] = (u_int16_t)(bgra[offset + 2]) * bgra[offset + 3] / 255
-            + (u_int16_t)(dest[canvas_offset + 2]) * (255 - bgra[offset + 3]) / 255;
+          output[0] = pixel[0] + (u_int16_t)(output[0]) * (255 - pixel[3]) / 255;
+          output[1] = pixel[1] + (u_int16_t)(output[1]) * (255 - pixel[3]) / 255;
+          output[2] = pixel[2] + (u_int16_t)(output[2]) * (255 - pixel[3]) / 255;
         }
       }
     }
   }
-
-  free(bgra);
 }
 
 XImage *ximage_from_data(
   Display *display, Visual *visual,
   unsigned char *image,
+  int format,
   int32_t canvas_width, int32_t canvas_height,
   int32_t offset_x, int32_t offset_y,
   int32_t width, int32_t height,
@@ -91,7 +93,7 @@ XImage *ximage_from_data(
     memset(image32, 255, canvas_width * canvas_height * 4);
 
   // Draw image to the canvas.
-  draw_subimage(image32, image, canvas_width, canvas_height, offset_x, offset_y, width, height, transparent);
+  draw_subimage(image32, image, format, canvas_width, canvas_height, offset_x, offset_y, width, height, transparent);
 
   // Create XImage.
   return XCreateImage(display, visual, 32, ZPixmap, 0, (char *)image32, canvas_width, canvas_height, 32, 0);
@@ -112,7 +114,7 @@ XImage *ximage_from_tiled_gif(
   // Draw sub-images to the canvas.
   for (int idx = 0; idx<gif->image_count; idx++) {
     gif_decoded_image_t image = gif->images[idx];
-    draw_subimage(image32, image.rgba, gif->width, gif->height, image.left, image.top, image.width, image.height, transparent);
+    draw_subimage(image32, image.rgba, gif->format, gif->width, gif->height, image.left, image.top, image.width, image.height, transparent);
   }
 
   // Create XImage.
@@ -163,6 +165,7 @@ image_holder_t *image_holder_from_png(png_decoded_t *png, Display *display, Visu
       holder->frames[idx].image = ximage_from_data(
         display, visual,
         frame->data,
+        png->format,
         png->width, png->height,
         frame->x_offset, frame->y_offset,
         frame->width, frame->height,
@@ -176,6 +179,7 @@ image_holder_t *image_holder_from_png(png_decoded_t *png, Display *display, Visu
     holder->frames[0].image = ximage_from_data(
       display, visual,
       png->data,
+      png->format,
       png->width, png->height,
       0, 0,
       png->width, png->height,
@@ -212,6 +216,7 @@ image_holder_t *image_holder_from_gif(gif_decoded_t *gif, Display *display, Visu
       holder->frames[idx].image = ximage_from_data(
         display, visual,
         img.rgba,
+        gif->format,
         gif->width, gif->height,
         img.left, img.top,
         img.width, img.height,
@@ -256,6 +261,7 @@ image_holder_t *image_holder_from_image(animated_image_t *image, Display *displa
     holder->frames[idx].image = ximage_from_data(
       display, visual,
       frame->rgba,
+      image->format,
       image->width, image->height,
       0, 0,
       image->width, image->height,
@@ -0,0 +1,118 @@
+/**
+ * Benchmarks CRC32 implementations on chunk data of a PNG file. Splits the
+ * file into chunks and checksums [type+data] of each chunk in a loop, the same
+ * way chunk validation does it, once per implementation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pngif/utils.h>
+#include <pngif/png_raw.h>
+
+extern u_int32_t u_crc32(void *input, size_t length);
+extern u_int32_t u_crc32_bytewise(void *input, size_t length);
+extern u_int32_t update_crc_slice8(u_int32_t crc, unsigned char *buf, size_t len);
+#if defined(__x86_64__)
+extern u_int32_t update_crc_pclmul(u_int32_t crc, unsigned char *buf, size_t len);
+#endif
+
+typedef u_int32_t (*crc_fn)(void *input, size_t length);
+
+u_int32_t crc_slice8(void *input, size_t length) {
+  return update_crc_slice8(0xffffffff, input, length) ^ 0xffffffff;
+}
+
+#if defined(__x86_64__)
+u_int32_t crc_pclmul(void *input, size_t length) {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("pclmul") || !__builtin_cpu_supports("sse4.1")) {
+    return 0;
+  }
+  return update_crc_pclmul(0xffffffff, input, length) ^ 0xffffffff;
+}
+#endif
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench(
+  const char *name,
+  crc_fn crc,
+  png_raw_t *raw,
+  int rounds
+) {
+  size_t total = 0;
+  int mismatches = 0;
+
+  double start = now();
+  for (int round = 0; round < rounds; round++) {
+    for (int idx = 0; idx < raw->chunk_count; idx++) {
+      png_chunk_raw_t *chunk = raw->chunks[idx];
+      // Chunk data is a view into the file data, type is right before it.
+      unsigned char *type_with_body = (chunk->length > 0)
+        ? chunk->data - 4
+        : NULL;
+      if (type_with_body == NULL) {
+        continue;
+      }
+
+      if (crc(type_with_body, chunk->length + 4) != chunk->crc) {
+        mismatches += 1;
+      }
+      total += chunk->length + 4;
+    }
+  }
+  double elapsed = now() - start;
+
+  printf("%-10s %8.3f s %10.1f MB/s %s\n",
+    name,
+    elapsed,
+    (double)total / elapsed / (1024 * 1024),
+    mismatches == 0 ? "" : "CRC MISMATCH"
+  );
+}
+
+int main(int argc, char **argv) {
+  const char *path = (argc > 1) ? argv[1] : "samples/png/1920.png";
+  int rounds = (argc > 2) ? atoi(argv[2]) : 5000;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    printf("Usage: %s [filename.png] [rounds]\n", argv[0]);
+    return 0;
+  }
+
+  int error = 0;
+  unsigned char *data = NULL;
+  size_t size = pngif_read_file(file, &data, &error);
+  fclose(file);
+  if (error != 0) {
+    printf("Failed to read file: %d.\n", error);
+    return 1;
+  }
+
+  png_raw_t *raw = png_raw_view_from_data(data, size, 0, &error);
+  if (raw == NULL || error != 0) {
+    printf("Failed to parse file: %d.\n", error);
+    free(data);
+    return 1;
+  }
+
+  printf("%s, %zu bytes, %d rounds\n", path, size, rounds);
+  bench("bytewise", u_crc32_bytewise, raw, rounds);
+  bench("slice8", crc_slice8, raw, rounds);
+#if defined(__x86_64__)
+  bench("pclmul", crc_pclmul, raw, rounds);
+#endif
+  bench("u_crc32", u_crc32, raw, rounds);
+
+  png_raw_free(raw);
+  free(data);
+  return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * Benchmarks scanline defiltering for every filter type and bytes per pixel
+ * value, once per instruction set level supported by the CPU. Every kernel's
+ * output is compared to the bytewise reference implementation first.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pngif/utils.h>
+#include "../src/png/png_filter.h"
+
+static const char *level_names[] = { "scalar", "sse2", "ssse3", "avx2" };
+static const char *filter_names[] = { "none", "sub", "up", "avg", "paeth" };
+static const int bpps[] = { 1, 2, 3, 4, 6, 8 };
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Checks kernel output against the reference on scanlines of every length up
+ * to a few vectors, to cover all tail handling paths.
+ */
+int verify(png_defilter_fn kernel, int filter, int bpp) {
+  unsigned char filtered[257], previous[256], expected[256], actual[256];
+
+  for (size_t length = bpp; length <= 256; length += bpp) {
+    filtered[0] = filter;
+    for (size_t byte = 0; byte < length; byte++) {
+      filtered[byte + 1] = rand();
+      previous[byte] = rand();
+    }
+
+    png_defilter_row_bytewise(filtered, expected, previous, length, bpp);
+    kernel(filtered + 1, actual, previous, length);
+    if (memcmp(expected, actual, length) != 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  size_t width = (argc > 1) ? atoi(argv[1]) : 1920;
+  int rows = (argc > 2) ? atoi(argv[2]) : 20000;
+
+  size_t length = width * 8;
+  unsigned char *filtered = malloc(length + 1);
+  unsigned char *previous = malloc(length);
+  unsigned char *output = malloc(length);
+  if (filtered == NULL || previous == NULL || output == NULL) {
+    printf("Failed to allocate memory.\n");
+    return 1;
+  }
+
+  for (size_t byte = 0; byte < length; byte++) {
+    filtered[byte + 1] = rand();
+    previous[byte] = rand();
+  }
+
+  printf("%zu pixels per row, %d rows, MB/s of defiltered data\n", width, rows);
+  printf("%-6s %-4s", "filter", "bpp");
+  for (int level = DEFILTER_SCALAR - 1; level <= DEFILTER_AVX2; level++) {
+    printf(" %9s", level < 0 ? "bytewise" : level_names[level]);
+  }
+  printf("\n");
+
+  int failures = 0;
+  for (int filter = 0; filter < 5; filter++) {
+    for (int idx = 0; idx < sizeof(bpps) / sizeof(bpps[0]); idx++) {
+      int bpp = bpps[idx];
+      size_t row_length = width * bpp;
+      printf("%-6s %-4d", filter_names[filter], bpp);
+
+      // Reference implementation.
+      filtered[0] = filter;
+      double start = now();
+      for (int row = 0; row < rows; row++) {
+        png_defilter_row_bytewise(filtered, output, previous, row_length, bpp);
+      }
+      printf(" %9.1f", (double)row_length * rows / (now() - start) / (1024 * 1024));
+
+      for (int level = DEFILTER_SCALAR; level <= DEFILTER_AVX2; level++) {
+        const png_defilter_table_t *table = png_defilter_table(level);
+        if (table == NULL) {
+          printf(" %9s", "-");
+          continue;
+        }
+
+        png_defilter_fn kernel = table->kernels[filter][bpp];
+        if (!verify(kernel, filter, bpp)) {
+          printf(" %9s", "MISMATCH");
+          failures += 1;
+          continue;
+        }
+
+        start = now();
+        for (int row = 0; row < rows; row++) {
+          kernel(filtered + 1, output, previous, row_length);
+        }
+        printf(" %9.1f", (double)row_length * rows / (now() - start) / (1024 * 1024));
+      }
+      printf("\n");
+    }
+  }
+
+  free(filtered);
+  free(previous);
+  free(output);
+  return failures == 0 ? 0 : 1;
+}
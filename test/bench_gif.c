@@ -0,0 +1,137 @@
+/**
+ * Benchmarks GIF image decoding, i. e. LZW decompression and color lookup,
+ * on already parsed files. Each file is decoded a number of times, and the
+ * fastest round is reported, along with the throughput in compressed bytes
+ * and decoded pixels. Then the same is done with images decoded in parallel,
+ * one thread per CPU.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pngif/gif_parsed.h>
+#include <pngif/gif_decoded.h>
+
+static char *default_paths[] = {
+  "samples/gif/photo.gif",
+  "samples/gif/frame_full_25fps.gif",
+};
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Decodes the file a number of times.
+ *
+ * @param parsed Parsed file.
+ * @param options Decoding options, or NULL.
+ * @param rounds Number of times to decode.
+ * @param pixel_count Output number of decoded pixels.
+ *
+ * @return Time of the fastest round in seconds, or a negative value on errors.
+ */
+double best_time(gif_parsed_t *parsed, pngif_options_t *options, int rounds, size_t *pixel_count) {
+  double best = -1;
+  for (int round = 0; round < rounds; round++) {
+    int error = 0;
+    double start = now();
+    gif_decoded_t *decoded = gif_decoded_from_parsed_with_options(parsed, options, &error);
+    double time = now() - start;
+    if (decoded == NULL || error != 0) {
+      return -1;
+    }
+
+    if (best < 0 || time < best) {
+      best = time;
+    }
+    *pixel_count = 0;
+    for (size_t idx = 0; idx < decoded->image_count; idx++) {
+      *pixel_count += (size_t)decoded->images[idx].width * decoded->images[idx].height;
+    }
+    gif_decoded_free(decoded);
+    free(decoded);
+  }
+
+  return best;
+}
+
+int bench(char *path, int rounds) {
+  int error = 0;
+  gif_parsed_t *parsed = gif_parsed_from_path(path, &error);
+  if (parsed == NULL) {
+    printf("%-36s failed to parse, error %d\n", path, error);
+    return 0;
+  }
+
+  // Compressed data size, to go with the decoded pixel count.
+  size_t data_length = 0;
+  size_t image_count = 0;
+  for (size_t idx = 0; idx < parsed->block_count; idx++) {
+    if (parsed->blocks[idx]->type == GIF_BLOCK_IMAGE) {
+      data_length += ((gif_image_block_t *)parsed->blocks[idx])->data_length;
+      image_count += 1;
+    }
+  }
+
+  size_t pixel_count = 0;
+  pngif_options_t parallel = { .threads = -1 };
+  double best = best_time(parsed, NULL, rounds, &pixel_count);
+  double best_parallel = best_time(parsed, &parallel, rounds, &pixel_count);
+  if (best < 0 || best_parallel < 0) {
+    printf("%-36s failed to decode\n", path);
+    gif_parsed_free(parsed);
+    return 0;
+  }
+
+  printf(
+    "%-36s %6zu %9.2f %9.1f %9.1f %9.2f %7.2fx\n",
+    path,
+    image_count,
+    best * 1000,
+    data_length / best / (1024 * 1024),
+    pixel_count / best / 1e6,
+    best_parallel * 1000,
+    best / best_parallel
+  );
+
+  gif_parsed_free(parsed);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int rounds = 10;
+  char **paths = default_paths;
+  int path_count = sizeof(default_paths) / sizeof(default_paths[0]);
+
+  if (argc > 1) {
+    paths = argv + 1;
+    path_count = argc - 1;
+  }
+
+  printf("Best of %d rounds, %ld CPUs\n", rounds, sysconf(_SC_NPROCESSORS_ONLN));
+  printf(
+    "%-36s %6s %9s %9s %9s %9s %8s\n",
+    "file",
+    "images",
+    "ms",
+    "MB/s",
+    "Mpx/s",
+    "par. ms",
+    "speedup"
+  );
+
+  int failures = 0;
+  for (int idx = 0; idx < path_count; idx++) {
+    if (!bench(paths[idx], rounds)) {
+      failures += 1;
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
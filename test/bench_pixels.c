@@ -0,0 +1,293 @@
+/**
+ * Benchmarks pixel format conversion, premultiplication, unpremultiplication
+ * and blending kernels, once per instruction set level supported by the CPU.
+ * Every kernel's output is compared to the scalar kernels first, and the
+ * scalar kernels are checked against the exact results for every color and
+ * alpha value, and for every pair of alpha values when blending.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <pngif/surface.h>
+#include <pngif/utils.h>
+
+#define PIXELS_SCALAR 0
+#define PIXELS_AVX2 2
+
+typedef struct {
+  void (*convert)(unsigned char *rgba, unsigned char *output, size_t count, int format);
+  void (*premultiply)(unsigned char *pixels, size_t count, int alpha);
+  void (*unpremultiply)(unsigned char *pixels, size_t count, int alpha);
+  void (*blend)(unsigned char *canvas, unsigned char *pixels, size_t count, int format);
+} pngif_pixel_kernels_t;
+
+extern const pngif_pixel_kernels_t *pngif_pixel_kernels(int level);
+
+static const char *level_names[] = { "scalar", "ssse3", "avx2" };
+static const char *format_names[] = { "rgba", "bgra", "argb", "abgr" };
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Checks the scalar kernels against round(c * a / 255) and round(c * 255 / a)
+ * for every pair of values.
+ */
+int verify_exact(const pngif_pixel_kernels_t *scalar) {
+  unsigned char pixel[4];
+
+  for (int alpha = 0; alpha < 256; alpha++) {
+    for (int color = 0; color < 256; color++) {
+      unsigned char expected = floor(color * alpha / 255.0 + 0.5);
+      memset(pixel, color, 3);
+      pixel[3] = alpha;
+      scalar->premultiply(pixel, 1, 3);
+      if (pixel[0] != expected || pixel[3] != alpha) {
+        return 0;
+      }
+
+      double value = (alpha == 0) ? 0 : floor(color * 255.0 / alpha + 0.5);
+      expected = (value > 255) ? 255 : value;
+      memset(pixel, color, 3);
+      pixel[3] = alpha;
+      scalar->unpremultiply(pixel, 1, 3);
+      if (pixel[0] != expected || pixel[3] != alpha) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Checks scalar blending against the exact Porter-Duff "over" results for
+ * every pair of alpha values, with a few colors.
+ */
+int verify_blend_exact(const pngif_pixel_kernels_t *scalar) {
+  static const unsigned char colors[] = { 0, 1, 77, 128, 254, 255 };
+  size_t color_count = sizeof(colors) / sizeof(colors[0]);
+  unsigned char pixel[4], canvas[4];
+
+  for (int alpha = 0; alpha < 256; alpha++) {
+    for (int under = 0; under < 256; under++) {
+      for (size_t src = 0; src < color_count; src++) {
+        for (size_t dst = 0; dst < color_count; dst++) {
+          double total = alpha * 255.0 + under * (255.0 - alpha);
+          memset(pixel, colors[src], 3);
+          memset(canvas, colors[dst], 3);
+          pixel[3] = alpha;
+          canvas[3] = under;
+          scalar->blend(canvas, pixel, 1, PNGIF_FORMAT_RGBA);
+
+          // Fully transparent pixels leave the canvas as is.
+          unsigned char color = colors[dst], composed = under;
+          if (alpha > 0) {
+            color = floor((colors[src] * alpha * 255.0 + colors[dst] * under * (255.0 - alpha)) / total + 0.5);
+            composed = floor(total / 255 + 0.5);
+          }
+          if (canvas[0] != color || canvas[3] != composed) {
+            return 0;
+          }
+
+          // Premultiplied colors are valid when they don't exceed alpha.
+          if (colors[src] > alpha || colors[dst] > under) {
+            continue;
+          }
+          memset(pixel, colors[src], 3);
+          memset(canvas, colors[dst], 3);
+          pixel[3] = alpha;
+          canvas[3] = under;
+          scalar->blend(canvas, pixel, 1, PNGIF_FORMAT_RGBA | PNGIF_FORMAT_PREMULTIPLIED);
+          color = colors[src] + floor(colors[dst] * (255.0 - alpha) / 255 + 0.5);
+          composed = alpha + floor(under * (255.0 - alpha) / 255 + 0.5);
+          if (canvas[0] != color || canvas[3] != composed) {
+            return 0;
+          }
+        }
+      }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Checks kernels against the scalar ones on every pixel count up to a few
+ * vectors, to cover all tail handling paths.
+ */
+int verify(const pngif_pixel_kernels_t *kernels, const pngif_pixel_kernels_t *scalar) {
+  unsigned char input[64 * 4], expected[64 * 4], actual[64 * 4], canvas[64 * 4];
+
+  for (size_t count = 0; count <= 64; count++) {
+    for (size_t byte = 0; byte < count * 4; byte++) {
+      input[byte] = rand();
+    }
+    // Some fully transparent and opaque pixels.
+    for (size_t idx = 0; idx < count; idx += 3) {
+      input[idx * 4 + 3] = (idx & 1) ? 0 : 255;
+    }
+
+    for (int format = 1; format < 8; format++) {
+      scalar->convert(input, expected, count, format);
+      kernels->convert(input, actual, count, format);
+      if (memcmp(expected, actual, count * 4) != 0) {
+        return 0;
+      }
+    }
+
+    for (int alpha = 0; alpha <= 3; alpha += 3) {
+      memcpy(expected, input, count * 4);
+      memcpy(actual, input, count * 4);
+      scalar->premultiply(expected, count, alpha);
+      kernels->premultiply(actual, count, alpha);
+      if (memcmp(expected, actual, count * 4) != 0) {
+        return 0;
+      }
+
+      memcpy(expected, input, count * 4);
+      memcpy(actual, input, count * 4);
+      scalar->unpremultiply(expected, count, alpha);
+      kernels->unpremultiply(actual, count, alpha);
+      if (memcmp(expected, actual, count * 4) != 0) {
+        return 0;
+      }
+    }
+
+    // Blending over random canvas pixels, in every format.
+    for (size_t byte = 0; byte < count * 4; byte++) {
+      canvas[byte] = rand();
+    }
+    for (int format = 0; format < 8; format++) {
+      memcpy(expected, canvas, count * 4);
+      memcpy(actual, canvas, count * 4);
+      scalar->blend(expected, input, count, format);
+      kernels->blend(actual, input, count, format);
+      if (memcmp(expected, actual, count * 4) != 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+void print_speed(size_t count, int rounds, double start) {
+  printf(" %9.1f", (double)count * rounds / (now() - start) / 1e6);
+}
+
+int main(int argc, char **argv) {
+  size_t count = (argc > 1) ? atoi(argv[1]) : 1920 * 1080;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 100;
+
+  unsigned char *input = malloc(count * 4);
+  unsigned char *output = malloc(count * 4);
+  if (input == NULL || output == NULL) {
+    printf("Failed to allocate memory.\n");
+    return 1;
+  }
+
+  for (size_t byte = 0; byte < count * 4; byte++) {
+    input[byte] = rand();
+  }
+
+  const pngif_pixel_kernels_t *scalar = pngif_pixel_kernels(PIXELS_SCALAR);
+  int failures = 0;
+  if (!verify_exact(scalar)) {
+    printf("Scalar kernels are not exact.\n");
+    failures += 1;
+  }
+  if (!verify_blend_exact(scalar)) {
+    printf("Scalar blending is not exact.\n");
+    failures += 1;
+  }
+
+  printf("%zu pixels, %d rounds, megapixels per second\n", count, rounds);
+  printf("%-16s", "kernel");
+  for (int level = PIXELS_SCALAR; level <= PIXELS_AVX2; level++) {
+    printf(" %9s", level_names[level]);
+  }
+  printf("\n");
+
+  // Conversions from RGBA, straight and premultiplied.
+  for (int format = 1; format < 8; format++) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s%s", format_names[format & 3], (format & 4) ? " premul" : "");
+    printf("%-16s", name);
+
+    for (int level = PIXELS_SCALAR; level <= PIXELS_AVX2; level++) {
+      const pngif_pixel_kernels_t *kernels = pngif_pixel_kernels(level);
+      if (kernels == NULL) {
+        printf(" %9s", "-");
+        continue;
+      }
+      if (!verify(kernels, scalar)) {
+        printf(" %9s", "MISMATCH");
+        failures += 1;
+        continue;
+      }
+
+      double start = now();
+      for (int round = 0; round < rounds; round++) {
+        kernels->convert(input, output, count, format);
+      }
+      print_speed(count, rounds, start);
+    }
+    printf("\n");
+  }
+
+  // In place alpha kernels, on RGBA pixels.
+  for (int unpremultiply = 0; unpremultiply <= 1; unpremultiply++) {
+    printf("%-16s", unpremultiply ? "unpremultiply" : "premultiply");
+    for (int level = PIXELS_SCALAR; level <= PIXELS_AVX2; level++) {
+      const pngif_pixel_kernels_t *kernels = pngif_pixel_kernels(level);
+      if (kernels == NULL) {
+        printf(" %9s", "-");
+        continue;
+      }
+
+      double start = now();
+      for (int round = 0; round < rounds; round++) {
+        memcpy(output, input, count * 4);
+        if (unpremultiply) {
+          kernels->unpremultiply(output, count, 3);
+        } else {
+          kernels->premultiply(output, count, 3);
+        }
+      }
+      print_speed(count, rounds, start);
+    }
+    printf("\n");
+  }
+
+  // Blending random RGBA pixels over the input, straight and premultiplied.
+  for (int format = 0; format < 8; format += PNGIF_FORMAT_PREMULTIPLIED) {
+    printf("%-16s", format ? "blend premul" : "blend");
+    for (int level = PIXELS_SCALAR; level <= PIXELS_AVX2; level++) {
+      const pngif_pixel_kernels_t *kernels = pngif_pixel_kernels(level);
+      if (kernels == NULL) {
+        printf(" %9s", "-");
+        continue;
+      }
+
+      double start = now();
+      for (int round = 0; round < rounds; round++) {
+        memcpy(output, input, count * 4);
+        kernels->blend(output, input + 4, count - 1, format);
+      }
+      print_speed(count, rounds, start);
+    }
+    printf("\n");
+  }
+
+  free(input);
+  free(output);
+  return failures == 0 ? 0 : 1;
+}
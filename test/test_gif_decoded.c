@@ -2,6 +2,14 @@
  * Takes a GIF file, decodes it into gif_decoded_t, and displays
  * each frame. Requires a window system to work, since it creates a
  * window to show the final result.
+ *
+ * With --check, runs checks that don't require a window system instead:
+ * decodes small crafted GIFs with valid and corrupted LZW streams, and checks
+ * that color indices of given files, looked up in color tables, match their
+ * RGBA images, and that images decoded on 4 threads match the ones decoded on
+ * the calling thread. The progress callback has to report every pass of every
+ * image in order, end with the decoded images, and stop decoding when asked
+ * to.
  */
 
 #include <stdlib.h>
@@ -14,14 +22,417 @@
 
 #include "image_viewer.h"
 
+/**
+ * 4x1 image with a 4 color global table, and LZW data with minimum code size
+ * 2 (CLEAR is 4, END is 5, first new code is 6). The data is CLEAR, 0, 6, END,
+ * 3 bits per code: code 6 is used right when it's being added, which is legal.
+ */
+static unsigned char lzw_kwkwk_gif[] = {
+  'G', 'I', 'F', '8', '9', 'a', 4, 0, 1, 0, 0x81, 0, 0,
+  10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120,
+  0x2C, 0, 0, 0, 0, 4, 0, 1, 0, 0,
+  2, 2, 0x84, 0x0B, 0,
+  0x3B
+};
+
+/**
+ * Same image with the data CLEAR, 0, 7, END: code 7 is past the code being
+ * added, so the stream is corrupted.
+ */
+static unsigned char lzw_corrupted_gif[] = {
+  'G', 'I', 'F', '8', '9', 'a', 4, 0, 1, 0, 0x81, 0, 0,
+  10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120,
+  0x2C, 0, 0, 0, 0, 4, 0, 1, 0, 0,
+  2, 2, 0xC4, 0x0B, 0,
+  0x3B
+};
+
+/**
+ * 4x1 image with a 4 color global table, a transparent index of 1, and a local
+ * table of 2 colors, so that indices 0, 1, 2, 3 of the data are opaque,
+ * transparent, and past the end of the table.
+ */
+static unsigned char local_table_gif[] = {
+  'G', 'I', 'F', '8', '9', 'a', 4, 0, 1, 0, 0x81, 0, 0,
+  10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120,
+  0x21, 0xF9, 4, 0x01, 0, 0, 1, 0,
+  0x2C, 0, 0, 0, 0, 4, 0, 1, 0, 0x80,
+  200, 0, 0, 0, 200, 0,
+  2, 3, 0x44, 0x34, 0x05, 0,
+  0x3B
+};
+
+/**
+ * Compares color indices looked up in color tables to RGBA images. Indices
+ * past the end of the table and the transparent index are transparent black.
+ *
+ * @return 1 if all images match, 0 otherwise.
+ */
+int indexed_matches(gif_indexed_t *indexed, gif_decoded_t *gif) {
+  if (indexed->image_count != gif->image_count) {
+    return 0;
+  }
+
+  for (size_t image = 0; image < gif->image_count; image++) {
+    gif_indexed_image_t *source = &indexed->images[image];
+    gif_decoded_image_t *target = &gif->images[image];
+    if (source->width != target->width || source->height != target->height) {
+      return 0;
+    }
+
+    size_t pixel_count = (size_t)source->width * source->height;
+    for (size_t idx = 0; idx < pixel_count; idx++) {
+      unsigned char index = source->indices[idx];
+      unsigned char expected[4] = { 0, 0, 0, 0 };
+      if (index < source->color_table_size && index != source->transparent_index) {
+        expected[0] = source->color_table[index].red;
+        expected[1] = source->color_table[index].green;
+        expected[2] = source->color_table[index].blue;
+        expected[3] = 255;
+      }
+
+      if (memcmp(expected, target->rgba + idx * 4, 4) != 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Decodes a file into color indices and into RGBA images, and compares them.
+ *
+ * @return 1 if images match, 0 if they don't, -1 if the file couldn't be
+ *   decoded.
+ */
+int check_indexed(char *path) {
+  int error = 0;
+
+  gif_decoded_t *gif = gif_decoded_from_path(path, &error);
+  if (gif == NULL || error != 0) {
+    return -1;
+  }
+
+  gif_indexed_t *indexed = gif_indexed_from_path(path, &error);
+  if (indexed == NULL || error != 0) {
+    gif_decoded_free(gif);
+    return -1;
+  }
+
+  int matches = indexed_matches(indexed, gif);
+  gif_indexed_free(indexed);
+  gif_decoded_free(gif);
+  return matches;
+}
+
+/**
+ * FNV-1a hash of image data.
+ */
+u_int64_t hash_pixels(unsigned char *data, size_t length) {
+  u_int64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t idx = 0; idx < length; idx++) {
+    hash = (hash ^ data[idx]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Decodes a file on the calling thread and on 4 threads, and compares images
+ * one by one by their hashes.
+ *
+ * @return Number of images that differ, or -1 if the file couldn't be
+ *   decoded.
+ */
+int check_threads(char *path) {
+  int error = 0;
+  int mismatches = 0;
+
+  gif_decoded_t *serial = gif_decoded_from_path(path, &error);
+  if (serial == NULL || error != 0) {
+    return -1;
+  }
+
+  pngif_options_t options = { .threads = 4 };
+  gif_decoded_t *parallel = gif_decoded_from_path_with_options(path, &options, &error);
+  if (parallel == NULL || error != 0) {
+    gif_decoded_free(serial);
+    return -1;
+  }
+
+  if (parallel->image_count != serial->image_count) {
+    printf("%s: %zu images on 4 threads, %zu on one\n", path, parallel->image_count, serial->image_count);
+    mismatches += 1;
+  }
+
+  for (size_t idx = 0; idx < serial->image_count && idx < parallel->image_count; idx++) {
+    gif_decoded_image_t *expected = &serial->images[idx];
+    gif_decoded_image_t *actual = &parallel->images[idx];
+    size_t length = (size_t)expected->width * expected->height * 4;
+    if (
+      actual->width != expected->width || actual->height != expected->height ||
+      actual->top != expected->top || actual->left != expected->left ||
+      hash_pixels(actual->rgba, length) != hash_pixels(expected->rgba, length)
+    ) {
+      printf("%s: image %zu differs on 4 threads\n", path, idx);
+      mismatches += 1;
+    }
+  }
+
+  gif_decoded_free(parallel);
+  gif_decoded_free(serial);
+  return mismatches;
+}
+
+/**
+ * Progress callback state.
+ */
+typedef struct {
+  // Expected number of passes of each image.
+  int *pass_counts;
+  size_t image_count;
+  // Number of callbacks.
+  u_int32_t calls;
+  // Image and pass of the last callback.
+  u_int32_t image;
+  int pass;
+  // Number of callbacks out of order, or with a wrong pass count.
+  int mismatches;
+  // Copy of each image canvas from its last callback.
+  unsigned char **canvases;
+  // Number of callbacks after which decoding is stopped, or 0.
+  u_int32_t stop_after;
+} progress_record_t;
+
+/**
+ * Progress callback that checks the order of passes and keeps image canvases.
+ */
+int record_progress(pngif_progress_t *progress, void *context) {
+  progress_record_t *record = context;
+  if (progress->image >= record->image_count) {
+    record->mismatches += 1;
+    return 1;
+  }
+
+  // Passes of an image come in order, once all passes of the previous image
+  // are done.
+  int same_image = record->calls > 0 && progress->image == record->image;
+  int next_image = record->calls > 0 && progress->image == record->image + 1 &&
+    record->pass == record->pass_counts[record->image];
+  if (
+    progress->pass_count != record->pass_counts[progress->image] ||
+    progress->pass != (same_image ? record->pass + 1 : 1) ||
+    (record->calls > 0 && !same_image && !next_image) ||
+    (record->calls == 0 && progress->image != 0)
+  ) {
+    record->mismatches += 1;
+  }
+
+  size_t size = (size_t)progress->width * progress->height * 4;
+  unsigned char **canvas = &record->canvases[progress->image];
+  free(*canvas);
+  *canvas = malloc(size);
+  memcpy(*canvas, progress->rgba, size);
+
+  record->calls += 1;
+  record->image = progress->image;
+  record->pass = progress->pass;
+  return record->stop_after != 0 && record->calls >= record->stop_after;
+}
+
+/**
+ * Frees image canvases kept by the progress callback.
+ */
+void progress_record_free(progress_record_t *record) {
+  for (size_t idx = 0; idx < record->image_count; idx++) {
+    free(record->canvases[idx]);
+  }
+  free(record->canvases);
+}
+
+/**
+ * Decodes a file with a progress callback: each image has to be reported
+ * 4 times when interlaced and once otherwise, and its last canvas has to be
+ * the decoded image. Then decodes it again, stopping after the first callback.
+ *
+ * @return Number of failed checks, or -1 if the file couldn't be decoded.
+ */
+int check_progress(char *path) {
+  int error = 0;
+  int failures = 0;
+
+  gif_parsed_t *parsed = gif_parsed_from_path(path, &error);
+  if (parsed == NULL || error != 0) {
+    return -1;
+  }
+
+  int *pass_counts = malloc(sizeof(int) * (parsed->block_count + 1));
+  size_t image_count = 0;
+  for (size_t idx = 0; idx < parsed->block_count; idx++) {
+    if (parsed->blocks[idx]->type == GIF_BLOCK_IMAGE) {
+      gif_image_block_t *image = (gif_image_block_t *)parsed->blocks[idx];
+      pass_counts[image_count++] = image->descriptor.interlace ? 4 : 1;
+    }
+  }
+  gif_parsed_free(parsed);
+
+  progress_record_t record = {
+    .pass_counts = pass_counts,
+    .image_count = image_count,
+    .canvases = calloc(image_count + 1, sizeof(unsigned char *)),
+  };
+  pngif_options_t options = { .progress = record_progress, .progress_context = &record };
+  gif_decoded_t *gif = gif_decoded_from_path_with_options(path, &options, &error);
+  if (gif == NULL || error != 0) {
+    progress_record_free(&record);
+    free(pass_counts);
+    return -1;
+  }
+
+  if (
+    record.mismatches > 0 || gif->image_count != image_count ||
+    (image_count > 0 && (record.image != image_count - 1 || record.pass != pass_counts[image_count - 1]))
+  ) {
+    printf("%s: %d progress callbacks out of order\n", path, record.mismatches);
+    failures += 1;
+  }
+
+  for (size_t idx = 0; idx < gif->image_count && idx < image_count; idx++) {
+    gif_decoded_image_t *image = &gif->images[idx];
+    size_t size = (size_t)image->width * image->height * 4;
+    if (record.canvases[idx] == NULL || memcmp(record.canvases[idx], image->rgba, size) != 0) {
+      printf("%s: last progress canvas differs from image %zu\n", path, idx);
+      failures += 1;
+    }
+  }
+  if (gif->partial) {
+    printf("%s: decoding marked as partial\n", path);
+    failures += 1;
+  }
+  gif_decoded_free(gif);
+  progress_record_free(&record);
+
+  progress_record_t stopped = {
+    .pass_counts = pass_counts,
+    .image_count = image_count,
+    .canvases = calloc(image_count + 1, sizeof(unsigned char *)),
+    .stop_after = 1,
+  };
+  options.progress_context = &stopped;
+  gif = gif_decoded_from_path_with_options(path, &options, &error);
+  if (gif == NULL || error != 0 || !gif->partial || stopped.calls != 1) {
+    printf("%s: decoding not stopped by the progress callback, error %d\n", path, error);
+    failures += 1;
+  }
+  if (gif != NULL) {
+    gif_decoded_free(gif);
+  }
+  progress_record_free(&stopped);
+  free(pass_counts);
+
+  return failures;
+}
+
+/**
+ * Decodes the crafted GIFs, with RGBA and indexed output.
+ *
+ * @return Number of failed checks.
+ */
+int check_crafted_gifs() {
+  int failures = 0;
+  int error = 0;
+
+  gif_decoded_t *gif = gif_decoded_from_data(lzw_kwkwk_gif, sizeof(lzw_kwkwk_gif), &error);
+  unsigned char expected[4] = { 10, 20, 30, 255 };
+  if (
+    gif == NULL || error != 0 || gif->image_count != 1 ||
+    memcmp(gif->images[0].rgba, expected, 4) != 0 ||
+    memcmp(gif->images[0].rgba + 8, expected, 4) != 0
+  ) {
+    printf("crafted: KwKwK code not decoded, error %d\n", error);
+    failures += 1;
+  }
+  if (gif != NULL) {
+    gif_decoded_free(gif);
+  }
+
+  error = 0;
+  gif = gif_decoded_from_data(lzw_corrupted_gif, sizeof(lzw_corrupted_gif), &error);
+  if (error != GIF_ERR_BAD_ENCODING) {
+    printf("crafted: corrupted data decoded, error %d\n", error);
+    failures += 1;
+  }
+  if (gif != NULL) {
+    gif_decoded_free(gif);
+  }
+
+  error = 0;
+  gif_indexed_t *indexed = gif_indexed_from_data(lzw_corrupted_gif, sizeof(lzw_corrupted_gif), &error);
+  if (error != GIF_ERR_BAD_ENCODING) {
+    printf("crafted: corrupted data decoded into indices, error %d\n", error);
+    failures += 1;
+  }
+  if (indexed != NULL) {
+    gif_indexed_free(indexed);
+  }
+
+  int indexed_error = 0;
+  error = 0;
+  gif = gif_decoded_from_data(local_table_gif, sizeof(local_table_gif), &error);
+  indexed = gif_indexed_from_data(local_table_gif, sizeof(local_table_gif), &indexed_error);
+  unsigned char local[16] = { 200, 0, 0, 255 };
+  if (
+    gif == NULL || indexed == NULL || error != 0 || indexed_error != 0 ||
+    indexed->images[0].transparent_index != 1 ||
+    !indexed_matches(indexed, gif) ||
+    memcmp(gif->images[0].rgba, local, 16) != 0
+  ) {
+    printf("crafted: local color table mismatch, errors %d, %d\n", error, indexed_error);
+    failures += 1;
+  }
+  if (indexed != NULL) {
+    gif_indexed_free(indexed);
+  }
+  if (gif != NULL) {
+    gif_decoded_free(gif);
+  }
+
+  if (failures == 0) {
+    printf("crafted: OK\n");
+  }
+  return failures;
+}
+
 int main(int argc, char **argv) {
   int error = 0;
 
   if (argc < 2) {
     printf("Usage: %s <filepath>\n", argv[0]);
+    printf("       %s --check [<filepath>...]\n", argv[0]);
     return 0;
   }
 
+  if (strcmp(argv[1], "--check") == 0) {
+    int failures = check_crafted_gifs();
+    for (int arg = 2; arg < argc; arg++) {
+      int matches = check_indexed(argv[arg]);
+      int mismatches = check_threads(argv[arg]);
+      int progress_failures = check_progress(argv[arg]);
+      if (matches < 0 || mismatches < 0 || progress_failures < 0) {
+        printf("%s: decoding error\n", argv[arg]);
+        failures += 1;
+      } else if (!matches) {
+        printf("%s: indexed images mismatch\n", argv[arg]);
+        failures += 1;
+      } else if (mismatches > 0 || progress_failures > 0) {
+        failures += 1;
+      } else {
+        printf("%s: OK\n", argv[arg]);
+      }
+    }
+    return failures > 0;
+  }
+
   gif_decoded_t *dec = gif_decoded_from_path(argv[1], &error);
 
   if (dec == NULL) {
@@ -38,4 +449,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
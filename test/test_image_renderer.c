@@ -0,0 +1,636 @@
+/**
+ * Takes GIF or PNG files, draws every frame with a frame renderer into a BGRA
+ * surface with padded rows, and compares frames to the ones decoded into
+ * animated_image_t. Then draws the frames again in reverse order, seeking to
+ * each one, with frequent canvas snapshots. Doesn't require a window system.
+ *
+ * With --check, also decodes the files into delta frames at full and half
+ * scale, straight and premultiplied, applies them in order onto one canvas
+ * and compares it to full frames decoded with the same options. A small GIF
+ * built on the fly covers frames disposed to the background and restored, and
+ * frames that share pixels of the previous one because they change nothing.
+ * Frames decoded in a pipeline are compared to the ones decoded sequentially,
+ * and animations with a broken frame have to fail in the pipeline too.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <pngif/errors.h>
+#include <pngif/image.h>
+
+// Bytes of padding at the end of each surface row.
+#define PADDING 12
+
+/**
+ * Compares a BGRA surface to an RGBA frame, and checks that row padding is
+ * left untouched.
+ */
+int frame_matches(pngif_surface_t *surface, unsigned char *rgba) {
+  for (u_int32_t y = 0; y < surface->height; y++) {
+    unsigned char *row = surface->pixels + y * surface->stride;
+    for (u_int32_t x = 0; x < surface->width; x++) {
+      unsigned char *bgra = row + x * 4;
+      unsigned char *expected = rgba + (y * surface->width + x) * 4;
+      if (
+        bgra[0] != expected[2] || bgra[1] != expected[1] ||
+        bgra[2] != expected[0] || bgra[3] != expected[3]
+      ) {
+        return 0;
+      }
+    }
+
+    for (int idx = 0; idx < PADDING; idx++) {
+      if (row[surface->width * 4 + idx] != 0xAA) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Compares frames drawn by a frame renderer to the ones decoded into
+ * animated_image_t, forwards and then backwards.
+ *
+ * @return 1 if frames differ, 0 otherwise.
+ */
+int check_renderer(char *path) {
+  int error = 0;
+
+  animated_image_t *image = image_from_path(path, 1, &error);
+  if (error != 0 || image == NULL) {
+    printf("%s: decoding error %d\n", path, error);
+    return 0;
+  }
+
+  image_renderer_t *renderer = image_renderer_from_path(path, 1, NULL, &error);
+  if (error != 0 || renderer == NULL) {
+    printf("%s: renderer error %d\n", path, error);
+    animated_image_free(image);
+    return 1;
+  }
+
+  pngif_surface_t surface = {
+    .stride = renderer->width * 4 + PADDING,
+    .width = renderer->width,
+    .height = renderer->height,
+    .format = PNGIF_FORMAT_BGRA,
+  };
+  surface.pixels = malloc(surface.stride * surface.height);
+  memset(surface.pixels, 0xAA, surface.stride * surface.height);
+
+  size_t frame = 0;
+  u_int32_t duration_ms = 0;
+  int mismatches = 0;
+  while (image_renderer_next_frame(renderer, &surface, &duration_ms, &error)) {
+    if (
+      frame >= image->frame_count ||
+      duration_ms != image->frames[frame].duration_ms ||
+      !frame_matches(&surface, image->frames[frame].rgba)
+    ) {
+      mismatches += 1;
+    }
+    frame += 1;
+  }
+
+  // Seeking backwards, from snapshots that get thinned along the way.
+  image_renderer_set_keyframes(renderer, 2, 3);
+  for (size_t idx = image->frame_count; error == 0 && idx > 0; idx--) {
+    if (
+      !image_renderer_draw_frame(renderer, idx - 1, &surface, &duration_ms, &error) ||
+      duration_ms != image->frames[idx - 1].duration_ms ||
+      !frame_matches(&surface, image->frames[idx - 1].rgba)
+    ) {
+      mismatches += 1;
+    }
+  }
+
+  int failed = error != 0 || frame != image->frame_count || mismatches > 0;
+  if (failed) {
+    printf("%s: FAIL, %zu of %zu frames, %d mismatches, error %d\n",
+      path, frame, image->frame_count, mismatches, error);
+  } else {
+    printf("%s: OK, %zu frames\n", path, frame);
+  }
+
+  free(surface.pixels);
+  image_renderer_free(renderer);
+  animated_image_free(image);
+  return failed;
+}
+
+/**
+ * Reads a whole file into memory.
+ *
+ * @param size Return file size.
+ *
+ * @return File data, or NULL if the file can't be read.
+ */
+unsigned char *read_file(char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  unsigned char *data = (length > 0) ? malloc(length) : NULL;
+  if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+
+  *size = (size_t)length;
+  return data;
+}
+
+/**
+ * Frame of a GIF built on the fly.
+ */
+typedef struct {
+  u_int16_t x;
+  u_int16_t y;
+  u_int16_t width;
+  u_int16_t height;
+  u_int8_t disposal;
+  u_int16_t delay;
+  // Color indices, 3 being transparent.
+  unsigned char pixels[8];
+  // Whether the full frame shares pixels of the previous one: it changes
+  // nothing, and the previous frame isn't disposed to the background or
+  // restored.
+  int shared;
+} built_frame_t;
+
+// 4x2 frames, with zero delay, transparent and repeated ones, and every
+// disposal method.
+static const built_frame_t built_frames[] = {
+  { 0, 0, 4, 2, 1, 10, { 0, 1, 2, 0, 1, 2, 0, 1 }, 0 },
+  { 1, 0, 2, 1, 1, 0, { 3, 3 }, 1 },
+  { 0, 1, 2, 1, 2, 10, { 1, 2 }, 1 },
+  { 2, 1, 2, 1, 3, 10, { 0, 3 }, 0 },
+  { 0, 0, 1, 1, 1, 10, { 3 }, 0 },
+  { 0, 0, 1, 1, 0, 10, { 3 }, 1 },
+};
+
+#define BUILT_FRAME_COUNT (sizeof(built_frames) / sizeof(built_frames[0]))
+
+/**
+ * Appends a 3 bit LZW code at given bit position.
+ *
+ * @return Bit position after the code.
+ */
+size_t build_code(unsigned char *stream, size_t bit, int code) {
+  for (int idx = 0; idx < 3; idx++, bit++) {
+    if (code & (1 << idx)) {
+      stream[bit / 8] |= 1 << (bit % 8);
+    }
+  }
+  return bit;
+}
+
+/**
+ * Builds a 4x2 GIF out of built_frames, with 4 global colors and a repeat
+ * count of 3. Pixels are encoded with a clear code before each of them, so
+ * codes stay 3 bits long.
+ *
+ * @param gif Output buffer.
+ * @param broken Index of a frame to encode with a code that isn't in the table
+ *   yet, or -1.
+ *
+ * @return File size.
+ */
+size_t build_gif(unsigned char *gif, int broken) {
+  static const unsigned char header[] = {
+    'G', 'I', 'F', '8', '9', 'a', 4, 0, 2, 0, 0x81, 0, 0,
+    255, 0, 0, 0, 255, 0, 0, 0, 255, 255, 255, 255,
+    0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+    3, 1, 3, 0, 0,
+  };
+  size_t size = sizeof(header);
+  memcpy(gif, header, size);
+
+  for (size_t frame = 0; frame < BUILT_FRAME_COUNT; frame++) {
+    const built_frame_t *built = &built_frames[frame];
+    unsigned char control[] = {
+      0x21, 0xF9, 4, (built->disposal << 2) | 1, built->delay, 0, 3, 0,
+      0x2C, built->x, 0, built->y, 0, built->width, 0, built->height, 0, 0, 2,
+    };
+    memcpy(gif + size, control, sizeof(control));
+    size += sizeof(control);
+
+    unsigned char stream[16] = { 0 };
+    size_t bit = 0;
+    for (int idx = 0; idx < built->width * built->height; idx++) {
+      bit = build_code(stream, bit, 4);
+      bit = build_code(stream, bit, built->pixels[idx]);
+    }
+    if ((int)frame == broken) {
+      bit = build_code(stream, bit, 7);
+    }
+    bit = build_code(stream, bit, 5);
+
+    gif[size++] = (bit + 7) / 8;
+    memcpy(gif + size, stream, (bit + 7) / 8);
+    size += (bit + 7) / 8;
+    gif[size++] = 0;
+  }
+
+  gif[size++] = 0x3B;
+  return size;
+}
+
+/**
+ * Applies delta frames in order onto one canvas, and compares the canvas to
+ * each full frame.
+ *
+ * @return Number of frames that differ.
+ */
+int delta_mismatches(animated_image_t *full, animated_image_t *delta) {
+  if (
+    delta->width != full->width || delta->height != full->height ||
+    delta->frame_count != full->frame_count || !delta->delta_frames
+  ) {
+    return full->frame_count > 0 ? full->frame_count : 1;
+  }
+
+  size_t stride = (size_t)full->width * 4;
+  unsigned char *canvas = calloc(full->height, stride);
+  int mismatches = 0;
+  for (size_t idx = 0; idx < full->frame_count; idx++) {
+    image_frame_t *frame = &delta->frames[idx];
+    if (
+      frame->x + frame->width > full->width || frame->y + frame->height > full->height ||
+      frame->duration_ms != full->frames[idx].duration_ms
+    ) {
+      mismatches += 1;
+      continue;
+    }
+
+    image_frame_apply(frame, canvas, stride);
+    if (memcmp(canvas, full->frames[idx].rgba, full->height * stride) != 0) {
+      mismatches += 1;
+    }
+  }
+
+  free(canvas);
+  return mismatches;
+}
+
+/**
+ * Decodes data into full frames and into delta frames, at full and half scale,
+ * straight and premultiplied, and compares them.
+ *
+ * @return Number of failed checks, or -1 if the data couldn't be decoded.
+ */
+int check_delta_frames(char *name, unsigned char *data, size_t size) {
+  static const int formats[] = { PNGIF_FORMAT_RGBA, PNGIF_FORMAT_RGBA | PNGIF_FORMAT_PREMULTIPLIED };
+  int failures = 0;
+
+  for (int scale = 1; scale <= 2; scale++) {
+    for (int format = 0; format < 2; format++) {
+      int error = 0;
+      pngif_options_t options = { .scale = scale, .format = formats[format] };
+      animated_image_t *full = image_from_data_with_options(data, size, 1, &options, &error);
+      if (full == NULL || error != 0) {
+        return -1;
+      }
+
+      options.delta_frames = 1;
+      animated_image_t *delta = image_from_data_with_options(data, size, 1, &options, &error);
+      if (delta == NULL || error != 0) {
+        animated_image_free(full);
+        return -1;
+      }
+
+      int mismatches = delta_mismatches(full, delta);
+      if (mismatches > 0) {
+        printf("%s: %d delta frames differ at scale 1/%d, format %d\n",
+          name, mismatches, scale, formats[format]);
+        failures += 1;
+      }
+
+      animated_image_free(delta);
+      animated_image_free(full);
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Decodes the built GIF into full frames, and checks that frames share pixels
+ * of the previous frame as expected, with the count of frames sharing them.
+ * Pixels have to be the same as the ones of delta frames, which are never
+ * shared.
+ *
+ * @return Number of failed checks.
+ */
+int check_shared_frames(unsigned char *gif, size_t size) {
+  int failures = 0;
+  int error = 0;
+
+  animated_image_t *full = image_from_data_with_options(gif, size, 1, NULL, &error);
+  if (full == NULL || error != 0 || full->frame_count != BUILT_FRAME_COUNT) {
+    printf("built: decoding error %d\n", error);
+    if (full != NULL) {
+      animated_image_free(full);
+    }
+    return 1;
+  }
+
+  for (size_t idx = 0; idx < BUILT_FRAME_COUNT; idx++) {
+    image_frame_t *frame = &full->frames[idx];
+    image_frame_t *previous = (idx > 0) ? &full->frames[idx - 1] : NULL;
+
+    // Frames sharing the same pixels, this one included.
+    u_int32_t sharing = 1;
+    for (size_t other = idx; other > 0 && built_frames[other].shared; other--) {
+      sharing += 1;
+    }
+    for (size_t other = idx + 1; other < BUILT_FRAME_COUNT && built_frames[other].shared; other++) {
+      sharing += 1;
+    }
+
+    if (built_frames[idx].shared) {
+      if (frame->rgba != previous->rgba || frame->refcount != previous->refcount) {
+        printf("built: frame %zu doesn't share pixels of the previous one\n", idx);
+        failures += 1;
+      }
+    } else if (previous != NULL && frame->rgba == previous->rgba) {
+      printf("built: frame %zu shares pixels of the previous one\n", idx);
+      failures += 1;
+    }
+
+    if (
+      (sharing == 1 && frame->refcount != NULL) ||
+      (sharing > 1 && (frame->refcount == NULL || *frame->refcount != sharing))
+    ) {
+      printf("built: frame %zu shared by a wrong number of frames\n", idx);
+      failures += 1;
+    }
+  }
+
+  pngif_options_t options = { .delta_frames = 1 };
+  animated_image_t *delta = image_from_data_with_options(gif, size, 1, &options, &error);
+  if (delta == NULL || error != 0) {
+    printf("built: decoding error %d with delta frames\n", error);
+    failures += 1;
+  } else {
+    for (size_t idx = 0; idx < delta->frame_count; idx++) {
+      if (delta->frames[idx].refcount != NULL) {
+        printf("built: delta frame %zu is shared\n", idx);
+        failures += 1;
+      }
+    }
+    int mismatches = delta_mismatches(full, delta);
+    if (mismatches > 0) {
+      printf("built: %d shared frames differ from delta frames\n", mismatches);
+      failures += 1;
+    }
+  }
+
+  if (delta != NULL) {
+    animated_image_free(delta);
+  }
+  animated_image_free(full);
+  return failures;
+}
+
+/**
+ * FNV-1a hash of image data.
+ */
+u_int64_t hash_pixels(unsigned char *data, size_t length) {
+  u_int64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t idx = 0; idx < length; idx++) {
+    hash = (hash ^ data[idx]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Decodes data with a pipeline 1 and 4 frames deep, and compares the images to
+ * the one decoded sequentially: repeat count, frame positions and durations,
+ * frames that share pixels, and pixels by their hashes.
+ *
+ * @return Number of failed checks, or -1 if the data couldn't be decoded.
+ */
+int check_pipeline(char *name, unsigned char *data, size_t size) {
+  static const int depths[] = { 1, 4 };
+  int failures = 0;
+  int error = 0;
+
+  animated_image_t *expected = image_from_data_with_options(data, size, 1, NULL, &error);
+  if (expected == NULL || error != 0) {
+    return -1;
+  }
+
+  for (int depth = 0; depth < 2; depth++) {
+    pngif_options_t options = { .pipeline_depth = depths[depth] };
+    animated_image_t *actual = image_from_data_with_options(data, size, 1, &options, &error);
+    if (actual == NULL || error != 0) {
+      animated_image_free(expected);
+      return -1;
+    }
+
+    if (
+      actual->width != expected->width || actual->height != expected->height ||
+      actual->frame_count != expected->frame_count ||
+      actual->repeat_count != expected->repeat_count
+    ) {
+      printf("%s: %zu frames repeated %d times in a pipeline %d deep, %zu repeated %d times\n",
+        name, actual->frame_count, actual->repeat_count, depths[depth],
+        expected->frame_count, expected->repeat_count);
+      failures += 1;
+      animated_image_free(actual);
+      continue;
+    }
+
+    int mismatches = 0;
+    for (size_t idx = 0; idx < expected->frame_count; idx++) {
+      image_frame_t *frame = &actual->frames[idx];
+      image_frame_t *reference = &expected->frames[idx];
+      int shared = idx > 0 && frame->rgba == frame[-1].rgba;
+      int reference_shared = idx > 0 && reference->rgba == reference[-1].rgba;
+      size_t length = (size_t)reference->width * reference->height * 4;
+      if (
+        frame->x != reference->x || frame->y != reference->y ||
+        frame->width != reference->width || frame->height != reference->height ||
+        frame->duration_ms != reference->duration_ms || shared != reference_shared ||
+        hash_pixels(frame->rgba, length) != hash_pixels(reference->rgba, length)
+      ) {
+        mismatches += 1;
+      }
+    }
+    if (mismatches > 0) {
+      printf("%s: %d frames differ in a pipeline %d deep\n", name, mismatches, depths[depth]);
+      failures += 1;
+    }
+
+    animated_image_free(actual);
+  }
+
+  animated_image_free(expected);
+  return failures;
+}
+
+/**
+ * Decodes data that fails in the middle of an animation, sequentially and in
+ * pipelines 1 and 4 frames deep, which stop decoding frames ahead of the
+ * broken one.
+ *
+ * @return Number of decodes that didn't fail with the same error.
+ */
+int check_pipeline_error(char *name, unsigned char *data, size_t size) {
+  static const int depths[] = { 0, 1, 4 };
+  int failures = 0;
+  int expected = 0;
+
+  for (int depth = 0; depth < 3; depth++) {
+    int error = 0;
+    pngif_options_t options = { .pipeline_depth = depths[depth] };
+    animated_image_t *image = image_from_data_with_options(data, size, 1, &options, &error);
+    if (depth == 0) {
+      expected = error;
+    }
+
+    if (image != NULL || error == 0 || error != expected) {
+      printf("%s: broken frame decoded in a pipeline %d deep, error %d\n", name, depths[depth], error);
+      failures += 1;
+    }
+    if (image != NULL) {
+      animated_image_free(image);
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Reads a big-endian 32 bit number.
+ */
+u_int32_t read_be32(unsigned char *data) {
+  return ((u_int32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/**
+ * Cuts the data stream of the first APNG frame stored in frame data chunks in
+ * half, so that it ends at the next frame control. The last chunk of the
+ * stream is shortened, and its CRC updated.
+ *
+ * @param png PNG data, modified in place.
+ * @param size Data size.
+ *
+ * @return New data size, or 0 if there are no frame data chunks.
+ */
+size_t truncate_frame_stream(unsigned char *png, size_t size) {
+  if (size < 8 || memcmp(png + 1, "PNG", 3) != 0) {
+    return 0;
+  }
+
+  size_t offset = 8;
+  size_t last = 0;
+  while (offset + 12 <= size) {
+    u_int32_t length = read_be32(png + offset);
+    if (length > size - offset - 12) {
+      break;
+    }
+
+    if (memcmp(png + offset + 4, "fdAT", 4) == 0) {
+      last = offset;
+    } else if (last != 0) {
+      break;
+    }
+    offset += length + 12;
+  }
+
+  u_int32_t length = (last != 0) ? read_be32(png + last) : 0;
+  if (length <= 4) {
+    return 0;
+  }
+
+  // Sequence number and the first half of the data.
+  u_int32_t kept = 4 + (length - 4) / 2;
+  size_t end = last + 12 + length;
+  memmove(png + last + 12 + kept, png + end, size - end);
+  unsigned char header[4] = { kept >> 24, kept >> 16, kept >> 8, kept };
+  memcpy(png + last, header, 4);
+
+  u_int32_t crc = crc32(0, png + last + 4, kept + 4);
+  unsigned char footer[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+  memcpy(png + last + 8 + kept, footer, 4);
+
+  return size - (length - kept);
+}
+
+int main(int argc, char **argv) {
+  int failures = 0;
+
+  if (argc < 2) {
+    printf("Usage: %s <filepath>...\n", argv[0]);
+    printf("       %s --check [<filepath>...]\n", argv[0]);
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--check") == 0) {
+    unsigned char gif[512];
+    size_t size = build_gif(gif, -1);
+    int delta_failures = check_delta_frames("built", gif, size);
+    int shared_failures = check_shared_frames(gif, size);
+    int pipeline_failures = check_pipeline("built", gif, size);
+    size = build_gif(gif, 1);
+    pipeline_failures += check_pipeline_error("built", gif, size);
+    if (delta_failures != 0 || shared_failures != 0 || pipeline_failures != 0) {
+      printf("built: FAIL, delta frames %d, shared frames %d, pipeline %d\n",
+        delta_failures, shared_failures, pipeline_failures);
+      failures += 1;
+    } else {
+      printf("built: OK\n");
+    }
+
+    for (int arg = 2; arg < argc; arg++) {
+      char *path = argv[arg];
+      failures += check_renderer(path);
+
+      unsigned char *data = read_file(path, &size);
+      if (data == NULL) {
+        printf("%s: can't read file\n", path);
+        failures += 1;
+        continue;
+      }
+
+      delta_failures = check_delta_frames(path, data, size);
+      pipeline_failures = check_pipeline(path, data, size);
+
+      // A frame cut short stops the pipeline.
+      size_t truncated_size = truncate_frame_stream(data, size);
+      if (truncated_size > 0 && pipeline_failures >= 0) {
+        pipeline_failures += check_pipeline_error(path, data, truncated_size);
+      }
+
+      if (delta_failures < 0 || pipeline_failures < 0) {
+        printf("%s: decoding error\n", path);
+        failures += 1;
+      } else if (delta_failures > 0 || pipeline_failures > 0) {
+        failures += 1;
+      } else {
+        printf("%s: OK, delta frames, pipeline\n", path);
+      }
+      free(data);
+    }
+    return failures > 0;
+  }
+
+  for (int arg = 1; arg < argc; arg++) {
+    failures += check_renderer(argv[arg]);
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -20,7 +20,10 @@ int main(int argc, char **argv) {
     return 0;
   }
 
-  animated_image_t *image = image_from_path(argv[1], 1, &error);
+  // Frames are decoded in the pixel format the viewer displays.
+  pngif_options_t options = { 0 };
+  options.format = IMAGE_VIEWER_FORMAT;
+  animated_image_t *image = image_from_path_with_options(argv[1], 1, &options, &error);
 
   if (error != 0 || image == NULL) {
     printf("Decoding error: %d\n", error);
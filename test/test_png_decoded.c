@@ -2,11 +2,21 @@
  * Takes a PNG file, decodes it into png_decoded_t, and displays
  * each frame. Requires a window system to work, since it creates a
  * window to show the final result.
+ *
+ * With --check, takes PNG files and checks them without a window system
+ * instead: images and frames decoded at 1/2, 1/4 and 1/8 scale are compared
+ * to full size ones reduced afterwards, box-filtered for non-interlaced images
+ * and point-sampled for interlaced ones, and frames decoded on 4 threads are
+ * compared to the ones decoded on the calling thread. The progress callback
+ * has to report every pass of every image in order, end with the full image,
+ * and stop decoding when asked to. Small APNG files built on the fly check
+ * that a frame's data stream doesn't run into the next frame.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <zlib.h>
 
 #include <pngif/png_raw.h>
 #include <pngif/png_parsed.h>
@@ -14,14 +24,467 @@
 
 #include "image_viewer.h"
 
+/**
+ * Compares an image decoded at reduced scale to the full size image reduced
+ * the same way: each pixel is the alpha-weighted average of its box, or just
+ * the top left pixel of its box for interlaced images.
+ */
+int scaled_matches(
+  unsigned char *full,
+  u_int32_t width,
+  u_int32_t height,
+  unsigned char *scaled,
+  u_int32_t scale,
+  int interlaced
+) {
+  u_int32_t out_width = (width + scale - 1) / scale;
+  u_int32_t out_height = (height + scale - 1) / scale;
+
+  for (u_int32_t y = 0; y < out_height; y++) {
+    for (u_int32_t x = 0; x < out_width; x++) {
+      unsigned char expected[4] = { 0, 0, 0, 0 };
+      unsigned char *actual = scaled + (y * out_width + x) * 4;
+
+      if (interlaced) {
+        memcpy(expected, full + (y * scale * width + x * scale) * 4, 4);
+      } else {
+        u_int32_t sums[4] = { 0, 0, 0, 0 };
+        u_int32_t count = 0;
+        for (u_int32_t row = y * scale; row < height && row < (y + 1) * scale; row++) {
+          for (u_int32_t col = x * scale; col < width && col < (x + 1) * scale; col++) {
+            unsigned char *pixel = full + (row * width + col) * 4;
+            sums[0] += pixel[0] * pixel[3];
+            sums[1] += pixel[1] * pixel[3];
+            sums[2] += pixel[2] * pixel[3];
+            sums[3] += pixel[3];
+            count += 1;
+          }
+        }
+
+        if (sums[3] != 0) {
+          for (int channel = 0; channel < 3; channel++) {
+            expected[channel] = (sums[channel] + sums[3] / 2) / sums[3];
+          }
+          expected[3] = (sums[3] + count / 2) / count;
+        }
+      }
+
+      if (memcmp(expected, actual, 4) != 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Decodes a file at every reduced scale, and compares the image and all
+ * frames to the full size decode.
+ *
+ * @return Number of mismatches, or -1 if the file couldn't be decoded.
+ */
+int check_scaled(char *path) {
+  int error = 0;
+  int mismatches = 0;
+
+  png_parsed_t *parsed = png_parsed_from_path(path, &error);
+  if (parsed == NULL || error != 0) {
+    return -1;
+  }
+  int interlaced = parsed->header.interlace != 0;
+  png_parsed_free(parsed);
+
+  png_decoded_t *full = png_decoded_from_path(path, &error);
+  if (full == NULL || error != 0) {
+    return -1;
+  }
+
+  for (u_int32_t scale = 2; scale <= 8; scale *= 2) {
+    pngif_options_t options = { .scale = scale };
+    png_decoded_t *scaled = png_decoded_from_path_with_options(path, &options, &error);
+    if (scaled == NULL || error != 0) {
+      png_decoded_free(full);
+      return -1;
+    }
+
+    if (!scaled_matches(full->data, full->width, full->height, scaled->data, scale, interlaced)) {
+      printf("%s: image mismatch at 1/%u\n", path, scale);
+      mismatches += 1;
+    }
+
+    if (full->frames != NULL && scaled->frames != NULL) {
+      for (u_int32_t idx = 0; idx < full->frames->length && idx < scaled->frames->length; idx++) {
+        png_frame_t *frame = &full->frames->frames[idx];
+        if (!scaled_matches(
+          frame->data,
+          frame->width,
+          frame->height,
+          scaled->frames->frames[idx].data,
+          scale,
+          interlaced
+        )) {
+          printf("%s: frame %u mismatch at 1/%u\n", path, idx, scale);
+          mismatches += 1;
+        }
+      }
+    }
+
+    png_decoded_free(scaled);
+  }
+
+  png_decoded_free(full);
+  return mismatches;
+}
+
+/**
+ * FNV-1a hash of image data.
+ */
+u_int64_t hash_pixels(unsigned char *data, size_t length) {
+  u_int64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t idx = 0; idx < length; idx++) {
+    hash = (hash ^ data[idx]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Decodes a file on the calling thread and on 4 threads, and compares the
+ * image and the frames one by one by their hashes.
+ *
+ * @return Number of frames that differ, or -1 if the file couldn't be decoded.
+ */
+int check_threads(char *path) {
+  int error = 0;
+  int mismatches = 0;
+
+  png_decoded_t *serial = png_decoded_from_path(path, &error);
+  if (serial == NULL || error != 0) {
+    return -1;
+  }
+
+  pngif_options_t options = { .threads = 4 };
+  png_decoded_t *parallel = png_decoded_from_path_with_options(path, &options, &error);
+  if (parallel == NULL || error != 0) {
+    png_decoded_free(serial);
+    return -1;
+  }
+
+  size_t length = (size_t)serial->width * serial->height * 4;
+  if (
+    parallel->width != serial->width || parallel->height != serial->height ||
+    hash_pixels(parallel->data, length) != hash_pixels(serial->data, length)
+  ) {
+    printf("%s: image differs on 4 threads\n", path);
+    mismatches += 1;
+  }
+
+  u_int32_t serial_frames = (serial->frames != NULL) ? serial->frames->length : 0;
+  u_int32_t parallel_frames = (parallel->frames != NULL) ? parallel->frames->length : 0;
+  if (parallel_frames != serial_frames) {
+    printf("%s: %u frames on 4 threads, %u on one\n", path, parallel_frames, serial_frames);
+    mismatches += 1;
+  }
+
+  for (u_int32_t idx = 0; idx < serial_frames && idx < parallel_frames; idx++) {
+    png_frame_t *expected = &serial->frames->frames[idx];
+    png_frame_t *actual = &parallel->frames->frames[idx];
+    length = (size_t)expected->width * expected->height * 4;
+    if (
+      actual->width != expected->width || actual->height != expected->height ||
+      actual->x_offset != expected->x_offset || actual->y_offset != expected->y_offset ||
+      hash_pixels(actual->data, length) != hash_pixels(expected->data, length)
+    ) {
+      printf("%s: frame %u differs on 4 threads\n", path, idx);
+      mismatches += 1;
+    }
+  }
+
+  png_decoded_free(parallel);
+  png_decoded_free(serial);
+  return mismatches;
+}
+
+/**
+ * Progress callback state.
+ */
+typedef struct {
+  // Expected number of passes of each image.
+  int pass_count;
+  // Number of callbacks, for all images and for the first one.
+  u_int32_t calls;
+  u_int32_t first_image_calls;
+  // Image and pass of the last callback.
+  u_int32_t image;
+  int pass;
+  // Number of callbacks out of order, or with a wrong pass count.
+  int mismatches;
+  // Copy of the first image canvas from its last callback.
+  unsigned char *canvas;
+  // Number of callbacks after which decoding is stopped, or 0.
+  u_int32_t stop_after;
+} progress_record_t;
+
+/**
+ * Progress callback that checks the order of passes and keeps the first
+ * image canvas.
+ */
+int record_progress(pngif_progress_t *progress, void *context) {
+  progress_record_t *record = context;
+
+  // Passes of an image come in order, once all passes of the previous image
+  // are done.
+  int same_image = record->calls > 0 && progress->image == record->image;
+  int next_image = record->calls > 0 && progress->image == record->image + 1 &&
+    record->pass == record->pass_count;
+  if (
+    progress->pass_count != record->pass_count ||
+    progress->pass != (same_image ? record->pass + 1 : 1) ||
+    (record->calls > 0 && !same_image && !next_image) ||
+    (record->calls == 0 && progress->image != 0)
+  ) {
+    record->mismatches += 1;
+  }
+
+  if (progress->image == 0) {
+    record->first_image_calls += 1;
+    free(record->canvas);
+    record->canvas = malloc((size_t)progress->width * progress->height * 4);
+    for (u_int32_t y = 0; y < progress->height; y++) {
+      memcpy(
+        record->canvas + (size_t)y * progress->width * 4,
+        progress->rgba + y * progress->stride,
+        (size_t)progress->width * 4
+      );
+    }
+  }
+
+  record->calls += 1;
+  record->image = progress->image;
+  record->pass = progress->pass;
+  return record->stop_after != 0 && record->calls >= record->stop_after;
+}
+
+/**
+ * Decodes a file with a progress callback: the first image has to be reported
+ * 7 times when interlaced and once otherwise, and its last canvas has to be
+ * the decoded image. Then decodes it again, stopping after the first callback.
+ *
+ * @return Number of failed checks, or -1 if the file couldn't be decoded.
+ */
+int check_progress(char *path) {
+  int error = 0;
+  int failures = 0;
+
+  png_parsed_t *parsed = png_parsed_from_path(path, &error);
+  if (parsed == NULL || error != 0) {
+    return -1;
+  }
+  int pass_count = (parsed->header.interlace != 0) ? 7 : 1;
+  png_parsed_free(parsed);
+
+  progress_record_t record = { .pass_count = pass_count };
+  pngif_options_t options = { .progress = record_progress, .progress_context = &record };
+  png_decoded_t *png = png_decoded_from_path_with_options(path, &options, &error);
+  if (png == NULL || error != 0) {
+    free(record.canvas);
+    return -1;
+  }
+
+  if (record.mismatches > 0 || record.pass != pass_count || record.first_image_calls != pass_count) {
+    printf("%s: %u progress callbacks out of order\n", path, record.mismatches);
+    failures += 1;
+  }
+  if (png->partial || memcmp(record.canvas, png->data, (size_t)png->width * png->height * 4) != 0) {
+    printf("%s: last progress canvas differs from the image\n", path);
+    failures += 1;
+  }
+  png_decoded_free(png);
+  free(record.canvas);
+
+  progress_record_t stopped = { .pass_count = pass_count, .stop_after = 1 };
+  options.progress_context = &stopped;
+  png = png_decoded_from_path_with_options(path, &options, &error);
+  if (png == NULL || error != 0 || !png->partial || stopped.calls != 1) {
+    printf("%s: decoding not stopped by the progress callback, error %d\n", path, error);
+    failures += 1;
+  }
+  if (png != NULL) {
+    png_decoded_free(png);
+  }
+  free(stopped.canvas);
+
+  return failures;
+}
+
+/**
+ * Writes a big-endian 32-bit integer.
+ */
+void build_be32(unsigned char *data, u_int32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+/**
+ * Appends a chunk, with its length and CRC, to a PNG file being built.
+ *
+ * @return New file size.
+ */
+size_t build_chunk(unsigned char *png, size_t size, char *type, unsigned char *data, u_int32_t length) {
+  build_be32(png + size, length);
+  memcpy(png + size + 4, type, 4);
+  if (length > 0) {
+    memcpy(png + size + 8, data, length);
+  }
+  build_be32(png + size + 8 + length, crc32(0, png + size + 4, length + 4));
+  return size + length + 12;
+}
+
+/**
+ * Builds a 2x1 RGB APNG with 3 frames of different colors, the first one
+ * being the default image. With `split` set, the data stream of the second
+ * frame is cut short, and the rest of it is put into the data chunk of the
+ * third frame, after its frame control.
+ *
+ * @return File size.
+ */
+size_t build_apng(unsigned char *png, int split) {
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  unsigned char chunk[256];
+  u_int32_t seqnum = 0;
+  size_t size = sizeof(signature);
+  memcpy(png, signature, size);
+
+  unsigned char header[13] = { 0, 0, 0, 2, 0, 0, 0, 1, 8, 2, 0, 0, 0 };
+  size = build_chunk(png, size, "IHDR", header, sizeof(header));
+
+  build_be32(chunk, 3);
+  build_be32(chunk + 4, 0);
+  size = build_chunk(png, size, "acTL", chunk, 8);
+
+  unsigned char streams[3][64];
+  uLongf lengths[3];
+  for (int frame = 0; frame < 3; frame++) {
+    unsigned char scanline[7] = { 0 };
+    memset(scanline + 1, 40 + frame * 80, 6);
+    lengths[frame] = sizeof(streams[frame]);
+    compress2(streams[frame], &lengths[frame], scanline, sizeof(scanline), 9);
+  }
+
+  // Part of the second frame's stream that goes after the third frame control.
+  size_t cut = split ? lengths[1] / 2 : 0;
+
+  for (int frame = 0; frame < 3; frame++) {
+    memset(chunk, 0, 26);
+    build_be32(chunk, seqnum++);
+    build_be32(chunk + 4, 2);
+    build_be32(chunk + 8, 1);
+    chunk[21] = 1;
+    chunk[23] = 10;
+    size = build_chunk(png, size, "fcTL", chunk, 26);
+
+    if (frame == 0) {
+      size = build_chunk(png, size, "IDAT", streams[0], lengths[0]);
+    } else if (frame == 2 && split) {
+      build_be32(chunk, seqnum++);
+      memcpy(chunk + 4, streams[1] + lengths[1] - cut, cut);
+      size = build_chunk(png, size, "fdAT", chunk, 4 + cut);
+    } else {
+      build_be32(chunk, seqnum++);
+      memcpy(chunk + 4, streams[frame], lengths[frame] - cut);
+      size = build_chunk(png, size, "fdAT", chunk, 4 + lengths[frame] - cut);
+    }
+  }
+
+  return build_chunk(png, size, "IEND", NULL, 0);
+}
+
+/**
+ * Decodes built APNG files: the intact one has to decode into 3 frames, and
+ * the one with a split stream has to fail, both when parsing the data right
+ * away and when decoding it later.
+ *
+ * @return Number of failed checks.
+ */
+int check_frame_streams() {
+  unsigned char png[1024];
+  int failures = 0;
+  int error = 0;
+
+  size_t size = build_apng(png, 0);
+  png_decoded_t *decoded = png_decoded_from_data(png, size, &error);
+  if (decoded == NULL || error != 0 || decoded->frames == NULL || decoded->frames->length != 3) {
+    printf("built: intact APNG not decoded, error %d\n", error);
+    failures += 1;
+  } else {
+    for (u_int32_t idx = 0; idx < 3; idx++) {
+      unsigned char expected[4] = { 40 + idx * 80, 40 + idx * 80, 40 + idx * 80, 255 };
+      if (memcmp(decoded->frames->frames[idx].data + 4, expected, 4) != 0) {
+        printf("built: frame %u mismatch\n", idx);
+        failures += 1;
+      }
+    }
+  }
+  if (decoded != NULL) {
+    png_decoded_free(decoded);
+  }
+
+  size = build_apng(png, 1);
+  error = 0;
+  png_parsed_t *parsed = png_parsed_from_data(png, size, &error);
+  if (error != PNG_ERR_ZLIB) {
+    printf("built: split frame stream parsed, error %d\n", error);
+    failures += 1;
+  }
+  if (parsed != NULL) {
+    png_parsed_free(parsed);
+  }
+
+  error = 0;
+  decoded = png_decoded_from_data(png, size, &error);
+  if (error != PNG_ERR_ZLIB) {
+    printf("built: split frame stream decoded, error %d\n", error);
+    failures += 1;
+  }
+  if (decoded != NULL) {
+    png_decoded_free(decoded);
+  }
+
+  if (failures == 0) {
+    printf("built: OK\n");
+  }
+  return failures;
+}
+
 int main(int argc, char **argv) {
   int error = 0;
 
   if (argc < 2) {
     printf("Usage: %s <filename.png>\n", argv[0]);
+    printf("       %s --check [<filename.png>...]\n", argv[0]);
     return 0;
   }
 
+  if (strcmp(argv[1], "--check") == 0) {
+    int failures = check_frame_streams();
+    for (int arg = 2; arg < argc; arg++) {
+      int scale_mismatches = check_scaled(argv[arg]);
+      int thread_mismatches = check_threads(argv[arg]);
+      int progress_failures = check_progress(argv[arg]);
+      if (scale_mismatches < 0 || thread_mismatches < 0 || progress_failures < 0) {
+        printf("%s: decoding error\n", argv[arg]);
+        failures += 1;
+      } else if (scale_mismatches > 0 || thread_mismatches > 0 || progress_failures > 0) {
+        failures += 1;
+      } else {
+        printf("%s: OK\n", argv[arg]);
+      }
+    }
+    return failures > 0;
+  }
+
   png_decoded_t *png = png_decoded_from_path(argv[1], &error);
   if (png == NULL || error != 0) {
     printf("Failed to decode PNG data: %d.\n", error);
@@ -33,4 +496,3 @@ int main(int argc, char **argv) {
   png_decoded_free(png);
   return 0;
 }
-
@@ -0,0 +1,94 @@
+/**
+ * Takes GIF or PNG files and decodes each of them twice with a buffer pool,
+ * checking that freed frames go back to the pool and that the second decode
+ * takes all of its buffers from it. Also checks that a pool that isn't
+ * thread-safe is rejected for parallel and pipelined decoding. Doesn't require
+ * a window system.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pngif/errors.h>
+#include <pngif/image.h>
+#include <pngif/pool.h>
+
+/**
+ * Decodes a file with options that require a thread-safe pool, and checks
+ * that decoding fails with PNGIF_ERR_BAD_OPTIONS.
+ *
+ * @return 1 if the pool was rejected, 0 otherwise.
+ */
+int pool_rejected(char *path, pngif_options_t *options) {
+  int error = 0;
+  animated_image_t *image = image_from_path_with_options(path, 1, options, &error);
+  if (image != NULL) {
+    animated_image_free(image);
+  }
+
+  return image == NULL && error == PNGIF_ERR_BAD_OPTIONS;
+}
+
+int main(int argc, char **argv) {
+  int failures = 0;
+
+  if (argc < 2) {
+    printf("Usage: %s <filepath>...\n", argv[0]);
+    return 0;
+  }
+
+  for (int arg = 1; arg < argc; arg++) {
+    int error = 0;
+    char *path = argv[arg];
+    pngif_pool_t *pool = pngif_pool_new(0, 0);
+    pngif_options_t options = { .pool = pool };
+
+    animated_image_t *image = image_from_path_with_options(path, 1, &options, &error);
+    if (error != 0 || image == NULL) {
+      printf("%s: decoding error %d\n", path, error);
+      failures += 1;
+      pngif_pool_free(pool);
+      continue;
+    }
+
+    // Frames are released to the pool, not freed.
+    size_t cached = pool->cached;
+    animated_image_free(image);
+    if (pool->cached <= cached) {
+      printf("%s: frames not returned to the pool\n", path);
+      failures += 1;
+    }
+
+    // The second decode of the same file only reuses buffers.
+    size_t misses = pool->misses;
+    size_t hits = pool->hits;
+    image = image_from_path_with_options(path, 1, &options, &error);
+    if (error != 0 || image == NULL) {
+      printf("%s: decoding error %d with a warm pool\n", path, error);
+      failures += 1;
+    } else {
+      if (pool->misses != misses || pool->hits == hits) {
+        printf("%s: %zu buffers allocated with a warm pool\n", path, pool->misses - misses);
+        failures += 1;
+      }
+      animated_image_free(image);
+    }
+
+    pngif_options_t parallel = { .pool = pool, .threads = 4 };
+    pngif_options_t pipelined = { .pool = pool, .pipeline_depth = 2 };
+    if (!pool_rejected(path, &parallel)) {
+      printf("%s: pool that isn't thread-safe used on threads\n", path);
+      failures += 1;
+    } else if (!pool_rejected(path, &pipelined)) {
+      printf("%s: pool that isn't thread-safe used for pipelining\n", path);
+      failures += 1;
+    } else {
+      printf("%s: OK\n", path);
+    }
+
+    pngif_pool_free(pool);
+  }
+
+  return failures > 0;
+}